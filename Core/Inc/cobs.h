@@ -0,0 +1,33 @@
+/**
+  ******************************************************************************
+  * @file    cobs.h
+  * @brief   Consistent Overhead Byte Stuffing (COBS) encoder / decoder.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __COBS_H__
+#define __COBS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+
+/* Exported macro ------------------------------------------------------------*/
+
+/* Worst case size of an encoded block, excluding the 0x00 delimiter */
+#define COBS_MAX_ENCODED_SIZE(n)  ((n) + ((n) / 254U) + 1U)
+
+/* Exported functions prototypes ---------------------------------------------*/
+size_t COBS_Encode(const uint8_t *src, size_t len, uint8_t *dst);
+size_t COBS_Decode(const uint8_t *src, size_t len, uint8_t *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __COBS_H__ */
@@ -0,0 +1,65 @@
+/**
+  ******************************************************************************
+  * @file    fastseek.h
+  * @brief   FatFs fast seek: cluster link maps kept for files opened with
+  *          FastSeek_Open().
+  *
+  *          Without a map, f_lseek() follows the FAT chain cluster by
+  *          cluster, from the start of the file for a backward seek, which
+  *          takes a long time in a multi-gigabyte file. With a map (CLMT,
+  *          one run per fragment) it is a lookup in RAM. The maps share a
+  *          fixed arena of FASTSEEK_ARENA_WORDS words; a file whose map does
+  *          not fit stays open and seeks along the chain.
+  *
+  *          FatFs cannot grow a file through its map, so a write past the
+  *          mapped clusters drops the map and the next FastSeek_Lseek()
+  *          builds it again. Appends run at full speed and a file that only
+  *          grows is walked once per seek burst, not once per cluster.
+  *
+  *          The files must be written, truncated, sought and closed through
+  *          the functions below; f_read() can be used directly.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __FASTSEEK_H__
+#define __FASTSEEK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "ff.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define FASTSEEK_ARENA_WORDS    1024U   /* Link maps of all the files, 4 words + 2 per fragment each */
+#define FASTSEEK_FILES          4U      /* Files opened with FastSeek_Open() at once */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t MappedSeeks;   /* Seeks through a link map */
+  uint64_t MappedCycles;  /* DWT cycles spent in them */
+  uint32_t ChainSeeks;    /* Seeks along the FAT chain, no map */
+  uint64_t ChainCycles;   /* DWT cycles spent in them, 2^32 is 25.6 s */
+  uint32_t Builds;        /* Link maps built, the chain walked once each */
+  uint64_t BuildCycles;   /* DWT cycles spent in them */
+  uint32_t NoRoom;        /* Maps that did not fit the arena */
+  uint32_t ArenaUsed;     /* Arena words in use */
+} FastSeek_StatsTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+FRESULT FastSeek_Open(FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT FastSeek_Lseek(FIL *fp, FSIZE_t ofs);
+FRESULT FastSeek_Write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT FastSeek_Truncate(FIL *fp);
+FRESULT FastSeek_Close(FIL *fp);
+void    FastSeek_GetStats(FastSeek_StatsTypeDef *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FASTSEEK_H__ */
@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file    file_copy.h
+  * @brief   File copy between the SD card and a USB stick, either way, with
+  *          the reads and writes overlapped.
+  *
+  *          Two buffers take turns: while one is written to the destination
+  *          the other is read from the source, each transfer a single
+  *          multi-block request on sd_async.c or usbh_msc_async.c. The
+  *          destination is allocated contiguous with f_expand() and both
+  *          files are accessed by sector, FatFs only maps the source
+  *          clusters and writes the directory entry at the end.
+  *
+  *          The data is run through the CRC unit as it streams; with verify
+  *          set, the destination is read back the same way and its CRC
+  *          compared. A copy on the SD card fails if the card is exported
+  *          over USB meanwhile.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __FILE_COPY_H__
+#define __FILE_COPY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define FILECOPY_BUF_SIZE       16384U  /* Per buffer, transfers are a source cluster up to this */
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  FILECOPY_IDLE = 0U,
+  FILECOPY_COPYING,
+  FILECOPY_VERIFYING,
+  FILECOPY_DONE,
+  FILECOPY_FAILED
+} FileCopy_StateTypeDef;
+
+typedef struct
+{
+  FileCopy_StateTypeDef State;
+  uint64_t Size;          /* Source length */
+  uint64_t Copied;        /* Bytes on the destination */
+  uint32_t Chunk;         /* Bytes per transfer */
+  uint32_t CopyMs;        /* From FileCopy_Start() to the last write */
+  uint32_t KBps;          /* Copy rate, 1000 bytes per second */
+  uint32_t Crc;           /* CRC unit result over the source */
+  uint32_t VerifyCrc;     /* Same over the destination read back */
+} FileCopy_StatsTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+HAL_StatusTypeDef FileCopy_Start(const char *src, const char *dst, uint8_t verify);
+void              FileCopy_Process(void);
+void              FileCopy_GetStats(FileCopy_StatsTypeDef *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FILE_COPY_H__ */
@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file    modbus_sniffer.h
+  * @brief   Listen only Modbus RTU capture on the RS485 port (USART2).
+  *
+  *          Capture stream format, all fields little endian:
+  *
+  *            header (16) : "MBSN" | version (1) | parity (1) | stop bits (1)
+  *                          | reserved (1) | baudrate (4) | t3.5 in us (4)
+  *            record      : time (8) | len (2) | flags (1) | reserved (1)
+  *                          | len bytes of frame data
+  *
+  *          time is the start of the first byte of the frame in microseconds
+  *          since the capture was started. parity is 0 none, 1 odd, 2 even.
+  *          Frames are split on silent intervals of at least t3.5, the
+  *          Modbus CRC is checked but the frame is kept as received.
+  *
+  *          The SD sink goes through sd_logger.c to a preallocated
+  *          MBnnnnn.BIN file, so the main loop never waits for the card.
+  *          It takes the logger, which then cannot be used for anything
+  *          else during the capture. The records reach the card in
+  *          SD_LOGGER_BUF_SIZE writes and when the capture is stopped.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __MODBUS_SNIFFER_H__
+#define __MODBUS_SNIFFER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define MODBUS_SNIFFER_BAUDRATE     115200U
+#define MODBUS_SNIFFER_PARITY       UART_PARITY_EVEN  /* 2 stop bits with UART_PARITY_NONE */
+#define MODBUS_SNIFFER_RX_RING      4096U   /* ~350 ms of line time at 115200 */
+#define MODBUS_SNIFFER_EVENTS       128U    /* Idle line events queued by the IRQ */
+#define MODBUS_SNIFFER_MAX_FRAME    256U    /* Modbus RTU ADU, longer frames are truncated */
+#define MODBUS_SNIFFER_BLOCK        4096U   /* Records staged for the sink */
+#define MODBUS_SNIFFER_SD_SIZE      (256ULL * 1024U * 1024U)  /* SD capture file, ~6 h of saturated line */
+
+#define MODBUS_SNIFFER_VERSION      1U
+
+/* Record flags */
+#define MODBUS_SNIFFER_FLAG_CRC_OK      0x01U  /* Modbus CRC16 matches */
+#define MODBUS_SNIFFER_FLAG_TRUNCATED   0x02U  /* Longer than MODBUS_SNIFFER_MAX_FRAME */
+#define MODBUS_SNIFFER_FLAG_LINE_ERROR  0x04U  /* Parity, framing or noise error */
+#define MODBUS_SNIFFER_FLAG_GAP         0x08U  /* Silent interval > t1.5 inside the frame */
+#define MODBUS_SNIFFER_FLAG_SPLIT_LOST  0x10U  /* Idle events lost, boundaries uncertain */
+#define MODBUS_SNIFFER_FLAG_OVERRUN     0x20U  /* Bytes lost to a reception ring overrun */
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  MODBUS_SNIFFER_SINK_SD = 0,   /* New MBnnnnn.BIN file on the SD card */
+  MODBUS_SNIFFER_SINK_CDC       /* USB CDC, when not used for debug output */
+} ModbusSniffer_SinkTypeDef;
+
+typedef struct
+{
+  uint32_t Frames;        /* Frames captured */
+  uint32_t Bytes;         /* Frame bytes captured */
+  uint32_t CrcErrors;     /* Frames with a bad CRC */
+  uint32_t LineErrors;    /* Frames with parity / framing / noise errors */
+  uint32_t Dropped;       /* Records that did not fit the sink */
+  uint32_t WriteErrors;   /* Failed storage writes */
+  uint32_t Overruns;      /* Reception ring overruns, bytes lost */
+} ModbusSniffer_StatsTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+HAL_StatusTypeDef ModbusSniffer_Start(ModbusSniffer_SinkTypeDef sink);
+void              ModbusSniffer_Stop(void);
+void              ModbusSniffer_Process(void);
+void              ModbusSniffer_GetStats(ModbusSniffer_StatsTypeDef *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MODBUS_SNIFFER_H__ */
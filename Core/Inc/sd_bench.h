@@ -0,0 +1,74 @@
+/**
+  ******************************************************************************
+  * @file    sd_bench.h
+  * @brief   SD card and FatFs benchmark, to qualify cards for a logging rate.
+  *
+  *          SDBench_Run() allocates a contiguous test file and runs the raw
+  *          tests on its sectors only, with the BSP_SD_xxx_DMA() calls, so
+  *          the volume is left intact. The FatFs tests then write a new file
+  *          of SD_BENCH_FILE_SIZE with f_write() calls of each size.
+  *
+  *          Every operation is timed with the DWT cycle counter into a log
+  *          scale histogram: 4 bins per power of two of cycles, so a
+  *          percentile is known to within 25%. The run blocks the main loop
+  *          for several seconds, the SD card must not be in use.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SD_BENCH_H__
+#define __SD_BENCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define SD_BENCH_BUF_SIZE       16384U  /* Sequential transfer and largest f_write() */
+#define SD_BENCH_RAND_SIZE      4096U   /* Random transfer, aligned to its size */
+#define SD_BENCH_AREA_SIZE      (8U * 1024U * 1024U)    /* Raw tests stay in it */
+#define SD_BENCH_SEQ_OPS        256U    /* 4 MiB each way */
+#define SD_BENCH_RAND_OPS       512U
+#define SD_BENCH_FILE_SIZE      (4U * 1024U * 1024U)    /* Per f_write() size */
+#define SD_BENCH_TIMEOUT        1000U   /* ms per raw transfer */
+#define SD_BENCH_HIST_BINS      124U    /* 0 to 3 cycles, then 4 per power of two */
+#define SD_BENCH_FILE_NAME      "SDBENCH.BIN"   /* Test file, on SDPath */
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  SD_BENCH_SEQ_WRITE = 0U,
+  SD_BENCH_SEQ_READ,
+  SD_BENCH_RAND_WRITE,
+  SD_BENCH_RAND_READ,
+  SD_BENCH_FS_WRITE_512,
+  SD_BENCH_FS_WRITE_4K,
+  SD_BENCH_FS_WRITE_16K,
+  SD_BENCH_TESTS
+} SDBench_TestTypeDef;
+
+typedef struct
+{
+  uint32_t Ops;                         /* Operations timed */
+  uint32_t Errors;                      /* Failed, the test stops at the first */
+  uint32_t OpSize;                      /* Bytes per operation */
+  uint32_t KBps;                        /* Over all the operations */
+  uint32_t P50Us;                       /* Upper bound of the median bin */
+  uint32_t P99Us;                       /* Upper bound of the 99th percentile bin */
+  uint32_t MaxUs;
+  uint32_t Hist[SD_BENCH_HIST_BINS];    /* Operations per latency bin */
+} SDBench_ResultTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+HAL_StatusTypeDef SDBench_Run(const char *name);
+void              SDBench_GetResult(SDBench_TestTypeDef test, SDBench_ResultTypeDef *result);
+uint32_t          SDBench_BinCycles(uint32_t bin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_BENCH_H__ */
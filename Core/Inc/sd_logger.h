@@ -0,0 +1,78 @@
+/**
+  ******************************************************************************
+  * @file    sd_logger.h
+  * @brief   High rate logging to a preallocated, contiguous file on the SD
+  *          card.
+  *
+  *          SDLogger_Open() allocates the whole file at once with f_expand(),
+  *          so the data sectors are known and the log is streamed to them
+  *          with multi-block DMA writes, without FatFs and without any FAT
+  *          update. The directory entry keeps the allocated size, which
+  *          matches the cluster chain, until SDLogger_Close() sets the final
+  *          length and frees the unused clusters. The logged length is
+  *          committed every SD_LOGGER_COMMIT_MS, between two buffer writes:
+  *          - exFAT: to the valid data length of the entry. After a crash
+  *            the file reads as the log up to the last commit, then zeros.
+  *            FatFs itself ignores the valid length.
+  *          - FAT has no such field: to a trailer sector past the data, the
+  *            file is one sector longer than the log capacity. After a crash
+  *            the last sector of the file holds SD_LOGGER_TRAILER_MAGIC, then
+  *            the length as a little endian 64-bit integer, and the reader
+  *            must cut the file there. A closed log has no trailer.
+  *
+  *          On an exFAT volume f_expand() takes the clusters from the
+  *          allocation bitmap and the file is flagged contiguous, no FAT
+  *          entry is written at all, and a log may pass 4 GiB.
+  *
+  *          Writes are cut on SD_LOGGER_BUF_SIZE boundaries of the card, not
+  *          of the file, so none of them straddles an allocation unit.
+  *
+  *          Close the log before the card is exported over USB: the writes
+  *          queued by then complete, the next ones fail and stop the log.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SD_LOGGER_H__
+#define __SD_LOGGER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define SD_LOGGER_BUF_SIZE      8192U   /* Bytes per DMA write, sector multiple */
+#define SD_LOGGER_BUFFERS       2U      /* One filling while the others are written */
+#define SD_LOGGER_COMMIT_MS     1000U   /* Logged length to the directory entry */
+#define SD_LOGGER_LATENCY_BINS  256U    /* 1 ms write latency bins, the last one open ended */
+#define SD_LOGGER_TRAILER_MAGIC "SDLOGLEN"  /* 8 bytes, starts the trailer of a FAT log */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint64_t Capacity;      /* Bytes preallocated */
+  uint64_t Written;       /* Bytes accepted by SDLogger_Write() */
+  uint64_t Durable;       /* Bytes on the card */
+  uint64_t Committed;     /* Length recorded on the card */
+  uint32_t Writes;        /* DMA writes */
+  uint32_t WriteErrors;   /* Failed DMA writes, the log stops at the first */
+  uint32_t CommitErrors;  /* Failed length commits, retried */
+  uint32_t MaxWriteMs;    /* Longest write, from submit to completion */
+  uint32_t P99WriteMs;    /* 99th percentile of the write latency */
+} SDLogger_StatsTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+HAL_StatusTypeDef SDLogger_Open(const char *path, uint64_t size);
+uint32_t          SDLogger_Write(const void *data, uint32_t len);
+HAL_StatusTypeDef SDLogger_Close(void);
+void              SDLogger_Process(void);
+void              SDLogger_GetStats(SDLogger_StatsTypeDef *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_LOGGER_H__ */
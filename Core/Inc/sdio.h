@@ -30,12 +30,26 @@ extern "C" {
 
 /* USER CODE BEGIN Includes */
 
+#include "ff.h"
+
 /* USER CODE END Includes */
 
 extern SD_HandleTypeDef hsd;
 
 /* USER CODE BEGIN Private defines */
 
+#define SD_CD_DEBOUNCE_MS       50U     /* Card detect level stable this long */
+
+/* Bus mode negotiated by BSP_SD_Init(), and the card geometry it read */
+typedef struct
+{
+  uint8_t  BusWidth;                    /* 1 or 4, 0 if no card is running */
+  uint8_t  HighSpeed;                   /* Switched with CMD6 */
+  uint32_t ClockHz;
+  uint32_t ReadKBps;                    /* Measured on the bus check */
+  uint32_t AUSize;                      /* Allocation unit in bytes, 0 if not reported */
+} SD_BusInfoTypeDef;
+
 /* USER CODE END Private defines */
 
 void MX_SDIO_SD_Init(void);
@@ -43,6 +57,11 @@ void MX_SDIO_SD_Init(void);
 /* USER CODE BEGIN Prototypes */
 
 void MX_SDIO_SD_Check(void);
+void MX_SDIO_SD_Process(void);
+uint8_t MX_SDIO_SD_IsPresent(void);
+FRESULT MX_SDIO_SD_Mount(void);
+FRESULT MX_SDIO_SD_Unmount(void);
+void MX_SDIO_SD_GetBusInfo(SD_BusInfoTypeDef *info);
 
 /* USER CODE END Prototypes */
 
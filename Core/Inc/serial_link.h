@@ -0,0 +1,74 @@
+/**
+  ******************************************************************************
+  * @file    serial_link.h
+  * @brief   Framed binary transport over the DB9 serial port (USART1).
+  *
+  *          Wire format, one frame between 0x00 delimiters:
+  *
+  *            0x00 | COBS( header | payload | crc ) | 0x00
+  *
+  *            header  : type (1) | seq (1) | len (2, little endian)
+  *            payload : len bytes, len <= SERIAL_LINK_MTU
+  *            crc     : CRC32 (4, little endian)
+  *
+  *          The CRC is the STM32 CRC unit's CRC-32/MPEG-2 (poly 0x04C11DB7,
+  *          init 0xFFFFFFFF, no reflection, no final xor). It is fed with
+  *          header and payload zero padded to a multiple of 4 bytes, taking
+  *          each group of 4 bytes as a little endian 32-bit word.
+  *
+  *          DATA frames carry a sequence number and are kept by the sender
+  *          until acknowledged. ACK frames carry the next expected sequence
+  *          number followed by a 32-bit bitmap, bit n set meaning that
+  *          (next + 1 + n) has been received out of order. Frames that are
+  *          neither acknowledged nor selectively acknowledged are sent again
+  *          after SERIAL_LINK_RTO_MS.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SERIAL_LINK_H__
+#define __SERIAL_LINK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define SERIAL_LINK_BAUDRATE    2000000U  /* Up to 5250000 with USART1 on APB2 */
+#define SERIAL_LINK_MTU         1024U     /* Maximum payload per frame */
+#define SERIAL_LINK_WINDOW      8U        /* Frames in flight, at most 32 */
+#define SERIAL_LINK_RTO_MS      50U       /* Retransmission timeout */
+#define SERIAL_LINK_RX_RING     4096U     /* Circular DMA reception ring */
+
+#define SERIAL_LINK_TYPE_DATA   0x01U
+#define SERIAL_LINK_TYPE_ACK    0x02U
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t TxFrames;      /* DATA frames sent, including retransmissions */
+  uint32_t TxRetransmits; /* DATA frames sent again */
+  uint32_t TxBytes;       /* Payload bytes acknowledged by the peer */
+  uint32_t RxFrames;      /* Valid DATA frames received */
+  uint32_t RxBytes;       /* Payload bytes delivered in order */
+  uint32_t RxCrcErrors;   /* Frames dropped on CRC or length mismatch */
+  uint32_t RxDuplicates;  /* Frames received more than once */
+  uint32_t RxUartErrors;  /* UART overrun / framing errors */
+} SerialLink_StatsTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+HAL_StatusTypeDef SerialLink_Init(void);
+HAL_StatusTypeDef SerialLink_Send(const uint8_t *data, uint16_t len);
+uint32_t          SerialLink_TxFree(void);
+void              SerialLink_Process(void);
+void              SerialLink_GetStats(SerialLink_StatsTypeDef *stats);
+void              SerialLink_RxCpltCallback(const uint8_t *data, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SERIAL_LINK_H__ */
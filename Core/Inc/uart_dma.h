@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file    uart_dma.h
+  * @brief   Circular DMA reception and DMA transmission for the USARTs.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __UART_DMA_H__
+#define __UART_DMA_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+#include <stdbool.h>
+
+/* Exported constants --------------------------------------------------------*/
+
+/* Number of UARTs that can be driven through this module at the same time */
+#define UART_DMA_MAX_HANDLES  3U
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct __UART_DMA_HandleTypeDef
+{
+  UART_HandleTypeDef *huart;    /* UART with hdmarx (circular) and hdmatx linked */
+  uint8_t            *RxBuf;    /* Reception ring, written by the DMA */
+  uint16_t            RxSize;   /* Size of the reception ring in bytes, even */
+  uint16_t            RxTail;   /* Next byte to be consumed from the ring */
+  uint32_t            RxErrors; /* UART errors (overrun, framing, noise) seen */
+  uint32_t            RxIdleSR; /* Status register latched at the last idle line */
+  volatile uint32_t   RxHalves; /* Half and full ring DMA events since the start */
+  uint32_t            RxRead;   /* Bytes consumed since the start */
+
+  /* Optional callbacks, both called from interrupt context */
+  void (*RxIdleCallback)(struct __UART_DMA_HandleTypeDef *hud);
+  void (*TxCpltCallback)(struct __UART_DMA_HandleTypeDef *hud);
+} UART_DMA_HandleTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+HAL_StatusTypeDef UART_DMA_Start(UART_DMA_HandleTypeDef *hud);
+void              UART_DMA_Stop(UART_DMA_HandleTypeDef *hud);
+uint16_t          UART_DMA_RxHead(UART_DMA_HandleTypeDef *hud);
+uint16_t          UART_DMA_RxAvailable(UART_DMA_HandleTypeDef *hud);
+uint16_t          UART_DMA_RxPeek(UART_DMA_HandleTypeDef *hud, uint8_t **data);
+void              UART_DMA_RxConsume(UART_DMA_HandleTypeDef *hud, uint16_t len);
+bool              UART_DMA_RxOverrun(UART_DMA_HandleTypeDef *hud);
+HAL_StatusTypeDef UART_DMA_Transmit(UART_DMA_HandleTypeDef *hud, const uint8_t *data, uint16_t len);
+bool              UART_DMA_TxBusy(UART_DMA_HandleTypeDef *hud);
+void              UART_DMA_IRQHandler(UART_HandleTypeDef *huart);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UART_DMA_H__ */
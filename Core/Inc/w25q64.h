@@ -0,0 +1,80 @@
+/**
+  ******************************************************************************
+  * @file    w25q64.h
+  * @brief   W25Q64JV SPI NOR flash (8 MiB) on SPI2, with DMA.
+  *
+  *          One operation runs at a time and none of them waits for the
+  *          flash. A read is a Fast Read (0x0B) streamed in DMA chunks that
+  *          are chained from the completion interrupt, the chip staying
+  *          selected, so the whole part can be read at the SPI2 clock. A
+  *          write is split into page programs at the 256 byte boundaries, an
+  *          erase into the fewest 64K, 32K and 4K erases, or one chip erase.
+  *          The busy bit after each of them is polled from W25Q64_Process()
+  *          in the main loop: every pass after a page program, every
+  *          W25Q64_ERASE_POLL_MS after an erase.
+  *
+  *          The buffers belong to the DMA until the operation ends, they
+  *          must not be in CCMRAM.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __W25Q64_H__
+#define __W25Q64_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define W25Q64_SIZE             (8U * 1024U * 1024U)
+#define W25Q64_PAGE_SIZE        256U
+#define W25Q64_SECTOR_SIZE      4096U   /* Smallest erase */
+#define W25Q64_BLOCK32_SIZE     32768U
+#define W25Q64_BLOCK64_SIZE     65536U
+#define W25Q64_JEDEC_ID         0xEF4017U   /* Winbond, W25Q64JV */
+
+#define W25Q64_READ_CHUNK       32768U  /* Bytes per DMA transfer, 65535 at most */
+#define W25Q64_ERASE_POLL_MS    1U      /* Busy bit polling during an erase */
+#define W25Q64_CMD_TIMEOUT      10U     /* ms, command bytes sent without DMA */
+#define W25Q64_PROGRAM_TIMEOUT  10U     /* ms, tPP is 3 ms at most */
+#define W25Q64_ERASE_TIMEOUT    3000U   /* ms, 64K block erase is 2 s at most */
+#define W25Q64_CHIP_TIMEOUT     200000U /* ms, chip erase is 100 s at most */
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  W25Q64_OK = 0U,
+  W25Q64_BUSY,
+  W25Q64_ERROR
+} W25Q64_StatusTypeDef;
+
+typedef struct
+{
+  uint32_t ReadBytes;
+  uint32_t ReadKBps;                    /* Last read, command to last byte */
+  uint32_t PagePrograms;
+  uint32_t Erase4K;
+  uint32_t Erase32K;
+  uint32_t Erase64K;
+  uint32_t ChipErases;
+  uint32_t Errors;                      /* SPI errors and busy timeouts */
+} W25Q64_StatsTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+HAL_StatusTypeDef    W25Q64_ReadId(uint32_t *id);
+HAL_StatusTypeDef    W25Q64_Read(uint32_t addr, uint8_t *buf, uint32_t len);
+HAL_StatusTypeDef    W25Q64_Write(uint32_t addr, const uint8_t *buf, uint32_t len);
+HAL_StatusTypeDef    W25Q64_Erase(uint32_t addr, uint32_t len);
+W25Q64_StatusTypeDef W25Q64_GetStatus(void);
+void                 W25Q64_Process(void);
+void                 W25Q64_GetStats(W25Q64_StatsTypeDef *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __W25Q64_H__ */
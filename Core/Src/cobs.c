@@ -0,0 +1,88 @@
+/**
+  ******************************************************************************
+  * @file    cobs.c
+  * @brief   Consistent Overhead Byte Stuffing (COBS) encoder / decoder.
+  *
+  *          COBS removes every 0x00 from a block at a cost of at most one
+  *          byte per 254, so 0x00 can be used as an unambiguous frame
+  *          delimiter on a byte stream.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "cobs.h"
+
+/**
+  * @brief  Encode a block
+  * @param  src: Data to encode
+  * @param  len: Length of data in bytes
+  * @param  dst: Output buffer, at least COBS_MAX_ENCODED_SIZE(len) bytes
+  * @retval Encoded length (no delimiter is appended)
+  */
+size_t COBS_Encode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+  const uint8_t *end = src + len;
+  uint8_t *out = dst;
+  uint8_t *code_ptr = out++;
+  uint8_t code = 1;
+
+  while (src < end)
+  {
+    if (*src == 0)
+    {
+      *code_ptr = code;
+      code_ptr = out++;
+      code = 1;
+    }
+    else
+    {
+      *out++ = *src;
+      if (++code == 0xFF)
+      {
+        *code_ptr = code;
+        code_ptr = out++;
+        code = 1;
+      }
+    }
+    src++;
+  }
+  *code_ptr = code;
+
+  return (size_t)(out - dst);
+}
+
+/**
+  * @brief  Decode a block (without its delimiter)
+  * @note   Decoding may be done in place (src == dst).
+  * @param  src: Encoded data
+  * @param  len: Length of encoded data in bytes
+  * @param  dst: Output buffer, at least len bytes
+  * @retval Decoded length, or 0 if the block is malformed
+  */
+size_t COBS_Decode(const uint8_t *src, size_t len, uint8_t *dst)
+{
+  const uint8_t *end = src + len;
+  uint8_t *out = dst;
+
+  while (src < end)
+  {
+    uint8_t code = *src++;
+
+    if ((code == 0) || ((size_t)(end - src) < (size_t)(code - 1)))
+    {
+      return 0;
+    }
+
+    for (uint8_t i = 1; i < code; i++)
+    {
+      *out++ = *src++;
+    }
+
+    if ((code != 0xFF) && (src < end))
+    {
+      *out++ = 0;
+    }
+  }
+
+  return (size_t)(out - dst);
+}
@@ -0,0 +1,326 @@
+/**
+  ******************************************************************************
+  * @file    fastseek.c
+  * @brief   FatFs fast seek: cluster link maps kept for files opened with
+  *          FastSeek_Open().
+  *
+  *          The maps are packed from the start of fastseek_arena; a new one
+  *          is built at the end of the packed maps with all the free words
+  *          offered to FatFs, then trimmed to what it used. Dropping a map
+  *          moves the ones after it down and repoints their files, so the
+  *          free words are always in one piece.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "fastseek.h"
+
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define FASTSEEK_MIN_WORDS      4U      /* Size word, one fragment, terminator */
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  FIL *File;              /* NULL for a free slot */
+  uint32_t Offset;        /* Map position in the arena */
+  uint32_t Words;         /* Map size, 0 without a map */
+  FSIZE_t Covered;        /* Bytes of the clusters in the map */
+  uint8_t Stale;          /* Build the map on the next seek */
+} FastSeek_MapTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static DWORD fastseek_arena[FASTSEEK_ARENA_WORDS];
+static uint32_t arena_used;
+static FastSeek_MapTypeDef fastseek_maps[FASTSEEK_FILES];
+static FastSeek_StatsTypeDef fastseek_stats;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Slot of a file opened with FastSeek_Open()
+  * @param  fp: File, NULL for a free slot
+  * @retval Slot, NULL if none
+  */
+static FastSeek_MapTypeDef *FastSeek_Find(const FIL *fp)
+{
+  uint32_t i;
+
+  for (i = 0U; i < FASTSEEK_FILES; i++)
+  {
+    if (fastseek_maps[i].File == fp)
+    {
+      return &fastseek_maps[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+  * @brief  Drop the map of a file, packing the arena again
+  * @param  m: Slot
+  * @retval None
+  */
+static void FastSeek_Release(FastSeek_MapTypeDef *m)
+{
+  uint32_t i;
+
+  m->File->cltbl = NULL;
+  if (m->Words == 0U)
+  {
+    return;
+  }
+
+  memmove(&fastseek_arena[m->Offset], &fastseek_arena[m->Offset + m->Words],
+          (arena_used - m->Offset - m->Words) * sizeof(DWORD));
+  for (i = 0U; i < FASTSEEK_FILES; i++)
+  {
+    if ((fastseek_maps[i].File != NULL) && (fastseek_maps[i].Words != 0U) &&
+        (fastseek_maps[i].Offset > m->Offset))
+    {
+      fastseek_maps[i].Offset -= m->Words;
+      fastseek_maps[i].File->cltbl = &fastseek_arena[fastseek_maps[i].Offset];
+    }
+  }
+  arena_used -= m->Words;
+  m->Words = 0U;
+  m->Covered = 0U;
+}
+
+/**
+  * @brief  Walk the cluster chain of a file into a new map
+  * @param  m: Slot, its old map dropped first
+  * @retval FatFs result, FR_NOT_ENOUGH_CORE if the map does not fit: the
+  *         file is then left without a map
+  */
+static FRESULT FastSeek_Build(FastSeek_MapTypeDef *m)
+{
+  FIL *fp = m->File;
+  DWORD *tbl;
+  DWORD clusters = 0U;
+  uint32_t start;
+  uint32_t i;
+  FRESULT res;
+
+  FastSeek_Release(m);
+  m->Stale = 0U;
+  if ((arena_used + FASTSEEK_MIN_WORDS) > FASTSEEK_ARENA_WORDS)
+  {
+    fastseek_stats.NoRoom++;
+    return FR_NOT_ENOUGH_CORE;
+  }
+
+  tbl = &fastseek_arena[arena_used];
+  tbl[0] = FASTSEEK_ARENA_WORDS - arena_used;
+  fp->cltbl = tbl;
+
+  start = DWT->CYCCNT;
+  res = f_lseek(fp, CREATE_LINKMAP);
+  fastseek_stats.BuildCycles += DWT->CYCCNT - start;
+  fastseek_stats.Builds++;
+
+  if (res != FR_OK)
+  {
+    /* The map was left unfinished */
+    fp->cltbl = NULL;
+    if (res == FR_NOT_ENOUGH_CORE)
+    {
+      fastseek_stats.NoRoom++;
+    }
+    return res;
+  }
+
+  /* tbl[0] is now the words used, terminator included */
+  for (i = 1U; tbl[i] != 0U; i += 2U)
+  {
+    clusters += tbl[i];
+  }
+  m->Offset = arena_used;
+  m->Words = tbl[0];
+  m->Covered = (FSIZE_t)clusters * fp->obj.fs->csize * _MAX_SS;
+  arena_used += m->Words;
+  return FR_OK;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Open a file and map its cluster chain
+  * @param  fp: File object, kept until FastSeek_Close()
+  * @param  path: File name
+  * @param  mode: f_open() mode flags
+  * @retval FatFs result. The file is also open when its map does not fit
+  *         the arena, it then seeks along the FAT chain.
+  */
+FRESULT FastSeek_Open(FIL *fp, const TCHAR *path, BYTE mode)
+{
+  FastSeek_MapTypeDef *m = FastSeek_Find(NULL);
+  FRESULT res;
+
+  if (m == NULL)
+  {
+    return FR_TOO_MANY_OPEN_FILES;
+  }
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  res = f_open(fp, path, mode);
+  if (res != FR_OK)
+  {
+    return res;
+  }
+
+  m->File = fp;
+  m->Words = 0U;
+  res = FastSeek_Build(m);
+  if (res == FR_NOT_ENOUGH_CORE)
+  {
+    res = FR_OK;
+  }
+  else if (res != FR_OK)
+  {
+    m->File = NULL;
+    (void)f_close(fp);
+  }
+  return res;
+}
+
+/**
+  * @brief  Move the file pointer, through the link map when there is one
+  * @param  fp: File opened with FastSeek_Open()
+  * @param  ofs: New position, past the end of a writable file to grow it
+  * @retval FatFs result
+  */
+FRESULT FastSeek_Lseek(FIL *fp, FSIZE_t ofs)
+{
+  FastSeek_MapTypeDef *m = FastSeek_Find(fp);
+  uint32_t start;
+  uint32_t cycles;
+  FRESULT res;
+
+  if (m == NULL)
+  {
+    return FR_INVALID_OBJECT;
+  }
+
+  if ((ofs > fp->obj.objsize) && ((fp->flag & FA_WRITE) != 0U))
+  {
+    /* Seeking through a map stops at the end of the file */
+    FastSeek_Release(m);
+    m->Stale = 1U;
+  }
+  else if (m->Stale)
+  {
+    (void)FastSeek_Build(m);
+  }
+
+  start = DWT->CYCCNT;
+  res = f_lseek(fp, ofs);
+  cycles = DWT->CYCCNT - start;
+
+  if (fp->cltbl != NULL)
+  {
+    fastseek_stats.MappedSeeks++;
+    fastseek_stats.MappedCycles += cycles;
+  }
+  else
+  {
+    fastseek_stats.ChainSeeks++;
+    fastseek_stats.ChainCycles += cycles;
+  }
+  return res;
+}
+
+/**
+  * @brief  Write to the file, dropping the map when the file grows past it
+  * @param  fp: File opened with FastSeek_Open()
+  * @param  buff: Data
+  * @param  btw: Bytes to write
+  * @param  bw: Set to the bytes written
+  * @retval FatFs result
+  */
+FRESULT FastSeek_Write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+  FastSeek_MapTypeDef *m = FastSeek_Find(fp);
+
+  if (m == NULL)
+  {
+    *bw = 0U;
+    return FR_INVALID_OBJECT;
+  }
+
+  /* With a map, f_write() cannot add clusters and stops as if the disk
+     was full */
+  if ((fp->cltbl != NULL) && (btw > (m->Covered - fp->fptr)))
+  {
+    FastSeek_Release(m);
+    m->Stale = 1U;
+  }
+
+  return f_write(fp, buff, btw, bw);
+}
+
+/**
+  * @brief  Truncate the file at the file pointer
+  * @param  fp: File opened with FastSeek_Open()
+  * @retval FatFs result
+  */
+FRESULT FastSeek_Truncate(FIL *fp)
+{
+  FastSeek_MapTypeDef *m = FastSeek_Find(fp);
+
+  if (m == NULL)
+  {
+    return FR_INVALID_OBJECT;
+  }
+
+  /* The freed clusters may be given to another file */
+  FastSeek_Release(m);
+  m->Stale = 1U;
+
+  return f_truncate(fp);
+}
+
+/**
+  * @brief  Close the file and give its map back to the arena
+  * @param  fp: File opened with FastSeek_Open()
+  * @retval FatFs result
+  */
+FRESULT FastSeek_Close(FIL *fp)
+{
+  FastSeek_MapTypeDef *m = FastSeek_Find(fp);
+  uint32_t i;
+
+  if (m == NULL)
+  {
+    return FR_INVALID_OBJECT;
+  }
+
+  FastSeek_Release(m);
+  m->File = NULL;
+
+  /* Files left without a map may fit now */
+  for (i = 0U; i < FASTSEEK_FILES; i++)
+  {
+    if ((fastseek_maps[i].File != NULL) && (fastseek_maps[i].Words == 0U))
+    {
+      fastseek_maps[i].Stale = 1U;
+    }
+  }
+
+  return f_close(fp);
+}
+
+/**
+  * @brief  Get the seek statistics. The mean cost of a seek is Cycles / Seeks,
+  *         with and without a map.
+  * @param  stats: Filled with the counters
+  * @retval None
+  */
+void FastSeek_GetStats(FastSeek_StatsTypeDef *stats)
+{
+  fastseek_stats.ArenaUsed = arena_used;
+  *stats = fastseek_stats;
+}
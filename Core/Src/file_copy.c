@@ -0,0 +1,468 @@
+/**
+  ******************************************************************************
+  * @file    file_copy.c
+  * @brief   File copy between the SD card and a USB stick, either way, with
+  *          the reads and writes overlapped.
+  *
+  *          Reads are issued in file order into the buffers in turn and the
+  *          buffers are written back in the same order, so at most one read
+  *          and one write are in flight. Completions only change the buffer
+  *          state; FileCopy_Process() maps the next source chunk, runs the
+  *          CRC and submits the transfers. A chunk never crosses a source
+  *          cluster, so it is contiguous on both volumes.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "file_copy.h"
+#include "crc.h"
+#include "fatfs.h"
+#include "sd_async.h"
+#include "usbh_msc_async.h"
+#include "diskio.h"
+
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define COPY_BUFFERS        2U
+
+#define COPY_CRC_POLY       0x04C11DB7U   /* CRC unit polynomial */
+
+#if ((FILECOPY_BUF_SIZE & (FILECOPY_BUF_SIZE - 1U)) != 0U) || (FILECOPY_BUF_SIZE < 512U)
+#error "FILECOPY_BUF_SIZE must be a power of two of at least 512"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum
+{
+  BUF_FREE = 0U,
+  BUF_READING,
+  BUF_FULL,
+  BUF_WRITING
+} FileCopy_BufStateTypeDef;
+
+typedef struct
+{
+  FATFS *Fs;
+  uint8_t Usb;            /* 0: SD card, 1: USB stick */
+  BYTE Lun;
+} FileCopy_VolTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+extern Disk_drvTypeDef disk;
+extern USBH_HandleTypeDef hUSB_Host;
+
+/* Word aligned for the DMA, not in CCMRAM */
+static uint32_t copy_buf[COPY_BUFFERS][FILECOPY_BUF_SIZE / 4U];
+static volatile FileCopy_BufStateTypeDef buf_state[COPY_BUFFERS];
+static uint32_t buf_len[COPY_BUFFERS];
+static SD_AsyncReqTypeDef sd_req[COPY_BUFFERS];
+static USBH_MSC_AsyncReqTypeDef usb_req[COPY_BUFFERS];
+
+static FIL src_file;
+static FIL dst_file;
+static FileCopy_VolTypeDef src_vol;
+static FileCopy_VolTypeDef dst_vol;
+static DWORD dst_sector;          /* First sector of the contiguous destination */
+static uint8_t copy_verify;
+static volatile uint8_t copy_failed;
+static uint64_t read_pos;         /* Next chunk to read */
+static uint8_t read_buf;          /* Buffer it goes to */
+static uint8_t write_buf;         /* Next buffer to hash and write */
+static uint64_t write_pos;        /* Its position in the file */
+static uint32_t crc_state;
+static uint32_t start_tick;
+
+static FileCopy_StatsTypeDef copy_stats;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Find which driver holds an open file
+  * @param  fp: Open file
+  * @param  vol: Filled with the volume
+  * @retval HAL_OK, HAL_ERROR if the volume is neither the SD card nor the
+  *         USB stick
+  */
+static HAL_StatusTypeDef FileCopy_Volume(FIL *fp, FileCopy_VolTypeDef *vol)
+{
+  BYTE pdrv = fp->obj.fs->drv;
+
+  vol->Fs = fp->obj.fs;
+  vol->Lun = disk.lun[pdrv];
+  if (disk.drv[pdrv] == &SD_Driver)
+  {
+    vol->Usb = 0U;
+  }
+  else if (disk.drv[pdrv] == &USBH_Driver)
+  {
+    vol->Usb = 1U;
+  }
+  else
+  {
+    return HAL_ERROR;
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief  A buffer transfer is over, called from the queue processing of
+  *         either driver
+  * @param  i: Buffer
+  * @param  ok: 1 if the transfer succeeded
+  * @retval None
+  */
+static void FileCopy_XferDone(uint32_t i, uint8_t ok)
+{
+  if (!ok)
+  {
+    copy_failed = 1U;
+    buf_state[i] = BUF_FREE;
+  }
+  else if (buf_state[i] == BUF_READING)
+  {
+    buf_state[i] = BUF_FULL;
+  }
+  else
+  {
+    copy_stats.Copied += buf_len[i];
+    buf_state[i] = BUF_FREE;
+  }
+}
+
+/**
+  * @brief  Completion of an SD card transfer, from SD_Async_Process()
+  * @param  req: Request of the buffer
+  * @retval None
+  */
+static void FileCopy_SdDone(SD_AsyncReqTypeDef *req)
+{
+  FileCopy_XferDone((uint32_t)(req - sd_req), (req->Status == SD_ASYNC_OK) ? 1U : 0U);
+}
+
+/**
+  * @brief  Completion of a USB stick transfer, from USBH_MSC_Async_Process()
+  * @param  req: Request of the buffer
+  * @retval None
+  */
+static void FileCopy_UsbDone(USBH_MSC_AsyncReqTypeDef *req)
+{
+  FileCopy_XferDone((uint32_t)(req - usb_req), (req->Status == USBH_OK) ? 1U : 0U);
+}
+
+/**
+  * @brief  Queue a buffer transfer
+  * @param  vol: Volume
+  * @param  i: Buffer
+  * @param  write: 1 to write, 0 to read
+  * @param  sector: First sector
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef FileCopy_Submit(const FileCopy_VolTypeDef *vol, uint32_t i,
+                                         uint8_t write, DWORD sector)
+{
+  uint32_t count = (buf_len[i] + BLOCKSIZE - 1U) / BLOCKSIZE;
+
+  buf_state[i] = write ? BUF_WRITING : BUF_READING;
+  if (vol->Usb)
+  {
+    usb_req[i].Lun = vol->Lun;
+    usb_req[i].Write = write;
+    usb_req[i].Sector = sector;
+    usb_req[i].Buf = (uint8_t *)copy_buf[i];
+    usb_req[i].Count = count;
+    usb_req[i].Callback = FileCopy_UsbDone;
+    usb_req[i].Context = NULL;
+    if (USBH_MSC_Async_Submit(&hUSB_Host, &usb_req[i]) == USBH_OK)
+    {
+      return HAL_OK;
+    }
+  }
+  else
+  {
+    sd_req[i].Write = write;
+    sd_req[i].Sector = sector;
+    sd_req[i].Buf = (uint8_t *)copy_buf[i];
+    sd_req[i].Count = count;
+    sd_req[i].Callback = FileCopy_SdDone;
+    sd_req[i].Context = NULL;
+    if (SD_Async_Submit(&sd_req[i]) == SD_ASYNC_OK)
+    {
+      return HAL_OK;
+    }
+  }
+
+  buf_state[i] = BUF_FREE;
+  copy_failed = 1U;
+  return HAL_ERROR;
+}
+
+/**
+  * @brief  Read the next chunk, from the source or, when verifying, from the
+  *         destination
+  * @retval None
+  */
+static void FileCopy_Read(void)
+{
+  FATFS *fs = src_vol.Fs;
+  uint32_t i = read_buf;
+  uint32_t cluster_size = (uint32_t)fs->csize * BLOCKSIZE;
+  DWORD sector;
+
+  buf_len[i] = (uint32_t)(((copy_stats.Size - read_pos) < copy_stats.Chunk) ?
+                          (copy_stats.Size - read_pos) : copy_stats.Chunk);
+
+  if (copy_stats.State == FILECOPY_VERIFYING)
+  {
+    (void)FileCopy_Submit(&dst_vol, i, 0U, dst_sector + (DWORD)(read_pos / BLOCKSIZE));
+  }
+  else
+  {
+    /* Seeking to the end of the chunk leaves the FIL on its cluster */
+    if (f_lseek(&src_file, (FSIZE_t)(read_pos + buf_len[i])) != FR_OK)
+    {
+      copy_failed = 1U;
+      return;
+    }
+    sector = fs->database + ((src_file.clust - 2U) * fs->csize) +
+             (DWORD)((read_pos % cluster_size) / BLOCKSIZE);
+    (void)FileCopy_Submit(&src_vol, i, 0U, sector);
+  }
+
+  read_pos += buf_len[i];
+  read_buf = (uint8_t)((read_buf + 1U) % COPY_BUFFERS);
+}
+
+/**
+  * @brief  Run a buffer through the CRC unit, carrying on from crc_state.
+  *         The unit may have been used in between and cannot be loaded, so
+  *         it is reset and fed the one word that brings it back to
+  *         crc_state: the 32 steps of the polynomial division, undone.
+  * @param  i: Buffer, zero padded here to a whole word
+  * @retval None
+  */
+static void FileCopy_Crc(uint32_t i)
+{
+  uint32_t words = (buf_len[i] + 3U) / 4U;
+  uint32_t seed = crc_state;
+  uint32_t bit;
+
+  memset((uint8_t *)copy_buf[i] + buf_len[i], 0, (words * 4U) - buf_len[i]);
+
+  for (bit = 0U; bit < 32U; bit++)
+  {
+    seed = (seed & 1U) ? (((seed ^ COPY_CRC_POLY) >> 1) | 0x80000000U) : (seed >> 1);
+  }
+
+  __HAL_CRC_DR_RESET(&hcrc);
+  hcrc.Instance->DR = seed ^ 0xFFFFFFFFU;
+  crc_state = HAL_CRC_Accumulate(&hcrc, copy_buf[i], words);
+}
+
+/**
+  * @brief  Stop, once nothing is in flight any more. A copy that failed
+  *         leaves the destination cut at the last byte written.
+  * @param  state: FILECOPY_DONE or FILECOPY_FAILED
+  * @retval None
+  */
+static void FileCopy_Finish(FileCopy_StateTypeDef state)
+{
+  if (copy_stats.State == FILECOPY_COPYING)
+  {
+    /* Keep what was written, in order, up to the first failure */
+    if (f_lseek(&dst_file, (FSIZE_t)copy_stats.Copied) == FR_OK)
+    {
+      (void)f_truncate(&dst_file);
+    }
+    (void)f_close(&dst_file);
+  }
+  (void)f_close(&src_file);
+  copy_stats.State = state;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Start copying a file, between the SD card and the USB stick or on
+  *         the same volume
+  * @param  src: Source path, on SDPath or USBHPath
+  * @param  dst: Destination path, replaced if it exists
+  * @param  verify: 1 to read the destination back and check its CRC
+  * @retval HAL_OK, HAL_ERROR if a copy is running, a file could not be
+  *         opened or the destination has no contiguous free space that large
+  */
+HAL_StatusTypeDef FileCopy_Start(const char *src, const char *dst, uint8_t verify)
+{
+  uint32_t sectors;
+  uint32_t i;
+
+  if ((copy_stats.State == FILECOPY_COPYING) || (copy_stats.State == FILECOPY_VERIFYING))
+  {
+    return HAL_ERROR;
+  }
+
+  if (f_open(&src_file, src, FA_READ) != FR_OK)
+  {
+    return HAL_ERROR;
+  }
+  if ((FileCopy_Volume(&src_file, &src_vol) != HAL_OK) ||
+      (f_open(&dst_file, dst, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK))
+  {
+    (void)f_close(&src_file);
+    return HAL_ERROR;
+  }
+
+  memset(&copy_stats, 0, sizeof(copy_stats));
+  copy_stats.Size = f_size(&src_file);
+  if ((FileCopy_Volume(&dst_file, &dst_vol) != HAL_OK) ||
+      ((copy_stats.Size != 0U) && (f_expand(&dst_file, f_size(&src_file), 1) != FR_OK)))
+  {
+    (void)f_close(&dst_file);
+    (void)f_unlink(dst);
+    (void)f_close(&src_file);
+    return HAL_ERROR;
+  }
+
+  /* The source must be on the medium, the destination must not be in a
+     cache any more */
+  (void)disk_ioctl(src_vol.Fs->drv, CTRL_SYNC, NULL);
+  if (copy_stats.Size != 0U)
+  {
+    dst_sector = dst_vol.Fs->database + ((dst_file.obj.sclust - 2U) * dst_vol.Fs->csize);
+    sectors = (uint32_t)((copy_stats.Size + BLOCKSIZE - 1U) / BLOCKSIZE);
+    if (dst_vol.Usb)
+    {
+      USBH_DiskCache_Discard(dst_vol.Lun, dst_sector, sectors);
+    }
+    else
+    {
+      SD_DiskCache_Discard(dst_sector, sectors);
+    }
+  }
+
+  copy_stats.Chunk = (uint32_t)src_vol.Fs->csize * BLOCKSIZE;
+  if (copy_stats.Chunk > FILECOPY_BUF_SIZE)
+  {
+    copy_stats.Chunk = FILECOPY_BUF_SIZE;
+  }
+  for (i = 0U; i < COPY_BUFFERS; i++)
+  {
+    buf_state[i] = BUF_FREE;
+  }
+  copy_verify = verify;
+  copy_failed = 0U;
+  read_pos = 0U;
+  read_buf = 0U;
+  write_buf = 0U;
+  write_pos = 0U;
+  crc_state = 0xFFFFFFFFU;
+  start_tick = HAL_GetTick();
+  copy_stats.State = FILECOPY_COPYING;
+  return HAL_OK;
+}
+
+/**
+  * @brief  Move the copy on. Call from the main loop, after the SD and USB
+  *         host processing.
+  * @retval None
+  */
+void FileCopy_Process(void)
+{
+  uint32_t i;
+  uint8_t busy = 0U;
+
+  if ((copy_stats.State != FILECOPY_COPYING) && (copy_stats.State != FILECOPY_VERIFYING))
+  {
+    return;
+  }
+
+  for (i = 0U; i < COPY_BUFFERS; i++)
+  {
+    if ((buf_state[i] == BUF_READING) || (buf_state[i] == BUF_WRITING))
+    {
+      busy = 1U;
+    }
+  }
+
+  if (copy_failed)
+  {
+    if (!busy)
+    {
+      FileCopy_Finish(FILECOPY_FAILED);
+    }
+    return;
+  }
+
+  /* Oldest buffer read: hash it, then write it or, verifying, drop it */
+  i = write_buf;
+  if (buf_state[i] == BUF_FULL)
+  {
+    FileCopy_Crc(i);
+    if (copy_stats.State == FILECOPY_COPYING)
+    {
+      (void)FileCopy_Submit(&dst_vol, i, 1U, dst_sector + (DWORD)(write_pos / BLOCKSIZE));
+    }
+    else
+    {
+      copy_stats.Copied += buf_len[i];
+      buf_state[i] = BUF_FREE;
+    }
+    write_pos += buf_len[i];
+    write_buf = (uint8_t)((write_buf + 1U) % COPY_BUFFERS);
+    busy = 1U;
+  }
+
+  /* One read at a time, into the next buffer as soon as it is free */
+  if ((read_pos < copy_stats.Size) && (buf_state[read_buf] == BUF_FREE) &&
+      (buf_state[(read_buf + 1U) % COPY_BUFFERS] != BUF_READING))
+  {
+    FileCopy_Read();
+    busy = 1U;
+  }
+
+  if (busy || (copy_stats.Copied < copy_stats.Size))
+  {
+    return;
+  }
+
+  if (copy_stats.State == FILECOPY_COPYING)
+  {
+    copy_stats.CopyMs = HAL_GetTick() - start_tick;
+    copy_stats.KBps = (copy_stats.CopyMs != 0U) ? (uint32_t)(copy_stats.Size / copy_stats.CopyMs) : 0U;
+    copy_stats.Crc = crc_state;
+
+    /* f_expand() set the length, closing writes the directory entry */
+    if (f_close(&dst_file) != FR_OK)
+    {
+      copy_failed = 1U;
+      return;
+    }
+    if (!copy_verify)
+    {
+      FileCopy_Finish(FILECOPY_DONE);
+      return;
+    }
+
+    copy_stats.State = FILECOPY_VERIFYING;
+    copy_stats.Copied = 0U;
+    read_pos = 0U;
+    read_buf = 0U;
+    write_buf = 0U;
+    write_pos = 0U;
+    crc_state = 0xFFFFFFFFU;
+    return;
+  }
+
+  copy_stats.VerifyCrc = crc_state;
+  FileCopy_Finish((copy_stats.VerifyCrc == copy_stats.Crc) ? FILECOPY_DONE : FILECOPY_FAILED);
+}
+
+/**
+  * @brief  Get the state and counters of the current or last copy
+  * @param  stats: Filled with the counters
+  * @retval None
+  */
+void FileCopy_GetStats(FileCopy_StatsTypeDef *stats)
+{
+  *stats = copy_stats;
+}
@@ -23,6 +23,8 @@
 
 /* USER CODE BEGIN 0 */
 
+#include "bsp_driver_sd.h"
+
 /* USER CODE END 0 */
 
 /*----------------------------------------------------------------------------*/
@@ -103,14 +105,20 @@ void MX_GPIO_Init(void)
 
   /*Configure GPIO pins : PDPin PDPin PDPin PDPin
                            PDPin PDPin PDPin PDPin
-                           PDPin PDPin */
+                           PDPin */
   GPIO_InitStruct.Pin = P5_GPIOD8_Pin|P5_GPIOD9_Pin|P5_GPIOD10_Pin|P5_GPIOD11_Pin
                           |P5_GPIOD12_Pin|P5_GPIOD13_Pin|P5_GPIOD14_Pin|P5_GPIOD15_Pin
-                          |SDIO_CD_Pin|P4_GPIOD4_Pin;
+                          |P4_GPIOD4_Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : PtPin */
+  GPIO_InitStruct.Pin = SDIO_CD_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(SDIO_CD_GPIO_Port, &GPIO_InitStruct);
+
   /*Configure GPIO pin : PtPin */
   GPIO_InitStruct.Pin = RS485_TX_RX__Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
@@ -118,8 +126,25 @@ void MX_GPIO_Init(void)
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
   HAL_GPIO_Init(RS485_TX_RX__GPIO_Port, &GPIO_InitStruct);
 
+  /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI3_IRQn, 15, 0);
+  HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+
 }
 
 /* USER CODE BEGIN 2 */
 
+/**
+  * @brief  EXTI line edge, only the SD card detect switch is wired to one
+  * @param  GPIO_Pin: Pin of the line
+  * @retval None
+  */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  if (GPIO_Pin == SDIO_CD_Pin)
+  {
+    BSP_SD_DetectIT();
+  }
+}
+
 /* USER CODE END 2 */
@@ -36,6 +36,15 @@
 
 #include "usbd_cdc_if.h"
 #include "eeprma2_m24.h"
+#include "serial_link.h"
+#include "modbus_sniffer.h"
+#include "usbd_storage_if.h"
+#include "sd_async.h"
+#include "sd_logger.h"
+#include "file_copy.h"
+#include "sd_bench.h"
+#include "w25q64.h"
+#include "usbd_cdc_msc.h"
 
 #include <stdio.h>
 
@@ -58,6 +67,53 @@
 /* Enable the LWIP Ethernet Stack */
 /* #define ENABLE_ETHERNET */
 
+/* Enable the framed binary transport on the DB9 serial port (USART1) */
+/* #define ENABLE_SERIAL_LINK */
+
+/* Run IP over the DB9 serial port (USART1) with SLIP, next to Ethernet */
+/* #define ENABLE_SLIP */
+
+#if defined(ENABLE_SERIAL_LINK) && defined(ENABLE_SLIP)
+#error "ENABLE_SERIAL_LINK and ENABLE_SLIP both need USART1"
+#endif
+
+#if defined(ENABLE_SERIAL_LINK) && !defined(USB_DEBUG)
+#error "USART1 is used by the serial link, define USB_DEBUG for debug output"
+#endif
+
+#if defined(ENABLE_SLIP) && !defined(USB_DEBUG)
+#error "USART1 is used by SLIP, define USB_DEBUG for debug output"
+#endif
+
+/* Capture Modbus RTU traffic on the RS485 port (listen only), to SD by default */
+/* #define ENABLE_MODBUS_SNIFFER */
+/* #define MODBUS_SNIFFER_TO_CDC */
+
+#if defined(MODBUS_SNIFFER_TO_CDC) && defined(USB_DEBUG)
+#error "USB CDC carries the debug output, capture the Modbus traffic to SD"
+#endif
+
+/* Hand the SD card to the USB host (mass storage) while one is attached */
+/* #define ENABLE_USB_MSC */
+
+#if defined(ENABLE_USB_MSC) && defined(ENABLE_MODBUS_SNIFFER) && !defined(MODBUS_SNIFFER_TO_CDC)
+#error "The SD card is exported over USB, capture the Modbus traffic to CDC"
+#endif
+
+#if defined(ENABLE_USB_MSC) && defined(USBD_VENDOR_STREAM)
+#error "USBD_VENDOR_STREAM replaces the mass storage interface (usbd_cdc_msc.h)"
+#endif
+
+/* USBD_CDC_NCM (usbd_cdc_msc.h) replaces the USB serial port with an
+   Ethernet adapter, served by LwIP next to the Ethernet interface */
+#if defined(USBD_CDC_NCM) && (defined(USB_DEBUG) || defined(MODBUS_SNIFFER_TO_CDC))
+#error "USBD_CDC_NCM removes the USB CDC serial port"
+#endif
+
+/* Benchmark the SD card at boot: raw and f_write() throughput and latency,
+   several seconds, on a test file deleted afterwards */
+/* #define ENABLE_SD_BENCH */
+
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -121,7 +177,7 @@ int main(void)
   MX_SDIO_SD_Init();
   MX_USART1_UART_Init();
   MX_USART2_UART_Init();
-#ifdef ENABLE_ETHERNET
+#if defined(ENABLE_ETHERNET) || defined(ENABLE_SLIP) || defined(USBD_CDC_NCM)
   MX_LWIP_Init();
 #endif
   MX_USB_DEVICE_Init();
@@ -138,17 +194,59 @@ int main(void)
   MX_EEPRMA2_Check_24C02();
   MX_SPI2_Check_W25Q64();
   MX_SDIO_SD_Check();
+#ifdef ENABLE_SD_BENCH
+  if (SDBench_Run(SD_BENCH_FILE_NAME) != HAL_OK)
+  {
+    printf("SD bench:     Error\r\n");
+  }
+#endif
 
   printf("Checking CAN Devices:\r\n");
   MX_CAN_Loopback_Check();
 
+#ifdef ENABLE_SERIAL_LINK
+  if (SerialLink_Init() != HAL_OK)
+  {
+    printf("Serial link:  Error\r\n");
+  }
+#endif
+
+#ifdef ENABLE_SLIP
+  if (MX_LWIP_SLIP_Init() != ERR_OK)
+  {
+    printf("SLIP:         Error\r\n");
+  }
+#endif
+
+#ifdef USBD_CDC_NCM
+  if (MX_LWIP_NCM_Init() != ERR_OK)
+  {
+    printf("USB NCM:      Error\r\n");
+  }
+#endif
+
+#ifdef ENABLE_MODBUS_SNIFFER
+#ifdef MODBUS_SNIFFER_TO_CDC
+  if (ModbusSniffer_Start(MODBUS_SNIFFER_SINK_CDC) != HAL_OK)
+#else
+  if (ModbusSniffer_Start(MODBUS_SNIFFER_SINK_SD) != HAL_OK)
+#endif
+  {
+    printf("Modbus:       Error\r\n");
+  }
+#endif
+
+#ifdef ENABLE_USB_MSC
+  STORAGE_Export_FS();
+#endif
+
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
   while (1)
   {
-#ifdef ENABLE_ETHERNET
+#if defined(ENABLE_ETHERNET) || defined(ENABLE_SLIP) || defined(USBD_CDC_NCM)
     MX_LWIP_Process();
 #endif
     /* USER CODE END WHILE */
@@ -157,6 +255,18 @@ int main(void)
     MX_USB_HOST_Process();
 #endif
     /* USER CODE BEGIN 3 */
+    MX_USB_DEVICE_Process();
+    MX_SDIO_SD_Process();
+    SD_Async_Process();
+    SDLogger_Process();
+    FileCopy_Process();
+    W25Q64_Process();
+#ifdef ENABLE_SERIAL_LINK
+    SerialLink_Process();
+#endif
+#ifdef ENABLE_MODBUS_SNIFFER
+    ModbusSniffer_Process();
+#endif
   }
 
   /* Something went wrong */
@@ -225,8 +335,8 @@ int _write(int file, char *ptr, int len)
     HAL_GPIO_WritePin(GPIOE, LED1_Pin, GPIO_PIN_RESET);
 
 #ifdef USB_DEBUG
-    static uint8_t rc = USBD_OK;
     bool wait = false;
+    uint32_t sent = 0;
 
     /* Wait for terminal to be opened */
     while (!CDC_Is_Connected())
@@ -240,15 +350,10 @@ int _write(int file, char *ptr, int len)
       HAL_Delay(250);
     }
 
-    /* Send the data, retrying if busy */
-    do {
-        rc = CDC_Transmit_FS((uint8_t*)ptr, len);
-    } while (USBD_BUSY == rc);
-
-    if (USBD_FAIL == rc) {
-        /// NOTE: Should never reach here.
-        /// TODO: Handle this error.
-        return 0;
+    /* Queue the data, only waiting while the transmission ring is full */
+    while (sent < (uint32_t)len)
+    {
+        sent += CDC_Write_FS((uint8_t*)ptr + sent, len - sent);
     }
 #else
     HAL_StatusTypeDef rc;
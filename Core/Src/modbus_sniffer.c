@@ -0,0 +1,597 @@
+/**
+  ******************************************************************************
+  * @file    modbus_sniffer.c
+  * @brief   Listen only Modbus RTU capture on the RS485 port (USART2).
+  *
+  *          Bytes are received into a circular DMA ring. The USART idle line
+  *          interrupt only queues the ring position and the DWT cycle count;
+  *          the main loop turns these events into bursts, works out the
+  *          silent interval before each burst from the character time and
+  *          splits frames on t3.5. Completed frames are packed into records
+  *          and handed to the sink in batches of up to MODBUS_SNIFFER_BLOCK,
+  *          without ever waiting for it: a record that does not fit is
+  *          dropped and counted. A ring overrun is detected and counted too,
+  *          the frame it hit is flagged.
+  *
+  *          See modbus_sniffer.h for the capture stream format.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "modbus_sniffer.h"
+#include "fatfs.h"
+#include "sd_async.h"
+#include "sd_logger.h"
+#include "sdio.h"
+#include "uart_dma.h"
+#include "usart.h"
+#include "usbd_cdc_if.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define STREAM_HDR_SIZE     16U
+#define RECORD_HDR_SIZE     12U
+
+#define LINE_ERROR_FLAGS    (USART_SR_PE | USART_SR_FE | USART_SR_NE | USART_SR_ORE)
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  uint32_t Cycles;      /* DWT cycle count when the line went idle */
+  uint16_t Pos;         /* Ring position reached at that time */
+  uint16_t LineError;   /* Parity / framing / noise error in the burst */
+} IdleEventTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static UART_DMA_HandleTypeDef hsniff;
+static uint8_t rx_ring[MODBUS_SNIFFER_RX_RING];
+static uint32_t rx_errors;
+static uint8_t running;
+
+/* Idle line events, written by the IRQ */
+static IdleEventTypeDef events[MODBUS_SNIFFER_EVENTS];
+static volatile uint32_t evt_head;
+static volatile uint32_t evt_tail;
+static volatile uint8_t evt_lost;
+
+/* 64-bit extension of the DWT cycle counter, 0 at capture start */
+static uint64_t cyc_now;
+static uint32_t cyc_last;
+static uint32_t cyc_per_us;
+
+/* Line timing in cycles */
+static uint32_t char_cyc;
+static uint32_t t15_cyc;
+static uint32_t t35_cyc;
+static uint32_t t35_us;
+
+/* Frame being assembled, stored after its record header */
+static uint8_t record[RECORD_HDR_SIZE + MODBUS_SNIFFER_MAX_FRAME];
+static uint64_t frame_start;
+static uint64_t frame_end;
+static uint16_t frame_len;
+static uint8_t frame_flags;
+static uint8_t frame_open;
+
+/* Sink */
+static ModbusSniffer_SinkTypeDef sink_type;
+static uint32_t blocks[2][MODBUS_SNIFFER_BLOCK / 4U];
+static uint32_t blk_len;
+static uint8_t blk_fill;
+
+static ModbusSniffer_StatsTypeDef sniffer_stats;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Store a little endian value
+  * @param  p: Destination
+  * @param  value: Value
+  * @param  size: Size in bytes
+  * @retval None
+  */
+static void ModbusSniffer_PutLE(uint8_t *p, uint64_t value, uint32_t size)
+{
+  for (uint32_t i = 0; i < size; i++)
+  {
+    p[i] = (uint8_t)(value >> (8U * i));
+  }
+}
+
+/**
+  * @brief  Modbus CRC16 (poly 0xA001 reflected, init 0xFFFF)
+  * @param  data: Data
+  * @param  len: Length in bytes
+  * @retval CRC, 0 when run over a frame including its CRC
+  */
+static uint16_t ModbusSniffer_Crc16(const uint8_t *data, uint32_t len)
+{
+  uint16_t crc = 0xFFFF;
+
+  while (len--)
+  {
+    crc ^= *data++;
+    for (uint32_t i = 0; i < 8U; i++)
+    {
+      crc = (crc & 1U) ? ((crc >> 1) ^ 0xA001U) : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+/**
+  * @brief  Advance the extended cycle counter
+  * @note   Must run at least once per 2^31 cycles (12 s at 168 MHz).
+  * @retval None
+  */
+static void ModbusSniffer_ClockUpdate(void)
+{
+  uint32_t now = DWT->CYCCNT;
+
+  cyc_now += (uint32_t)(now - cyc_last);
+  cyc_last = now;
+}
+
+/**
+  * @brief  Extend a recent DWT cycle count to 64 bits
+  * @param  cycles: DWT cycle count, at most 2^31 cycles away from the last update
+  * @retval Cycles since capture start
+  */
+static uint64_t ModbusSniffer_Extend(uint32_t cycles)
+{
+  return cyc_now + (int64_t)(int32_t)(cycles - cyc_last);
+}
+
+/**
+  * @brief  Hand the current block to the sink, without waiting
+  * @note   For USB CDC the block is only released when the previous transfer
+  *         has completed, so batches grow with the load. The SD logger takes
+  *         what fits its buffers, the rest stays in the block.
+  * @retval None
+  */
+static void ModbusSniffer_Submit(void)
+{
+  uint32_t n;
+
+  if (blk_len == 0U)
+  {
+    return;
+  }
+
+  if (sink_type == MODBUS_SNIFFER_SINK_SD)
+  {
+    n = SDLogger_Write(blocks[0], blk_len);
+    if ((n != 0U) && (n < blk_len))
+    {
+      memmove(blocks[0], (uint8_t *)blocks[0] + n, blk_len - n);
+    }
+    blk_len -= n;
+  }
+  else if (CDC_Transmit_FS((uint8_t *)blocks[blk_fill], (uint16_t)blk_len) == USBD_OK)
+  {
+    /* Accepted, so the transfer of the other block has completed */
+    blk_fill ^= 1U;
+    blk_len = 0;
+  }
+}
+
+/**
+  * @brief  Append data to the capture stream
+  * @note   A record is never split, it is dropped if the sink cannot take
+  *         it: waiting for the sink would let the reception ring overrun.
+  * @param  data: Data
+  * @param  len: Length in bytes, at most MODBUS_SNIFFER_BLOCK
+  * @retval None
+  */
+static void ModbusSniffer_Put(const uint8_t *data, uint32_t len)
+{
+  if ((blk_len + len) > MODBUS_SNIFFER_BLOCK)
+  {
+    ModbusSniffer_Submit();
+    if ((blk_len + len) > MODBUS_SNIFFER_BLOCK)
+    {
+      sniffer_stats.Dropped++;
+      return;
+    }
+  }
+
+  memcpy((uint8_t *)blocks[blk_fill] + blk_len, data, len);
+  blk_len += len;
+}
+
+/**
+  * @brief  Close the current frame and queue its record
+  * @retval None
+  */
+static void ModbusSniffer_Emit(void)
+{
+  if ((frame_len >= 4U) && ((frame_flags & MODBUS_SNIFFER_FLAG_TRUNCATED) == 0U) &&
+      (ModbusSniffer_Crc16(&record[RECORD_HDR_SIZE], frame_len) == 0U))
+  {
+    frame_flags |= MODBUS_SNIFFER_FLAG_CRC_OK;
+  }
+  else
+  {
+    sniffer_stats.CrcErrors++;
+  }
+  if (frame_flags & MODBUS_SNIFFER_FLAG_LINE_ERROR)
+  {
+    sniffer_stats.LineErrors++;
+  }
+  sniffer_stats.Frames++;
+  sniffer_stats.Bytes += frame_len;
+
+  ModbusSniffer_PutLE(&record[0], frame_start / cyc_per_us, 8);
+  ModbusSniffer_PutLE(&record[8], frame_len, 2);
+  record[10] = frame_flags;
+  record[11] = 0;
+  ModbusSniffer_Put(record, RECORD_HDR_SIZE + frame_len);
+
+  frame_open = 0;
+  frame_len = 0;
+  frame_flags = 0;
+}
+
+/**
+  * @brief  Add the bytes received up to an idle line event
+  * @param  evt: Idle line event
+  * @retval None
+  */
+static void ModbusSniffer_Burst(const IdleEventTypeDef *evt)
+{
+  uint16_t n = (uint16_t)((evt->Pos + MODBUS_SNIFFER_RX_RING - hsniff.RxTail) % MODBUS_SNIFFER_RX_RING);
+  uint64_t end;
+  uint64_t start;
+  int64_t gap;
+  uint8_t *data;
+  uint16_t len;
+  uint16_t copy;
+
+  if (n == 0U)
+  {
+    return;
+  }
+
+  /* The idle flag is raised one character time after the last stop bit */
+  end = ModbusSniffer_Extend(evt->Cycles) - char_cyc;
+  start = end - ((uint64_t)n * char_cyc);
+
+  if (frame_open)
+  {
+    gap = (int64_t)(start - frame_end);
+    if (gap >= (int64_t)t35_cyc)
+    {
+      ModbusSniffer_Emit();
+    }
+    else if (gap >= (int64_t)t15_cyc)
+    {
+      frame_flags |= MODBUS_SNIFFER_FLAG_GAP;
+    }
+  }
+
+  if (!frame_open)
+  {
+    frame_open = 1;
+    frame_start = start;
+  }
+  if (evt->LineError)
+  {
+    frame_flags |= MODBUS_SNIFFER_FLAG_LINE_ERROR;
+  }
+  if (evt_lost)
+  {
+    evt_lost = 0;
+    frame_flags |= MODBUS_SNIFFER_FLAG_SPLIT_LOST;
+  }
+  frame_end = end;
+
+  while (n > 0U)
+  {
+    len = UART_DMA_RxPeek(&hsniff, &data);
+    if (len > n)
+    {
+      len = n;
+    }
+
+    copy = MODBUS_SNIFFER_MAX_FRAME - frame_len;
+    if (copy > len)
+    {
+      copy = len;
+    }
+    if (copy < len)
+    {
+      frame_flags |= MODBUS_SNIFFER_FLAG_TRUNCATED;
+    }
+    memcpy(&record[RECORD_HDR_SIZE + frame_len], data, copy);
+    frame_len += copy;
+
+    UART_DMA_RxConsume(&hsniff, len);
+    n -= len;
+  }
+}
+
+/**
+  * @brief  USART2 idle line, queue the ring position and time
+  * @note   Called from the USART2 IRQ.
+  * @param  hud: UART DMA handle
+  * @retval None
+  */
+static void ModbusSniffer_IdleCallback(UART_DMA_HandleTypeDef *hud)
+{
+  uint32_t cycles = DWT->CYCCNT;
+  uint32_t head = evt_head;
+  uint32_t next = (head + 1U) % MODBUS_SNIFFER_EVENTS;
+
+  if (next == evt_tail)
+  {
+    evt_lost = 1;
+    return;
+  }
+
+  events[head].Cycles = cycles;
+  events[head].Pos = UART_DMA_RxHead(hud);
+  events[head].LineError = (hud->RxIdleSR & LINE_ERROR_FLAGS) ? 1U : 0U;
+  evt_head = next;
+}
+
+/**
+  * @brief  Open the next free MBnnnnn.BIN capture file on the SD card with
+  *         the SD logger, MODBUS_SNIFFER_SD_SIZE preallocated
+  * @retval FatFs result
+  */
+static FRESULT ModbusSniffer_OpenFile(void)
+{
+  char name[20];
+  FRESULT res;
+
+  for (uint32_t i = 0; i < 100000U; i++)
+  {
+    snprintf(name, sizeof(name), "%sMB%05lu.BIN", SDPath, (unsigned long)i);
+    res = f_stat(name, NULL);
+    if (res == FR_NO_FILE)
+    {
+      return (SDLogger_Open(name, MODBUS_SNIFFER_SD_SIZE) == HAL_OK) ? FR_OK : FR_DENIED;
+    }
+    if (res != FR_OK)
+    {
+      return res;
+    }
+  }
+  return FR_DENIED;
+}
+
+/**
+  * @brief  Flush the last block and close the capture file
+  * @retval None
+  */
+static void ModbusSniffer_Close(void)
+{
+  uint32_t len;
+
+  if (sink_type != MODBUS_SNIFFER_SINK_SD)
+  {
+    ModbusSniffer_Submit();
+    return;
+  }
+
+  /* The logger takes the rest once its buffers are written, nothing more
+     is taken when idle: the file is full or a write failed */
+  while (blk_len != 0U)
+  {
+    len = blk_len;
+    ModbusSniffer_Submit();
+    if ((blk_len == len) && SD_Async_IsIdle())
+    {
+      sniffer_stats.Dropped++;
+      break;
+    }
+    SD_Async_Process();
+  }
+  if (SDLogger_Close() != HAL_OK)
+  {
+    sniffer_stats.WriteErrors++;
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Reconfigure USART2 for listening and start the capture
+  * @param  sink: Where the capture stream is written
+  * @retval HAL status
+  */
+HAL_StatusTypeDef ModbusSniffer_Start(ModbusSniffer_SinkTypeDef sink)
+{
+  uint8_t *hdr = record;
+  uint32_t parity_code;
+
+  if (running)
+  {
+    return HAL_BUSY;
+  }
+
+  sink_type = sink;
+  blk_len = 0;
+  blk_fill = 0;
+  memset(&sniffer_stats, 0, sizeof(sniffer_stats));
+
+  if (sink == MODBUS_SNIFFER_SINK_SD)
+  {
+    if ((MX_SDIO_SD_Mount() != FR_OK) || (ModbusSniffer_OpenFile() != FR_OK))
+    {
+      return HAL_ERROR;
+    }
+  }
+
+  /* Line timing: start + 8 data + parity + stop bits is 11 bits either way */
+  cyc_per_us = SystemCoreClock / 1000000U;
+  char_cyc = (uint32_t)(((uint64_t)SystemCoreClock * 11U) / MODBUS_SNIFFER_BAUDRATE);
+  if (MODBUS_SNIFFER_BAUDRATE > 19200U)
+  {
+    /* Fixed values recommended by the Modbus serial line specification */
+    t15_cyc = 750U * cyc_per_us;
+    t35_cyc = 1750U * cyc_per_us;
+  }
+  else
+  {
+    t15_cyc = (char_cyc * 3U) / 2U;
+    t35_cyc = (char_cyc * 7U) / 2U;
+  }
+  t35_us = t35_cyc / cyc_per_us;
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  cyc_last = DWT->CYCCNT;
+  cyc_now = 0;
+
+  switch (MODBUS_SNIFFER_PARITY)
+  {
+    case UART_PARITY_ODD:
+      parity_code = 1;
+      break;
+    case UART_PARITY_EVEN:
+      parity_code = 2;
+      break;
+    default:
+      parity_code = 0;
+      break;
+  }
+
+  memcpy(hdr, "MBSN", 4);
+  hdr[4] = MODBUS_SNIFFER_VERSION;
+  hdr[5] = (uint8_t)parity_code;
+  hdr[6] = (parity_code == 0U) ? 2U : 1U;
+  hdr[7] = 0;
+  ModbusSniffer_PutLE(&hdr[8], MODBUS_SNIFFER_BAUDRATE, 4);
+  ModbusSniffer_PutLE(&hdr[12], t35_us, 4);
+  ModbusSniffer_Put(hdr, STREAM_HDR_SIZE);
+
+  /* Keep the transceiver in receive mode, the sniffer never drives the bus */
+  HAL_GPIO_WritePin(RS485_TX_RX__GPIO_Port, RS485_TX_RX__Pin, GPIO_PIN_RESET);
+
+  huart2.Init.BaudRate = MODBUS_SNIFFER_BAUDRATE;
+  huart2.Init.Parity = MODBUS_SNIFFER_PARITY;
+  huart2.Init.WordLength = (parity_code == 0U) ? UART_WORDLENGTH_8B : UART_WORDLENGTH_9B;
+  huart2.Init.StopBits = (parity_code == 0U) ? UART_STOPBITS_2 : UART_STOPBITS_1;
+  huart2.Init.Mode = UART_MODE_RX;
+  if (HAL_UART_Init(&huart2) != HAL_OK)
+  {
+    ModbusSniffer_Close();
+    return HAL_ERROR;
+  }
+
+  evt_head = 0;
+  evt_tail = 0;
+  evt_lost = 0;
+  frame_open = 0;
+  frame_len = 0;
+  frame_flags = 0;
+
+  hsniff.huart = &huart2;
+  hsniff.RxBuf = rx_ring;
+  hsniff.RxSize = MODBUS_SNIFFER_RX_RING;
+  hsniff.RxIdleCallback = ModbusSniffer_IdleCallback;
+  if (UART_DMA_Start(&hsniff) != HAL_OK)
+  {
+    ModbusSniffer_Close();
+    return HAL_ERROR;
+  }
+  rx_errors = hsniff.RxErrors;
+
+  /* Line errors are recorded per frame instead of aborting the reception DMA */
+  __HAL_UART_DISABLE_IT(&huart2, UART_IT_PE);
+  __HAL_UART_DISABLE_IT(&huart2, UART_IT_ERR);
+
+  running = 1;
+
+  return HAL_OK;
+}
+
+/**
+  * @brief  Stop the capture, flushing the last frame and closing the file
+  * @retval None
+  */
+void ModbusSniffer_Stop(void)
+{
+  if (!running)
+  {
+    return;
+  }
+
+  UART_DMA_Stop(&hsniff);
+
+  ModbusSniffer_Process();
+  if (frame_open)
+  {
+    ModbusSniffer_Emit();
+  }
+  running = 0;
+
+  ModbusSniffer_Close();
+}
+
+/**
+  * @brief  Split received bytes into frames and feed the sink
+  * @note   Call from the main loop, at least every few seconds.
+  * @retval None
+  */
+void ModbusSniffer_Process(void)
+{
+  uint32_t tail;
+
+  if (!running)
+  {
+    return;
+  }
+
+  ModbusSniffer_ClockUpdate();
+
+  if (hsniff.RxErrors != rx_errors)
+  {
+    /* Reception was restarted from the start of the ring, drop stale events */
+    rx_errors = hsniff.RxErrors;
+    evt_tail = evt_head;
+    frame_flags |= MODBUS_SNIFFER_FLAG_SPLIT_LOST;
+  }
+  else if (UART_DMA_RxOverrun(&hsniff))
+  {
+    /* The DMA lapped the tail, the ring was emptied: the events point at
+       overwritten bytes */
+    sniffer_stats.Overruns++;
+    evt_tail = evt_head;
+    frame_flags |= MODBUS_SNIFFER_FLAG_OVERRUN;
+  }
+
+  while ((tail = evt_tail) != evt_head)
+  {
+    ModbusSniffer_Burst(&events[tail]);
+    evt_tail = (tail + 1U) % MODBUS_SNIFFER_EVENTS;
+  }
+
+  /* The frame is complete once the line has been silent for t3.5 */
+  if (frame_open && ((int64_t)(cyc_now - frame_end) >= (int64_t)t35_cyc))
+  {
+    ModbusSniffer_Emit();
+  }
+
+  ModbusSniffer_Submit();
+}
+
+/**
+  * @brief  Get the capture statistics
+  * @param  stats: Filled with a copy of the statistics
+  * @retval None
+  */
+void ModbusSniffer_GetStats(ModbusSniffer_StatsTypeDef *stats)
+{
+  SDLogger_StatsTypeDef log;
+
+  *stats = sniffer_stats;
+  if (sink_type == MODBUS_SNIFFER_SINK_SD)
+  {
+    SDLogger_GetStats(&log);
+    stats->WriteErrors += log.WriteErrors + log.CommitErrors;
+  }
+}
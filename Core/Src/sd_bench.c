@@ -0,0 +1,381 @@
+/**
+  ******************************************************************************
+  * @file    sd_bench.c
+  * @brief   SD card and FatFs benchmark, to qualify cards for a logging rate.
+  *
+  *          A raw operation is timed from the DMA start until the card is
+  *          back in the transfer state, so a write includes the programming
+  *          time. The sd_async.c queue is drained and the cached copies of
+  *          the test file sectors dropped first, the raw transfers then go
+  *          around sd_diskio.c. The f_write() tests include the close, which
+  *          writes the FAT and the directory entry, in the throughput.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sd_bench.h"
+#include "fatfs.h"
+#include "sdio.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define BENCH_SEED          0x2545F491U     /* Same random sectors on every run */
+
+/* Private variables ---------------------------------------------------------*/
+/* Word aligned for the DMA, not in CCMRAM */
+static uint32_t bench_buf[SD_BENCH_BUF_SIZE / 4U];
+
+static FIL bench_file;
+static SDBench_ResultTypeDef bench_results[SD_BENCH_TESTS];
+static uint64_t bench_total;    /* Cycles of the current test */
+static uint32_t bench_max;
+
+static const char *const bench_names[SD_BENCH_TESTS] =
+{
+  "seq write", "seq read", "rand write", "rand read",
+  "f_write 512", "f_write 4K", "f_write 16K"
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Latency bin of a cycle count
+  * @param  cycles: Cycles
+  * @retval Bin, below SD_BENCH_HIST_BINS
+  */
+static uint32_t SDBench_Bin(uint32_t cycles)
+{
+  uint32_t e;
+
+  if (cycles < 4U)
+  {
+    return cycles;
+  }
+
+  /* Power of two, then the two bits below the leading one */
+  e = 31U - __CLZ(cycles);
+  return 4U + ((e - 2U) * 4U) + ((cycles >> (e - 2U)) & 3U);
+}
+
+/**
+  * @brief  Start timing a test
+  * @param  r: Result of the test
+  * @param  size: Bytes per operation
+  * @retval None
+  */
+static void SDBench_Start(SDBench_ResultTypeDef *r, uint32_t size)
+{
+  memset(r, 0, sizeof(*r));
+  r->OpSize = size;
+  bench_total = 0U;
+  bench_max = 0U;
+}
+
+/**
+  * @brief  Count one operation
+  * @param  r: Result of the test
+  * @param  cycles: Time it took
+  * @retval None
+  */
+static void SDBench_Record(SDBench_ResultTypeDef *r, uint32_t cycles)
+{
+  r->Ops++;
+  r->Hist[SDBench_Bin(cycles)]++;
+  bench_total += cycles;
+  if (cycles > bench_max)
+  {
+    bench_max = cycles;
+  }
+}
+
+/**
+  * @brief  Latency under which pct percent of the operations completed
+  * @param  r: Result of the test
+  * @param  pct: Percentile
+  * @retval Upper bound of the bin reaching it, at most the longest operation
+  */
+static uint32_t SDBench_Percentile(const SDBench_ResultTypeDef *r, uint32_t pct)
+{
+  uint32_t sum = 0U;
+  uint32_t i;
+
+  for (i = 0U; i < SD_BENCH_HIST_BINS; i++)
+  {
+    sum += r->Hist[i];
+    if ((r->Ops != 0U) && (((uint64_t)sum * 100U) >= ((uint64_t)r->Ops * pct)))
+    {
+      return (SDBench_BinCycles(i) < bench_max) ? SDBench_BinCycles(i) : bench_max;
+    }
+  }
+  return 0U;
+}
+
+/**
+  * @brief  Work out the throughput and the percentiles of a test
+  * @param  r: Result of the test
+  * @retval None
+  */
+static void SDBench_Finish(SDBench_ResultTypeDef *r)
+{
+  uint32_t per_us = SystemCoreClock / 1000000U;
+
+  r->KBps = (bench_total != 0U) ?
+            (uint32_t)(((uint64_t)r->Ops * r->OpSize * (SystemCoreClock / 1000U)) / bench_total) : 0U;
+  r->P50Us = SDBench_Percentile(r, 50U) / per_us;
+  r->P99Us = SDBench_Percentile(r, 99U) / per_us;
+  r->MaxUs = bench_max / per_us;
+}
+
+/**
+  * @brief  One raw transfer of bench_buf, waiting for the card
+  * @param  write: 0 to read, 1 to write
+  * @param  sector: First sector
+  * @param  count: Number of sectors
+  * @param  cycles: Set to the time it took
+  * @retval MSD_OK or MSD_ERROR
+  */
+static uint8_t SDBench_Transfer(uint8_t write, uint32_t sector, uint32_t count, uint32_t *cycles)
+{
+  uint32_t start = DWT->CYCCNT;
+  uint32_t tick = HAL_GetTick();
+  uint8_t ret;
+
+  if (write)
+  {
+    ret = BSP_SD_WriteBlocks_DMA(bench_buf, sector, count);
+  }
+  else
+  {
+    ret = BSP_SD_ReadBlocks_DMA(bench_buf, sector, count);
+  }
+  if (ret != MSD_OK)
+  {
+    return MSD_ERROR;
+  }
+
+  while (HAL_SD_GetState(&hsd) == HAL_SD_STATE_BUSY)
+  {
+    if ((HAL_GetTick() - tick) > SD_BENCH_TIMEOUT)
+    {
+      (void)HAL_SD_Abort(&hsd);
+      return MSD_ERROR;
+    }
+  }
+  if (hsd.ErrorCode != HAL_SD_ERROR_NONE)
+  {
+    return MSD_ERROR;
+  }
+
+  /* Written data is not safe before the card has programmed it */
+  while (BSP_SD_GetCardState() != SD_TRANSFER_OK)
+  {
+    if ((HAL_GetTick() - tick) > SD_BENCH_TIMEOUT)
+    {
+      return MSD_ERROR;
+    }
+  }
+
+  *cycles = DWT->CYCCNT - start;
+  return MSD_OK;
+}
+
+/**
+  * @brief  Raw sequential or random transfers inside the test area
+  * @param  test: Test to run
+  * @param  write: 0 to read, 1 to write
+  * @param  random: 0 for SD_BENCH_BUF_SIZE transfers one after the other,
+  *         1 for SD_BENCH_RAND_SIZE ones at random
+  * @param  area: First sector of the test area
+  * @retval None
+  */
+static void SDBench_Raw(SDBench_TestTypeDef test, uint8_t write, uint8_t random, uint32_t area)
+{
+  SDBench_ResultTypeDef *r = &bench_results[test];
+  uint32_t size = random ? SD_BENCH_RAND_SIZE : SD_BENCH_BUF_SIZE;
+  uint32_t ops = random ? SD_BENCH_RAND_OPS : SD_BENCH_SEQ_OPS;
+  uint32_t slots = SD_BENCH_AREA_SIZE / size;
+  uint32_t rnd = BENCH_SEED;
+  uint32_t slot;
+  uint32_t cycles;
+  uint32_t i;
+
+  SDBench_Start(r, size);
+  for (i = 0U; i < ops; i++)
+  {
+    slot = i % slots;
+    if (random)
+    {
+      /* xorshift32 */
+      rnd ^= rnd << 13;
+      rnd ^= rnd >> 17;
+      rnd ^= rnd << 5;
+      slot = rnd % slots;
+    }
+
+    if (SDBench_Transfer(write, area + (slot * (size / BLOCKSIZE)), size / BLOCKSIZE, &cycles) != MSD_OK)
+    {
+      r->Errors++;
+      break;
+    }
+    SDBench_Record(r, cycles);
+  }
+  SDBench_Finish(r);
+}
+
+/**
+  * @brief  Write a new file of SD_BENCH_FILE_SIZE with f_write() calls of
+  *         one size
+  * @param  test: Test to run
+  * @param  path: File path
+  * @param  size: Bytes per f_write(), SD_BENCH_BUF_SIZE at most
+  * @retval None
+  */
+static void SDBench_FsWrite(SDBench_TestTypeDef test, const char *path, uint32_t size)
+{
+  SDBench_ResultTypeDef *r = &bench_results[test];
+  uint32_t start;
+  uint32_t done;
+  UINT bw;
+  FRESULT res;
+
+  SDBench_Start(r, size);
+  if (f_open(&bench_file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+  {
+    r->Errors++;
+    return;
+  }
+  /* Replacing the file freed the last test's clusters into the pending
+     trim, erase them before the timing starts */
+  (void)SD_DiskCache_Flush();
+
+  for (done = 0U; done < SD_BENCH_FILE_SIZE; done += size)
+  {
+    start = DWT->CYCCNT;
+    res = f_write(&bench_file, bench_buf, size, &bw);
+    if ((res != FR_OK) || (bw != size))
+    {
+      r->Errors++;
+      break;
+    }
+    SDBench_Record(r, DWT->CYCCNT - start);
+  }
+
+  start = DWT->CYCCNT;
+  if (f_close(&bench_file) != FR_OK)
+  {
+    r->Errors++;
+  }
+  bench_total += DWT->CYCCNT - start;
+  SDBench_Finish(r);
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Run all the tests and print the results. Blocks until done.
+  * @param  name: Test file name (8.3) on SDPath, replaced, deleted at the end
+  * @retval HAL_OK, HAL_ERROR if the test file cannot be allocated contiguous
+  *         on the SD card or a test failed
+  */
+HAL_StatusTypeDef SDBench_Run(const char *name)
+{
+  SDBench_ResultTypeDef *r;
+  FATFS *fs;
+  FRESULT res;
+  char path[sizeof(SDPath) + 12U];
+  uint32_t area = 0U;
+  uint32_t errors = 0U;
+  uint32_t i;
+
+  if ((uint32_t)snprintf(path, sizeof(path), "%s%s", SDPath, name) >= sizeof(path))
+  {
+    return HAL_ERROR;
+  }
+
+  memset(bench_results, 0, sizeof(bench_results));
+  for (i = 0U; i < (SD_BENCH_BUF_SIZE / 4U); i++)
+  {
+    bench_buf[i] = i * 0x9E3779B9U;
+  }
+
+  if ((MX_SDIO_SD_Mount() != FR_OK) || (f_open(&bench_file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK))
+  {
+    return HAL_ERROR;
+  }
+
+  /* The raw tests only touch the clusters of this file */
+  fs = bench_file.obj.fs;
+  res = (fs == &SDFatFS) ? f_expand(&bench_file, SD_BENCH_AREA_SIZE, 1) : FR_INVALID_DRIVE;
+  if (res == FR_OK)
+  {
+    area = fs->database + ((bench_file.obj.sclust - 2U) * fs->csize);
+  }
+  if ((f_close(&bench_file) != FR_OK) || (res != FR_OK))
+  {
+    (void)f_unlink(path);
+    return HAL_ERROR;
+  }
+
+  (void)SD_DiskCache_Flush();
+  SD_DiskCache_Discard(area, SD_BENCH_AREA_SIZE / BLOCKSIZE);
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  SDBench_Raw(SD_BENCH_SEQ_WRITE, 1U, 0U, area);
+  SDBench_Raw(SD_BENCH_SEQ_READ, 0U, 0U, area);
+  SDBench_Raw(SD_BENCH_RAND_WRITE, 1U, 1U, area);
+  SDBench_Raw(SD_BENCH_RAND_READ, 0U, 1U, area);
+
+  SDBench_FsWrite(SD_BENCH_FS_WRITE_512, path, 512U);
+  SDBench_FsWrite(SD_BENCH_FS_WRITE_4K, path, 4096U);
+  SDBench_FsWrite(SD_BENCH_FS_WRITE_16K, path, SD_BENCH_BUF_SIZE);
+  (void)f_unlink(path);
+
+  for (i = 0U; i < SD_BENCH_TESTS; i++)
+  {
+    r = &bench_results[i];
+    errors += r->Errors;
+    if (r->Errors != 0U)
+    {
+      printf("SD bench     %-11s Error after %lu ops\r\n", bench_names[i], r->Ops);
+      continue;
+    }
+    printf("SD bench     %-11s %6luKB/s  p50 %luus  p99 %luus  max %luus\r\n", bench_names[i],
+           r->KBps, r->P50Us, r->P99Us, r->MaxUs);
+  }
+
+  return (errors == 0U) ? HAL_OK : HAL_ERROR;
+}
+
+/**
+  * @brief  Get the result of a test of the last run
+  * @param  test: Test
+  * @param  result: Filled with the result, zeroed if the test did not run
+  * @retval None
+  */
+void SDBench_GetResult(SDBench_TestTypeDef test, SDBench_ResultTypeDef *result)
+{
+  *result = bench_results[test];
+}
+
+/**
+  * @brief  Longest latency counted in a histogram bin
+  * @param  bin: Bin, below SD_BENCH_HIST_BINS
+  * @retval Cycles
+  */
+uint32_t SDBench_BinCycles(uint32_t bin)
+{
+  uint32_t e;
+
+  if (bin < 4U)
+  {
+    return bin;
+  }
+
+  /* Wraps to 0xFFFFFFFF for the last bin */
+  e = ((bin - 4U) / 4U) + 2U;
+  return ((5U + ((bin - 4U) % 4U)) << (e - 2U)) - 1U;
+}
@@ -0,0 +1,446 @@
+/**
+  ******************************************************************************
+  * @file    sd_logger.c
+  * @brief   High rate logging to a preallocated, contiguous file on the SD
+  *          card.
+  *
+  *          The data goes into SD_LOGGER_BUFFERS buffers in turn, a full one
+  *          is queued on sd_async.c as a single multi-block write while the
+  *          next fills. Completions are counted from SDLogger_WriteDone(),
+  *          run by SD_Async_Process() in the main loop. The logged length
+  *          is written with f_setvalid() on exFAT, as one more queued write
+  *          of the trailer sector on FAT.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sd_logger.h"
+#include "sd_async.h"
+#include "fatfs.h"
+
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define LOG_BUF_SECTORS     (SD_LOGGER_BUF_SIZE / BLOCKSIZE)
+
+/* Writes end on SD_LOGGER_BUF_SIZE boundaries of the card, which must then
+   divide every allocation unit size (16 KiB to 64 MiB, 12 and 24 MiB) */
+#if ((SD_LOGGER_BUF_SIZE & (SD_LOGGER_BUF_SIZE - 1U)) != 0U) || \
+    (SD_LOGGER_BUF_SIZE > 16384U) || ((SD_LOGGER_BUF_SIZE % 512U) != 0U)
+#error "SD_LOGGER_BUF_SIZE must be a power of two from 512 to 16384"
+#endif
+
+/* Private variables ---------------------------------------------------------*/
+/* Word aligned for the DMA, not in CCMRAM */
+static uint32_t log_buf[SD_LOGGER_BUFFERS][SD_LOGGER_BUF_SIZE / 4U];
+static SD_AsyncReqTypeDef log_req[SD_LOGGER_BUFFERS];
+static uint64_t log_req_end[SD_LOGGER_BUFFERS];   /* Log offset after the write */
+static uint32_t log_req_tick[SD_LOGGER_BUFFERS];
+static uint8_t log_pending[SD_LOGGER_BUFFERS];
+
+/* Trailer sector of a FAT log, word aligned for the DMA */
+static uint32_t log_trailer[BLOCKSIZE / 4U];
+static SD_AsyncReqTypeDef trailer_req;
+static uint64_t trailer_size;   /* Length in the trailer being written */
+static uint8_t trailer_pending;
+
+static FIL log_file;
+static uint8_t log_open;
+static uint8_t log_failed;
+static uint8_t log_exfat;       /* Length in the valid data length, no trailer */
+static DWORD log_sector;        /* First data sector of the file */
+static uint64_t log_queued;     /* Bytes handed to sd_async.c */
+static uint32_t log_fill;       /* Bytes in the buffer being filled */
+static uint32_t log_limit;      /* Size of that buffer's write */
+static uint8_t log_cur;         /* Buffer being filled */
+static uint32_t commit_tick;
+
+static SDLogger_StatsTypeDef logger_stats;
+static uint32_t latency_hist[SD_LOGGER_LATENCY_BINS];
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  A buffer write is over, called from SD_Async_Process()
+  * @param  req: Request of the buffer
+  * @retval None
+  */
+static void SDLogger_WriteDone(SD_AsyncReqTypeDef *req)
+{
+  uint32_t i = (uint32_t)(req - log_req);
+  uint32_t ms = HAL_GetTick() - log_req_tick[i];
+
+  log_pending[i] = 0U;
+  if (ms > logger_stats.MaxWriteMs)
+  {
+    logger_stats.MaxWriteMs = ms;
+  }
+  latency_hist[(ms < SD_LOGGER_LATENCY_BINS) ? ms : (SD_LOGGER_LATENCY_BINS - 1U)]++;
+
+  /* Completions come in order, once one fails the log stops there */
+  if ((req->Status == SD_ASYNC_OK) && !log_failed)
+  {
+    logger_stats.Durable = log_req_end[i];
+  }
+  else if (req->Status != SD_ASYNC_OK)
+  {
+    log_failed = 1U;
+    logger_stats.WriteErrors++;
+  }
+}
+
+/**
+  * @brief  The trailer write is over, called from SD_Async_Process()
+  * @param  req: Request of the trailer
+  * @retval None
+  */
+static void SDLogger_TrailerDone(SD_AsyncReqTypeDef *req)
+{
+  trailer_pending = 0U;
+  if (req->Status == SD_ASYNC_OK)
+  {
+    logger_stats.Committed = trailer_size;
+  }
+  else
+  {
+    logger_stats.CommitErrors++;
+  }
+}
+
+/**
+  * @brief  Size of the next buffer write: up to the next SD_LOGGER_BUF_SIZE
+  *         boundary of the card, so that no write straddles an AU
+  * @retval Bytes
+  */
+static uint32_t SDLogger_Limit(void)
+{
+  uint32_t pos = ((log_sector % LOG_BUF_SECTORS) * BLOCKSIZE) + (uint32_t)(log_queued % SD_LOGGER_BUF_SIZE);
+
+  return SD_LOGGER_BUF_SIZE - (pos % SD_LOGGER_BUF_SIZE);
+}
+
+/**
+  * @brief  Queue the buffer being filled, the last sector zero padded
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef SDLogger_Submit(void)
+{
+  SD_AsyncReqTypeDef *req = &log_req[log_cur];
+  uint32_t sectors = (log_fill + BLOCKSIZE - 1U) / BLOCKSIZE;
+
+  memset((uint8_t *)log_buf[log_cur] + log_fill, 0, (sectors * BLOCKSIZE) - log_fill);
+
+  req->Write = 1U;
+  req->Sector = log_sector + (DWORD)(log_queued / BLOCKSIZE);
+  req->Buf = (uint8_t *)log_buf[log_cur];
+  req->Count = sectors;
+  req->Callback = SDLogger_WriteDone;
+  req->Context = NULL;
+  if (SD_Async_Submit(req) != SD_ASYNC_OK)
+  {
+    log_failed = 1U;
+    logger_stats.WriteErrors++;
+    return HAL_ERROR;
+  }
+
+  log_pending[log_cur] = 1U;
+  log_req_end[log_cur] = log_queued + log_fill;
+  log_req_tick[log_cur] = HAL_GetTick();
+  logger_stats.Writes++;
+
+  log_queued += log_fill;
+  log_fill = 0U;
+  log_limit = SDLogger_Limit();
+  log_cur = (uint8_t)((log_cur + 1U) % SD_LOGGER_BUFFERS);
+  return HAL_OK;
+}
+
+/**
+  * @brief  Record the logged length: the valid data length of the directory
+  *         entry on exFAT, the trailer sector on FAT
+  * @param  size: Length, at most the log capacity
+  * @retval FatFs result, on FAT FR_OK once the trailer write is queued
+  */
+static FRESULT SDLogger_Commit(uint64_t size)
+{
+  FRESULT res;
+
+  if (log_exfat)
+  {
+    res = f_setvalid(&log_file, (FSIZE_t)size);
+    if (res == FR_OK)
+    {
+      logger_stats.Committed = size;
+    }
+    return res;
+  }
+
+  memset(log_trailer, 0, sizeof(log_trailer));
+  memcpy(log_trailer, SD_LOGGER_TRAILER_MAGIC, 8U);
+  memcpy((uint8_t *)log_trailer + 8U, &size, sizeof(size));    /* Little endian */
+  trailer_size = size;
+
+  trailer_req.Write = 1U;
+  trailer_req.Sector = log_sector + (DWORD)(logger_stats.Capacity / BLOCKSIZE);
+  trailer_req.Buf = (uint8_t *)log_trailer;
+  trailer_req.Count = 1U;
+  trailer_req.Callback = SDLogger_TrailerDone;
+  trailer_req.Context = NULL;
+  if (SD_Async_Submit(&trailer_req) != SD_ASYNC_OK)
+  {
+    return FR_DISK_ERR;
+  }
+  trailer_pending = 1U;
+  return FR_OK;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Create a log file on the SD card, with all its clusters in one
+  *         contiguous run
+  * @param  path: File path on SDPath, replaced if it exists
+  * @param  size: Largest log, rounded up to SD_LOGGER_BUF_SIZE, under 4 GiB
+  *         unless the volume is exFAT
+  * @retval HAL_OK, HAL_ERROR if a log is open, the volume is not the SD card
+  *         or has no contiguous free space that large
+  */
+HAL_StatusTypeDef SDLogger_Open(const char *path, uint64_t size)
+{
+  FATFS *fs;
+  FRESULT res;
+  uint64_t alloc;
+
+  /* f_expand() itself refuses 4 GiB and more on a FAT volume */
+  if (log_open || (size == 0U) || (size > ((FSIZE_t)0 - 1U - SD_LOGGER_BUF_SIZE)))
+  {
+    return HAL_ERROR;
+  }
+  size = ((size + SD_LOGGER_BUF_SIZE - 1U) / SD_LOGGER_BUF_SIZE) * SD_LOGGER_BUF_SIZE;
+
+  if (f_open(&log_file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+  {
+    return HAL_ERROR;
+  }
+
+  /* The data is written to the card directly, only the SD volume will do.
+     A FAT log gets one more sector, for the trailer. */
+  fs = log_file.obj.fs;
+  log_exfat = (fs->fs_type == FS_EXFAT) ? 1U : 0U;
+  alloc = log_exfat ? size : (size + BLOCKSIZE);
+  res = (fs == &SDFatFS) ? f_expand(&log_file, (FSIZE_t)alloc, 1) : FR_INVALID_DRIVE;
+  if (res == FR_OK)
+  {
+    log_sector = fs->database + ((log_file.obj.sclust - 2U) * fs->csize);
+    SD_DiskCache_Discard(log_sector, (uint32_t)(alloc / BLOCKSIZE));
+
+    memset(&logger_stats, 0, sizeof(logger_stats));
+    logger_stats.Capacity = size;
+
+    /* The entry gets the allocated size, the log starts empty */
+    res = f_sync(&log_file);
+  }
+  if (res == FR_OK)
+  {
+    res = SDLogger_Commit(0U);
+  }
+  while (trailer_pending)
+  {
+    SD_Async_Process();
+  }
+  if ((res != FR_OK) || (logger_stats.CommitErrors != 0U))
+  {
+    (void)f_close(&log_file);
+    (void)f_unlink(path);
+    return HAL_ERROR;
+  }
+
+  memset(latency_hist, 0, sizeof(latency_hist));
+  memset(log_pending, 0, sizeof(log_pending));
+  log_queued = 0U;
+  log_fill = 0U;
+  log_limit = SDLogger_Limit();
+  log_cur = 0U;
+  log_failed = 0U;
+  commit_tick = HAL_GetTick();
+  log_open = 1U;
+  return HAL_OK;
+}
+
+/**
+  * @brief  Append data to the log, without waiting for the card
+  * @param  data: Data
+  * @param  len: Length
+  * @retval Bytes taken, less than len when all the buffers are still being
+  *         written, the file is full or a write failed
+  */
+uint32_t SDLogger_Write(const void *data, uint32_t len)
+{
+  const uint8_t *src = data;
+  uint32_t done = 0U;
+  uint64_t room;
+  uint32_t n;
+
+  if (!log_open || log_failed)
+  {
+    return 0U;
+  }
+
+  while ((done < len) && !log_pending[log_cur])
+  {
+    room = logger_stats.Capacity - log_queued - log_fill;
+    if (room == 0U)
+    {
+      break;
+    }
+    n = log_limit - log_fill;
+    if (n > room)
+    {
+      n = (uint32_t)room;
+    }
+    if (n > (len - done))
+    {
+      n = len - done;
+    }
+
+    memcpy((uint8_t *)log_buf[log_cur] + log_fill, &src[done], n);
+    log_fill += n;
+    done += n;
+
+    if ((log_fill == log_limit) && (SDLogger_Submit() != HAL_OK))
+    {
+      break;
+    }
+  }
+
+  logger_stats.Written += done;
+  return done;
+}
+
+/**
+  * @brief  Write the data still buffered, set the final length and free the
+  *         clusters past it
+  * @retval HAL_OK, HAL_ERROR if a write failed or the file could not be
+  *         finalized
+  */
+HAL_StatusTypeDef SDLogger_Close(void)
+{
+  FRESULT res;
+  uint32_t i;
+
+  if (!log_open)
+  {
+    return HAL_ERROR;
+  }
+  log_open = 0U;
+
+  if ((log_fill != 0U) && !log_failed)
+  {
+    (void)SDLogger_Submit();
+  }
+  for (i = 0U; i < SD_LOGGER_BUFFERS; i++)
+  {
+    while (log_pending[i])
+    {
+      SD_Async_Process();
+    }
+  }
+  while (trailer_pending)
+  {
+    SD_Async_Process();
+  }
+
+  /* f_truncate() cuts the chain at the file pointer, the trailer with it,
+     and f_close() then writes the size as the valid length. A full exFAT
+     log is not cut and f_close() leaves its entry alone: set the valid
+     length there. */
+  res = f_lseek(&log_file, (FSIZE_t)logger_stats.Durable);
+  if (res == FR_OK)
+  {
+    res = f_truncate(&log_file);
+  }
+  if ((res == FR_OK) && log_exfat &&
+      (logger_stats.Durable == (uint64_t)f_size(&log_file)))
+  {
+    res = f_setvalid(&log_file, (FSIZE_t)logger_stats.Durable);
+  }
+  if (f_close(&log_file) != FR_OK)
+  {
+    res = FR_DISK_ERR;
+  }
+  if (res == FR_OK)
+  {
+    logger_stats.Committed = logger_stats.Durable;
+  }
+
+  return ((res == FR_OK) && !log_failed) ? HAL_OK : HAL_ERROR;
+}
+
+/**
+  * @brief  Commit the logged length every SD_LOGGER_COMMIT_MS, at the first
+  *         pass with no buffer write in flight. A failed commit is counted
+  *         and retried after SD_LOGGER_COMMIT_MS.
+  *         Call from the main loop, after SD_Async_Process().
+  * @retval None
+  */
+void SDLogger_Process(void)
+{
+  uint32_t i;
+
+  if (!log_open || ((HAL_GetTick() - commit_tick) < SD_LOGGER_COMMIT_MS) ||
+      (logger_stats.Durable == logger_stats.Committed))
+  {
+    return;
+  }
+
+  /* f_setvalid() would wait behind the queued buffers, and the trailer
+     write delay them: try on a later pass */
+  if (trailer_pending)
+  {
+    return;
+  }
+  for (i = 0U; i < SD_LOGGER_BUFFERS; i++)
+  {
+    if (log_pending[i])
+    {
+      return;
+    }
+  }
+  commit_tick = HAL_GetTick();
+
+  if (SDLogger_Commit(logger_stats.Durable) != FR_OK)
+  {
+    logger_stats.CommitErrors++;
+  }
+}
+
+/**
+  * @brief  Get the logger counters
+  * @param  stats: Filled with the counters of the current or last log
+  * @retval None
+  */
+void SDLogger_GetStats(SDLogger_StatsTypeDef *stats)
+{
+  uint32_t total = 0U;
+  uint32_t sum = 0U;
+  uint32_t i;
+
+  for (i = 0U; i < SD_LOGGER_LATENCY_BINS; i++)
+  {
+    total += latency_hist[i];
+  }
+
+  /* Smallest latency that 99% of the writes did not exceed */
+  logger_stats.P99WriteMs = 0U;
+  for (i = 0U; (i < SD_LOGGER_LATENCY_BINS) && (total != 0U); i++)
+  {
+    sum += latency_hist[i];
+    if (((uint64_t)sum * 100U) >= ((uint64_t)total * 99U))
+    {
+      logger_stats.P99WriteMs = i;
+      break;
+    }
+  }
+
+  *stats = logger_stats;
+}
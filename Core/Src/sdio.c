@@ -23,12 +23,61 @@
 /* USER CODE BEGIN 0 */
 
 #include "fatfs.h"
+#include "sd_async.h"
 #include <stdio.h>
 
+/* Bus modes, fastest first. BSP_SD_Init() tries them in turn and keeps the
+   first that reads back without error. SDIOCLK is 48 MHz, the card clock
+   is SDIOCLK / (ClockDiv + 2), or SDIOCLK itself with the bypass. */
+typedef struct
+{
+  uint32_t BusWide;
+  uint8_t  HighSpeed;                   /* Needs the CMD6 switch */
+  uint32_t ClockBypass;
+  uint32_t ClockDiv;
+} SD_BusModeTypeDef;
+
+static const SD_BusModeTypeDef sd_modes[] =
+{
+  { SDIO_BUS_WIDE_4B, 1U, SDIO_CLOCK_BYPASS_ENABLE,  0U },    /* 48 MHz */
+  { SDIO_BUS_WIDE_4B, 0U, SDIO_CLOCK_BYPASS_DISABLE, 0U },    /* 24 MHz */
+  { SDIO_BUS_WIDE_4B, 0U, SDIO_CLOCK_BYPASS_DISABLE, 3U },    /* 9.6 MHz */
+  { SDIO_BUS_WIDE_1B, 0U, SDIO_CLOCK_BYPASS_DISABLE, 0U },    /* 24 MHz */
+  { SDIO_BUS_WIDE_1B, 0U, SDIO_CLOCK_BYPASS_DISABLE, 3U },    /* 9.6 MHz, as MX_SDIO_SD_Init() */
+};
+#define SD_MODES                (sizeof(sd_modes) / sizeof(sd_modes[0]))
+
+#define SD_TEST_BLOCKS          4U      /* Read back per pass */
+#define SD_TEST_PASSES          16U     /* 32 KiB in all */
+#define SD_TEST_TIMEOUT         100U    /* ms per pass */
+#define SD_CRC_ERROR_LIMIT      3U      /* Bus errors before starting one mode lower */
+
+/* AU_SIZE field of the SD status in KiB, 0 when not defined */
+static const uint32_t sd_au_kb[16] =
+{
+  0U, 16U, 32U, 64U, 128U, 256U, 512U, 1024U,
+  2048U, 4096U, 8192U, 12288U, 16384U, 24576U, 32768U, 65536U
+};
+
+/* Fastest mode allowed, lowered by bus errors */
+static uint32_t sd_mode_first = 0;
+static uint32_t sd_bus_errors = 0;
+static SD_BusInfoTypeDef sd_bus;
+static uint32_t sd_test_buf[(SD_TEST_BLOCKS * BLOCKSIZE) / 4];
+
+/* Card detect, the EXTI edge only starts the debounce. SDFatFS is
+   registered while a card is in and mounted by FatFs on first access. */
+static volatile uint32_t sd_cd_tick = 0;
+static volatile uint8_t sd_cd_changed = 0;
+static uint8_t sd_present = 0;
+static uint8_t sd_registered = 0;
+static uint8_t sd_reported = 0;
+
 /* USER CODE END 0 */
 
 SD_HandleTypeDef hsd;
-DMA_HandleTypeDef hdma_sdio;
+DMA_HandleTypeDef hdma_sdio_rx;
+DMA_HandleTypeDef hdma_sdio_tx;
 
 /* SDIO init function */
 
@@ -71,10 +120,14 @@ void HAL_SD_MspInit(SD_HandleTypeDef* sdHandle)
     __HAL_RCC_GPIOD_CLK_ENABLE();
     /**SDIO GPIO Configuration
     PC8     ------> SDIO_D0
+    PC9     ------> SDIO_D1
+    PC10     ------> SDIO_D2
+    PC11     ------> SDIO_D3
     PC12     ------> SDIO_CK
     PD2     ------> SDIO_CMD
     */
-    GPIO_InitStruct.Pin = GPIO_PIN_8|GPIO_PIN_12;
+    GPIO_InitStruct.Pin = GPIO_PIN_8|GPIO_PIN_9|GPIO_PIN_10|GPIO_PIN_11
+                          |GPIO_PIN_12;
     GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
     GPIO_InitStruct.Pull = GPIO_NOPULL;
     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
@@ -89,31 +142,47 @@ void HAL_SD_MspInit(SD_HandleTypeDef* sdHandle)
     HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
 
     /* SDIO DMA Init */
-    /* SDIO Init */
-    hdma_sdio.Instance = DMA2_Stream3;
-    hdma_sdio.Init.Channel = DMA_CHANNEL_4;
-    hdma_sdio.Init.Direction = DMA_PERIPH_TO_MEMORY;
-    hdma_sdio.Init.PeriphInc = DMA_PINC_DISABLE;
-    hdma_sdio.Init.MemInc = DMA_MINC_ENABLE;
-    hdma_sdio.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
-    hdma_sdio.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
-    hdma_sdio.Init.Mode = DMA_PFCTRL;
-    hdma_sdio.Init.Priority = DMA_PRIORITY_LOW;
-    hdma_sdio.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
-    hdma_sdio.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
-    hdma_sdio.Init.MemBurst = DMA_MBURST_INC4;
-    hdma_sdio.Init.PeriphBurst = DMA_PBURST_INC4;
-    if (HAL_DMA_Init(&hdma_sdio) != HAL_OK)
+    /* SDIO_RX Init */
+    hdma_sdio_rx.Instance = DMA2_Stream3;
+    hdma_sdio_rx.Init.Channel = DMA_CHANNEL_4;
+    hdma_sdio_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_sdio_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_sdio_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_sdio_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_sdio_rx.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_sdio_rx.Init.Mode = DMA_PFCTRL;
+    hdma_sdio_rx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_sdio_rx.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+    hdma_sdio_rx.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    hdma_sdio_rx.Init.MemBurst = DMA_MBURST_INC4;
+    hdma_sdio_rx.Init.PeriphBurst = DMA_PBURST_INC4;
+    if (HAL_DMA_Init(&hdma_sdio_rx) != HAL_OK)
     {
       Error_Handler();
     }
 
-    /* Several peripheral DMA handle pointers point to the same DMA handle.
-     Be aware that there is only one stream to perform all the requested DMAs. */
-    /* Be sure to change transfer direction before calling
-     HAL_SD_ReadBlocks_DMA or HAL_SD_WriteBlocks_DMA. */
-    __HAL_LINKDMA(sdHandle,hdmarx,hdma_sdio);
-    __HAL_LINKDMA(sdHandle,hdmatx,hdma_sdio);
+    __HAL_LINKDMA(sdHandle,hdmarx,hdma_sdio_rx);
+
+    /* SDIO_TX Init */
+    hdma_sdio_tx.Instance = DMA2_Stream6;
+    hdma_sdio_tx.Init.Channel = DMA_CHANNEL_4;
+    hdma_sdio_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_sdio_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_sdio_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_sdio_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_sdio_tx.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_sdio_tx.Init.Mode = DMA_PFCTRL;
+    hdma_sdio_tx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_sdio_tx.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+    hdma_sdio_tx.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    hdma_sdio_tx.Init.MemBurst = DMA_MBURST_INC4;
+    hdma_sdio_tx.Init.PeriphBurst = DMA_PBURST_INC4;
+    if (HAL_DMA_Init(&hdma_sdio_tx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(sdHandle,hdmatx,hdma_sdio_tx);
 
     /* SDIO interrupt Init */
     HAL_NVIC_SetPriority(SDIO_IRQn, 0, 0);
@@ -137,10 +206,14 @@ void HAL_SD_MspDeInit(SD_HandleTypeDef* sdHandle)
 
     /**SDIO GPIO Configuration
     PC8     ------> SDIO_D0
+    PC9     ------> SDIO_D1
+    PC10     ------> SDIO_D2
+    PC11     ------> SDIO_D3
     PC12     ------> SDIO_CK
     PD2     ------> SDIO_CMD
     */
-    HAL_GPIO_DeInit(GPIOC, GPIO_PIN_8|GPIO_PIN_12);
+    HAL_GPIO_DeInit(GPIOC, GPIO_PIN_8|GPIO_PIN_9|GPIO_PIN_10|GPIO_PIN_11
+                          |GPIO_PIN_12);
 
     HAL_GPIO_DeInit(GPIOD, GPIO_PIN_2);
 
@@ -159,29 +232,429 @@ void HAL_SD_MspDeInit(SD_HandleTypeDef* sdHandle)
 /* USER CODE BEGIN 1 */
 
 /**
-  * @brief Check for valid SD FATFS
+  * @brief  Switch the card to high speed (CMD6 mode 1, group 1 function 1)
+  * @retval HAL status, HAL_ERROR if the card did not switch
+  */
+static HAL_StatusTypeDef SD_SwitchHighSpeed(void)
+{
+  SDIO_DataInitTypeDef config;
+  HAL_SD_CardCSDTypeDef csd;
+  uint32_t status[16];
+  uint32_t count = 0;
+  uint32_t tickstart;
+  uint32_t i;
+
+  /* CMD6 is command class 10 */
+  if ((HAL_SD_GetCardCSD(&hsd, &csd) != HAL_OK) || ((csd.CardComdClasses & (1U << 10)) == 0U))
+  {
+    return HAL_ERROR;
+  }
+
+  /* The 512 bit switch status comes on the data lines */
+  hsd.Instance->DCTRL = 0U;
+  config.DataTimeOut   = SDMMC_DATATIMEOUT;
+  config.DataLength    = sizeof(status);
+  config.DataBlockSize = SDIO_DATABLOCK_SIZE_64B;
+  config.TransferDir   = SDIO_TRANSFER_DIR_TO_SDIO;
+  config.TransferMode  = SDIO_TRANSFER_MODE_BLOCK;
+  config.DPSM          = SDIO_DPSM_ENABLE;
+  (void)SDIO_ConfigData(hsd.Instance, &config);
+
+  if (SDMMC_CmdSwitch(hsd.Instance, 0x80FFFFF1U) != HAL_SD_ERROR_NONE)
+  {
+    __HAL_SD_CLEAR_FLAG(&hsd, SDIO_STATIC_FLAGS);
+    return HAL_ERROR;
+  }
+
+  tickstart = HAL_GetTick();
+  while (!__HAL_SD_GET_FLAG(&hsd, SDIO_FLAG_RXOVERR | SDIO_FLAG_DCRCFAIL | SDIO_FLAG_DTIMEOUT | SDIO_FLAG_DBCKEND))
+  {
+    if (__HAL_SD_GET_FLAG(&hsd, SDIO_FLAG_RXFIFOHF) && (count <= 8U))
+    {
+      for (i = 0; i < 8U; i++)
+      {
+        status[count++] = SDIO_ReadFIFO(hsd.Instance);
+      }
+    }
+    if ((HAL_GetTick() - tickstart) >= SD_TEST_TIMEOUT)
+    {
+      __HAL_SD_CLEAR_FLAG(&hsd, SDIO_STATIC_FLAGS);
+      return HAL_ERROR;
+    }
+  }
+
+  if (__HAL_SD_GET_FLAG(&hsd, SDIO_FLAG_RXOVERR | SDIO_FLAG_DCRCFAIL | SDIO_FLAG_DTIMEOUT))
+  {
+    __HAL_SD_CLEAR_FLAG(&hsd, SDIO_STATIC_FLAGS);
+    return HAL_ERROR;
+  }
+  while (__HAL_SD_GET_FLAG(&hsd, SDIO_FLAG_RXDAVL) && (count < 16U))
+  {
+    status[count++] = SDIO_ReadFIFO(hsd.Instance);
+  }
+  __HAL_SD_CLEAR_FLAG(&hsd, SDIO_STATIC_DATA_FLAGS);
+
+  /* Bits 379:376, the function now selected in group 1 */
+  if ((count < 16U) || ((((uint8_t *)status)[16] & 0x0FU) != 0x01U))
+  {
+    return HAL_ERROR;
+  }
+
+  /* The card takes 8 clocks to switch */
+  HAL_Delay(1);
+  return HAL_OK;
+}
+
+/**
+  * @brief  Read the first blocks back with DMA, timing them
+  * @param  cycles: Set to the DWT cycles taken
+  * @retval HAL_SD_ERROR_NONE, or the HAL error code that stopped the test
+  */
+static uint32_t SD_TestBus(uint32_t *cycles)
+{
+  uint32_t start = DWT->CYCCNT;
+  uint32_t tickstart;
+  uint32_t pass;
+
+  for (pass = 0; pass < SD_TEST_PASSES; pass++)
+  {
+    if (HAL_SD_ReadBlocks_DMA(&hsd, (uint8_t *)sd_test_buf, 0, SD_TEST_BLOCKS) != HAL_OK)
+    {
+      return (hsd.ErrorCode != HAL_SD_ERROR_NONE) ? hsd.ErrorCode : HAL_SD_ERROR_BUSY;
+    }
+
+    tickstart = HAL_GetTick();
+    while ((HAL_SD_GetState(&hsd) != HAL_SD_STATE_READY) ||
+           (HAL_SD_GetCardState(&hsd) != HAL_SD_CARD_TRANSFER))
+    {
+      if ((HAL_GetTick() - tickstart) >= SD_TEST_TIMEOUT)
+      {
+        (void)HAL_SD_Abort(&hsd);
+        return HAL_SD_ERROR_TIMEOUT;
+      }
+    }
+
+    if (hsd.ErrorCode != HAL_SD_ERROR_NONE)
+    {
+      return hsd.ErrorCode;
+    }
+  }
+
+  *cycles = DWT->CYCCNT - start;
+  return HAL_SD_ERROR_NONE;
+}
+
+/**
+  * @brief  Initialize the card, then move to the fastest bus mode that works
+  * @note   Overrides the weak version in bsp_driver_sd.c. Every mode is
+  *         checked by reading blocks back; a CRC error, overrun or timeout
+  *         moves on to the next slower mode.
+  * @retval MSD_OK or MSD_ERROR
+  */
+uint8_t BSP_SD_Init(void)
+{
+  HAL_SD_CardStatusTypeDef status;
+  const SD_BusModeTypeDef *mode;
+  uint32_t cycles = 0;
+  uint32_t width = SDIO_BUS_WIDE_1B;
+  uint8_t high_speed = 0;
+  uint8_t wide_ok = 1;
+  uint8_t hs_ok = 1;
+  uint32_t i;
+
+  sd_bus.BusWidth = 0;
+
+  if (BSP_SD_IsDetected() != SD_PRESENT)
+  {
+    return MSD_ERROR;
+  }
+
+  /* Back to the generated 1 bit, 9.6 MHz setup for the identification */
+  hsd.Init.BusWide = SDIO_BUS_WIDE_1B;
+  hsd.Init.ClockBypass = SDIO_CLOCK_BYPASS_DISABLE;
+  hsd.Init.ClockDiv = 3;
+  if (HAL_SD_Init(&hsd) != HAL_OK)
+  {
+    return MSD_ERROR;
+  }
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  for (i = sd_mode_first; i < SD_MODES; i++)
+  {
+    mode = &sd_modes[i];
+    if ((mode->HighSpeed && !hs_ok) || ((mode->BusWide == SDIO_BUS_WIDE_4B) && !wide_ok))
+    {
+      continue;
+    }
+
+    /* Switch at the old clock, the card then also works slower */
+    if (mode->HighSpeed && !high_speed)
+    {
+      if (SD_SwitchHighSpeed() != HAL_OK)
+      {
+        hs_ok = 0;
+        continue;
+      }
+      high_speed = 1;
+    }
+
+    hsd.Init.ClockBypass = mode->ClockBypass;
+    hsd.Init.ClockDiv = mode->ClockDiv;
+    if (mode->BusWide != width)
+    {
+      /* Sends ACMD6 and sets the new clock */
+      hsd.ErrorCode = HAL_SD_ERROR_NONE;
+      if (HAL_SD_ConfigWideBusOperation(&hsd, mode->BusWide) != HAL_OK)
+      {
+        if (mode->BusWide == SDIO_BUS_WIDE_4B)
+        {
+          wide_ok = 0;
+          continue;
+        }
+        return MSD_ERROR;
+      }
+      width = mode->BusWide;
+    }
+    else
+    {
+      SDIO_InitTypeDef init = hsd.Init;
+      init.BusWide = width;
+      (void)SDIO_Init(hsd.Instance, init);
+    }
+    hsd.Init.BusWide = width;
+
+    hsd.ErrorCode = HAL_SD_ERROR_NONE;
+    if (SD_TestBus(&cycles) == HAL_SD_ERROR_NONE)
+    {
+      break;
+    }
+    hsd.ErrorCode = HAL_SD_ERROR_NONE;
+  }
+
+  if (i == SD_MODES)
+  {
+    return MSD_ERROR;
+  }
+
+  sd_bus.BusWidth = (width == SDIO_BUS_WIDE_4B) ? 4U : 1U;
+  sd_bus.HighSpeed = high_speed;
+  sd_bus.ClockHz = (mode->ClockBypass == SDIO_CLOCK_BYPASS_ENABLE) ?
+                   48000000U : (48000000U / (mode->ClockDiv + 2U));
+  sd_bus.ReadKBps = (uint32_t)(((uint64_t)SD_TEST_PASSES * SD_TEST_BLOCKS * BLOCKSIZE *
+                                (SystemCoreClock / 1000U)) / ((cycles != 0U) ? cycles : 1U));
+
+  /* Allocation unit from the SD status (ACMD13), writes kept inside one
+     avoid the long garbage collection stalls of the card */
+  sd_bus.AUSize = 0;
+  if (HAL_SD_GetCardStatus(&hsd, &status) == HAL_OK)
+  {
+    sd_bus.AUSize = sd_au_kb[status.AllocationUnitSize & 0x0FU] * 1024U;
+  }
+  hsd.ErrorCode = HAL_SD_ERROR_NONE;
+  return MSD_OK;
+}
+
+/**
+  * @brief  Count bus errors, enough of them and the next BSP_SD_Init()
+  *         starts one mode slower, and end the disk I/O wait
+  * @param  hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+  if (hsd->ErrorCode & (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_CMD_CRC_FAIL |
+                        HAL_SD_ERROR_RX_OVERRUN | HAL_SD_ERROR_TX_UNDERRUN))
+  {
+    if ((++sd_bus_errors >= SD_CRC_ERROR_LIMIT) && (sd_mode_first < (SD_MODES - 1U)))
+    {
+      sd_bus_errors = 0;
+      sd_mode_first++;
+    }
+  }
+
+  /* Wake up the disk I/O waiting on the RX or TX stream */
+  BSP_SD_AbortCallback();
+}
+
+/**
+  * @brief  Get the bus mode chosen by the last BSP_SD_Init()
+  * @param  info: Filled with the mode, BusWidth 0 if no card is running
+  * @retval None
+  */
+void MX_SDIO_SD_GetBusInfo(SD_BusInfoTypeDef *info)
+{
+  *info = sd_bus;
+}
+
+/**
+  * @brief  Print the card geometry and bus mode, once FatFs has mounted it
+  * @retval None
+  */
+static void SD_Report(void)
+{
+  SD_BusInfoTypeDef bus;
+  uint32_t totalBlocks = (SDFatFS.n_fatent - 2) * SDFatFS.csize;
+
+  printf("Drive %s     %luMB\r\n", SDPath, totalBlocks / 2000);
+
+  MX_SDIO_SD_GetBusInfo(&bus);
+  printf("Drive %s     %u bit %s%luMHz, %lu.%luMB/s\r\n", SDPath, bus.BusWidth,
+         bus.HighSpeed ? "HS " : "", bus.ClockHz / 1000000U,
+         bus.ReadKBps / 1000U, (bus.ReadKBps % 1000U) / 100U);
+  printf("Drive %s     AU %luKB\r\n", SDPath, bus.AUSize / 1024U);
+}
+
+/**
+  * @brief  The card was pulled out: fail what is in flight and drop the
+  *         volume, open files become invalid. Nothing can be written back.
+  * @retval None
+  */
+static void SD_Removed(void)
+{
+  SD_Async_Cancel();
+  if (sd_registered)
+  {
+    (void)f_mount(NULL, SDPath, 0);
+    sd_registered = 0;
+  }
+  SD_DiskCache_Invalidate();
+
+  sd_bus.BusWidth = 0;
+  sd_reported = 0;
+  printf("Drive %s     Removed\r\n", SDPath);
+}
+
+/**
+  * @brief  SD card detect edge, overrides the weak version in
+  *         bsp_driver_sd.c. Called from the EXTI interrupt.
+  * @retval None
+  */
+void BSP_SD_DetectIT(void)
+{
+  sd_cd_tick = HAL_GetTick();
+  sd_cd_changed = 1;
+}
+
+/**
+  * @brief  Register the SD volume if a card is in, without touching the
+  *         card: it is initialized and mounted on the first file access
   * @retval None
   */
 void MX_SDIO_SD_Check(void)
 {
-  FATFS fs;
-  FRESULT res;
+  sd_present = (BSP_SD_IsDetected() == SD_PRESENT) ? 1U : 0U;
 
-  // mount the SD drive
-  res = f_mount(&fs, SDPath, 0);
-  if(res == FR_OK) 
+  if (sd_present && (MX_SDIO_SD_Mount() == FR_OK))
   {
-    uint32_t freeClust;
-    FATFS* fs_ptr = &fs;
-    res = f_getfree(SDPath, &freeClust, &fs_ptr); // Warning! This fills fs.n_fatent and fs.csize!
-    if(res != FR_OK) {
-        printf("Drive %s     Error\r\n", SDPath);
-        return;
+    printf("Drive %s     Mount on first use\r\n", SDPath);
+  }
+  else
+  {
+    printf("Drive %s     No card\r\n", SDPath);
+  }
+}
+
+/**
+  * @brief  Follow the card detect switch once it has settled, and report
+  *         a card after its first mount. Call from the main loop.
+  * @retval None
+  */
+void MX_SDIO_SD_Process(void)
+{
+  uint8_t present;
+
+  if (sd_cd_changed && ((HAL_GetTick() - sd_cd_tick) >= SD_CD_DEBOUNCE_MS))
+  {
+    /* A later edge sets the flag again and restarts the debounce */
+    sd_cd_changed = 0;
+    present = (BSP_SD_IsDetected() == SD_PRESENT) ? 1U : 0U;
+
+    if (present != sd_present)
+    {
+      sd_present = present;
+      if (present)
+      {
+        /* Maybe another card, start again from the fastest mode */
+        sd_mode_first = 0;
+        sd_bus_errors = 0;
+        printf("Drive %s     Inserted\r\n", SDPath);
+        (void)MX_SDIO_SD_Mount();
+      }
+      else
+      {
+        SD_Removed();
+      }
     }
+  }
 
-    uint32_t totalBlocks = (fs.n_fatent - 2) * fs.csize;
-    printf("Drive %s     %luMB\r\n", SDPath, totalBlocks / 2000);
+  if (sd_registered && !sd_reported && (SDFatFS.fs_type != 0U))
+  {
+    sd_reported = 1;
+    SD_Report();
   }
 }
 
+/**
+  * @brief  Tell whether a card is in, as last debounced
+  * @retval 1 if a card is in
+  */
+uint8_t MX_SDIO_SD_IsPresent(void)
+{
+  return sd_present;
+}
+
+/**
+  * @brief  Register SDFatFS for the card. Nothing is read here, FatFs
+  *         initializes the card and mounts the volume on first access.
+  * @retval FR_OK, FR_NOT_READY without a card
+  */
+FRESULT MX_SDIO_SD_Mount(void)
+{
+  FRESULT res;
+
+  if (!sd_present)
+  {
+    return FR_NOT_READY;
+  }
+  if (sd_registered)
+  {
+    return FR_OK;
+  }
+
+  res = f_mount(&SDFatFS, SDPath, 0);
+  if (res == FR_OK)
+  {
+    sd_registered = 1;
+  }
+  return res;
+}
+
+/**
+  * @brief  Unmount the volume cleanly, before the card is pulled out or
+  *         handed over. Close the files first, FatFs then holds nothing
+  *         dirty: what is left is written back from the sd_diskio cache.
+  * @retval FR_OK, or FR_DISK_ERR if the write back failed
+  */
+FRESULT MX_SDIO_SD_Unmount(void)
+{
+  FRESULT res = FR_OK;
+
+  if (!sd_registered)
+  {
+    return FR_OK;
+  }
+
+  if ((SDFatFS.fs_type != 0U) && (SD_DiskCache_Flush() != RES_OK))
+  {
+    res = FR_DISK_ERR;
+  }
+  (void)f_mount(NULL, SDPath, 0);
+  sd_registered = 0;
+  sd_reported = 0;
+
+  return res;
+}
+
 /* USER CODE END 1 */
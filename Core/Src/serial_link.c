@@ -0,0 +1,580 @@
+/**
+  ******************************************************************************
+  * @file    serial_link.c
+  * @brief   Framed binary transport over the DB9 serial port (USART1).
+  *
+  *          Reception is fed from a circular DMA ring and transmission uses
+  *          two encode buffers in ping-pong: while one frame is shifted out
+  *          by the DMA, the next one is COBS encoded into the other buffer
+  *          and started from the transmit complete interrupt, so the line
+  *          never idles between frames.
+  *
+  *          See serial_link.h for the wire format.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "serial_link.h"
+#include "cobs.h"
+#include "crc.h"
+#include "uart_dma.h"
+#include "usart.h"
+
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define FRAME_HDR_SIZE      4U
+#define FRAME_CRC_SIZE      4U
+#define FRAME_MAX_SIZE      (FRAME_HDR_SIZE + SERIAL_LINK_MTU + FRAME_CRC_SIZE)
+#define FRAME_WORDS         ((FRAME_MAX_SIZE + 3U) / 4U)
+#define ENCODED_MAX_SIZE    COBS_MAX_ENCODED_SIZE(FRAME_MAX_SIZE)
+#define ACK_PAYLOAD_SIZE    8U
+
+#if ((SERIAL_LINK_WINDOW & (SERIAL_LINK_WINDOW - 1U)) != 0U) || (SERIAL_LINK_WINDOW > 32U)
+#error "SERIAL_LINK_WINDOW must be a power of two, at most 32"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum
+{
+  SLOT_FREE = 0,
+  SLOT_QUEUED,
+  SLOT_SENT,
+  SLOT_SACKED
+} SlotStateTypeDef;
+
+typedef struct
+{
+  uint32_t Frame[FRAME_WORDS];  /* header | payload | crc, word aligned for the CRC unit */
+  uint32_t SentTick;
+  uint16_t Len;
+  uint8_t  State;
+} TxSlotTypeDef;
+
+typedef struct
+{
+  uint8_t  Data[SERIAL_LINK_MTU];
+  uint16_t Len;
+  uint8_t  Seq;
+  uint8_t  Valid;
+} RxSlotTypeDef;
+
+/* Private variables ---------------------------------------------------------*/
+static UART_DMA_HandleTypeDef hlink;
+static uint8_t rx_ring[SERIAL_LINK_RX_RING];
+
+/* Sender */
+static TxSlotTypeDef tx_slots[SERIAL_LINK_WINDOW];
+static uint8_t snd_una;   /* Oldest unacknowledged sequence number */
+static uint8_t snd_nxt;   /* Next sequence number to allocate */
+
+/* Receiver */
+static RxSlotTypeDef rx_slots[SERIAL_LINK_WINDOW];
+static uint32_t rx_frame[(ENCODED_MAX_SIZE + 3U) / 4U];
+static uint32_t rx_len;
+static uint8_t rx_overflow;
+static uint8_t rcv_nxt;   /* Next in order sequence number expected */
+static uint8_t ack_pending;
+
+/* Encode buffers, one being transmitted while the other is filled */
+static uint8_t tx_buf[2][ENCODED_MAX_SIZE + 2U];
+static uint16_t tx_buf_len[2];
+static volatile int8_t tx_active = -1;
+static volatile int8_t tx_pending = -1;
+
+static SerialLink_StatsTypeDef link_stats;
+
+/* Private function prototypes -----------------------------------------------*/
+static void SerialLink_TxCpltCallback(UART_DMA_HandleTypeDef *hud);
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  CRC32 of a frame using the CRC unit
+  * @note   The bytes following the frame, up to the next word boundary, are
+  *         cleared in the buffer.
+  * @param  frame: Word aligned frame
+  * @param  len: Length of the frame in bytes
+  * @retval CRC32
+  */
+static uint32_t SerialLink_Crc(uint32_t *frame, uint32_t len)
+{
+  uint8_t *p = (uint8_t *)frame;
+
+  while (len & 3U)
+  {
+    p[len++] = 0;
+  }
+  return HAL_CRC_Calculate(&hcrc, frame, len / 4U);
+}
+
+/**
+  * @brief  Fill in header and CRC of a frame
+  * @param  frame: Word aligned frame, payload already in place
+  * @param  type: Frame type
+  * @param  seq: Sequence number
+  * @param  len: Payload length
+  * @retval Total frame length in bytes
+  */
+static uint32_t SerialLink_Seal(uint32_t *frame, uint8_t type, uint8_t seq, uint16_t len)
+{
+  uint8_t *p = (uint8_t *)frame;
+  uint32_t crc;
+
+  p[0] = type;
+  p[1] = seq;
+  p[2] = (uint8_t)len;
+  p[3] = (uint8_t)(len >> 8);
+
+  crc = SerialLink_Crc(frame, FRAME_HDR_SIZE + len);
+  p += FRAME_HDR_SIZE + len;
+  p[0] = (uint8_t)crc;
+  p[1] = (uint8_t)(crc >> 8);
+  p[2] = (uint8_t)(crc >> 16);
+  p[3] = (uint8_t)(crc >> 24);
+
+  return FRAME_HDR_SIZE + len + FRAME_CRC_SIZE;
+}
+
+/**
+  * @brief  Start the pending encode buffer if the UART is idle
+  * @note   Called with interrupts masked or from the Tx complete interrupt.
+  * @retval None
+  */
+static void SerialLink_Kick(void)
+{
+  int8_t idx = tx_pending;
+
+  if ((tx_active < 0) && (idx >= 0))
+  {
+    if (UART_DMA_Transmit(&hlink, tx_buf[idx], tx_buf_len[idx]) == HAL_OK)
+    {
+      tx_active = idx;
+      tx_pending = -1;
+    }
+  }
+}
+
+/**
+  * @brief  UART DMA transmit complete, chain the next encoded frame
+  * @param  hud: UART DMA handle
+  * @retval None
+  */
+static void SerialLink_TxCpltCallback(UART_DMA_HandleTypeDef *hud)
+{
+  UNUSED(hud);
+
+  tx_active = -1;
+  SerialLink_Kick();
+}
+
+/**
+  * @brief  COBS encode a frame into the free encode buffer and queue it
+  * @param  frame: Raw frame
+  * @param  len: Raw frame length in bytes
+  * @retval None
+  */
+static void SerialLink_Queue(const uint32_t *frame, uint32_t len)
+{
+  int8_t idx = (tx_active == 0) ? 1 : 0;
+  uint8_t *out = tx_buf[idx];
+  size_t n;
+
+  /* A leading delimiter resynchronises the receiver after line noise */
+  out[0] = 0;
+  n = COBS_Encode((const uint8_t *)frame, len, &out[1]);
+  out[n + 1U] = 0;
+  tx_buf_len[idx] = (uint16_t)(n + 2U);
+
+  __disable_irq();
+  tx_pending = idx;
+  SerialLink_Kick();
+  __enable_irq();
+}
+
+/**
+  * @brief  Pick the next frame to transmit: ACK, then retransmission, then new data
+  * @retval None
+  */
+static void SerialLink_TxNext(void)
+{
+  static uint32_t ack_frame[(FRAME_HDR_SIZE + ACK_PAYLOAD_SIZE + FRAME_CRC_SIZE) / 4U];
+  uint32_t now = HAL_GetTick();
+  TxSlotTypeDef *slot;
+  TxSlotTypeDef *queued = NULL;
+  uint8_t seq;
+
+  if (tx_pending >= 0)
+  {
+    return;
+  }
+
+  if (ack_pending)
+  {
+    uint8_t *p = (uint8_t *)ack_frame + FRAME_HDR_SIZE;
+    uint32_t sack = 0;
+
+    for (uint32_t i = 0; i < (SERIAL_LINK_WINDOW - 1U); i++)
+    {
+      seq = (uint8_t)(rcv_nxt + 1U + i);
+      if (rx_slots[seq % SERIAL_LINK_WINDOW].Valid && (rx_slots[seq % SERIAL_LINK_WINDOW].Seq == seq))
+      {
+        sack |= (1UL << i);
+      }
+    }
+
+    p[0] = rcv_nxt;
+    p[1] = 0;
+    p[2] = 0;
+    p[3] = 0;
+    p[4] = (uint8_t)sack;
+    p[5] = (uint8_t)(sack >> 8);
+    p[6] = (uint8_t)(sack >> 16);
+    p[7] = (uint8_t)(sack >> 24);
+
+    ack_pending = 0;
+    SerialLink_Queue(ack_frame, SerialLink_Seal(ack_frame, SERIAL_LINK_TYPE_ACK, 0, ACK_PAYLOAD_SIZE));
+    return;
+  }
+
+  for (seq = snd_una; seq != snd_nxt; seq++)
+  {
+    slot = &tx_slots[seq % SERIAL_LINK_WINDOW];
+
+    if ((slot->State == SLOT_SENT) && ((now - slot->SentTick) >= SERIAL_LINK_RTO_MS))
+    {
+      link_stats.TxRetransmits++;
+      queued = slot;
+      break;
+    }
+    if ((slot->State == SLOT_QUEUED) && (queued == NULL))
+    {
+      queued = slot;
+    }
+  }
+
+  if (queued != NULL)
+  {
+    queued->State = SLOT_SENT;
+    queued->SentTick = now;
+    link_stats.TxFrames++;
+    SerialLink_Queue(queued->Frame, FRAME_HDR_SIZE + queued->Len + FRAME_CRC_SIZE);
+  }
+}
+
+/**
+  * @brief  Process an ACK frame
+  * @param  p: ACK payload
+  * @retval None
+  */
+static void SerialLink_HandleAck(const uint8_t *p)
+{
+  uint8_t next = p[0];
+  uint32_t sack = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+  uint8_t in_flight = (uint8_t)(snd_nxt - snd_una);
+  uint8_t highest = next;
+  TxSlotTypeDef *slot;
+  uint8_t seq;
+
+  /* Ignore stale or bogus acknowledgements */
+  if ((uint8_t)(next - snd_una) > in_flight)
+  {
+    return;
+  }
+
+  /* Cumulative part */
+  while (snd_una != next)
+  {
+    slot = &tx_slots[snd_una % SERIAL_LINK_WINDOW];
+    link_stats.TxBytes += slot->Len;
+    slot->State = SLOT_FREE;
+    snd_una++;
+  }
+
+  /* Selective part */
+  in_flight = (uint8_t)(snd_nxt - snd_una);
+  for (uint32_t i = 0; i < 32U; i++)
+  {
+    seq = (uint8_t)(next + 1U + i);
+    if ((sack & (1UL << i)) && ((uint8_t)(seq - snd_una) < in_flight))
+    {
+      tx_slots[seq % SERIAL_LINK_WINDOW].State = SLOT_SACKED;
+      highest = seq;
+    }
+  }
+
+  /* Holes below a selectively acknowledged frame were lost: resend them
+     without waiting for the full timeout, unless just sent */
+  for (seq = snd_una; seq != highest; seq++)
+  {
+    slot = &tx_slots[seq % SERIAL_LINK_WINDOW];
+    if ((slot->State == SLOT_SENT) &&
+        ((HAL_GetTick() - slot->SentTick) >= (SERIAL_LINK_RTO_MS / 4U)))
+    {
+      slot->SentTick -= SERIAL_LINK_RTO_MS;
+    }
+  }
+}
+
+/**
+  * @brief  Process a DATA frame
+  * @param  seq: Sequence number
+  * @param  data: Payload
+  * @param  len: Payload length
+  * @retval None
+  */
+static void SerialLink_HandleData(uint8_t seq, const uint8_t *data, uint16_t len)
+{
+  uint8_t offset = (uint8_t)(seq - rcv_nxt);
+  RxSlotTypeDef *slot;
+
+  ack_pending = 1;
+
+  if (offset == 0)
+  {
+    link_stats.RxFrames++;
+    link_stats.RxBytes += len;
+    SerialLink_RxCpltCallback(data, len);
+    rcv_nxt++;
+
+    /* Deliver whatever was held back waiting for this frame */
+    slot = &rx_slots[rcv_nxt % SERIAL_LINK_WINDOW];
+    while (slot->Valid && (slot->Seq == rcv_nxt))
+    {
+      link_stats.RxBytes += slot->Len;
+      SerialLink_RxCpltCallback(slot->Data, slot->Len);
+      slot->Valid = 0;
+      rcv_nxt++;
+      slot = &rx_slots[rcv_nxt % SERIAL_LINK_WINDOW];
+    }
+  }
+  else if (offset < SERIAL_LINK_WINDOW)
+  {
+    slot = &rx_slots[seq % SERIAL_LINK_WINDOW];
+    if (slot->Valid && (slot->Seq == seq))
+    {
+      link_stats.RxDuplicates++;
+    }
+    else
+    {
+      link_stats.RxFrames++;
+      memcpy(slot->Data, data, len);
+      slot->Len = len;
+      slot->Seq = seq;
+      slot->Valid = 1;
+    }
+  }
+  else
+  {
+    /* Already delivered, our ACK was probably lost */
+    link_stats.RxDuplicates++;
+  }
+}
+
+/**
+  * @brief  Decode, check and dispatch a received frame
+  * @retval None
+  */
+static void SerialLink_HandleFrame(void)
+{
+  uint8_t *p = (uint8_t *)rx_frame;
+  uint32_t n;
+  uint32_t crc;
+  uint16_t len;
+
+  n = COBS_Decode(p, rx_len, p);
+  if (n < (FRAME_HDR_SIZE + FRAME_CRC_SIZE))
+  {
+    link_stats.RxCrcErrors++;
+    return;
+  }
+
+  len = (uint16_t)(p[2] | (p[3] << 8));
+  if ((len > SERIAL_LINK_MTU) || (n != (FRAME_HDR_SIZE + len + FRAME_CRC_SIZE)))
+  {
+    link_stats.RxCrcErrors++;
+    return;
+  }
+
+  n -= FRAME_CRC_SIZE;
+  crc = (uint32_t)p[n] | ((uint32_t)p[n + 1U] << 8) | ((uint32_t)p[n + 2U] << 16) | ((uint32_t)p[n + 3U] << 24);
+  if (SerialLink_Crc(rx_frame, n) != crc)
+  {
+    link_stats.RxCrcErrors++;
+    return;
+  }
+
+  switch (p[0])
+  {
+  case SERIAL_LINK_TYPE_DATA:
+    SerialLink_HandleData(p[1], &p[FRAME_HDR_SIZE], len);
+    break;
+
+  case SERIAL_LINK_TYPE_ACK:
+    if (len == ACK_PAYLOAD_SIZE)
+    {
+      SerialLink_HandleAck(&p[FRAME_HDR_SIZE]);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+/**
+  * @brief  Split received bytes into frames on the 0x00 delimiter
+  * @param  data: Received bytes
+  * @param  len: Number of bytes
+  * @retval None
+  */
+static void SerialLink_RxBytes(const uint8_t *data, uint16_t len)
+{
+  while (len > 0)
+  {
+    const uint8_t *end = memchr(data, 0, len);
+    uint16_t n = (end != NULL) ? (uint16_t)(end - data) : len;
+
+    if (!rx_overflow)
+    {
+      if ((rx_len + n) <= ENCODED_MAX_SIZE)
+      {
+        memcpy((uint8_t *)rx_frame + rx_len, data, n);
+        rx_len += n;
+      }
+      else
+      {
+        rx_overflow = 1;
+      }
+    }
+
+    if (end != NULL)
+    {
+      if (rx_overflow)
+      {
+        link_stats.RxCrcErrors++;
+      }
+      else if (rx_len > 0)
+      {
+        SerialLink_HandleFrame();
+      }
+      rx_len = 0;
+      rx_overflow = 0;
+      n++;
+    }
+
+    data += n;
+    len -= n;
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Switch USART1 to the link baud rate and start DMA reception
+  * @note   USART1 is owned by the link from here on, printf() must not use it.
+  * @retval HAL status
+  */
+HAL_StatusTypeDef SerialLink_Init(void)
+{
+  huart1.Init.BaudRate = SERIAL_LINK_BAUDRATE;
+  if (HAL_UART_Init(&huart1) != HAL_OK)
+  {
+    return HAL_ERROR;
+  }
+
+  hlink.huart = &huart1;
+  hlink.RxBuf = rx_ring;
+  hlink.RxSize = SERIAL_LINK_RX_RING;
+  hlink.TxCpltCallback = SerialLink_TxCpltCallback;
+
+  return UART_DMA_Start(&hlink);
+}
+
+/**
+  * @brief  Queue a payload for reliable delivery
+  * @note   The payload is copied, the buffer can be reused on return.
+  * @param  data: Payload
+  * @param  len: Payload length, at most SERIAL_LINK_MTU
+  * @retval HAL_BUSY if the window is full
+  */
+HAL_StatusTypeDef SerialLink_Send(const uint8_t *data, uint16_t len)
+{
+  TxSlotTypeDef *slot;
+
+  if (len > SERIAL_LINK_MTU)
+  {
+    return HAL_ERROR;
+  }
+  if (SerialLink_TxFree() == 0)
+  {
+    return HAL_BUSY;
+  }
+
+  slot = &tx_slots[snd_nxt % SERIAL_LINK_WINDOW];
+  memcpy((uint8_t *)slot->Frame + FRAME_HDR_SIZE, data, len);
+  SerialLink_Seal(slot->Frame, SERIAL_LINK_TYPE_DATA, snd_nxt, len);
+  slot->Len = len;
+  slot->State = SLOT_QUEUED;
+  snd_nxt++;
+
+  SerialLink_TxNext();
+
+  return HAL_OK;
+}
+
+/**
+  * @brief  Number of payloads that can be queued without blocking
+  * @retval Free window slots
+  */
+uint32_t SerialLink_TxFree(void)
+{
+  return SERIAL_LINK_WINDOW - (uint8_t)(snd_nxt - snd_una);
+}
+
+/**
+  * @brief  Background task, to be called from the superloop
+  * @retval None
+  */
+void SerialLink_Process(void)
+{
+  uint8_t *data;
+  uint16_t len;
+
+  /* At most two runs: up to the end of the ring, then from its start */
+  for (uint32_t i = 0; i < 2U; i++)
+  {
+    len = UART_DMA_RxPeek(&hlink, &data);
+    if (len == 0)
+    {
+      break;
+    }
+    SerialLink_RxBytes(data, len);
+    UART_DMA_RxConsume(&hlink, len);
+  }
+
+  SerialLink_TxNext();
+}
+
+/**
+  * @brief  Get the link statistics
+  * @param  stats: Filled with a copy of the counters
+  * @retval None
+  */
+void SerialLink_GetStats(SerialLink_StatsTypeDef *stats)
+{
+  link_stats.RxUartErrors = hlink.RxErrors;
+  *stats = link_stats;
+}
+
+/**
+  * @brief  Payload received in order
+  * @param  data: Payload, only valid during the call
+  * @param  len: Payload length
+  * @retval None
+  */
+__weak void SerialLink_RxCpltCallback(const uint8_t *data, uint16_t len)
+{
+  UNUSED(data);
+  UNUSED(len);
+}
@@ -22,11 +22,14 @@
 
 /* USER CODE BEGIN 0 */
 
+#include "w25q64.h"
 #include <stdio.h>
 
 /* USER CODE END 0 */
 
 SPI_HandleTypeDef hspi2;
+DMA_HandleTypeDef hdma_spi2_rx;
+DMA_HandleTypeDef hdma_spi2_tx;
 
 /* SPI2 init function */
 void MX_SPI2_Init(void)
@@ -94,6 +97,43 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* spiHandle)
     GPIO_InitStruct.Alternate = GPIO_AF5_SPI2;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+    /* SPI2 DMA Init */
+    /* SPI2_RX Init */
+    hdma_spi2_rx.Instance = DMA1_Stream3;
+    hdma_spi2_rx.Init.Channel = DMA_CHANNEL_0;
+    hdma_spi2_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_spi2_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi2_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi2_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi2_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi2_rx.Init.Mode = DMA_NORMAL;
+    hdma_spi2_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_spi2_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_spi2_rx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(spiHandle,hdmarx,hdma_spi2_rx);
+
+    /* SPI2_TX Init */
+    hdma_spi2_tx.Instance = DMA1_Stream4;
+    hdma_spi2_tx.Init.Channel = DMA_CHANNEL_0;
+    hdma_spi2_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_spi2_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi2_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi2_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi2_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi2_tx.Init.Mode = DMA_NORMAL;
+    hdma_spi2_tx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_spi2_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_spi2_tx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(spiHandle,hdmatx,hdma_spi2_tx);
+
   /* USER CODE BEGIN SPI2_MspInit 1 */
 
   /* USER CODE END SPI2_MspInit 1 */
@@ -120,6 +160,9 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef* spiHandle)
 
     HAL_GPIO_DeInit(GPIOB, GPIO_PIN_10);
 
+    /* SPI2 DMA DeInit */
+    HAL_DMA_DeInit(spiHandle->hdmarx);
+    HAL_DMA_DeInit(spiHandle->hdmatx);
   /* USER CODE BEGIN SPI2_MspDeInit 1 */
 
   /* USER CODE END SPI2_MspDeInit 1 */
@@ -135,19 +178,16 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef* spiHandle)
 void MX_SPI2_Check_W25Q64(void)
 {
   HAL_StatusTypeDef ret;
-
-  // CMD 0x9f: Read JEDEC ID
-  uint8_t data[7] = {0x9f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  uint32_t id = 0;
 
   HAL_Delay(100);
 
-  HAL_GPIO_WritePin(GPIOE, SPI2_FLASH_CS_Pin, GPIO_PIN_RESET);
-  ret = HAL_SPI_TransmitReceive(&hspi2, data, data, 7, 100);
+  ret = W25Q64_ReadId(&id);
   if (ret == HAL_OK)
   {
     // 0xEF: Winbond
     // 0x40 0x17: W25Q64JV (8 MB)
-    if (*(uint32_t*)data == 0x1740ef00)
+    if (id == W25Q64_JEDEC_ID)
     {
       printf("SPI W25Q64JV: 8MB\r\n");
     }
@@ -156,7 +196,6 @@ void MX_SPI2_Check_W25Q64(void)
       ret = HAL_ERROR;
     }
   }
-  HAL_GPIO_WritePin(GPIOE, SPI2_FLASH_CS_Pin, GPIO_PIN_SET);
 
   if (ret != HAL_OK)
   {
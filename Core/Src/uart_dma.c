@@ -0,0 +1,326 @@
+/**
+  ******************************************************************************
+  * @file    uart_dma.c
+  * @brief   Circular DMA reception and DMA transmission for the USARTs.
+  *
+  *          Reception runs continuously into a ring buffer in circular DMA
+  *          mode, so no byte is lost while the superloop is busy elsewhere.
+  *          The consumer reads the ring directly (zero copy) using the DMA
+  *          write position as the head index. The half and full transfer
+  *          interrupts count the DMA passes over the ring, so that a
+  *          consumer that fell a whole ring behind is detected.
+  *
+  *          The UART handle must have its hdmarx stream configured with
+  *          DMA_CIRCULAR mode and its hdmatx stream in DMA_NORMAL mode.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "uart_dma.h"
+
+/* Private variables ---------------------------------------------------------*/
+static UART_DMA_HandleTypeDef *handles[UART_DMA_MAX_HANDLES];
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Find the registered handle for a UART
+  * @param  huart: UART handle
+  * @retval Registered handle, NULL if none
+  */
+static UART_DMA_HandleTypeDef *UART_DMA_Lookup(UART_HandleTypeDef *huart)
+{
+  for (uint32_t i = 0; i < UART_DMA_MAX_HANDLES; i++)
+  {
+    if ((handles[i] != NULL) && (handles[i]->huart == huart))
+    {
+      return handles[i];
+    }
+  }
+  return NULL;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Register the handle and start circular reception
+  * @param  hud: UART DMA handle
+  * @retval HAL status
+  */
+HAL_StatusTypeDef UART_DMA_Start(UART_DMA_HandleTypeDef *hud)
+{
+  HAL_StatusTypeDef ret;
+  uint32_t i;
+
+  if (UART_DMA_Lookup(hud->huart) == NULL)
+  {
+    for (i = 0; i < UART_DMA_MAX_HANDLES; i++)
+    {
+      if (handles[i] == NULL)
+      {
+        handles[i] = hud;
+        break;
+      }
+    }
+    if (i == UART_DMA_MAX_HANDLES)
+    {
+      return HAL_ERROR;
+    }
+  }
+
+  hud->RxTail = 0;
+  hud->RxHalves = 0;
+  hud->RxRead = 0;
+  ret = HAL_UART_Receive_DMA(hud->huart, hud->RxBuf, hud->RxSize);
+  if (ret != HAL_OK)
+  {
+    return ret;
+  }
+
+  if (hud->RxIdleCallback != NULL)
+  {
+    __HAL_UART_CLEAR_IDLEFLAG(hud->huart);
+    __HAL_UART_ENABLE_IT(hud->huart, UART_IT_IDLE);
+  }
+
+  return HAL_OK;
+}
+
+/**
+  * @brief  Stop reception and transmission and unregister the handle
+  * @param  hud: UART DMA handle
+  * @retval None
+  */
+void UART_DMA_Stop(UART_DMA_HandleTypeDef *hud)
+{
+  __HAL_UART_DISABLE_IT(hud->huart, UART_IT_IDLE);
+  HAL_UART_Abort(hud->huart);
+
+  for (uint32_t i = 0; i < UART_DMA_MAX_HANDLES; i++)
+  {
+    if (handles[i] == hud)
+    {
+      handles[i] = NULL;
+    }
+  }
+}
+
+/**
+  * @brief  Current DMA write position in the reception ring
+  * @note   May be called from interrupt context, e.g. to timestamp the
+  *         position reached when the line goes idle.
+  * @param  hud: UART DMA handle
+  * @retval Ring index
+  */
+uint16_t UART_DMA_RxHead(UART_DMA_HandleTypeDef *hud)
+{
+  uint16_t head = hud->RxSize - (uint16_t)__HAL_DMA_GET_COUNTER(hud->huart->hdmarx);
+
+  /* NDTR reloads on wrap, but may briefly read as 0 */
+  if (head >= hud->RxSize)
+  {
+    head = 0;
+  }
+  return head;
+}
+
+/**
+  * @brief  Number of received bytes waiting in the ring
+  * @param  hud: UART DMA handle
+  * @retval Byte count
+  */
+uint16_t UART_DMA_RxAvailable(UART_DMA_HandleTypeDef *hud)
+{
+  uint16_t head = UART_DMA_RxHead(hud);
+
+  if (head >= hud->RxTail)
+  {
+    return head - hud->RxTail;
+  }
+  return hud->RxSize - hud->RxTail + head;
+}
+
+/**
+  * @brief  Get the largest contiguous run of received bytes in the ring
+  * @note   The data stays valid until UART_DMA_RxConsume() is called, as long
+  *         as the consumer keeps up with the line rate.
+  * @param  hud: UART DMA handle
+  * @param  data: Set to the start of the run
+  * @retval Length of the run in bytes
+  */
+uint16_t UART_DMA_RxPeek(UART_DMA_HandleTypeDef *hud, uint8_t **data)
+{
+  uint16_t head = UART_DMA_RxHead(hud);
+
+  *data = &hud->RxBuf[hud->RxTail];
+  if (head >= hud->RxTail)
+  {
+    return head - hud->RxTail;
+  }
+  return hud->RxSize - hud->RxTail;
+}
+
+/**
+  * @brief  Release bytes previously returned by UART_DMA_RxPeek()
+  * @param  hud: UART DMA handle
+  * @param  len: Number of bytes consumed
+  * @retval None
+  */
+void UART_DMA_RxConsume(UART_DMA_HandleTypeDef *hud, uint16_t len)
+{
+  hud->RxTail = (uint16_t)((hud->RxTail + len) % hud->RxSize);
+  hud->RxRead += len;
+}
+
+/**
+  * @brief  Check whether the DMA overwrote bytes not yet consumed. If so, the
+  *         ring content is dropped and the tail moved to the head.
+  * @note   The half / full transfer interrupt must not be held off for half
+  *         a ring of line time.
+  * @param  hud: UART DMA handle
+  * @retval true if bytes were lost
+  */
+bool UART_DMA_RxOverrun(UART_DMA_HandleTypeDef *hud)
+{
+  uint32_t halves = hud->RxHalves;
+  uint16_t head = UART_DMA_RxHead(hud);
+  uint32_t written = ((halves / 2U) * hud->RxSize) + head;
+
+  /* Past the end of the ring, the full transfer event not counted yet */
+  if (((halves & 1U) != 0U) && (head < (hud->RxSize / 2U)))
+  {
+    written += hud->RxSize;
+  }
+
+  if ((written - hud->RxRead) <= hud->RxSize)
+  {
+    return false;
+  }
+
+  hud->RxTail = head;
+  hud->RxRead = written;
+  return true;
+}
+
+/**
+  * @brief  Start a DMA transmission
+  * @note   The buffer must stay untouched until the transmission completes.
+  * @param  hud: UART DMA handle
+  * @param  data: Data to send
+  * @param  len: Length of data in bytes
+  * @retval HAL_BUSY if a transmission is already in progress
+  */
+HAL_StatusTypeDef UART_DMA_Transmit(UART_DMA_HandleTypeDef *hud, const uint8_t *data, uint16_t len)
+{
+  if (hud->huart->gState != HAL_UART_STATE_READY)
+  {
+    return HAL_BUSY;
+  }
+  return HAL_UART_Transmit_DMA(hud->huart, (uint8_t *)data, len);
+}
+
+/**
+  * @brief  Check for a DMA transmission in progress
+  * @param  hud: UART DMA handle
+  * @retval true if busy
+  */
+bool UART_DMA_TxBusy(UART_DMA_HandleTypeDef *hud)
+{
+  return (hud->huart->gState != HAL_UART_STATE_READY);
+}
+
+/**
+  * @brief  Idle line detection, call from the USART IRQ handler
+  * @param  huart: UART handle
+  * @retval None
+  */
+void UART_DMA_IRQHandler(UART_HandleTypeDef *huart)
+{
+  UART_DMA_HandleTypeDef *hud;
+  uint32_t sr = huart->Instance->SR;
+
+  if (((sr & USART_SR_IDLE) != RESET) &&
+      (__HAL_UART_GET_IT_SOURCE(huart, UART_IT_IDLE) != RESET))
+  {
+    /* Also clears the PE / FE / NE flags, keep them for the callback */
+    __HAL_UART_CLEAR_IDLEFLAG(huart);
+
+    hud = UART_DMA_Lookup(huart);
+    if ((hud != NULL) && (hud->RxIdleCallback != NULL))
+    {
+      hud->RxIdleSR = sr;
+      hud->RxIdleCallback(hud);
+    }
+  }
+}
+
+/**
+  * @brief  Tx Transfer completed callback
+  * @param  huart: UART handle
+  * @retval None
+  */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+  UART_DMA_HandleTypeDef *hud = UART_DMA_Lookup(huart);
+
+  if ((hud != NULL) && (hud->TxCpltCallback != NULL))
+  {
+    hud->TxCpltCallback(hud);
+  }
+}
+
+/**
+  * @brief  Rx half transfer callback, the DMA reached the middle of the ring
+  * @param  huart: UART handle
+  * @retval None
+  */
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+  UART_DMA_HandleTypeDef *hud = UART_DMA_Lookup(huart);
+
+  if (hud != NULL)
+  {
+    hud->RxHalves++;
+  }
+}
+
+/**
+  * @brief  Rx transfer completed callback, the DMA wrapped around the ring
+  * @param  huart: UART handle
+  * @retval None
+  */
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+  UART_DMA_HandleTypeDef *hud = UART_DMA_Lookup(huart);
+
+  if (hud != NULL)
+  {
+    hud->RxHalves++;
+  }
+}
+
+/**
+  * @brief  UART error callback, restarts the reception ring
+  * @note   The HAL aborts the reception DMA on any error while DMA reception
+  *         is active. Whatever was not yet consumed from the ring is lost.
+  * @param  huart: UART handle
+  * @retval None
+  */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  UART_DMA_HandleTypeDef *hud = UART_DMA_Lookup(huart);
+
+  if (hud == NULL)
+  {
+    return;
+  }
+
+  hud->RxErrors++;
+  if (huart->RxState == HAL_UART_STATE_READY)
+  {
+    hud->RxTail = 0;
+    hud->RxHalves = 0;
+    hud->RxRead = 0;
+    (void)HAL_UART_Receive_DMA(huart, hud->RxBuf, hud->RxSize);
+  }
+}
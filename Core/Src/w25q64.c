@@ -0,0 +1,494 @@
+/**
+  ******************************************************************************
+  * @file    w25q64.c
+  * @brief   W25Q64JV SPI NOR flash (8 MiB) on SPI2, with DMA.
+  *
+  *          The few command and address bytes in front of a transfer are
+  *          sent without DMA, the data with it. Read chunks and page program
+  *          completions are handled in the SPI DMA interrupts; everything
+  *          that has to wait for the flash goes through the W25Q64_WAIT
+  *          state, left by W25Q64_Process() once the busy bit clears.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "w25q64.h"
+#include "spi.h"
+
+/* Private define ------------------------------------------------------------*/
+#define W25Q64_CMD_WRITE_ENABLE     0x06U
+#define W25Q64_CMD_READ_STATUS1     0x05U
+#define W25Q64_CMD_FAST_READ        0x0BU   /* One dummy byte after the address */
+#define W25Q64_CMD_PAGE_PROGRAM     0x02U
+#define W25Q64_CMD_SECTOR_ERASE     0x20U
+#define W25Q64_CMD_BLOCK32_ERASE    0x52U
+#define W25Q64_CMD_BLOCK64_ERASE    0xD8U
+#define W25Q64_CMD_CHIP_ERASE       0xC7U
+#define W25Q64_CMD_JEDEC_ID         0x9FU
+
+#define W25Q64_SR1_BUSY             0x01U
+
+/* Driver states */
+#define W25Q64_IDLE                 0U
+#define W25Q64_READ                 1U      /* Read DMA running */
+#define W25Q64_PROGRAM              2U      /* Page data DMA running */
+#define W25Q64_WAIT                 3U      /* Flash busy programming or erasing */
+
+/* Operations */
+#define W25Q64_OP_READ              0U
+#define W25Q64_OP_WRITE             1U
+#define W25Q64_OP_ERASE             2U
+
+/* Private variables ---------------------------------------------------------*/
+static volatile uint8_t flash_state = W25Q64_IDLE;
+static volatile W25Q64_StatusTypeDef flash_result = W25Q64_OK;
+static uint8_t flash_op;
+static uint32_t flash_addr;
+static uint8_t *flash_buf;
+static uint32_t flash_len;          /* Left after the current chunk */
+static uint32_t flash_chunk;        /* Bytes of the DMA transfer running */
+static uint32_t flash_total;        /* Bytes of the read */
+static uint32_t flash_start;        /* DWT cycles at the read command */
+static uint32_t wait_tick;
+static uint32_t wait_timeout;
+static uint32_t poll_tick;
+static uint32_t poll_ms;
+
+static W25Q64_StatsTypeDef flash_stats;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void W25Q64_Select(void)
+{
+  HAL_GPIO_WritePin(SPI2_FLASH_CS_GPIO_Port, SPI2_FLASH_CS_Pin, GPIO_PIN_RESET);
+}
+
+static void W25Q64_Deselect(void)
+{
+  HAL_GPIO_WritePin(SPI2_FLASH_CS_GPIO_Port, SPI2_FLASH_CS_Pin, GPIO_PIN_SET);
+}
+
+/**
+  * @brief  Fill in a command with a 24 bit address
+  * @param  cmd: 4 bytes
+  * @param  op: Command code
+  * @param  addr: Flash address
+  * @retval None
+  */
+static void W25Q64_Header(uint8_t *cmd, uint8_t op, uint32_t addr)
+{
+  cmd[0] = op;
+  cmd[1] = (uint8_t)(addr >> 16);
+  cmd[2] = (uint8_t)(addr >> 8);
+  cmd[3] = (uint8_t)addr;
+}
+
+/**
+  * @brief  Send a whole command, without DMA
+  * @param  cmd: Command bytes
+  * @param  len: Length
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef W25Q64_Command(uint8_t *cmd, uint16_t len)
+{
+  HAL_StatusTypeDef ret;
+
+  W25Q64_Select();
+  ret = HAL_SPI_Transmit(&hspi2, cmd, len, W25Q64_CMD_TIMEOUT);
+  W25Q64_Deselect();
+  return ret;
+}
+
+/**
+  * @brief  The operation failed, the flash is left deselected
+  * @note   Also called from the SPI DMA interrupts
+  * @retval None
+  */
+static void W25Q64_Fail(void)
+{
+  W25Q64_Deselect();
+  flash_stats.Errors++;
+  flash_result = W25Q64_ERROR;
+  flash_state = W25Q64_IDLE;
+}
+
+/**
+  * @brief  Wait for the busy bit to clear, from W25Q64_Process()
+  * @param  timeout: ms
+  * @param  interval: ms between status reads, 0 for every pass
+  * @retval None
+  */
+static void W25Q64_StartWait(uint32_t timeout, uint32_t interval)
+{
+  wait_tick = HAL_GetTick();
+  poll_tick = wait_tick;
+  wait_timeout = timeout;
+  poll_ms = interval;
+  flash_state = W25Q64_WAIT;
+}
+
+/**
+  * @brief  Receive the next chunk of a read, the command already sent
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef W25Q64_ReadNext(void)
+{
+  flash_chunk = (flash_len < W25Q64_READ_CHUNK) ? flash_len : W25Q64_READ_CHUNK;
+  return HAL_SPI_Receive_DMA(&hspi2, flash_buf, (uint16_t)flash_chunk);
+}
+
+/**
+  * @brief  Start programming the next page, up to the page boundary
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef W25Q64_ProgramNext(void)
+{
+  uint8_t cmd[4];
+
+  flash_chunk = W25Q64_PAGE_SIZE - (flash_addr % W25Q64_PAGE_SIZE);
+  if (flash_chunk > flash_len)
+  {
+    flash_chunk = flash_len;
+  }
+
+  cmd[0] = W25Q64_CMD_WRITE_ENABLE;
+  if (W25Q64_Command(cmd, 1U) != HAL_OK)
+  {
+    return HAL_ERROR;
+  }
+
+  W25Q64_Header(cmd, W25Q64_CMD_PAGE_PROGRAM, flash_addr);
+  flash_state = W25Q64_PROGRAM;
+  W25Q64_Select();
+  if (HAL_SPI_Transmit(&hspi2, cmd, 4U, W25Q64_CMD_TIMEOUT) != HAL_OK)
+  {
+    return HAL_ERROR;
+  }
+  return HAL_SPI_Transmit_DMA(&hspi2, flash_buf, (uint16_t)flash_chunk);
+}
+
+/**
+  * @brief  Start the largest erase that fits the range left
+  * @retval HAL status
+  */
+static HAL_StatusTypeDef W25Q64_EraseNext(void)
+{
+  uint8_t cmd[4];
+  uint8_t wren = W25Q64_CMD_WRITE_ENABLE;
+  uint16_t len = 4U;
+  uint32_t size;
+  uint32_t timeout = W25Q64_ERASE_TIMEOUT;
+  uint32_t *count;
+
+  if ((flash_addr == 0U) && (flash_len == W25Q64_SIZE))
+  {
+    cmd[0] = W25Q64_CMD_CHIP_ERASE;
+    len = 1U;
+    size = W25Q64_SIZE;
+    timeout = W25Q64_CHIP_TIMEOUT;
+    count = &flash_stats.ChipErases;
+  }
+  else if (((flash_addr % W25Q64_BLOCK64_SIZE) == 0U) && (flash_len >= W25Q64_BLOCK64_SIZE))
+  {
+    W25Q64_Header(cmd, W25Q64_CMD_BLOCK64_ERASE, flash_addr);
+    size = W25Q64_BLOCK64_SIZE;
+    count = &flash_stats.Erase64K;
+  }
+  else if (((flash_addr % W25Q64_BLOCK32_SIZE) == 0U) && (flash_len >= W25Q64_BLOCK32_SIZE))
+  {
+    W25Q64_Header(cmd, W25Q64_CMD_BLOCK32_ERASE, flash_addr);
+    size = W25Q64_BLOCK32_SIZE;
+    count = &flash_stats.Erase32K;
+  }
+  else
+  {
+    W25Q64_Header(cmd, W25Q64_CMD_SECTOR_ERASE, flash_addr);
+    size = W25Q64_SECTOR_SIZE;
+    count = &flash_stats.Erase4K;
+  }
+
+  if ((W25Q64_Command(&wren, 1U) != HAL_OK) || (W25Q64_Command(cmd, len) != HAL_OK))
+  {
+    return HAL_ERROR;
+  }
+
+  (*count)++;
+  flash_addr += size;
+  flash_len -= size;
+  W25Q64_StartWait(timeout, W25Q64_ERASE_POLL_MS);
+  return HAL_OK;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Read the JEDEC ID, without DMA
+  * @param  id: Set to the manufacturer, memory type and capacity bytes
+  * @retval HAL status, HAL_BUSY while an operation runs
+  */
+HAL_StatusTypeDef W25Q64_ReadId(uint32_t *id)
+{
+  uint8_t data[4] = { W25Q64_CMD_JEDEC_ID, 0U, 0U, 0U };
+  HAL_StatusTypeDef ret;
+
+  if (flash_state != W25Q64_IDLE)
+  {
+    return HAL_BUSY;
+  }
+
+  W25Q64_Select();
+  ret = HAL_SPI_TransmitReceive(&hspi2, data, data, 4U, W25Q64_CMD_TIMEOUT);
+  W25Q64_Deselect();
+
+  *id = ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+  return ret;
+}
+
+/**
+  * @brief  Start reading
+  * @param  addr: Flash address
+  * @param  buf: Destination, not in CCMRAM
+  * @param  len: Length
+  * @retval HAL_OK if started, HAL_BUSY while an operation runs, HAL_ERROR
+  *         for a range outside the flash or if the command failed
+  */
+HAL_StatusTypeDef W25Q64_Read(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  uint8_t cmd[5];
+
+  if (flash_state != W25Q64_IDLE)
+  {
+    return HAL_BUSY;
+  }
+  if ((len == 0U) || (addr >= W25Q64_SIZE) || (len > (W25Q64_SIZE - addr)))
+  {
+    return HAL_ERROR;
+  }
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  flash_op = W25Q64_OP_READ;
+  flash_buf = buf;
+  flash_len = len;
+  flash_total = len;
+  flash_result = W25Q64_BUSY;
+  flash_state = W25Q64_READ;
+  flash_start = DWT->CYCCNT;
+
+  W25Q64_Header(cmd, W25Q64_CMD_FAST_READ, addr);
+  cmd[4] = 0U;
+  W25Q64_Select();
+  if ((HAL_SPI_Transmit(&hspi2, cmd, 5U, W25Q64_CMD_TIMEOUT) != HAL_OK) ||
+      (W25Q64_ReadNext() != HAL_OK))
+  {
+    W25Q64_Fail();
+    return HAL_ERROR;
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief  Start programming, the range must have been erased
+  * @param  addr: Flash address
+  * @param  buf: Data, not in CCMRAM
+  * @param  len: Length
+  * @retval HAL_OK if started, HAL_BUSY while an operation runs, HAL_ERROR
+  *         for a range outside the flash or if the command failed
+  */
+HAL_StatusTypeDef W25Q64_Write(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  if (flash_state != W25Q64_IDLE)
+  {
+    return HAL_BUSY;
+  }
+  if ((len == 0U) || (addr >= W25Q64_SIZE) || (len > (W25Q64_SIZE - addr)))
+  {
+    return HAL_ERROR;
+  }
+
+  flash_op = W25Q64_OP_WRITE;
+  flash_addr = addr;
+  flash_buf = (uint8_t *)buf;     /* Only read by the TX DMA */
+  flash_len = len;
+  flash_result = W25Q64_BUSY;
+  if (W25Q64_ProgramNext() != HAL_OK)
+  {
+    W25Q64_Fail();
+    return HAL_ERROR;
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief  Start erasing, with the fewest erase commands
+  * @param  addr: Flash address, W25Q64_SECTOR_SIZE aligned
+  * @param  len: Length, W25Q64_SECTOR_SIZE multiple
+  * @retval HAL_OK if started, HAL_BUSY while an operation runs, HAL_ERROR
+  *         for a bad range or if the command failed
+  */
+HAL_StatusTypeDef W25Q64_Erase(uint32_t addr, uint32_t len)
+{
+  if (flash_state != W25Q64_IDLE)
+  {
+    return HAL_BUSY;
+  }
+  if ((len == 0U) || ((addr % W25Q64_SECTOR_SIZE) != 0U) || ((len % W25Q64_SECTOR_SIZE) != 0U) ||
+      (addr >= W25Q64_SIZE) || (len > (W25Q64_SIZE - addr)))
+  {
+    return HAL_ERROR;
+  }
+
+  flash_op = W25Q64_OP_ERASE;
+  flash_addr = addr;
+  flash_len = len;
+  flash_result = W25Q64_BUSY;
+  if (W25Q64_EraseNext() != HAL_OK)
+  {
+    W25Q64_Fail();
+    return HAL_ERROR;
+  }
+  return HAL_OK;
+}
+
+/**
+  * @brief  Get the state of the last operation
+  * @retval W25Q64_BUSY while it runs, then W25Q64_OK or W25Q64_ERROR
+  */
+W25Q64_StatusTypeDef W25Q64_GetStatus(void)
+{
+  return flash_result;
+}
+
+/**
+  * @brief  Poll the busy bit of a program or erase and start the next
+  *         page or block once it clears. Call from the main loop.
+  * @retval None
+  */
+void W25Q64_Process(void)
+{
+  uint8_t data[2] = { W25Q64_CMD_READ_STATUS1, 0U };
+  uint32_t now;
+  HAL_StatusTypeDef ret;
+
+  if (flash_state != W25Q64_WAIT)
+  {
+    return;
+  }
+
+  now = HAL_GetTick();
+  if ((now - poll_tick) < poll_ms)
+  {
+    return;
+  }
+  poll_tick = now;
+
+  W25Q64_Select();
+  ret = HAL_SPI_TransmitReceive(&hspi2, data, data, 2U, W25Q64_CMD_TIMEOUT);
+  W25Q64_Deselect();
+  if (ret != HAL_OK)
+  {
+    W25Q64_Fail();
+    return;
+  }
+
+  if (data[1] & W25Q64_SR1_BUSY)
+  {
+    if ((now - wait_tick) > wait_timeout)
+    {
+      W25Q64_Fail();
+    }
+    return;
+  }
+
+  if (flash_len == 0U)
+  {
+    flash_result = W25Q64_OK;
+    flash_state = W25Q64_IDLE;
+    return;
+  }
+
+  ret = (flash_op == W25Q64_OP_WRITE) ? W25Q64_ProgramNext() : W25Q64_EraseNext();
+  if (ret != HAL_OK)
+  {
+    W25Q64_Fail();
+  }
+}
+
+/**
+  * @brief  Get the flash counters
+  * @param  stats: Filled with the counters since boot
+  * @retval None
+  */
+void W25Q64_GetStats(W25Q64_StatsTypeDef *stats)
+{
+  *stats = flash_stats;
+}
+
+/**
+  * @brief  A read chunk is in, chain the next one with the chip still
+  *         selected
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  uint32_t cycles;
+
+  if ((hspi != &hspi2) || (flash_state != W25Q64_READ))
+  {
+    return;
+  }
+
+  flash_buf += flash_chunk;
+  flash_len -= flash_chunk;
+  flash_stats.ReadBytes += flash_chunk;
+  if (flash_len != 0U)
+  {
+    if (W25Q64_ReadNext() != HAL_OK)
+    {
+      W25Q64_Fail();
+    }
+    return;
+  }
+
+  W25Q64_Deselect();
+  cycles = DWT->CYCCNT - flash_start;
+  flash_stats.ReadKBps = (cycles != 0U) ?
+                         (uint32_t)(((uint64_t)flash_total * (SystemCoreClock / 1000U)) / cycles) : 0U;
+  flash_result = W25Q64_OK;
+  flash_state = W25Q64_IDLE;
+}
+
+/**
+  * @brief  Page data sent, the flash now programs it
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  if ((hspi != &hspi2) || (flash_state != W25Q64_PROGRAM))
+  {
+    return;
+  }
+
+  W25Q64_Deselect();
+  flash_addr += flash_chunk;
+  flash_buf += flash_chunk;
+  flash_len -= flash_chunk;
+  flash_stats.PagePrograms++;
+  W25Q64_StartWait(W25Q64_PROGRAM_TIMEOUT, 0U);
+}
+
+/**
+  * @brief  SPI or DMA error during a transfer
+  * @param  hspi: SPI handle
+  * @retval None
+  */
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+  if ((hspi == &hspi2) && ((flash_state == W25Q64_READ) || (flash_state == W25Q64_PROGRAM)))
+  {
+    W25Q64_Fail();
+  }
+}
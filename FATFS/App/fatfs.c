@@ -84,4 +84,22 @@ void MX_FATFS_USB_Drive_Connected(void)
   }
 }
 
+/**
+  * @brief Callback when USB Drive is removed
+  * @retval None
+  */
+void MX_FATFS_USB_Drive_Disconnected(void)
+{
+  USBH_DiskCacheStatsTypeDef stats;
+
+  USBH_DiskCache_Invalidate();
+  USBH_DiskCache_GetStats(&stats);
+
+  printf("Drive %s     read %lu (%lu hit), %lu cmds\r\n", USBHPath,
+         stats.ReadSectors, stats.ReadHitSectors, stats.ReadCommands);
+  printf("Drive %s     write %lu (%lu cached), %lu cmds, %lu lost\r\n", USBHPath,
+         stats.WriteSectors, stats.WriteCachedSectors, stats.WriteCommands,
+         stats.LostSectors);
+}
+
 /* USER CODE END Application */
@@ -46,6 +46,7 @@ void MX_FATFS_Init(void);
 /* USER CODE BEGIN Prototypes */
 
 void MX_FATFS_USB_Drive_Connected(void);
+void MX_FATFS_USB_Drive_Disconnected(void);
 
 /* USER CODE END Prototypes */
 #ifdef __cplusplus
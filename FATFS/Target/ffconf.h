@@ -67,9 +67,22 @@
 #define _USE_FASTSEEK        1
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
-#define	_USE_EXPAND		0
+#define	_USE_EXPAND		1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
+#define _USE_DIRINDEX        1
+#define _DIRINDEX_DIRS       2
+#define _DIRINDEX_ENTRIES    2048
+#define _DIRINDEX_ATTR       __attribute__((section(".ccmram_bss")))
+/* This option switches a hashed name index of the last _DIRINDEX_DIRS searched
+/  directories, so that finding a name does not read the whole directory.
+/  (0:Disable or 1:Enable) An index is built at the first search in the
+/  directory and dropped when an object is created, renamed or removed in it.
+/  It holds up to _DIRINDEX_ENTRIES objects (6 bytes each), the objects past
+/  that are searched linearly. _DIRINDEX_ATTR places the index (CCM RAM, not
+/  zeroed at startup: the items are only read once their slot is built).
+/  LFN needs to be enabled. */
+
 #define _USE_CHMOD		0
 /* This option switches attribute manipulation functions, f_chmod() and f_utime().
 /  (0:Disable or 1:Enable) Also _FS_READONLY needs to be 0 to enable this option. */
@@ -113,7 +126,7 @@
 /   950 - Traditional Chinese (DBCS)
 */
 
-#define _USE_LFN     0    /* 0 to 3 */
+#define _USE_LFN     1    /* 0 to 3 */
 #define _MAX_LFN     255  /* Maximum LFN length to handle (12 to 255) */
 /* The _USE_LFN switches the support of long file name (LFN).
 /
@@ -187,7 +200,7 @@
 /  to variable sector size and GET_SECTOR_SIZE command must be implemented to the
 /  disk_ioctl() function. */
 
-#define	_USE_TRIM      0
+#define	_USE_TRIM      1
 /* This option switches support of ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable Trim function, also CTRL_TRIM command should be implemented to the
 /  disk_ioctl() function. */
@@ -213,7 +226,7 @@
 /  Instead of private sector buffer eliminated from the file object, common sector
 /  buffer in the file system object (FATFS) is used for the file data transfer. */
 
-#define _FS_EXFAT	0
+#define _FS_EXFAT	1
 /* This option switches support of exFAT file system. (0:Disable or 1:Enable)
 /  When enable exFAT, also LFN needs to be enabled. (_USE_LFN >= 1)
 /  Note that enabling exFAT discards C89 compatibility. */
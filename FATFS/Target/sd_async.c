@@ -0,0 +1,398 @@
+/**
+  ******************************************************************************
+  * @file    sd_async.c
+  * @brief   Non-blocking block reads and writes on the SDIO card.
+  *
+  *          The card runs one transfer at a time, so requests wait in a
+  *          FIFO. The DMA interrupt only moves the active request to the
+  *          completed list, and after a read starts the next one, the card
+  *          being back in the transfer state once the HAL has sent the stop
+  *          command. After a write the card stays busy programming, that is
+  *          polled with CMD13 from SD_Async_Process() before the next start.
+  *          The queue and completed lists are shared with the interrupts and
+  *          only changed with them masked, or from them.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sd_async.h"
+
+/* Private define ------------------------------------------------------------*/
+#define SD_ASYNC_TIMEOUT        30000U  /* ms, as the ST sd_diskio template */
+#define SD_ASYNC_ERASE_TIMEOUT  60000U  /* ms, card busy after an erase */
+
+/* Phases of the active request */
+#define SD_PHASE_XFER           0U      /* DMA running */
+#define SD_PHASE_PROG           1U      /* Write data sent or erase taken, card busy */
+
+/* Private variables ---------------------------------------------------------*/
+extern SD_HandleTypeDef hsd;
+
+static SD_AsyncReqTypeDef *head;
+static SD_AsyncReqTypeDef *tail;
+static SD_AsyncReqTypeDef *volatile active;   /* On the bus */
+static SD_AsyncReqTypeDef *done_head;         /* Callbacks to run */
+static SD_AsyncReqTypeDef *done_tail;
+static volatile uint8_t phase;
+static volatile uint8_t xfer_error;
+static uint32_t active_tick;
+static uint32_t wait_tick;                    /* Card busy before a start */
+static uint8_t waiting;
+static volatile uint8_t locked;               /* Card handed to another user */
+static volatile uint32_t writes;              /* Writes queued or on the bus */
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Move the active request to the completed list
+  * @note   Called from the interrupts, or with them masked
+  * @param  result: SD_ASYNC_OK or SD_ASYNC_ERROR
+  * @retval None
+  */
+static void SD_Async_Finish(SD_AsyncStatusTypeDef result)
+{
+  SD_AsyncReqTypeDef *req = active;
+
+  active = NULL;
+  if (req->Write == 1U)
+  {
+    writes--;
+  }
+  req->Result = result;
+  req->Next = NULL;
+  if (done_tail != NULL)
+  {
+    done_tail->Next = req;
+  }
+  else
+  {
+    done_head = req;
+  }
+  done_tail = req;
+}
+
+/**
+  * @brief  Start the request at the head of the queue, the card being in
+  *         the transfer state. Requests that cannot start fail at once.
+  * @note   Called from the interrupts, or with no request active
+  * @retval None
+  */
+static void SD_Async_Start(void)
+{
+  SD_AsyncReqTypeDef *req;
+  uint8_t ret;
+
+  while ((active == NULL) && (head != NULL))
+  {
+    req = head;
+    head = req->Next;
+    if (head == NULL)
+    {
+      tail = NULL;
+    }
+
+    phase = SD_PHASE_XFER;
+    xfer_error = 0U;
+    active_tick = HAL_GetTick();
+    active = req;
+
+    if (req->Write == SD_ASYNC_ERASE)
+    {
+      /* No data, the card is busy once it has taken the command */
+      ret = BSP_SD_Erase(req->Sector, req->Sector + req->Count - 1U);
+      if (ret == MSD_OK)
+      {
+        phase = SD_PHASE_PROG;
+      }
+    }
+    else if (req->Write)
+    {
+      ret = BSP_SD_WriteBlocks_DMA((uint32_t *)req->Buf, req->Sector, req->Count);
+    }
+    else
+    {
+      ret = BSP_SD_ReadBlocks_DMA((uint32_t *)req->Buf, req->Sector, req->Count);
+    }
+    if (ret != MSD_OK)
+    {
+      SD_Async_Finish(SD_ASYNC_ERROR);
+    }
+  }
+}
+
+/**
+  * @brief  Start the next request from the main loop, once the card is ready
+  * @retval None
+  */
+static void SD_Async_StartIdle(void)
+{
+  /* The card may still be programming data written by someone else */
+  if (BSP_SD_GetCardState() != SD_TRANSFER_OK)
+  {
+    if (waiting == 0U)
+    {
+      waiting = 1U;
+      wait_tick = HAL_GetTick();
+    }
+    else if ((HAL_GetTick() - wait_tick) > SD_ASYNC_TIMEOUT)
+    {
+      waiting = 0U;
+      __disable_irq();
+      active = head;
+      head = head->Next;
+      if (head == NULL)
+      {
+        tail = NULL;
+      }
+      SD_Async_Finish(SD_ASYNC_ERROR);
+      __enable_irq();
+    }
+    return;
+  }
+
+  waiting = 0U;
+  SD_Async_Start();
+}
+
+/**
+  * @brief  Check the active request for its end, failure or timeout
+  * @retval None
+  */
+static void SD_Async_Step(void)
+{
+  uint8_t abort = 0U;
+
+  if (phase == SD_PHASE_XFER)
+  {
+    /* Checked with the interrupts masked, a read may chain the next request */
+    __disable_irq();
+    if ((active != NULL) && (phase == SD_PHASE_XFER))
+    {
+      if ((xfer_error != 0U) && (HAL_SD_GetState(&hsd) != HAL_SD_STATE_BUSY))
+      {
+        /* The HAL aborted the transfer, no completion will follow */
+        SD_Async_Finish(SD_ASYNC_ERROR);
+      }
+      else if ((HAL_GetTick() - active_tick) > SD_ASYNC_TIMEOUT)
+      {
+        abort = 1U;
+        SD_Async_Finish(SD_ASYNC_ERROR);
+      }
+    }
+    __enable_irq();
+
+    if (abort != 0U)
+    {
+      (void)HAL_SD_Abort(&hsd);
+    }
+    return;
+  }
+
+  /* Write data sent or erase started, done once the card is ready again */
+  if (BSP_SD_GetCardState() == SD_TRANSFER_OK)
+  {
+    __disable_irq();
+    SD_Async_Finish(SD_ASYNC_OK);
+    __enable_irq();
+  }
+  else if ((HAL_GetTick() - active_tick) >
+           ((active->Write == SD_ASYNC_ERASE) ? SD_ASYNC_ERASE_TIMEOUT : SD_ASYNC_TIMEOUT))
+  {
+    __disable_irq();
+    SD_Async_Finish(SD_ASYNC_ERROR);
+    __enable_irq();
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Queue a block read, write or erase
+  * @param  req: Request, owned by the caller until it completes
+  * @retval SD_ASYNC_OK if queued, SD_ASYNC_ERROR if the request cannot be used
+  *         or the queue is locked
+  */
+SD_AsyncStatusTypeDef SD_Async_Submit(SD_AsyncReqTypeDef *req)
+{
+  if (locked || (req->Count == 0U) || (((uint32_t)req->Buf & 3U) != 0U))
+  {
+    return SD_ASYNC_ERROR;
+  }
+
+  req->Status = SD_ASYNC_BUSY;
+  req->Next = NULL;
+
+  __disable_irq();
+  if (req->Write == 1U)
+  {
+    writes++;
+  }
+  if (tail != NULL)
+  {
+    tail->Next = req;
+  }
+  else
+  {
+    head = req;
+  }
+  tail = req;
+  __enable_irq();
+
+  return SD_ASYNC_OK;
+}
+
+/**
+  * @brief  Start queued requests, finish writes and run the callbacks of
+  *         the completed requests, without waiting for the card.
+  *         Call from the main loop.
+  * @retval None
+  */
+void SD_Async_Process(void)
+{
+  SD_AsyncReqTypeDef *req;
+
+  if (active != NULL)
+  {
+    SD_Async_Step();
+  }
+
+  if ((active == NULL) && (head != NULL))
+  {
+    SD_Async_StartIdle();
+  }
+
+  for (;;)
+  {
+    __disable_irq();
+    req = done_head;
+    if (req != NULL)
+    {
+      done_head = req->Next;
+      if (done_head == NULL)
+      {
+        done_tail = NULL;
+      }
+    }
+    __enable_irq();
+
+    if (req == NULL)
+    {
+      break;
+    }
+    req->Status = req->Result;
+    if (req->Callback != NULL)
+    {
+      req->Callback(req);
+    }
+  }
+}
+
+/**
+  * @brief  Tell whether all the requests are done
+  * @retval 1 if nothing is queued, on the bus or waiting for its callback
+  */
+uint8_t SD_Async_IsIdle(void)
+{
+  return (active == NULL) && (head == NULL) && (done_head == NULL);
+}
+
+/**
+  * @brief  Count the writes not done yet, to wait for the data without
+  *         waiting for the erases
+  * @retval Writes queued or on the bus
+  */
+uint32_t SD_Async_WritesPending(void)
+{
+  return writes;
+}
+
+/**
+  * @brief  Fail the active and all the queued requests at once, the card
+  *         is gone. Their callbacks run from the next SD_Async_Process().
+  * @retval None
+  */
+void SD_Async_Cancel(void)
+{
+  uint8_t abort;
+
+  __disable_irq();
+  abort = ((active != NULL) && (phase == SD_PHASE_XFER)) ? 1U : 0U;
+  if (active != NULL)
+  {
+    SD_Async_Finish(SD_ASYNC_ERROR);
+  }
+  while (head != NULL)
+  {
+    active = head;
+    head = head->Next;
+    SD_Async_Finish(SD_ASYNC_ERROR);
+  }
+  tail = NULL;
+  waiting = 0U;
+  __enable_irq();
+
+  /* Stop the DMA rather than wait for the data timeout */
+  if (abort != 0U)
+  {
+    (void)HAL_SD_Abort(&hsd);
+  }
+}
+
+/**
+  * @brief  Lock the queue while the card belongs to another user (USB mass
+  *         storage): the requests already queued are run to their end, then
+  *         SD_Async_Submit() refuses new ones until unlocked
+  * @param  lock: 1 to lock, 0 to unlock
+  * @retval None
+  */
+void SD_Async_Lock(uint8_t lock)
+{
+  if (lock)
+  {
+    while (!SD_Async_IsIdle())
+    {
+      SD_Async_Process();
+    }
+  }
+  locked = lock;
+}
+
+/**
+  * @brief  DMA transfer complete
+  * @param  write: 1 for the TX stream, 0 for the RX stream
+  * @retval None
+  */
+void SD_Async_XferCplt(uint8_t write)
+{
+  /* Transfers of BSP_SD_Init() or usbd_storage_if.c */
+  if ((active == NULL) || (phase != SD_PHASE_XFER) || (active->Write != write))
+  {
+    return;
+  }
+
+  if (xfer_error != 0U)
+  {
+    SD_Async_Finish(SD_ASYNC_ERROR);
+  }
+  else if (write)
+  {
+    phase = SD_PHASE_PROG;
+  }
+  else
+  {
+    SD_Async_Finish(SD_ASYNC_OK);
+    SD_Async_Start();
+  }
+}
+
+/**
+  * @brief  Transfer error or abort reported by the HAL
+  * @retval None
+  */
+void SD_Async_XferError(void)
+{
+  if (active != NULL)
+  {
+    xfer_error = 1U;
+  }
+}
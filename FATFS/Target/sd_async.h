@@ -0,0 +1,78 @@
+/**
+  ******************************************************************************
+  * @file    sd_async.h
+  * @brief   Non-blocking block reads and writes on the SDIO card.
+  *
+  *          A request is queued with SD_Async_Submit() and runs as one
+  *          multi-block DMA transfer. A read ends in the DMA interrupt, which
+  *          starts the next queued request at once. A write ends when the
+  *          card has finished programming, which SD_Async_Process() polls
+  *          from the main loop, as does the end of an erase. The requests
+  *          run in order, so one queued after an erase waits for the card
+  *          to finish erasing. Callbacks only ever run from
+  *          SD_Async_Process(). The request objects belong to the caller
+  *          and must stay valid until completed. The callbacks must not use
+  *          FatFs, whose disk I/O waits on this same queue.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SD_ASYNC_H__
+#define __SD_ASYNC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "bsp_driver_sd.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define SD_ASYNC_ERASE          2U      /* Write value of an erase request */
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  SD_ASYNC_BUSY = 0U,                   /* Queued or on the bus */
+  SD_ASYNC_OK,
+  SD_ASYNC_ERROR
+} SD_AsyncStatusTypeDef;
+
+typedef struct SD_AsyncReq SD_AsyncReqTypeDef;
+
+/* Called from SD_Async_Process() once req->Status is final. It may submit
+   further requests. */
+typedef void (*SD_AsyncCallbackTypeDef)(SD_AsyncReqTypeDef *req);
+
+struct SD_AsyncReq
+{
+  uint8_t  Write;                       /* 0: read, 1: write, SD_ASYNC_ERASE */
+  uint32_t Sector;
+  uint8_t  *Buf;                        /* Word aligned, for the DMA, unused to erase */
+  uint32_t Count;                       /* Blocks */
+  SD_AsyncCallbackTypeDef Callback;     /* May be NULL, poll Status */
+  void     *Context;                    /* For the caller */
+
+  /* Set by the driver */
+  volatile SD_AsyncStatusTypeDef Status;
+  SD_AsyncStatusTypeDef Result;         /* Status to report, once completed */
+  SD_AsyncReqTypeDef *Next;
+};
+
+/* Exported functions prototypes ---------------------------------------------*/
+SD_AsyncStatusTypeDef SD_Async_Submit(SD_AsyncReqTypeDef *req);
+void                  SD_Async_Process(void);
+uint8_t               SD_Async_IsIdle(void);
+uint32_t              SD_Async_WritesPending(void);
+void                  SD_Async_Cancel(void);
+void                  SD_Async_Lock(uint8_t lock);
+
+/* Called by the BSP_SD_xxxCallback() of sd_diskio.c, in interrupt context */
+void                  SD_Async_XferCplt(uint8_t write);
+void                  SD_Async_XferError(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_ASYNC_H__ */
@@ -28,18 +28,14 @@
 #include "ff_gen_drv.h"
 #include "sd_diskio.h"
 
+#include "sd_async.h"
+#include "fatfs.h"
+#include "sdio.h"
 #include <string.h>
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 
- /*
- * the following Timeout is useful to give the control back to the applications
- * in case of errors in either BSP_SD_ReadCpltCallback() or BSP_SD_WriteCpltCallback()
- * the value by default is as defined in the BSP platform driver otherwise 30 secs
- */
-#define SD_TIMEOUT 30 * 1000
-
 #define SD_DEFAULT_BLOCK_SIZE 512
 
 /*
@@ -68,7 +64,7 @@
 * transfer data
 */
 /* USER CODE BEGIN enableScratchBuffer */
-/* #define ENABLE_SCRATCH_BUFFER */
+#define ENABLE_SCRATCH_BUFFER
 /* USER CODE END enableScratchBuffer */
 
 /* Private variables ---------------------------------------------------------*/
@@ -82,7 +78,6 @@ __ALIGN_BEGIN static uint8_t scratch[BLOCKSIZE] __ALIGN_END;
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
-static volatile  UINT  WriteStatus = 0, ReadStatus = 0;
 /* Private function prototypes -----------------------------------------------*/
 static DSTATUS SD_CheckStatus(BYTE lun);
 DSTATUS SD_initialize (BYTE);
@@ -111,29 +106,87 @@ const Diskio_drvTypeDef  SD_Driver =
 
 /* USER CODE BEGIN beforeFunctionSection */
 /* can be used to modify / undefine following code or add new code */
+
+/* Set while the card is exported over USB, FatFs must not touch it */
+static volatile uint8_t Exported = 0;
+
+/* Write-back sector cache for the single sector accesses of FatFs, 0 to
+   disable. FAT and directory sectors, the ones read into SDFatFS.win, are
+   kept in preference to file data up to SD_CACHE_META_MAX lines. Larger
+   transfers go straight to the card. */
+#define SD_CACHE_SECTORS      32U
+#define SD_CACHE_META_MAX     ((SD_CACHE_SECTORS * 3U) / 4U)
+
+/* Put the cache lines in the 64 KB CCMRAM to leave SRAM to the DMA users.
+   The DMA cannot reach CCMRAM, the lines are then moved through the
+   scratch buffer. The section is not zeroed, a line is filled before it
+   is used. */
+/* #define SD_CACHE_IN_CCMRAM */
+
+#if defined(SD_CACHE_IN_CCMRAM) && !defined(ENABLE_SCRATCH_BUFFER)
+#error "SD_CACHE_IN_CCMRAM needs ENABLE_SCRATCH_BUFFER"
+#endif
+
+#if (SD_CACHE_SECTORS > 0U)
+typedef struct
+{
+  DWORD    Sector;
+  uint32_t Used;                        /* LRU stamp, 0 for a free line */
+  uint8_t  Dirty;
+  uint8_t  Meta;                        /* FAT or directory sector */
+} SD_CacheLineTypeDef;
+
+static SD_CacheLineTypeDef cache_line[SD_CACHE_SECTORS];
+#if defined(SD_CACHE_IN_CCMRAM)
+static uint32_t cache_data[SD_CACHE_SECTORS][BLOCKSIZE / 4U] __attribute__((section(".ccmram_bss")));
+#else
+static uint32_t cache_data[SD_CACHE_SECTORS][BLOCKSIZE / 4U];
+#endif
+static uint32_t cache_clock;
+#endif
+static SD_DiskCacheStatsTypeDef cache_stats;
+
+#if _USE_TRIM == 1
+/* Sectors freed by FatFs, erased as one range once a freed run does not
+   join it or a write reaches it. Only the whole allocation units inside
+   are erased, by a request on the sd_async.c queue. */
+static DWORD trim_start = 1U;           /* Inclusive range, none while trim_end < trim_start */
+static DWORD trim_end = 0U;
+static SD_AsyncReqTypeDef trim_req;
+static volatile uint8_t trim_busy;      /* trim_req queued or erasing */
+#endif
+
 /* USER CODE END beforeFunctionSection */
 
 /* Private functions ---------------------------------------------------------*/
 
-static int SD_CheckStatusWithTimeout(uint32_t timeout)
+static DSTATUS SD_CheckStatus(BYTE lun)
 {
-  uint32_t timer = HAL_GetTick();
-  /* block until SDIO IP is ready again or a timeout occur */
-  while(HAL_GetTick() - timer < timeout)
+  HAL_SD_CardStateTypeDef state;
+
+  if(Exported)
   {
-    if (BSP_SD_GetCardState() == SD_TRANSFER_OK)
+    Stat = STA_NOINIT;
+    return Stat;
+  }
+
+  /* An initialized card stays so while it is busy: no CMD13 during the
+     queued DMA transfers, and the data and programming states are as good
+     as TRANSFER. Only a card that is gone or lost needs SD_initialize(). */
+  if(!(Stat & STA_NOINIT))
+  {
+    if(!SD_Async_IsIdle())
     {
-      return 0;
+      return Stat;
     }
+    state = HAL_SD_GetCardState(&hsd);
+    if((state < HAL_SD_CARD_TRANSFER) || (state > HAL_SD_CARD_PROGRAMMING))
+    {
+      Stat = STA_NOINIT;
+    }
+    return Stat;
   }
 
-  return -1;
-}
-
-static DSTATUS SD_CheckStatus(BYTE lun)
-{
-  Stat = STA_NOINIT;
-
   if(BSP_SD_GetCardState() == MSD_OK)
   {
     Stat &= ~STA_NOINIT;
@@ -149,6 +202,18 @@ static DSTATUS SD_CheckStatus(BYTE lun)
   */
 DSTATUS SD_initialize(BYTE lun)
 {
+  if(Exported)
+  {
+    return STA_NOINIT;
+  }
+
+  /* Maybe another card, nothing cached is valid any more */
+  Stat = STA_NOINIT;
+  SD_DiskCache_Invalidate();
+#if _USE_TRIM == 1
+  trim_start = 1U;
+  trim_end = 0U;
+#endif
 
 #if !defined(DISABLE_SD_INIT)
 
@@ -176,123 +241,453 @@ DSTATUS SD_status(BYTE lun)
 
 /* USER CODE BEGIN beforeReadSection */
 /* can be used to modify previous code / undefine following code / add new code */
-/* USER CODE END beforeReadSection */
+
 /**
-  * @brief  Reads Sector(s)
-  * @param  lun : not used
-  * @param  *buff: Data buffer to store read data
+  * @brief  Run one request of the sd_async.c queue to its end
+  * @param  write: 0 to read, 1 to write
+  * @param  buff: Word aligned data buffer
   * @param  sector: Sector address (LBA)
-  * @param  count: Number of sectors to read (1..128)
+  * @param  count: Number of sectors
   * @retval DRESULT: Operation result
   */
+static DRESULT SD_Transfer(uint8_t write, BYTE *buff, DWORD sector, UINT count)
+{
+  SD_AsyncReqTypeDef req;
+
+  req.Write = write;
+  req.Sector = sector;
+  req.Buf = buff;
+  req.Count = count;
+  req.Callback = NULL;
+  req.Context = NULL;
+  if (SD_Async_Submit(&req) != SD_ASYNC_OK)
+  {
+    return RES_ERROR;
+  }
 
-DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+  /* Requests queued before this one go first, the queue has the timeouts */
+  while (req.Status == SD_ASYNC_BUSY)
+  {
+    SD_Async_Process();
+  }
+
+  return (req.Status == SD_ASYNC_OK) ? RES_OK : RES_ERROR;
+}
+
+#if (SD_CACHE_SECTORS > 0U)
+/**
+  * @brief  Read or write one cache line on the card
+  * @param  write: 0 to fill the line, 1 to write it back
+  * @param  line: Cache line
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_CacheLineTransfer(uint8_t write, uint32_t line)
 {
-  DRESULT res = RES_ERROR;
-  uint32_t timeout;
-#if defined(ENABLE_SCRATCH_BUFFER)
-  uint8_t ret;
-#endif
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-  uint32_t alignedAddr;
+#if defined(SD_CACHE_IN_CCMRAM)
+  DRESULT res;
+
+  if (write)
+  {
+    memcpy(scratch, cache_data[line], BLOCKSIZE);
+    return SD_Transfer(1U, scratch, cache_line[line].Sector, 1U);
+  }
+
+  res = SD_Transfer(0U, scratch, cache_line[line].Sector, 1U);
+  if (res == RES_OK)
+  {
+    memcpy(cache_data[line], scratch, BLOCKSIZE);
+  }
+  return res;
+#else
+  return SD_Transfer(write, (BYTE *)cache_data[line], cache_line[line].Sector, 1U);
 #endif
+}
 
-  /*
-  * ensure the SDCard is ready for a new operation
+/**
+  * @brief  Find the line holding a sector
+  * @param  sector: Sector address (LBA)
+  * @retval Line, -1 if not cached
   */
+static int32_t SD_CacheFind(DWORD sector)
+{
+  uint32_t i;
 
-  if (SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0)
+  for (i = 0U; i < SD_CACHE_SECTORS; i++)
   {
-    return res;
+    if ((cache_line[i].Used != 0U) && (cache_line[i].Sector == sector))
+    {
+      return (int32_t)i;
+    }
   }
+  return -1;
+}
 
-#if defined(ENABLE_SCRATCH_BUFFER)
-  if (!((uint32_t)buff & 0x3))
+/**
+  * @brief  Get a line for a new sector: a free one, else the least recently
+  *         used data line, else the least recently used FAT/directory line
+  * @param  meta: 1 for a FAT or directory sector
+  * @retval Line, -1 if a dirty victim could not be written back
+  */
+static int32_t SD_CacheAlloc(uint8_t meta)
+{
+  int32_t lru_data = -1;
+  int32_t lru_meta = -1;
+  int32_t victim;
+  uint32_t n_meta = 0U;
+  uint32_t i;
+
+  for (i = 0U; i < SD_CACHE_SECTORS; i++)
   {
-#endif
-    if(BSP_SD_ReadBlocks_DMA((uint32_t*)buff,
-                             (uint32_t) (sector),
-                             count) == MSD_OK)
+    if (cache_line[i].Used == 0U)
     {
-      ReadStatus = 0;
-      /* Wait that the reading process is completed or a timeout occurs */
-      timeout = HAL_GetTick();
-      while((ReadStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
+      return (int32_t)i;
+    }
+    if (cache_line[i].Meta)
+    {
+      n_meta++;
+      if ((lru_meta < 0) || (cache_line[i].Used < cache_line[lru_meta].Used))
       {
+        lru_meta = (int32_t)i;
       }
-      /* in case of a timeout return error */
-      if (ReadStatus == 0)
+    }
+    else if ((lru_data < 0) || (cache_line[i].Used < cache_line[lru_data].Used))
+    {
+      lru_data = (int32_t)i;
+    }
+  }
+
+  victim = ((lru_data < 0) || (meta && (n_meta >= SD_CACHE_META_MAX))) ? lru_meta : lru_data;
+
+  if (cache_line[victim].Dirty)
+  {
+    if (SD_CacheLineTransfer(1U, (uint32_t)victim) != RES_OK)
+    {
+      return -1;
+    }
+    cache_stats.WriteBacks++;
+  }
+  cache_stats.Evictions++;
+  cache_line[victim].Used = 0U;
+  cache_line[victim].Dirty = 0U;
+  return victim;
+}
+
+/**
+  * @brief  Mark a line as just used
+  * @param  line: Cache line
+  * @retval None
+  */
+static void SD_CacheTouch(int32_t line)
+{
+  /* Stamps only grow, restart them all before the clock wraps */
+  if (++cache_clock == 0U)
+  {
+    uint32_t i;
+
+    for (i = 0U; i < SD_CACHE_SECTORS; i++)
+    {
+      if (cache_line[i].Used != 0U)
       {
-        res = RES_ERROR;
+        cache_line[i].Used = 1U;
       }
-      else
+    }
+    cache_clock = 2U;
+  }
+  cache_line[line].Used = cache_clock;
+}
+
+/**
+  * @brief  Read one sector through the cache
+  * @param  buff: Data buffer, any alignment
+  * @param  sector: Sector address (LBA)
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_CacheRead(BYTE *buff, DWORD sector)
+{
+  int32_t line = SD_CacheFind(sector);
+
+  if (line >= 0)
+  {
+    cache_stats.ReadHits++;
+  }
+  else
+  {
+    cache_stats.ReadMisses++;
+    line = SD_CacheAlloc(buff == SDFatFS.win);
+    if (line < 0)
+    {
+      return RES_ERROR;
+    }
+    cache_line[line].Sector = sector;
+    cache_line[line].Meta = (buff == SDFatFS.win);
+    if (SD_CacheLineTransfer(0U, (uint32_t)line) != RES_OK)
+    {
+      return RES_ERROR;
+    }
+  }
+
+  SD_CacheTouch(line);
+  memcpy(buff, cache_data[line], BLOCKSIZE);
+  return RES_OK;
+}
+
+/**
+  * @brief  Write one sector into the cache, the card gets it on a flush or
+  *         when the line is evicted
+  * @param  buff: Data, any alignment
+  * @param  sector: Sector address (LBA)
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_CacheWrite(const BYTE *buff, DWORD sector)
+{
+  int32_t line = SD_CacheFind(sector);
+
+  if (line >= 0)
+  {
+    cache_stats.WriteHits++;
+  }
+  else
+  {
+    cache_stats.WriteMisses++;
+    line = SD_CacheAlloc(buff == SDFatFS.win);
+    if (line < 0)
+    {
+      return RES_ERROR;
+    }
+    cache_line[line].Sector = sector;
+  }
+
+  memcpy(cache_data[line], buff, BLOCKSIZE);
+  cache_line[line].Meta = (buff == SDFatFS.win);
+  cache_line[line].Dirty = 1U;
+  SD_CacheTouch(line);
+  return RES_OK;
+}
+
+/**
+  * @brief  Write back the dirty lines of a sector range, lowest sector first
+  * @param  sector: First sector
+  * @param  count: Number of sectors
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_CacheFlush(DWORD sector, UINT count)
+{
+  int32_t next;
+  uint32_t i;
+
+  for (;;)
+  {
+    next = -1;
+    for (i = 0U; i < SD_CACHE_SECTORS; i++)
+    {
+      if ((cache_line[i].Used != 0U) && cache_line[i].Dirty &&
+          ((cache_line[i].Sector - sector) < count) &&
+          ((next < 0) || (cache_line[i].Sector < cache_line[next].Sector)))
       {
-        ReadStatus = 0;
-        timeout = HAL_GetTick();
-
-        while((HAL_GetTick() - timeout) < SD_TIMEOUT)
-        {
-          if (BSP_SD_GetCardState() == SD_TRANSFER_OK)
-          {
-            res = RES_OK;
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-            /*
-            the SCB_InvalidateDCache_by_Addr() requires a 32-Byte aligned address,
-            adjust the address and the D-Cache size to invalidate accordingly.
-            */
-            alignedAddr = (uint32_t)buff & ~0x1F;
-            SCB_InvalidateDCache_by_Addr((uint32_t*)alignedAddr, count*BLOCKSIZE + ((uint32_t)buff - alignedAddr));
-#endif
-            break;
-          }
-        }
+        next = (int32_t)i;
       }
     }
-#if defined(ENABLE_SCRATCH_BUFFER)
+    if (next < 0)
+    {
+      return RES_OK;
+    }
+
+    if (SD_CacheLineTransfer(1U, (uint32_t)next) != RES_OK)
+    {
+      return RES_ERROR;
+    }
+    cache_line[next].Dirty = 0U;
+    cache_stats.WriteBacks++;
+  }
+}
+
+/**
+  * @brief  Forget the lines of a sector range, dirty or not
+  * @param  sector: First sector
+  * @param  count: Number of sectors
+  * @retval None
+  */
+static void SD_CacheDrop(DWORD sector, UINT count)
+{
+  uint32_t i;
+
+  for (i = 0U; i < SD_CACHE_SECTORS; i++)
+  {
+    if ((cache_line[i].Used != 0U) && ((cache_line[i].Sector - sector) < count))
+    {
+      cache_line[i].Used = 0U;
+      cache_line[i].Dirty = 0U;
+    }
+  }
+}
+#endif /* SD_CACHE_SECTORS > 0U */
+
+#if _USE_TRIM == 1
+/**
+  * @brief  The erase is over, called from SD_Async_Process()
+  * @param  req: Request of the erase
+  * @retval None
+  */
+static void SD_TrimDone(SD_AsyncReqTypeDef *req)
+{
+  trim_busy = 0U;
+  if (req->Status == SD_ASYNC_OK)
+  {
+    cache_stats.TrimmedSectors += req->Count;
+  }
+}
+
+/**
+  * @brief  Queue the erase of the freed range, keeping to whole allocation
+  *         units, without waiting for it: the requests queued after it
+  *         wait instead. While the last erase still runs the range is let
+  *         go, an erase is only a hint to the card.
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_TrimFlush(void)
+{
+  SD_BusInfoTypeDef BusInfo;
+  DWORD start = trim_start;
+  DWORD end = trim_end;
+  DWORD au;
+
+  if (end < start)
+  {
+    return RES_OK;
   }
-    else
+  trim_start = 1U;
+  trim_end = 0U;
+
+#if (SD_CACHE_SECTORS > 0U)
+  /* Whatever is cached there was freed */
+  SD_CacheDrop(start, end - start + 1U);
+#endif
+
+  MX_SDIO_SD_GetBusInfo(&BusInfo);
+  au = BusInfo.AUSize / BLOCKSIZE;
+  if (au != 0U)
+  {
+    start = ((start + au - 1U) / au) * au;
+    end = (((end + 1U) / au) * au) - 1U;
+    if ((end + 1U) <= start)
     {
-      /* Slow path, fetch each sector a part and memcpy to destination buffer */
-      int i;
-
-      for (i = 0; i < count; i++) {
-        ret = BSP_SD_ReadBlocks_DMA((uint32_t*)scratch, (uint32_t)sector++, 1);
-        if (ret == MSD_OK) {
-          /* wait until the read is successful or a timeout occurs */
-
-          timeout = HAL_GetTick();
-          while((ReadStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
-          {
-          }
-          if (ReadStatus == 0)
-          {
-            res = RES_ERROR;
-            break;
-          }
-          ReadStatus = 0;
-
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-          /*
-          *
-          * invalidate the scratch buffer before the next read to get the actual data instead of the cached one
-          */
-          SCB_InvalidateDCache_by_Addr((uint32_t*)scratch, BLOCKSIZE);
+      return RES_OK;
+    }
+  }
+
+  if (trim_busy)
+  {
+    return RES_OK;
+  }
+
+  trim_req.Write = SD_ASYNC_ERASE;
+  trim_req.Sector = start;
+  trim_req.Buf = NULL;
+  trim_req.Count = end - start + 1U;
+  trim_req.Callback = SD_TrimDone;
+  trim_req.Context = NULL;
+  if (SD_Async_Submit(&trim_req) != SD_ASYNC_OK)
+  {
+    return RES_ERROR;
+  }
+  trim_busy = 1U;
+  cache_stats.TrimCommands++;
+  return RES_OK;
+}
+
+/**
+  * @brief  Erase the freed range first if a write is about to reach it, the
+  *         write being queued behind the erase
+  * @param  sector: First sector written
+  * @param  count: Number of sectors
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_TrimCheck(DWORD sector, UINT count)
+{
+  if ((trim_end >= trim_start) && (sector <= trim_end) && ((sector + count - 1U) >= trim_start))
+  {
+    return SD_TrimFlush();
+  }
+  return RES_OK;
+}
+
+/**
+  * @brief  Add a range freed by FatFs, joined to the pending one when they
+  *         touch
+  * @param  start: First sector
+  * @param  end: Last sector
+  * @retval DRESULT: Operation result
+  */
+static DRESULT SD_TrimAdd(DWORD start, DWORD end)
+{
+  DRESULT res = RES_OK;
+
+  if (end < start)
+  {
+    return RES_PARERR;
+  }
+
+  if ((trim_end >= trim_start) && (start <= (trim_end + 1U)) && ((end + 1U) >= trim_start))
+  {
+    trim_start = (start < trim_start) ? start : trim_start;
+    trim_end = (end > trim_end) ? end : trim_end;
+    return RES_OK;
+  }
+
+  res = SD_TrimFlush();
+  trim_start = start;
+  trim_end = end;
+  return res;
+}
+#endif /* _USE_TRIM == 1 */
+
+/* USER CODE END beforeReadSection */
+/**
+  * @brief  Reads Sector(s)
+  * @param  lun : not used
+  * @param  *buff: Data buffer to store read data
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to read (1..128)
+  * @retval DRESULT: Operation result
+  */
+
+DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+{
+#if defined(ENABLE_SCRATCH_BUFFER)
+  DRESULT res = RES_OK;
 #endif
-          memcpy(buff, scratch, BLOCKSIZE);
-          buff += BLOCKSIZE;
-        }
-        else
-        {
-          break;
-        }
-      }
 
-      if ((i == count) && (ret == MSD_OK))
-        res = RES_OK;
+#if (SD_CACHE_SECTORS > 0U)
+  if (count == 1U)
+  {
+    return SD_CacheRead(buff, sector);
+  }
+
+  /* Straight from the card, which must hold what is dirty here first */
+  if (SD_CacheFlush(sector, count) != RES_OK)
+  {
+    return RES_ERROR;
+  }
+#endif
+
+#if defined(ENABLE_SCRATCH_BUFFER)
+  if ((uint32_t)buff & 0x3)
+  {
+    /* Slow path, fetch each sector a part and memcpy to destination buffer */
+    while ((count-- > 0U) && (res == RES_OK))
+    {
+      res = SD_Transfer(0U, scratch, sector++, 1U);
+      if (res == RES_OK)
+      {
+        memcpy(buff, scratch, BLOCKSIZE);
+        buff += BLOCKSIZE;
+      }
     }
+    return res;
+  }
 #endif
 
-  return res;
+  return SD_Transfer(0U, buff, sector, count);
 }
 
 /* USER CODE BEGIN beforeWriteSection */
@@ -310,109 +705,43 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 
 DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
-  uint32_t timeout;
 #if defined(ENABLE_SCRATCH_BUFFER)
-  uint8_t ret;
-  int i;
+  DRESULT res = RES_OK;
 #endif
 
-   WriteStatus = 0;
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-  uint32_t alignedAddr;
+#if _USE_TRIM == 1
+  /* Erasing afterwards would lose this data */
+  if (SD_TrimCheck(sector, count) != RES_OK)
+  {
+    return RES_ERROR;
+  }
 #endif
 
-  if (SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0)
+#if (SD_CACHE_SECTORS > 0U)
+  if (count == 1U)
   {
-    return res;
+    return SD_CacheWrite(buff, sector);
   }
 
-#if defined(ENABLE_SCRATCH_BUFFER)
-  if (!((uint32_t)buff & 0x3))
-  {
-#endif
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-
-    /*
-    the SCB_CleanDCache_by_Addr() requires a 32-Byte aligned address
-    adjust the address and the D-Cache size to clean accordingly.
-    */
-    alignedAddr = (uint32_t)buff &  ~0x1F;
-    SCB_CleanDCache_by_Addr((uint32_t*)alignedAddr, count*BLOCKSIZE + ((uint32_t)buff - alignedAddr));
+  /* Straight to the card, what is cached here is superseded */
+  SD_CacheDrop(sector, count);
 #endif
 
-    if(BSP_SD_WriteBlocks_DMA((uint32_t*)buff,
-                              (uint32_t)(sector),
-                              count) == MSD_OK)
+#if defined(ENABLE_SCRATCH_BUFFER)
+  if ((uint32_t)buff & 0x3)
+  {
+    /* Slow path, copy each sector a part to the scratch buffer */
+    while ((count-- > 0U) && (res == RES_OK))
     {
-      /* Wait that writing process is completed or a timeout occurs */
-
-      timeout = HAL_GetTick();
-      while((WriteStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
-      {
-      }
-      /* in case of a timeout return error */
-      if (WriteStatus == 0)
-      {
-        res = RES_ERROR;
-      }
-      else
-      {
-        WriteStatus = 0;
-        timeout = HAL_GetTick();
-
-        while((HAL_GetTick() - timeout) < SD_TIMEOUT)
-        {
-          if (BSP_SD_GetCardState() == SD_TRANSFER_OK)
-          {
-            res = RES_OK;
-            break;
-          }
-        }
-      }
+      memcpy(scratch, buff, BLOCKSIZE);
+      buff += BLOCKSIZE;
+      res = SD_Transfer(1U, scratch, sector++, 1U);
     }
-#if defined(ENABLE_SCRATCH_BUFFER)
+    return res;
   }
-    else
-    {
-      /* Slow path, fetch each sector a part and memcpy to destination buffer */
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-      /*
-      * invalidate the scratch buffer before the next write to get the actual data instead of the cached one
-      */
-      SCB_InvalidateDCache_by_Addr((uint32_t*)scratch, BLOCKSIZE);
 #endif
 
-      for (i = 0; i < count; i++)
-      {
-        WriteStatus = 0;
-
-        memcpy((void *)scratch, (void *)buff, BLOCKSIZE);
-        buff += BLOCKSIZE;
-
-        ret = BSP_SD_WriteBlocks_DMA((uint32_t*)scratch, (uint32_t)sector++, 1);
-        if (ret == MSD_OK) {
-          /* wait for a message from the queue or a timeout */
-          timeout = HAL_GetTick();
-          while((WriteStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
-          {
-          }
-          if (WriteStatus == 0)
-          {
-            break;
-          }
-
-        }
-        else
-        {
-          break;
-        }
-      }
-      if ((i == count) && (ret == MSD_OK))
-        res = RES_OK;
-    }
-#endif
-  return res;
+  return SD_Transfer(1U, (BYTE *)buff, sector, count);
 }
 #endif /* _USE_WRITE == 1 */
 
@@ -431,6 +760,7 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 {
   DRESULT res = RES_ERROR;
   BSP_SD_CardInfo CardInfo;
+  SD_BusInfoTypeDef BusInfo;
 
   if (Stat & STA_NOINIT) return RES_NOTRDY;
 
@@ -438,6 +768,17 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
   {
   /* Make sure that no pending write process */
   case CTRL_SYNC :
+#if (SD_CACHE_SECTORS > 0U)
+    if (SD_CacheFlush(0U, 0xFFFFFFFFU) != RES_OK)
+    {
+      break;
+    }
+#endif
+    /* Writes of the other users too, not the erases queued */
+    while (SD_Async_WritesPending() != 0U)
+    {
+      SD_Async_Process();
+    }
     res = RES_OK;
     break;
 
@@ -457,11 +798,20 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 
   /* Get erase block size in unit of sector (DWORD) */
   case GET_BLOCK_SIZE :
+    /* The allocation unit of the card when it reports one */
+    MX_SDIO_SD_GetBusInfo(&BusInfo);
     BSP_SD_GetCardInfo(&CardInfo);
-    *(DWORD*)buff = CardInfo.LogBlockSize / SD_DEFAULT_BLOCK_SIZE;
+    *(DWORD*)buff = ((BusInfo.AUSize != 0U) ? BusInfo.AUSize : CardInfo.LogBlockSize) / SD_DEFAULT_BLOCK_SIZE;
     res = RES_OK;
     break;
 
+#if _USE_TRIM == 1
+  /* Sectors no longer used by FatFs (DWORD[2], first and last) */
+  case CTRL_TRIM :
+    res = SD_TrimAdd(((DWORD*)buff)[0], ((DWORD*)buff)[1]);
+    break;
+#endif
+
   default:
     res = RES_PARERR;
   }
@@ -484,8 +834,7 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
   */
 void BSP_SD_WriteCpltCallback(void)
 {
-
-  WriteStatus = 1;
+  SD_Async_XferCplt(1U);
 }
 
 /**
@@ -495,25 +844,123 @@ void BSP_SD_WriteCpltCallback(void)
   */
 void BSP_SD_ReadCpltCallback(void)
 {
-  ReadStatus = 1;
+  SD_Async_XferCplt(0U);
 }
 
 /* USER CODE BEGIN ErrorAbortCallbacks */
-/*
-==============================================================================================
-  depending on the SD_HAL_Driver version, either the HAL_SD_ErrorCallback() or HAL_SD_AbortCallback()
-  or both could be defined, activate the callbacks below when suitable and needed
-==============================================================================================
+/**
+  * @brief  Transfer aborted or failed, also called from HAL_SD_ErrorCallback()
+  * @retval None
+  */
 void BSP_SD_AbortCallback(void)
 {
+  SD_Async_XferError();
 }
-
-void BSP_SD_ErrorCallback(void)
-{
-}
-*/
 /* USER CODE END ErrorAbortCallbacks */
 
 /* USER CODE BEGIN lastSection */
 /* can be used to modify / undefine previous code or add new code */
+
+/**
+  * @brief  Hand the card to another user (USB mass storage) or take it back
+  * @note   While exported the drive reports STA_NOINIT and is never
+  *         initialized, unmount the volume before exporting. The sd_async.c
+  *         queue is drained and locked, so the raw users (SD logger, file
+  *         copy) get their later requests refused.
+  * @param  exported: 1 to export, 0 to give the card back to FatFs
+  * @retval None
+  */
+void SD_SetExported(uint8_t exported)
+{
+  /* The host may change anything while it owns the card */
+  if (exported)
+  {
+    (void)SD_DiskCache_Flush();
+  }
+  SD_Async_Lock(exported);
+  SD_DiskCache_Invalidate();
+
+  Exported = exported;
+  Stat = STA_NOINIT;
+}
+
+/**
+  * @brief  Write back what is held for the card: the pending erase, the
+  *         dirty sectors and the queued requests
+  * @retval DRESULT: Operation result
+  */
+DRESULT SD_DiskCache_Flush(void)
+{
+  DRESULT res = RES_OK;
+
+#if _USE_TRIM == 1
+  if (SD_TrimFlush() != RES_OK)
+  {
+    res = RES_ERROR;
+  }
+#endif
+#if (SD_CACHE_SECTORS > 0U)
+  if (SD_CacheFlush(0U, 0xFFFFFFFFU) != RES_OK)
+  {
+    res = RES_ERROR;
+  }
+#endif
+  while (!SD_Async_IsIdle())
+  {
+    SD_Async_Process();
+  }
+
+  return res;
+}
+
+/**
+  * @brief  Forget all the cached sectors, dirty ones included
+  * @retval None
+  */
+void SD_DiskCache_Invalidate(void)
+{
+#if (SD_CACHE_SECTORS > 0U)
+  uint32_t i;
+
+  for (i = 0U; i < SD_CACHE_SECTORS; i++)
+  {
+    if ((cache_line[i].Used != 0U) && cache_line[i].Dirty)
+    {
+      cache_stats.LostSectors++;
+    }
+    cache_line[i].Used = 0U;
+    cache_line[i].Dirty = 0U;
+  }
+  cache_clock = 0U;
+#endif
+}
+
+/**
+  * @brief  Forget the cached copies of sectors about to be written without
+  *         this driver, dirty or not, and erase them first if they were
+  *         freed
+  * @param  sector: First sector
+  * @param  count: Number of sectors
+  * @retval None
+  */
+void SD_DiskCache_Discard(uint32_t sector, uint32_t count)
+{
+#if _USE_TRIM == 1
+  (void)SD_TrimCheck(sector, count);
+#endif
+#if (SD_CACHE_SECTORS > 0U)
+  SD_CacheDrop(sector, count);
+#endif
+}
+
+/**
+  * @brief  Get the sector cache counters
+  * @param  stats: Filled with the counters since boot
+  * @retval None
+  */
+void SD_DiskCache_GetStats(SD_DiskCacheStatsTypeDef *stats)
+{
+  *stats = cache_stats;
+}
+
 /* USER CODE END lastSection */
@@ -36,6 +36,26 @@ extern const Diskio_drvTypeDef  SD_Driver;
 
 /* USER CODE BEGIN lastSection */
 /* can be used to modify / undefine previous code or add new definitions */
+
+/* Sector cache and trim counters, in sectors unless noted */
+typedef struct
+{
+  uint32_t ReadHits;                    /* Single sector reads served from the cache */
+  uint32_t ReadMisses;                  /* Single sector reads from the card */
+  uint32_t WriteHits;                   /* Single sector writes to a cached sector */
+  uint32_t WriteMisses;                 /* Single sector writes given a new line */
+  uint32_t WriteBacks;                  /* Dirty lines written to the card */
+  uint32_t Evictions;                   /* Lines reused for another sector */
+  uint32_t LostSectors;                 /* Dirty, dropped on invalidation */
+  uint32_t TrimCommands;                /* Erases sent for freed ranges */
+  uint32_t TrimmedSectors;              /* Erased, whole allocation units only */
+} SD_DiskCacheStatsTypeDef;
+
+void SD_SetExported(uint8_t exported);
+DRESULT SD_DiskCache_Flush(void);
+void SD_DiskCache_Invalidate(void);
+void SD_DiskCache_Discard(uint32_t sector, uint32_t count);
+void SD_DiskCache_GetStats(SD_DiskCacheStatsTypeDef *stats);
 /* USER CODE END lastSection */
 
 #endif /* __SD_DISKIO_H */
@@ -23,16 +23,43 @@
 /* Includes ------------------------------------------------------------------*/
 #include "ff_gen_drv.h"
 #include "usbh_diskio.h"
+#include "usbh_msc_async.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 
 #define USB_DEFAULT_BLOCK_SIZE 512
 
+/* Sectors per bounce buffer transfer, for FatFs buffers the OTG DMA cannot
+   use directly (not word aligned). Each chunk is one SCSI command. */
+#define USBH_BOUNCE_SECTORS    8U
+
+/* Block cache: one read-ahead window and one write-behind run, each
+   USBH_CACHE_SECTORS long. Dirty sectors older than USBH_CACHE_FLUSH_MS are
+   written back by USBH_DiskCache_Process(). */
+#define USBH_CACHE_SECTORS     16U
+#define USBH_CACHE_FLUSH_MS    250U
+
 /* Private variables ---------------------------------------------------------*/
-static DWORD scratch[_MAX_SS / 4];
+static DWORD bounce[(USBH_BOUNCE_SECTORS * _MAX_SS) / 4];
 extern USBH_HandleTypeDef  hUSB_Host;
 
+static struct
+{
+  DWORD ReadBuf[(USBH_CACHE_SECTORS * _MAX_SS) / 4];
+  DWORD WriteBuf[(USBH_CACHE_SECTORS * _MAX_SS) / 4];
+  BYTE  ReadLun;
+  DWORD ReadSector;                     /* Read-ahead window */
+  UINT  ReadCount;                      /* 0: window empty */
+  DWORD NextSector;                     /* Where a sequential read continues */
+  BYTE  WriteLun;
+  DWORD WriteSector;                    /* Write-behind run */
+  UINT  WriteCount;                     /* 0: nothing dirty */
+  uint32_t WriteTick;                   /* When the run was started */
+  DRESULT WriteError;                   /* A run was lost, until invalidated */
+  USBH_DiskCacheStatsTypeDef Stats;
+} cache;
+
 /* Private function prototypes -----------------------------------------------*/
 DSTATUS USBH_initialize (BYTE);
 DSTATUS USBH_status (BYTE);
@@ -100,67 +127,321 @@ DSTATUS USBH_status(BYTE lun)
 
 /* USER CODE BEGIN beforeReadSection */
 /* can be used to modify previous code / undefine following code / add new code */
-/* USER CODE END beforeReadSection */
 
 /**
-  * @brief  Reads Sector(s)
+  * @brief  Runs one transfer through the non-blocking request queue and
+  *         waits for it, behind any request already queued
+  * @param  lun : lun id
+  * @param  write: 1 to write, 0 to read
+  * @param  *buff: Word aligned data buffer
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_Transfer(BYTE lun, uint8_t write, BYTE *buff, DWORD sector, UINT count)
+{
+  USBH_MSC_AsyncReqTypeDef req = {0};
+
+  req.Lun = lun;
+  req.Write = write;
+  req.Sector = sector;
+  req.Buf = buff;
+  req.Count = count;
+
+  if (USBH_MSC_Async_Submit(&hUSB_Host, &req) != USBH_OK)
+  {
+    return USBH_FAIL;
+  }
+
+  while (req.Status == USBH_BUSY)
+  {
+    USBH_MSC_Async_Process(&hUSB_Host);
+  }
+
+  return req.Status;
+}
+
+/**
+  * @brief  Reads sectors from the drive, through the bounce buffer when the
+  *         OTG DMA cannot use buff
   * @param  lun : lun id
   * @param  *buff: Data buffer to store read data
   * @param  sector: Sector address (LBA)
-  * @param  count: Number of sectors to read (1..128)
-  * @retval DRESULT: Operation result
+  * @param  count: Number of sectors to read
+  * @retval USBH Status
   */
-DRESULT USBH_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+static USBH_StatusTypeDef USBH_ReadSectors(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
-  MSC_LUNTypeDef info;
   USBH_StatusTypeDef  status = USBH_OK;
+  UINT chunk;
 
   if (((DWORD)buff & 3) && (((HCD_HandleTypeDef *)hUSB_Host.pData)->Init.dma_enable))
   {
-    while ((count--)&&(status == USBH_OK))
+    while ((count > 0U) && (status == USBH_OK))
     {
-      status = USBH_MSC_Read(&hUSB_Host, lun, sector + count, (uint8_t *)scratch, 1);
+      chunk = (count > USBH_BOUNCE_SECTORS) ? USBH_BOUNCE_SECTORS : count;
+      status = USBH_Transfer(lun, 0U, (BYTE *)bounce, sector, chunk);
+      cache.Stats.ReadCommands++;
 
       if(status == USBH_OK)
       {
-        memcpy (&buff[count * _MAX_SS] ,scratch, _MAX_SS);
+        memcpy(buff, bounce, chunk * _MAX_SS);
+        buff += chunk * _MAX_SS;
+        sector += chunk;
+        count -= chunk;
       }
-      else
+    }
+  }
+  else
+  {
+    status = USBH_Transfer(lun, 0U, buff, sector, count);
+    cache.Stats.ReadCommands++;
+  }
+
+  return status;
+}
+
+/**
+  * @brief  Writes sectors to the drive, through the bounce buffer when the
+  *         OTG DMA cannot use buff
+  * @param  lun : lun id
+  * @param  *buff: Data to be written
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to write
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_WriteSectors(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
+{
+  USBH_StatusTypeDef  status = USBH_OK;
+  UINT chunk;
+
+  if (((DWORD)buff & 3) && (((HCD_HandleTypeDef *)hUSB_Host.pData)->Init.dma_enable))
+  {
+    while ((count > 0U) && (status == USBH_OK))
+    {
+      chunk = (count > USBH_BOUNCE_SECTORS) ? USBH_BOUNCE_SECTORS : count;
+      memcpy(bounce, buff, chunk * _MAX_SS);
+
+      status = USBH_Transfer(lun, 1U, (BYTE *)bounce, sector, chunk);
+      cache.Stats.WriteCommands++;
+      if(status == USBH_OK)
       {
-        break;
+        buff += chunk * _MAX_SS;
+        sector += chunk;
+        count -= chunk;
       }
     }
   }
   else
   {
-    status = USBH_MSC_Read(&hUSB_Host, lun, sector, buff, count);
+    status = USBH_Transfer(lun, 1U, (BYTE *)buff, sector, count);
+    cache.Stats.WriteCommands++;
   }
 
-  if(status == USBH_OK)
+  return status;
+}
+
+/**
+  * @brief  Converts a failed transfer to a FatFs result, from the sense data
+  * @param  lun : lun id
+  * @retval DRESULT: Operation result
+  */
+static DRESULT USBH_SenseResult(BYTE lun)
+{
+  DRESULT res = RES_ERROR;
+  MSC_LUNTypeDef info;
+
+  USBH_MSC_GetLUNInfo(&hUSB_Host, lun, &info);
+
+  switch (info.sense.asc)
   {
-    res = RES_OK;
+  case SCSI_ASC_WRITE_PROTECTED:
+    USBH_ErrLog("USB Disk is Write protected!");
+    res = RES_WRPRT;
+    break;
+
+  case SCSI_ASC_LOGICAL_UNIT_NOT_READY:
+  case SCSI_ASC_MEDIUM_NOT_PRESENT:
+  case SCSI_ASC_NOT_READY_TO_READY_CHANGE:
+    USBH_ErrLog("USB Disk is not ready!");
+    res = RES_NOTRDY;
+    break;
+
+  default:
+    res = RES_ERROR;
+    break;
   }
-  else
+
+  return res;
+}
+
+/**
+  * @brief  Writes the write-behind run back to the drive. The run is
+  *         dropped even if the write fails, and counted as lost. The error
+  *         is then latched: CTRL_SYNC and every write return it until
+  *         USBH_DiskCache_Invalidate(), FatFs already took the run as
+  *         written.
+  * @param  None
+  * @retval USBH Status
+  */
+static USBH_StatusTypeDef USBH_CacheFlush(void)
+{
+  USBH_StatusTypeDef status = USBH_OK;
+
+  if (cache.WriteCount > 0U)
+  {
+    status = USBH_WriteSectors(cache.WriteLun, (BYTE *)cache.WriteBuf,
+                               cache.WriteSector, cache.WriteCount);
+    cache.Stats.Flushes++;
+    if (status != USBH_OK)
+    {
+      cache.Stats.LostSectors += cache.WriteCount;
+      if (cache.WriteError == RES_OK)
+      {
+        cache.WriteError = USBH_SenseResult(cache.WriteLun);
+      }
+    }
+    cache.WriteCount = 0U;
+  }
+
+  return status;
+}
+
+/**
+  * @brief  Writes dirty sectors back once they are USBH_CACHE_FLUSH_MS old.
+  *         A failure is latched for the next CTRL_SYNC or write.
+  *         Call from the main loop, never from inside a FatFs call.
+  * @param  None
+  * @retval None
+  */
+void USBH_DiskCache_Process(void)
+{
+  if ((cache.WriteCount > 0U) && ((HAL_GetTick() - cache.WriteTick) >= USBH_CACHE_FLUSH_MS))
   {
-    USBH_MSC_GetLUNInfo(&hUSB_Host, lun, &info);
+    (void)USBH_CacheFlush();
+  }
+}
+
+/**
+  * @brief  Empties the cache when the drive is gone. Dirty sectors can no
+  *         longer be written and are counted as lost. Clears the latched
+  *         write error.
+  * @param  None
+  * @retval None
+  */
+void USBH_DiskCache_Invalidate(void)
+{
+  cache.Stats.LostSectors += cache.WriteCount;
+  cache.WriteCount = 0U;
+  cache.ReadCount = 0U;
+  cache.WriteError = RES_OK;
+}
+
+/**
+  * @brief  Forgets the cached copies of sectors about to be written without
+  *         FatFs. A write-behind run over them is written back first, the
+  *         new data then lands on top of it.
+  * @param  lun : lun id
+  * @param  sector: First sector
+  * @param  count: Number of sectors
+  * @retval None
+  */
+void USBH_DiskCache_Discard(BYTE lun, DWORD sector, DWORD count)
+{
+  if ((cache.WriteCount > 0U) && (cache.WriteLun == lun) &&
+      (cache.WriteSector < (sector + count)) && (sector < (cache.WriteSector + cache.WriteCount)))
+  {
+    (void)USBH_CacheFlush();
+  }
+  if ((cache.ReadCount > 0U) && (cache.ReadLun == lun) &&
+      (cache.ReadSector < (sector + count)) && (sector < (cache.ReadSector + cache.ReadCount)))
+  {
+    cache.ReadCount = 0U;
+  }
+}
+
+/**
+  * @brief  Gets the cache statistics
+  * @param  stats: Filled with the counters since power up
+  * @retval None
+  */
+void USBH_DiskCache_GetStats(USBH_DiskCacheStatsTypeDef *stats)
+{
+  *stats = cache.Stats;
+}
+
+/* USER CODE END beforeReadSection */
+
+/**
+  * @brief  Reads Sector(s)
+  * @param  lun : lun id
+  * @param  *buff: Data buffer to store read data
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to read (1..128)
+  * @retval DRESULT: Operation result
+  */
+DRESULT USBH_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+{
+  USBH_StatusTypeDef  status = USBH_OK;
+  MSC_LUNTypeDef info;
+  BYTE seq = (cache.ReadLun == lun) && (sector == cache.NextSector);
+  DWORD end;
+  UINT n;
 
-    switch (info.sense.asc)
+  cache.Stats.ReadSectors += count;
+
+  /* Read the drive's own copy of anything still waiting in the run */
+  if ((cache.WriteCount > 0U) && (cache.WriteLun == lun) &&
+      (sector < (cache.WriteSector + cache.WriteCount)) && ((sector + count) > cache.WriteSector))
+  {
+    status = USBH_CacheFlush();
+  }
+
+  while ((count > 0U) && (status == USBH_OK))
+  {
+    end = cache.ReadSector + cache.ReadCount;
+
+    if ((cache.ReadCount > 0U) && (cache.ReadLun == lun) &&
+        (sector >= cache.ReadSector) && (sector < end))
     {
-    case SCSI_ASC_LOGICAL_UNIT_NOT_READY:
-    case SCSI_ASC_MEDIUM_NOT_PRESENT:
-    case SCSI_ASC_NOT_READY_TO_READY_CHANGE:
-      USBH_ErrLog ("USB Disk is not ready!");
-      res = RES_NOTRDY;
-      break;
-
-    default:
-      res = RES_ERROR;
-      break;
+      /* Hit in the read-ahead window */
+      n = ((end - sector) < count) ? (end - sector) : count;
+      memcpy(buff, &((BYTE *)cache.ReadBuf)[(sector - cache.ReadSector) * _MAX_SS], n * _MAX_SS);
+      cache.Stats.ReadHitSectors += n;
+      seq = 1U;
+    }
+    else if (seq && (count < USBH_CACHE_SECTORS) &&
+             (USBH_MSC_GetLUNInfo(&hUSB_Host, lun, &info) == USBH_OK) && (sector < info.capacity.block_nbr))
+    {
+      /* Sequential: prefetch a whole window, served on the next pass */
+      n = ((info.capacity.block_nbr - sector) < USBH_CACHE_SECTORS) ?
+          (info.capacity.block_nbr - sector) : USBH_CACHE_SECTORS;
+      cache.ReadCount = 0U;
+      status = USBH_ReadSectors(lun, (BYTE *)cache.ReadBuf, sector, n);
+      if (status == USBH_OK)
+      {
+        cache.ReadSector = sector;
+        cache.ReadCount = n;
+        cache.Stats.PrefetchedSectors += n;
+      }
+      continue;
     }
+    else
+    {
+      /* Random or large: straight to the caller's buffer */
+      n = count;
+      status = USBH_ReadSectors(lun, buff, sector, n);
+    }
+
+    buff += n * _MAX_SS;
+    sector += n;
+    count -= n;
   }
 
-  return res;
+  cache.ReadLun = lun;
+  cache.NextSector = sector;
+
+  return (status == USBH_OK) ? RES_OK : USBH_SenseResult(lun);
 }
 
 /* USER CODE BEGIN beforeWriteSection */
@@ -178,58 +459,66 @@ DRESULT USBH_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 #if _USE_WRITE == 1
 DRESULT USBH_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
-  MSC_LUNTypeDef info;
   USBH_StatusTypeDef  status = USBH_OK;
+  UINT limit;
+  UINT n;
 
-  if (((DWORD)buff & 3) && (((HCD_HandleTypeDef *)hUSB_Host.pData)->Init.dma_enable))
+  cache.Stats.WriteSectors += count;
+
+  /* A lost run left the volume inconsistent, do not build on it */
+  if (cache.WriteError != RES_OK)
   {
+    return cache.WriteError;
+  }
 
-    while (count--)
+  /* The read-ahead window must not hold stale copies */
+  if ((cache.ReadCount > 0U) && (cache.ReadLun == lun) &&
+      (sector < (cache.ReadSector + cache.ReadCount)) && ((sector + count) > cache.ReadSector))
+  {
+    cache.ReadCount = 0U;
+  }
+
+  while ((count > 0U) && (status == USBH_OK))
+  {
+    if ((cache.WriteCount > 0U) &&
+        ((cache.WriteLun != lun) || (sector != (cache.WriteSector + cache.WriteCount))))
     {
-      memcpy (scratch, &buff[count * _MAX_SS], _MAX_SS);
+      status = USBH_CacheFlush();
+      continue;
+    }
 
-      status = USBH_MSC_Write(&hUSB_Host, lun, sector + count, (BYTE *)scratch, 1) ;
-      if(status == USBH_FAIL)
+    if (cache.WriteCount == 0U)
+    {
+      if (count >= USBH_CACHE_SECTORS)
       {
+        /* Already a large run, no point copying it */
+        status = USBH_WriteSectors(lun, buff, sector, count);
         break;
       }
+      cache.WriteLun = lun;
+      cache.WriteSector = sector;
+      cache.WriteTick = HAL_GetTick();
     }
-  }
-  else
-  {
-    status = USBH_MSC_Write(&hUSB_Host, lun, sector, (BYTE *)buff, count);
-  }
-
-  if(status == USBH_OK)
-  {
-    res = RES_OK;
-  }
-  else
-  {
-    USBH_MSC_GetLUNInfo(&hUSB_Host, lun, &info);
 
-    switch (info.sense.asc)
+    /* Runs never cross a USBH_CACHE_SECTORS boundary, so the sequential
+       ones are flushed as aligned blocks */
+    limit = USBH_CACHE_SECTORS - (cache.WriteSector % USBH_CACHE_SECTORS);
+    n = limit - cache.WriteCount;
+    n = (count < n) ? count : n;
+    memcpy(&((BYTE *)cache.WriteBuf)[cache.WriteCount * _MAX_SS], buff, n * _MAX_SS);
+    cache.WriteCount += n;
+    cache.Stats.WriteCachedSectors += n;
+    buff += n * _MAX_SS;
+    sector += n;
+    count -= n;
+
+    if (cache.WriteCount == limit)
     {
-    case SCSI_ASC_WRITE_PROTECTED:
-      USBH_ErrLog("USB Disk is Write protected!");
-      res = RES_WRPRT;
-      break;
-
-    case SCSI_ASC_LOGICAL_UNIT_NOT_READY:
-    case SCSI_ASC_MEDIUM_NOT_PRESENT:
-    case SCSI_ASC_NOT_READY_TO_READY_CHANGE:
-      USBH_ErrLog("USB Disk is not ready!");
-      res = RES_NOTRDY;
-      break;
-
-    default:
-      res = RES_ERROR;
-      break;
+      status = USBH_CacheFlush();
     }
   }
 
-  return res;
+  return (status == USBH_OK) ? RES_OK : USBH_SenseResult(lun);
 }
 #endif /* _USE_WRITE == 1 */
 
@@ -254,7 +543,8 @@ DRESULT USBH_ioctl(BYTE lun, BYTE cmd, void *buff)
   {
   /* Make sure that no pending write process */
   case CTRL_SYNC:
-    res = RES_OK;
+    (void)USBH_CacheFlush();
+    res = cache.WriteError;
     break;
 
   /* Get number of sectors on the disk (DWORD) */
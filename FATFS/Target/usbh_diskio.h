@@ -34,6 +34,26 @@ extern const Diskio_drvTypeDef  USBH_Driver;
 
 /* USER CODE BEGIN lastSection */
 /* can be used to modify / undefine previous code or add new definitions */
+
+/* Block cache counters, in sectors unless noted */
+typedef struct
+{
+  uint32_t ReadSectors;                 /* Asked for by FatFs */
+  uint32_t ReadHitSectors;              /* Served from the read-ahead window */
+  uint32_t PrefetchedSectors;           /* Read into the window */
+  uint32_t ReadCommands;                /* SCSI READ commands sent */
+  uint32_t WriteSectors;                /* Given by FatFs */
+  uint32_t WriteCachedSectors;          /* Gathered in the write-behind run */
+  uint32_t WriteCommands;               /* SCSI WRITE commands sent */
+  uint32_t Flushes;                     /* Write-behind runs written back */
+  uint32_t LostSectors;                 /* Dirty, dropped on error or removal */
+} USBH_DiskCacheStatsTypeDef;
+
+void USBH_DiskCache_Process(void);
+void USBH_DiskCache_Invalidate(void);
+void USBH_DiskCache_Discard(BYTE lun, DWORD sector, DWORD count);
+void USBH_DiskCache_GetStats(USBH_DiskCacheStatsTypeDef *stats);
+
 /* USER CODE END lastSection */
 
 #endif /* __USBH_DISKIO_H */
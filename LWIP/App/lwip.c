@@ -28,6 +28,9 @@
 #include "ethernetif.h"
 
 /* USER CODE BEGIN 0 */
+#include "netif/slipif.h"
+#include "serialif.h"
+#include "usbncmif.h"
 
 /* USER CODE END 0 */
 /* Private function prototypes -----------------------------------------------*/
@@ -51,6 +54,68 @@ ip4_addr_t netmask;
 ip4_addr_t gw;
 
 /* USER CODE BEGIN 2 */
+struct netif slipnetif;
+
+/**
+  * @brief  Add the SLIP interface on the DB9 serial port (USART1)
+  * @note   Must be called after MX_LWIP_Init(). The link is point to point,
+  *         the host end is expected at SLIP_PEER_ADDR.
+  * @retval ERR_OK, or ERR_IF if the serial port could not be opened
+  */
+err_t MX_LWIP_SLIP_Init(void)
+{
+  ip4_addr_t slip_ipaddr;
+  ip4_addr_t slip_netmask;
+  ip4_addr_t slip_gw;
+
+  IP4_ADDR(&slip_ipaddr, SLIP_IP_ADDR0, SLIP_IP_ADDR1, SLIP_IP_ADDR2, SLIP_IP_ADDR3);
+  IP4_ADDR(&slip_netmask, 255, 255, 255, 0);
+  IP4_ADDR(&slip_gw, SLIP_PEER_ADDR0, SLIP_PEER_ADDR1, SLIP_PEER_ADDR2, SLIP_PEER_ADDR3);
+
+  /* netif->state selects the sio device number */
+  if (netif_add(&slipnetif, &slip_ipaddr, &slip_netmask, &slip_gw, (void *)0, &slipif_init, &ip_input) == NULL)
+  {
+    return ERR_IF;
+  }
+
+  netif_set_link_up(&slipnetif);
+  netif_set_up(&slipnetif);
+
+  return ERR_OK;
+}
+
+struct netif ncmnetif;
+
+/**
+  * @brief  Add the USB CDC-NCM interface (USB Ethernet adapter for the host)
+  * @note   Must be called after MX_LWIP_Init(). The link is point to point,
+  *         the host end is expected at NCM_PEER_ADDR. The link goes up when
+  *         the host enables the NCM data interface.
+  * @retval ERR_OK, or ERR_IF if the interface could not be added
+  */
+err_t MX_LWIP_NCM_Init(void)
+{
+  ip4_addr_t ncm_ipaddr;
+  ip4_addr_t ncm_netmask;
+  ip4_addr_t ncm_gw;
+
+  IP4_ADDR(&ncm_ipaddr, NCM_IP_ADDR0, NCM_IP_ADDR1, NCM_IP_ADDR2, NCM_IP_ADDR3);
+  IP4_ADDR(&ncm_netmask, 255, 255, 255, 0);
+  IP4_ADDR(&ncm_gw, NCM_PEER_ADDR0, NCM_PEER_ADDR1, NCM_PEER_ADDR2, NCM_PEER_ADDR3);
+
+  if (netif_add(&ncmnetif, &ncm_ipaddr, &ncm_netmask, &ncm_gw, NULL, &usbncmif_init, &ethernet_input) == NULL)
+  {
+    return ERR_IF;
+  }
+
+  /* Every USB packet is CRC protected, only generate the checksums */
+  NETIF_SET_CHECKSUM_CTRL(&ncmnetif, NETIF_CHECKSUM_GEN_IP | NETIF_CHECKSUM_GEN_UDP |
+                                     NETIF_CHECKSUM_GEN_TCP | NETIF_CHECKSUM_GEN_ICMP |
+                                     NETIF_CHECKSUM_GEN_ICMP6);
+  netif_set_up(&ncmnetif);
+
+  return ERR_OK;
+}
 
 /* USER CODE END 2 */
 
@@ -93,6 +158,10 @@ void MX_LWIP_Init(void)
   dhcp_start(&gnetif);
 
 /* USER CODE BEGIN 3 */
+  /* Checksums are verified by the MAC, only generate them in software */
+  NETIF_SET_CHECKSUM_CTRL(&gnetif, NETIF_CHECKSUM_GEN_IP | NETIF_CHECKSUM_GEN_UDP |
+                                   NETIF_CHECKSUM_GEN_TCP | NETIF_CHECKSUM_GEN_ICMP |
+                                   NETIF_CHECKSUM_GEN_ICMP6);
 
 /* USER CODE END 3 */
 }
@@ -138,6 +207,14 @@ static void Ethernet_Link_Periodic_Handle(struct netif *netif)
 void MX_LWIP_Process(void)
 {
 /* USER CODE BEGIN 4_1 */
+  if (netif_is_up(&slipnetif))
+  {
+    serialif_input(&slipnetif);
+  }
+  if (netif_is_up(&ncmnetif))
+  {
+    usbncmif_input(&ncmnetif);
+  }
 /* USER CODE END 4_1 */
   ethernetif_input(&gnetif);
 
@@ -42,6 +42,28 @@
 
 /* USER CODE BEGIN 0 */
 
+/* SLIP interface on the DB9 serial port: board and host addresses */
+#define SLIP_IP_ADDR0   192
+#define SLIP_IP_ADDR1   168
+#define SLIP_IP_ADDR2   7
+#define SLIP_IP_ADDR3   2
+
+#define SLIP_PEER_ADDR0 192
+#define SLIP_PEER_ADDR1 168
+#define SLIP_PEER_ADDR2 7
+#define SLIP_PEER_ADDR3 1
+
+/* USB CDC-NCM interface: board and host addresses */
+#define NCM_IP_ADDR0    192
+#define NCM_IP_ADDR1    168
+#define NCM_IP_ADDR2    8
+#define NCM_IP_ADDR3    2
+
+#define NCM_PEER_ADDR0  192
+#define NCM_PEER_ADDR1  168
+#define NCM_PEER_ADDR2  8
+#define NCM_PEER_ADDR3  1
+
 /* USER CODE END 0 */
 
 /* Global Variables ----------------------------------------------------------*/
@@ -59,6 +81,12 @@ void MX_LWIP_Init(void);
  */
 void MX_LWIP_Process(void);
 
+/* SLIP interface on USART1, next to the Ethernet interface */
+err_t MX_LWIP_SLIP_Init(void);
+
+/* USB CDC-NCM interface, next to the Ethernet interface */
+err_t MX_LWIP_NCM_Init(void);
+
 /* USER CODE END 1 */
 #endif /* WITH_RTOS */
 
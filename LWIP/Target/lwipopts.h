@@ -96,6 +96,23 @@
 /*-----------------------------------------------------------------------------*/
 /* USER CODE BEGIN 1 */
 
+/* SLIP interface on USART1 (serialif.c): bytes are pushed to slipif in blocks
+   from the DMA ring and each packet is passed up as soon as it completes */
+#define SLIP_RX_FROM_ISR 1
+#define SLIP_RX_QUEUE 0
+
+/* The Ethernet MAC checks the checksums in hardware, the SLIP link does not.
+   Checking is compiled in and switched off on the Ethernet interface only. */
+#define LWIP_CHECKSUM_CTRL_PER_NETIF 1
+#undef CHECKSUM_CHECK_IP
+#define CHECKSUM_CHECK_IP 1
+#undef CHECKSUM_CHECK_UDP
+#define CHECKSUM_CHECK_UDP 1
+#undef CHECKSUM_CHECK_TCP
+#define CHECKSUM_CHECK_TCP 1
+#undef CHECKSUM_CHECK_ICMP
+#define CHECKSUM_CHECK_ICMP 1
+
 /* USER CODE END 1 */
 
 #ifdef __cplusplus
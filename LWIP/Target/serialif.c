@@ -0,0 +1,234 @@
+/**
+  ******************************************************************************
+  * @file    serialif.c
+  * @brief   LwIP serial I/O (sio) port on USART1 for the SLIP interface.
+  *
+  *          Reception runs into a circular DMA ring. serialif_input() hands
+  *          the ring to slipif in blocks (SLIP_RX_FROM_ISR), up to and
+  *          including each END delimiter, and passes every completed packet
+  *          up right away, so no per-byte sio_read() polling is involved.
+  *
+  *          sio_send() only stores into a transmission ring. The DMA is
+  *          started when a packet is complete (END after data) and then
+  *          chains itself from the transmit complete interrupt until the
+  *          ring is empty.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "lwip/opt.h"
+#include "lwip/sio.h"
+#include "netif/slipif.h"
+#include "serialif.h"
+#include "uart_dma.h"
+#include "usart.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define SLIP_END          0xC0U
+#define SLIP_RX_CHUNK     255U  /* slipif_received_bytes() takes a u8_t length */
+
+/* Private variables ---------------------------------------------------------*/
+static UART_DMA_HandleTypeDef hsio;
+static uint8_t rx_ring[SERIALIF_RX_RING];
+
+static uint8_t tx_ring[SERIALIF_TX_RING];
+static volatile uint16_t tx_head;     /* Next free byte, written by sio_send() */
+static volatile uint16_t tx_tail;     /* First byte not yet transmitted */
+static volatile uint16_t tx_dma_len;  /* Bytes from tx_tail owned by the DMA */
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Hand the next contiguous run of the transmission ring to the DMA
+  * @note   Called with interrupts masked or from the Tx complete interrupt.
+  * @retval None
+  */
+static void serialif_tx_kick(void)
+{
+  uint16_t head = tx_head;
+  uint16_t tail = tx_tail;
+  uint16_t len;
+
+  if ((tx_dma_len != 0U) || (head == tail))
+  {
+    return;
+  }
+
+  len = (head > tail) ? (head - tail) : (SERIALIF_TX_RING - tail);
+  if (UART_DMA_Transmit(&hsio, &tx_ring[tail], len) == HAL_OK)
+  {
+    tx_dma_len = len;
+  }
+}
+
+/**
+  * @brief  Start the transmission DMA if it is idle
+  * @retval None
+  */
+static void serialif_tx_start(void)
+{
+  __disable_irq();
+  serialif_tx_kick();
+  __enable_irq();
+}
+
+/**
+  * @brief  UART DMA transmit complete, release the run and chain the next one
+  * @param  hud: UART DMA handle
+  * @retval None
+  */
+static void serialif_tx_cplt(UART_DMA_HandleTypeDef *hud)
+{
+  UNUSED(hud);
+
+  tx_tail = (uint16_t)((tx_tail + tx_dma_len) % SERIALIF_TX_RING);
+  tx_dma_len = 0;
+  serialif_tx_kick();
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+ * Opens a serial device for communication.
+ *
+ * @param devnum device number, only 0 (USART1) is available
+ * @return handle to serial device if successful, NULL otherwise
+ */
+sio_fd_t sio_open(u8_t devnum)
+{
+  if (devnum != 0U)
+  {
+    return NULL;
+  }
+
+  huart1.Init.BaudRate = SERIALIF_BAUDRATE;
+  if (HAL_UART_Init(&huart1) != HAL_OK)
+  {
+    return NULL;
+  }
+
+  hsio.huart = &huart1;
+  hsio.RxBuf = rx_ring;
+  hsio.RxSize = SERIALIF_RX_RING;
+  hsio.TxCpltCallback = serialif_tx_cplt;
+  tx_head = 0;
+  tx_tail = 0;
+  tx_dma_len = 0;
+
+  if (UART_DMA_Start(&hsio) != HAL_OK)
+  {
+    return NULL;
+  }
+  return &hsio;
+}
+
+/**
+ * Sends a single character to the serial device.
+ *
+ * @param c character to send
+ * @param fd serial device handle
+ *
+ * @note This function only blocks while the transmission ring is full.
+ */
+void sio_send(u8_t c, sio_fd_t fd)
+{
+  uint16_t head = tx_head;
+  uint16_t next = (uint16_t)((head + 1U) % SERIALIF_TX_RING);
+
+  LWIP_UNUSED_ARG(fd);
+
+  while (next == tx_tail)
+  {
+    serialif_tx_start();
+  }
+
+  tx_ring[head] = c;
+  tx_head = next;
+
+  /* A lone END is the leading delimiter of a packet, wait for the rest */
+  if ((c == SLIP_END) && (((next + SERIALIF_TX_RING - tx_tail) % SERIALIF_TX_RING) > 1U))
+  {
+    serialif_tx_start();
+  }
+}
+
+/**
+ * Tries to read from the serial device. Returns immediately if no data is
+ * available and never blocks.
+ *
+ * @param fd serial device handle
+ * @param data pointer to data buffer for receiving
+ * @param len maximum length (in bytes) of data to receive
+ * @return number of bytes actually received
+ */
+u32_t sio_tryread(sio_fd_t fd, u8_t *data, u32_t len)
+{
+  UART_DMA_HandleTypeDef *hud = (UART_DMA_HandleTypeDef *)fd;
+  u32_t recved_bytes = 0;
+  uint8_t *src;
+  uint16_t n;
+
+  while (recved_bytes < len)
+  {
+    n = UART_DMA_RxPeek(hud, &src);
+    if (n == 0U)
+    {
+      break;
+    }
+    if (n > (len - recved_bytes))
+    {
+      n = (uint16_t)(len - recved_bytes);
+    }
+    memcpy(&data[recved_bytes], src, n);
+    UART_DMA_RxConsume(hud, n);
+    recved_bytes += n;
+  }
+  return recved_bytes;
+}
+
+/**
+  * @brief  Pass the bytes received on the serial port to a SLIP interface
+  * @note   Call from the main loop. Only the bytes present on entry are
+  *         processed, so a busy line cannot starve the rest of the loop.
+  * @param  netif: SLIP interface opened on sio device 0
+  * @retval None
+  */
+void serialif_input(struct netif *netif)
+{
+  uint16_t avail = UART_DMA_RxAvailable(&hsio);
+  uint8_t *data;
+  uint8_t *end;
+  uint16_t len;
+
+  while (avail != 0U)
+  {
+    len = UART_DMA_RxPeek(&hsio, &data);
+    if (len > avail)
+    {
+      len = avail;
+    }
+    if (len > SLIP_RX_CHUNK)
+    {
+      len = SLIP_RX_CHUNK;
+    }
+
+    /* END is never escaped: stop after it so that the packet it completes
+       is delivered before the next one is assembled */
+    end = memchr(data, SLIP_END, len);
+    if (end != NULL)
+    {
+      len = (uint16_t)(end - data + 1);
+    }
+
+    slipif_received_bytes(netif, data, (u8_t)len);
+    UART_DMA_RxConsume(&hsio, len);
+    avail -= len;
+
+    if (end != NULL)
+    {
+      slipif_process_rxqueue(netif);
+    }
+  }
+}
@@ -0,0 +1,22 @@
+/**
+  ******************************************************************************
+  * @file    serialif.h
+  * @brief   LwIP serial I/O (sio) port on USART1 for the SLIP interface.
+  ******************************************************************************
+  */
+
+#ifndef __SERIALIF_H__
+#define __SERIALIF_H__
+
+#include "lwip/err.h"
+#include "lwip/netif.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define SERIALIF_BAUDRATE   2000000U  /* Up to 5250000 with USART1 on APB2 */
+#define SERIALIF_RX_RING    4096U     /* Circular DMA reception ring */
+#define SERIALIF_TX_RING    4096U     /* Transmission ring, drained by DMA */
+
+/* Exported functions ------------------------------------------------------- */
+void serialif_input(struct netif *netif);
+
+#endif /* __SERIALIF_H__ */
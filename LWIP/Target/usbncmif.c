@@ -0,0 +1,127 @@
+/**
+  ******************************************************************************
+  * @file    usbncmif.c
+  * @brief   LwIP network interface on the USB CDC-NCM function.
+  *
+  *          Frames to send are copied from the pbuf chain straight into the
+  *          NTB being filled by usbd_ncm.c. Received frames are read in
+  *          place from the received NTB and copied once into a pool pbuf.
+  *          The link follows the host enabling the NCM data interface.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "lwip/opt.h"
+#include "lwip/pbuf.h"
+#include "netif/etharp.h"
+#include "usbncmif.h"
+#include "usbd_ncm.h"
+
+/* Private define ------------------------------------------------------------*/
+#define IFNAME0 'u'
+#define IFNAME1 's'
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Queue a frame for the host
+  * @param  netif: the NCM network interface
+  * @param  p: the frame, a pbuf chain
+  * @retval ERR_OK, or ERR_IF if the frame could not be queued
+  */
+static err_t low_level_output(struct netif *netif, struct pbuf *p)
+{
+  uint8_t *buf;
+
+  LWIP_UNUSED_ARG(netif);
+
+  buf = USBD_NCM_TxAlloc(p->tot_len);
+  if (buf == NULL)
+  {
+    return ERR_IF;
+  }
+  (void)pbuf_copy_partial(p, buf, p->tot_len, 0);
+  USBD_NCM_TxCommit(p->tot_len);
+  return ERR_OK;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Set up the NCM network interface, to be passed to netif_add()
+  * @param  netif: the lwip network interface structure
+  * @retval ERR_OK
+  */
+err_t usbncmif_init(struct netif *netif)
+{
+  LWIP_ASSERT("netif != NULL", (netif != NULL));
+
+#if LWIP_NETIF_HOSTNAME
+  netif->hostname = "lwip";
+#endif /* LWIP_NETIF_HOSTNAME */
+
+  netif->name[0] = IFNAME0;
+  netif->name[1] = IFNAME1;
+  netif->output = etharp_output;
+  netif->linkoutput = low_level_output;
+
+  netif->hwaddr_len = ETH_HWADDR_LEN;
+  USBD_NCM_GetMacAddress(netif->hwaddr, 0U);
+  netif->mtu = NCM_MAX_SEGMENT_SIZE - SIZEOF_ETH_HDR;
+  netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET;
+
+  return ERR_OK;
+}
+
+/**
+  * @brief  Track the USB link and pass the frames received from the host up
+  * @note   Call from the main loop. At most USBNCMIF_RX_BURST frames are
+  *         handled per call, so a busy link cannot starve the rest of the loop.
+  * @param  netif: the NCM network interface
+  * @retval None
+  */
+void usbncmif_input(struct netif *netif)
+{
+  const uint8_t *frame;
+  struct pbuf *p;
+  uint16_t len;
+  uint32_t n;
+
+  if (USBD_NCM_IsUp() != 0U)
+  {
+    if (!netif_is_link_up(netif))
+    {
+      netif_set_link_up(netif);
+    }
+  }
+  else
+  {
+    if (netif_is_link_up(netif))
+    {
+      netif_set_link_down(netif);
+    }
+    return;
+  }
+
+  for (n = 0U; n < USBNCMIF_RX_BURST; n++)
+  {
+    len = USBD_NCM_GetFrame(&frame);
+    if (len == 0U)
+    {
+      break;
+    }
+
+    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+    if (p == NULL)
+    {
+      /* Dropped, like the MAC does when it runs out of descriptors */
+      continue;
+    }
+    (void)pbuf_take(p, frame, len);
+    if (netif->input(p, netif) != ERR_OK)
+    {
+      pbuf_free(p);
+    }
+  }
+}
@@ -0,0 +1,21 @@
+/**
+  ******************************************************************************
+  * @file    usbncmif.h
+  * @brief   LwIP network interface on the USB CDC-NCM function.
+  ******************************************************************************
+  */
+
+#ifndef __USBNCMIF_H__
+#define __USBNCMIF_H__
+
+#include "lwip/err.h"
+#include "lwip/netif.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define USBNCMIF_RX_BURST   16U   /* Frames passed up per usbncmif_input() */
+
+/* Exported functions ------------------------------------------------------- */
+err_t usbncmif_init(struct netif *netif);
+void usbncmif_input(struct netif *netif);
+
+#endif /* __USBNCMIF_H__ */
@@ -56,6 +56,11 @@ EndBSPDependencies */
 /** @defgroup USBH_MSC_BOT_Private_Defines
   * @{
   */
+/* Packets per data IN URB, the HCD channel limit. IN NAKs are retried by
+   the core, so a whole chunk completes without software help. OUT stays
+   one packet per URB: a NAK halts the channel without telling how many
+   packets were already taken. */
+#define BOT_DATA_IN_MAX_PACKETS      256U
 /**
   * @}
   */
@@ -82,6 +87,7 @@ EndBSPDependencies */
   */
 static USBH_StatusTypeDef USBH_MSC_BOT_Abort(USBH_HandleTypeDef *phost, uint8_t lun, uint8_t dir);
 static BOT_CSWStatusTypeDef USBH_MSC_DecodeCSW(USBH_HandleTypeDef *phost);
+static uint32_t USBH_MSC_BOT_DataInLength(MSC_HandleTypeDef *MSC_Handle);
 /**
   * @}
   */
@@ -99,6 +105,26 @@ static BOT_CSWStatusTypeDef USBH_MSC_DecodeCSW(USBH_HandleTypeDef *phost);
   * @{
   */
 
+/**
+  * @brief  USBH_MSC_BOT_DataInLength
+  *         Length of the next data IN URB
+  * @param  MSC_Handle: MSC handle
+  * @retval Bytes, up to BOT_DATA_IN_MAX_PACKETS packets
+  */
+static uint32_t USBH_MSC_BOT_DataInLength(MSC_HandleTypeDef *MSC_Handle)
+{
+  uint32_t max = (uint32_t)MSC_Handle->InEpSize * BOT_DATA_IN_MAX_PACKETS;
+
+  /* URB lengths are 16 bit */
+  if (max > 0xFFFFU)
+  {
+    max = (0xFFFFU / MSC_Handle->InEpSize) * MSC_Handle->InEpSize;
+  }
+
+  return (MSC_Handle->hbot.cbw.field.DataTransferLength > max) ?
+         max : MSC_Handle->hbot.cbw.field.DataTransferLength;
+}
+
 /**
   * @brief  USBH_MSC_BOT_REQ_Reset
   *         The function the MSC BOT Reset request.
@@ -177,6 +203,9 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
   USBH_URBStateTypeDef URB_Status = USBH_URB_IDLE;
   MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *) phost->pActiveClass->pData;
   uint8_t toggle = 0U;
+  uint32_t requested;
+  uint32_t received;
+  uint32_t packets;
 
   switch (MSC_Handle->hbot.state)
   {
@@ -199,20 +228,27 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
           /* If there is Data Transfer Stage */
           if (((MSC_Handle->hbot.cbw.field.Flags) & USB_REQ_DIR_MASK) == USB_D2H)
           {
-            /* Data Direction is IN */
-            MSC_Handle->hbot.state = BOT_DATA_IN;
+            /* Data Direction is IN, start it without waiting for the next call */
+            (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.pbuf,
+                                       (uint16_t)USBH_MSC_BOT_DataInLength(MSC_Handle),
+                                       MSC_Handle->InPipe);
+            MSC_Handle->hbot.state = BOT_DATA_IN_WAIT;
           }
           else
           {
             /* Data Direction is OUT */
-            MSC_Handle->hbot.state = BOT_DATA_OUT;
+            (void)USBH_BulkSendData(phost, MSC_Handle->hbot.pbuf,
+                                    MSC_Handle->OutEpSize, MSC_Handle->OutPipe, 1U);
+            MSC_Handle->hbot.state = BOT_DATA_OUT_WAIT;
           }
         }
 
         else
         {
           /* If there is NO Data Transfer Stage */
-          MSC_Handle->hbot.state = BOT_RECEIVE_CSW;
+          (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.csw.data,
+                                     BOT_CSW_LENGTH, MSC_Handle->InPipe);
+          MSC_Handle->hbot.state = BOT_RECEIVE_CSW_WAIT;
         }
 
 #if (USBH_USE_OS == 1U)
@@ -257,9 +293,10 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
       break;
 
     case BOT_DATA_IN:
-      /* Send first packet */
+      /* Send first chunk */
       (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.pbuf,
-                                 MSC_Handle->InEpSize, MSC_Handle->InPipe);
+                                 (uint16_t)USBH_MSC_BOT_DataInLength(MSC_Handle),
+                                 MSC_Handle->InPipe);
 
       MSC_Handle->hbot.state = BOT_DATA_IN_WAIT;
 
@@ -271,13 +308,32 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
 
       if (URB_Status == USBH_URB_DONE)
       {
-        /* Adjust Data pointer and data length */
-        if (MSC_Handle->hbot.cbw.field.DataTransferLength > MSC_Handle->InEpSize)
+        requested = USBH_MSC_BOT_DataInLength(MSC_Handle);
+        received = USBH_LL_GetLastXferSize(phost, MSC_Handle->InPipe);
+        if (received > requested)
         {
-          MSC_Handle->hbot.pbuf += MSC_Handle->InEpSize;
-          MSC_Handle->hbot.cbw.field.DataTransferLength -= MSC_Handle->InEpSize;
+          received = requested;
         }
-        else
+
+        /* A short packet ends the data stage early */
+        if ((received < requested) &&
+            (((HCD_HandleTypeDef *)phost->pData)->Init.dma_enable != 0U))
+        {
+          /* With DMA the HCD toggled as if every packet of the URB came,
+             correct it for the packets that actually did */
+          packets = (received + MSC_Handle->InEpSize - 1U) / MSC_Handle->InEpSize;
+          packets = (packets == 0U) ? 1U : packets;
+          if (((packets ^ ((requested + MSC_Handle->InEpSize - 1U) / MSC_Handle->InEpSize)) & 1U) != 0U)
+          {
+            toggle = USBH_LL_GetToggle(phost, MSC_Handle->InPipe);
+            (void)USBH_LL_SetToggle(phost, MSC_Handle->InPipe, 1U - toggle);
+          }
+        }
+
+        /* Adjust Data pointer and data length */
+        MSC_Handle->hbot.pbuf += received;
+        MSC_Handle->hbot.cbw.field.DataTransferLength -= received;
+        if (received < requested)
         {
           MSC_Handle->hbot.cbw.field.DataTransferLength = 0U;
         }
@@ -285,14 +341,17 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
         /* More Data To be Received */
         if (MSC_Handle->hbot.cbw.field.DataTransferLength > 0U)
         {
-          /* Send next packet */
+          /* Send next chunk */
           (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.pbuf,
-                                     MSC_Handle->InEpSize, MSC_Handle->InPipe);
+                                     (uint16_t)USBH_MSC_BOT_DataInLength(MSC_Handle),
+                                     MSC_Handle->InPipe);
         }
         else
         {
-          /* If value was 0, and successful transfer, then change the state */
-          MSC_Handle->hbot.state  = BOT_RECEIVE_CSW;
+          /* If value was 0, and successful transfer, start the status stage */
+          (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.csw.data,
+                                     BOT_CSW_LENGTH, MSC_Handle->InPipe);
+          MSC_Handle->hbot.state  = BOT_RECEIVE_CSW_WAIT;
 
 #if (USBH_USE_OS == 1U)
           phost->os_msg = (uint32_t)USBH_URB_EVENT;
@@ -362,8 +421,10 @@ USBH_StatusTypeDef USBH_MSC_BOT_Process(USBH_HandleTypeDef *phost, uint8_t lun)
         }
         else
         {
-          /* If value was 0, and successful transfer, then change the state */
-          MSC_Handle->hbot.state  = BOT_RECEIVE_CSW;
+          /* If value was 0, and successful transfer, start the status stage */
+          (void)USBH_BulkReceiveData(phost, MSC_Handle->hbot.csw.data,
+                                     BOT_CSW_LENGTH, MSC_Handle->InPipe);
+          MSC_Handle->hbot.state  = BOT_RECEIVE_CSW_WAIT;
         }
 
 #if (USBH_USE_OS == 1U)
@@ -589,6 +589,34 @@ static WCHAR LfnBuf[_MAX_LFN + 1];	/* LFN enabled with static working buffer */
 #endif
 #endif	/* else _USE_LFN == 0 */
 
+#if _USE_DIRINDEX
+#if _USE_LFN == 0
+#error _USE_DIRINDEX needs LFN enabled
+#endif
+#ifndef _DIRINDEX_ATTR
+#define _DIRINDEX_ATTR
+#endif
+typedef struct {
+	WORD	hash;		/* Hash of the LFN, or of the SFN if none */
+	WORD	shash;		/* Hash of the SFN */
+	WORD	idx;		/* Index of the SFN entry in the directory */
+} DIXENT;
+
+typedef struct {
+	FATFS*	fs;			/* File system object (NULL:unused slot) */
+	WORD	id;			/* Volume mount ID of the index */
+	DWORD	sclust;		/* Directory start cluster (0:root) */
+	DWORD	stamp;		/* Last use */
+	UINT	nent;		/* Number of items in the index */
+	DWORD	next;		/* Index of the first entry not indexed */
+	BYTE	full;		/* The directory has more items than the index can hold */
+} DIRIDX;
+
+static DIRIDX DirIdx[_DIRINDEX_DIRS];	/* Directory name index slots */
+static DIXENT DixEnt[_DIRINDEX_DIRS][_DIRINDEX_ENTRIES] _DIRINDEX_ATTR;	/* Index items of each slot */
+static DWORD DixStamp;
+#endif
+
 #ifdef _EXCVT
 static const BYTE ExCvt[] = _EXCVT;	/* Upper conversion table for SBCS extended characters */
 #endif
@@ -2203,12 +2231,13 @@ FRESULT dir_read (
 
 
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Find an object in the directory                  */
+/* Directory handling - Match the file name in a range of the directory  */
 /*-----------------------------------------------------------------------*/
 
 static
-FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp			/* Pointer to the directory object with the file name */
+FRESULT dir_match (	/* FR_OK(0):found, FR_NO_FILE:not in the range, !=0:error */
+	DIR* dp,		/* Pointer to the directory object at the first entry to search */
+	DWORD last		/* Offset of the last entry to search */
 )
 {
 	FRESULT res;
@@ -2218,29 +2247,6 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE a, ord, sum;
 #endif
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
-#if _FS_EXFAT
-	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
-		BYTE nc;
-		UINT di, ni;
-		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
-
-		while ((res = dir_read(dp, 0)) == FR_OK) {	/* Read an item */
-#if _MAX_LFN < 255
-			if (fs->dirbuf[XDIR_NumName] > _MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
-#endif
-			if (ld_word(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
-			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
-				if ((di % SZDIRE) == 0) di += 2;
-				if (ff_wtoupper(ld_word(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
-			}
-			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
-		}
-		return res;
-	}
-#endif
-	/* On the FAT12/16/32 volume */
 #if _USE_LFN != 0
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
@@ -2274,6 +2280,7 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
 		if (!(dp->dir[DIR_Attr] & AM_VOL) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
 #endif
+		if (dp->dptr >= last) { res = FR_NO_FILE; break; }	/* Reached to end of the range */
 		res = dir_next(dp, 0);	/* Next entry */
 	} while (res == FR_OK);
 
@@ -2283,6 +2290,225 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+#if _USE_DIRINDEX
+/*-----------------------------------------------------------------------*/
+/* Directory index - Hashed names of the recently searched directories   */
+/*-----------------------------------------------------------------------*/
+
+#define DIX_LFN_ENT	20	/* LFN entries of the longest name, ((_MAX_LFN + 12) / 13) at 255 */
+
+static
+DWORD dix_mix (		/* Hash of a name character, a name hashes to the sum of its characters */
+	WCHAR wc,		/* Character */
+	UINT pos		/* Position in the name */
+)
+{
+	DWORD x;
+
+	x = ((DWORD)ff_wtoupper(wc) | (DWORD)pos << 16) * 0x9E3779B1;
+	return x ^ x >> 15;
+}
+
+
+static
+WORD dix_fold (		/* 16-bit hash */
+	DWORD h			/* 32-bit hash */
+)
+{
+	return (WORD)(h ^ h >> 16);
+}
+
+
+static
+WORD dix_sfn (		/* Hash of an SFN */
+	const BYTE* sfn	/* SFN in directory form (11 bytes) */
+)
+{
+	DWORD h = 2166136261;
+	UINT i;
+
+	for (i = 0; i < 11; i++) h = (h ^ sfn[i]) * 16777619;	/* FNV-1a */
+	return dix_fold(h);
+}
+
+
+static
+void dix_drop (		/* Forget the index of a directory about to be changed */
+	FATFS* fs,		/* File system object */
+	DWORD sclust	/* Directory start cluster (0:root) */
+)
+{
+	UINT i;
+
+	for (i = 0; i < _DIRINDEX_DIRS; i++) {
+		if (DirIdx[i].fs == fs && DirIdx[i].sclust == sclust) DirIdx[i].fs = 0;
+	}
+}
+
+
+static
+FRESULT dix_build (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,		/* Directory to index */
+	DIRIDX* di		/* Slot to fill */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DIXENT *ent = DixEnt[di - DirIdx];
+	BYTE c, a, ord = 0xFF, sum = 0xFF;
+	WCHAR wc;
+	DWORD h = 0;
+	UINT n = 0, i, s;
+
+	/* Same LFN sequence rules as dir_match() */
+	res = dir_sdi(dp, 0);
+	while (res == FR_OK) {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+		a = dp->dir[DIR_Attr] & AM_MASK;
+		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF;
+		} else if (a == AM_LFN) {		/* An LFN entry: add its part of the name to the hash */
+			if (c & LLEF) {
+				sum = dp->dir[LDIR_Chksum];
+				c &= (BYTE)~LLEF; ord = c; h = 0;
+			}
+			if (c == ord && sum == dp->dir[LDIR_Chksum] && ld_word(dp->dir + LDIR_FstClusLO) == 0) {
+				i = ((c & 0x3F) - 1) * 13;
+				for (wc = 1, s = 0; wc && s < 13; s++) {
+					wc = ld_word(dp->dir + LfnOfs[s]);
+					if (wc) h += dix_mix(wc, i + s);
+				}
+				ord--;
+			} else {
+				ord = 0xFF;
+			}
+		} else {						/* An SFN entry: index the object */
+			if (n == _DIRINDEX_ENTRIES) {	/* Index full, the rest is searched linearly */
+				di->full = 1; break;
+			}
+			ent[n].shash = dix_sfn(dp->dir);
+			ent[n].hash = (!ord && sum == sum_sfn(dp->dir)) ? dix_fold(h) : ent[n].shash;
+			ent[n].idx = (WORD)(dp->dptr / SZDIRE);
+			n++;
+			ord = 0xFF;
+		}
+		res = dir_next(dp, 0);
+	}
+	if (res == FR_NO_FILE) res = FR_OK;
+	di->nent = n;
+	di->next = dp->dptr / SZDIRE;
+
+	return res;
+}
+
+
+static
+FRESULT dix_find (	/* FR_OK(0):found, FR_NO_FILE:not found, !=0:error */
+	DIR* dp			/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DIRIDX *di, *dv;
+	DIXENT *ent;
+	WORD hl = 0, hs = 0;
+	UINT i, ml, ms;
+	DWORD h;
+
+	/* Hashes of the name to find, an LFN sequence and an SFN can match */
+	ml = !(dp->fn[NSFLAG] & NS_NOLFN);
+	ms = !(dp->fn[NSFLAG] & NS_LOSS);
+	if (ml) {
+		for (h = 0, i = 0; fs->lfnbuf[i]; i++) h += dix_mix(fs->lfnbuf[i], i);
+		hl = dix_fold(h);
+	}
+	if (ms) hs = dix_sfn(dp->fn);
+
+	/* Get the index of the directory, build it over the least recently used one if needed */
+	for (di = dv = DirIdx, i = 0; i < _DIRINDEX_DIRS; i++, di++) {
+		if (di->fs == fs && di->id == fs->id && di->sclust == dp->obj.sclust) break;
+		if (!di->fs || (dv->fs && di->stamp < dv->stamp)) dv = di;
+	}
+	if (i == _DIRINDEX_DIRS) {
+		di = dv;
+		di->fs = 0; di->full = 0;
+		res = dix_build(dp, di);
+		if (res != FR_OK) return res;
+		di->fs = fs; di->id = fs->id; di->sclust = dp->obj.sclust;
+	}
+	di->stamp = ++DixStamp;
+
+	/* Check the candidates from their LFN sequence on */
+	for (ent = DixEnt[di - DirIdx], i = 0; i < di->nent; i++, ent++) {
+		if ((ml && ent->hash == hl) || (ms && ent->shash == hs)) {
+			res = dir_sdi(dp, (ent->idx > DIX_LFN_ENT ? ent->idx - DIX_LFN_ENT : 0) * SZDIRE);
+			if (res == FR_OK) res = dir_match(dp, (DWORD)ent->idx * SZDIRE);
+			if (res != FR_NO_FILE) return res;
+		}
+	}
+	if (!di->full) return FR_NO_FILE;
+
+	/* Search the items the index could not hold */
+	res = dir_sdi(dp, (di->next > DIX_LFN_ENT ? di->next - DIX_LFN_ENT : 0) * SZDIRE);
+	if (res != FR_OK) return res;
+	return dir_match(dp, 0xFFFFFFFF);
+}
+
+#endif	/* _USE_DIRINDEX */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Find an object in the directory                  */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp			/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+#if _FS_EXFAT
+	FATFS *fs = dp->obj.fs;
+#endif
+
+	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	if (res != FR_OK) return res;
+#if _FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		BYTE nc;
+		UINT di, ni;
+		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
+
+		while ((res = dir_read(dp, 0)) == FR_OK) {	/* Read an item */
+#if _MAX_LFN < 255
+			if (fs->dirbuf[XDIR_NumName] > _MAX_LFN) continue;			/* Skip comparison if inaccessible object name */
+#endif
+			if (ld_word(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
+			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
+				if ((di % SZDIRE) == 0) di += 2;
+				if (ff_wtoupper(ld_word(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
+			}
+			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
+		}
+		return res;
+	}
+#endif
+	/* On the FAT12/16/32 volume */
+#if _USE_DIRINDEX
+	return dix_find(dp);
+#else
+	return dir_match(dp, 0xFFFFFFFF);
+#endif
+}
+
+
+
+
 #if !_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Register an object to the directory                                   */
@@ -2379,6 +2605,9 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 			fs->wflag = 1;
 		}
 	}
+#if _USE_DIRINDEX
+	dix_drop(fs, dp->obj.sclust);	/* The directory has changed */
+#endif
 
 	return res;
 }
@@ -2427,6 +2656,9 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		fs->wflag = 1;
 	}
 #endif
+#if _USE_DIRINDEX
+	dix_drop(fs, dp->obj.sclust);	/* The directory has changed */
+#endif
 
 	return res;
 }
@@ -4594,6 +4826,9 @@ FRESULT f_unlink (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
+#if _USE_DIRINDEX
+				if (dj.obj.attr & AM_DIR) dix_drop(fs, dclst);	/* The cluster may become another directory */
+#endif
 				if (res == FR_OK && dclst) {	/* Remove the cluster chain if exist */
 #if _FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
@@ -5222,6 +5457,47 @@ FRESULT f_expand (
 
 
 
+#if _USE_EXPAND && _FS_EXFAT && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Set the Valid Data Length of a File (exFAT)                           */
+/*-----------------------------------------------------------------------*/
+/* The file size stays as allocated, other systems read the data past    */
+/* the valid length as zeros. FatFs itself does not track it: the valid  */
+/* length is reset to the file size whenever the entry is updated.       */
+
+FRESULT f_setvalid (
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t vsz		/* Valid data length, up to the file size */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DIR dj;
+	DEF_NAMBUF
+
+
+	res = f_sync(fp);					/* Write the file size first */
+	if (res != FR_OK) return res;
+	res = validate(&fp->obj, &fs);
+	if (res == FR_OK && (fs->fs_type != FS_EXFAT || vsz > fp->obj.objsize)) res = FR_INVALID_PARAMETER;
+	if (res == FR_OK) {
+		INIT_NAMBUF(fs);
+		res = load_obj_dir(&dj, &fp->obj);	/* Load directory entry block */
+		if (res == FR_OK) {
+			st_qword(fs->dirbuf + XDIR_ValidFileSize, vsz);
+			res = store_xdir(&dj);	/* Restore it to the directory */
+			if (res == FR_OK) res = sync_fs(fs);
+		}
+		FREE_NAMBUF();
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+#endif /* _USE_EXPAND && _FS_EXFAT && !_FS_READONLY */
+
+
+
 #if _USE_FORWARD
 /*-----------------------------------------------------------------------*/
 /* Forward data to the stream directly                                   */
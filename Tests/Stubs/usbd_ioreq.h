@@ -0,0 +1,17 @@
+/**
+  ******************************************************************************
+  * @file    usbd_ioreq.h
+  * @brief   Host build of the tests: only the USB device library types that
+  *          the class headers name, left incomplete.
+  ******************************************************************************
+  */
+
+#ifndef __USBD_IOREQ_H
+#define __USBD_IOREQ_H
+
+#include <stdint.h>
+
+typedef struct _Device_cb USBD_ClassTypeDef;
+typedef struct _USBD_HandleTypeDef USBD_HandleTypeDef;
+
+#endif /* __USBD_IOREQ_H */
@@ -0,0 +1,552 @@
+/**
+  ******************************************************************************
+  * @file    ncm_ntb_test.c
+  * @brief   Host unit test of ncm_ntb.c: NTB16 building against the sizes
+  *          and alignment advertised by GET_NTB_PARAMETERS, parsing of
+  *          malformed NTH16 and NDP16 headers, the NDP chain limit and
+  *          unaligned buffers.
+  *
+  *          Build and run with "make -C Tests".
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ncm_ntb.h"
+#include "usbd_ncm.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define TEST_BUF_SIZE       (0x10000U + 8U)
+#define TEST_MAX_DATAGRAMS  100000U   /* Walk() gives up on a looping NDP chain */
+
+#define CHECK(cond)                                                     \
+  do                                                                    \
+  {                                                                     \
+    checks++;                                                           \
+    if (!(cond))                                                        \
+    {                                                                   \
+      failures++;                                                       \
+      printf("%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__,       \
+             __func__, #cond);                                          \
+    }                                                                   \
+  } while (0)
+
+/* Private variables ---------------------------------------------------------*/
+static unsigned checks;
+static unsigned failures;
+
+/* Room for the unaligned cases, one byte past a 4-byte boundary */
+static uint32_t test_mem[TEST_BUF_SIZE / 4U];
+static uint32_t ref_mem[TEST_BUF_SIZE / 4U];
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint16_t Get16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void Put16(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void Put32(uint8_t *p, uint32_t v)
+{
+  Put16(&p[0], v);
+  Put16(&p[2], v >> 16);
+}
+
+/* Datagram n of a test: a length and bytes that tell datagrams apart */
+static uint16_t DatagramLen(uint32_t n)
+{
+  static const uint16_t len[] = { 1U, 2U, 3U, 4U, 5U, 60U, 64U, 65U, 1513U, NCM_MAX_SEGMENT_SIZE };
+
+  return len[n % (sizeof(len) / sizeof(len[0]))];
+}
+
+static void FillDatagram(uint8_t *p, uint32_t n, uint16_t len)
+{
+  uint16_t i;
+
+  for (i = 0U; i < len; i++)
+  {
+    p[i] = (uint8_t)((n * 37U) + i + 1U);
+  }
+}
+
+static int CheckDatagram(const uint8_t *p, uint32_t n, uint16_t len)
+{
+  uint16_t i;
+
+  for (i = 0U; i < len; i++)
+  {
+    if (p[i] != (uint8_t)((n * 37U) + i + 1U))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+  * @brief  Build an NTB the way the IN path does, until it is full or
+  *         holds max datagrams
+  * @param  buf: NTB buffer, filled with 0xA5 first to catch stale padding
+  * @param  size: dwNtbInMaxSize, or what the host set
+  * @param  max: Datagrams to try
+  * @param  count: Set to the datagrams added
+  * @retval Block length returned by NCM_NTB_Finish()
+  */
+static uint32_t Build(uint8_t *buf, uint32_t size, uint32_t max, uint32_t *count)
+{
+  NCM_NTB_BuilderTypeDef b;
+  uint8_t *p;
+  uint32_t n;
+
+  memset(buf, 0xA5, size);
+  NCM_NTB_Init(&b, buf, size);
+  for (n = 0U; n < max; n++)
+  {
+    p = NCM_NTB_Alloc(&b, DatagramLen(n));
+    if (p == NULL)
+    {
+      break;
+    }
+    FillDatagram(p, n, DatagramLen(n));
+    NCM_NTB_Commit(&b, DatagramLen(n));
+  }
+  *count = n;
+  return NCM_NTB_Finish(&b, 0x1234U);
+}
+
+/**
+  * @brief  Check a built NTB against the GET_NTB_PARAMETERS of usbd_ncm.c,
+  *         then parse it back
+  */
+static void CheckBuilt(const uint8_t *buf, uint32_t size, uint32_t block, uint32_t count)
+{
+  NCM_NTB_ParserTypeDef p;
+  const uint8_t *d;
+  uint16_t len;
+  uint32_t ndp;
+  uint32_t end;
+  uint32_t n;
+
+  CHECK(block != 0U);
+  CHECK(block <= size);
+
+  /* NTH16 */
+  CHECK(Get32(&buf[0]) == NCM_NTH16_SIGNATURE);
+  CHECK(Get16(&buf[4]) == NCM_NTH16_SIZE);
+  CHECK(Get16(&buf[6]) == 0x1234U);
+  CHECK(Get16(&buf[8]) == block);
+
+  /* NDP16 at the end, on wNdpInAlignment */
+  ndp = Get16(&buf[10]);
+  CHECK((ndp % NCM_NTB_ALIGN) == 0U);
+  CHECK(Get32(&buf[ndp]) == NCM_NDP16_SIGNATURE);
+  CHECK(Get16(&buf[ndp + 4U]) == (NCM_NDP16_HEADER_SIZE + (4U * (count + 1U))));
+  CHECK(Get16(&buf[ndp + 6U]) == 0U);
+  CHECK((ndp + Get16(&buf[ndp + 4U])) == block);
+  CHECK(Get32(&buf[ndp + NCM_NDP16_HEADER_SIZE + (4U * count)]) == 0U);
+
+  /* Datagrams on wNdpInDivisor with wNdpInPayloadRemainder 0, in order,
+     with zeroed padding */
+  end = NCM_NTH16_SIZE;
+  for (n = 0U; n < count; n++)
+  {
+    uint32_t index = Get16(&buf[ndp + NCM_NDP16_HEADER_SIZE + (4U * n)]);
+    uint32_t length = Get16(&buf[ndp + NCM_NDP16_HEADER_SIZE + (4U * n) + 2U]);
+
+    CHECK((index % NCM_NTB_ALIGN) == 0U);
+    CHECK(index >= end);
+    CHECK((index - end) < NCM_NTB_ALIGN);
+    while (end < index)
+    {
+      CHECK(buf[end] == 0U);
+      end++;
+    }
+    CHECK(length == DatagramLen(n));
+    end = index + length;
+  }
+  while (end < ndp)
+  {
+    CHECK(buf[end] == 0U);
+    end++;
+  }
+
+  CHECK(NCM_NTB_Parse(&p, buf, block) == 0);
+  for (n = 0U; n < count; n++)
+  {
+    CHECK(NCM_NTB_Next(&p, &d, &len) == 1);
+    CHECK(len == DatagramLen(n));
+    CHECK(CheckDatagram(d, n, len));
+  }
+  CHECK(NCM_NTB_Next(&p, &d, &len) == 0);
+  CHECK(NCM_NTB_Next(&p, &d, &len) == 0);
+}
+
+static void TestBuildSizes(void)
+{
+  /* dwNtbInMaxSize, the smallest size the host may set, and odd sizes */
+  static const uint32_t sizes[] = { NCM_NTB_IN_SIZE, NCM_NTB_MIN_IN_SIZE, 2049U, 4095U, 0xFFFFU };
+  uint8_t *buf = (uint8_t *)test_mem;
+  uint32_t block;
+  uint32_t count;
+  uint32_t i;
+
+  for (i = 0U; i < (sizeof(sizes) / sizeof(sizes[0])); i++)
+  {
+    block = Build(buf, sizes[i], 1000U, &count);
+    CHECK(count > 0U);
+    CheckBuilt(buf, sizes[i], block, count);
+  }
+
+  /* The largest frame always fits the smallest NTB */
+  block = Build(buf, NCM_NTB_MIN_IN_SIZE, 1U, &count);
+  CHECK(count == 1U);
+  CheckBuilt(buf, NCM_NTB_MIN_IN_SIZE, block, count);
+}
+
+static void TestBuildLimits(void)
+{
+  NCM_NTB_BuilderTypeDef b;
+  uint8_t *buf = (uint8_t *)test_mem;
+  uint32_t block;
+  uint32_t count;
+  uint32_t n;
+
+  /* Nothing to send */
+  NCM_NTB_Init(&b, buf, NCM_NTB_IN_SIZE);
+  CHECK(NCM_NTB_Finish(&b, 0U) == 0U);
+
+  /* Zero length datagrams are refused */
+  CHECK(NCM_NTB_Alloc(&b, 0U) == NULL);
+
+  /* Sizes past NTB16 are clamped */
+  NCM_NTB_Init(&b, buf, 0x20000U);
+  CHECK(b.Size == 0xFFFFU);
+
+  /* NCM_NTB_MAX_DATAGRAMS per NTB */
+  NCM_NTB_Init(&b, buf, NCM_NTB_IN_SIZE);
+  for (n = 0U; n < NCM_NTB_MAX_DATAGRAMS; n++)
+  {
+    CHECK(NCM_NTB_Alloc(&b, 1U) != NULL);
+    NCM_NTB_Commit(&b, 1U);
+  }
+  CHECK(NCM_NTB_Alloc(&b, 1U) == NULL);
+
+  /* A datagram is only taken with room left for the NDP: exactly enough
+     room, then one byte short */
+  for (n = 1U; n < 64U; n++)
+  {
+    uint32_t size = ((NCM_NTH16_SIZE + n + 3U) & ~3U) + NCM_NDP16_HEADER_SIZE + 8U;
+
+    NCM_NTB_Init(&b, buf, size - 1U);
+    CHECK(NCM_NTB_Alloc(&b, (uint16_t)n) == NULL);
+    NCM_NTB_Init(&b, buf, size);
+    CHECK(NCM_NTB_Alloc(&b, (uint16_t)n) != NULL);
+    NCM_NTB_Commit(&b, (uint16_t)n);
+    CHECK(NCM_NTB_Finish(&b, 0U) == size);
+  }
+
+  block = Build(buf, NCM_NTB_IN_SIZE, NCM_NTB_MAX_DATAGRAMS, &count);
+  CheckBuilt(buf, NCM_NTB_IN_SIZE, block, count);
+}
+
+static void TestUnaligned(void)
+{
+  uint8_t *buf;
+  uint8_t *ref = (uint8_t *)ref_mem;
+  uint32_t block;
+  uint32_t ref_block;
+  uint32_t count;
+  uint32_t off;
+
+  /* Offsets are from the NTB start: the buffer needs no alignment, and
+     the block is the same wherever it sits */
+  ref_block = Build(ref, NCM_NTB_IN_SIZE, 1000U, &count);
+  for (off = 1U; off < 4U; off++)
+  {
+    buf = (uint8_t *)test_mem + off;
+    block = Build(buf, NCM_NTB_IN_SIZE, 1000U, &count);
+    CHECK(block == ref_block);
+    CHECK(memcmp(buf, ref, block) == 0);
+    CheckBuilt(buf, NCM_NTB_IN_SIZE, block, count);
+  }
+}
+
+/* Hand made OUT NTBs ------------------------------------------------------*/
+
+static void Nth(uint8_t *buf, uint32_t block, uint32_t ndp)
+{
+  Put32(&buf[0], NCM_NTH16_SIGNATURE);
+  Put16(&buf[4], NCM_NTH16_SIZE);
+  Put16(&buf[6], 0U);
+  Put16(&buf[8], block);
+  Put16(&buf[10], ndp);
+}
+
+static void Ndp(uint8_t *buf, uint32_t ndp, uint32_t len, uint32_t next)
+{
+  Put32(&buf[ndp], NCM_NDP16_SIGNATURE);
+  Put16(&buf[ndp + 4U], len);
+  Put16(&buf[ndp + 6U], next);
+}
+
+static void Entry(uint8_t *buf, uint32_t ndp, uint32_t n, uint32_t index, uint32_t length)
+{
+  Put16(&buf[ndp + NCM_NDP16_HEADER_SIZE + (4U * n)], index);
+  Put16(&buf[ndp + NCM_NDP16_HEADER_SIZE + (4U * n) + 2U], length);
+}
+
+/* One datagram at 12, one NDP16 at 64, block 128 */
+static void Simple(uint8_t *buf)
+{
+  memset(buf, 0, 128U);
+  Nth(buf, 128U, 64U);
+  FillDatagram(&buf[12], 0U, 20U);
+  Ndp(buf, 64U, 16U, 0U);
+  Entry(buf, 64U, 0U, 12U, 20U);
+  Entry(buf, 64U, 1U, 0U, 0U);
+}
+
+/* Datagrams handed out by the parser, -1 if it failed first, -2 if it
+   never ends */
+static int Walk(const uint8_t *buf, uint32_t len)
+{
+  NCM_NTB_ParserTypeDef p;
+  const uint8_t *d;
+  uint16_t dlen;
+  int count = 0;
+  uint32_t loops = 0U;
+  int ret;
+
+  if (NCM_NTB_Parse(&p, buf, len) != 0)
+  {
+    return -1;
+  }
+  while ((ret = NCM_NTB_Next(&p, &d, &dlen)) == 1)
+  {
+    if (++loops > TEST_MAX_DATAGRAMS)
+    {
+      return -2;
+    }
+    CHECK(d >= &buf[NCM_NTH16_SIZE]);
+    CHECK((d + dlen) <= &buf[len]);
+    count++;
+  }
+  return (ret == 0) ? count : -1;
+}
+
+static void TestParseNth(void)
+{
+  uint8_t *buf = (uint8_t *)test_mem;
+
+  Simple(buf);
+  CHECK(Walk(buf, 128U) == 1);
+
+  /* Shorter than the NTH16 */
+  CHECK(Walk(buf, 0U) == -1);
+  CHECK(Walk(buf, NCM_NTH16_SIZE - 1U) == -1);
+
+  /* Bad signature */
+  Simple(buf);
+  buf[3] ^= 0x01U;
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* NTH16 length other than 12 */
+  Simple(buf);
+  Put16(&buf[4], 16U);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* Block longer than the transfer */
+  Simple(buf);
+  CHECK(Walk(buf, 127U) == -1);
+
+  /* Block shorter than the transfer: the rest is ignored */
+  Simple(buf);
+  CHECK(Walk(buf, 512U) == 1);
+
+  /* Zero block length: the NTB ends with the transfer */
+  Simple(buf);
+  Put16(&buf[8], 0U);
+  CHECK(Walk(buf, 128U) == 1);
+  CHECK(Walk(buf, 80U) == 1);
+  CHECK(Walk(buf, 79U) == -1);
+}
+
+static void TestParseNdp(void)
+{
+  uint8_t *buf = (uint8_t *)test_mem;
+
+  /* NDP inside the NTH16, or at 0 */
+  Simple(buf);
+  Put16(&buf[10], 0U);
+  CHECK(Walk(buf, 128U) == -1);
+  Simple(buf);
+  Put16(&buf[10], 8U);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* NDP off wNdpOutAlignment */
+  Simple(buf);
+  memmove(&buf[66], &buf[64], 16U);
+  Put16(&buf[10], 66U);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* NDP header past the block */
+  Simple(buf);
+  Put16(&buf[10], 124U);
+  CHECK(Walk(buf, 128U) == -1);
+  Put16(&buf[10], 0xFFFCU);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* Bad NDP signature, or the CRC variant */
+  Simple(buf);
+  buf[67] = '1';
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* NDP length: too short for one entry and the terminator, not a
+     multiple of 4, past the block */
+  Simple(buf);
+  Put16(&buf[68], 12U);
+  CHECK(Walk(buf, 128U) == -1);
+  Put16(&buf[68], 18U);
+  CHECK(Walk(buf, 128U) == -1);
+  Put16(&buf[68], 68U);
+  CHECK(Walk(buf, 128U) == -1);
+  Put16(&buf[68], 64U);
+  CHECK(Walk(buf, 128U) == 1);
+
+  /* No terminator before the end of the table: stop at the end */
+  Simple(buf);
+  Put16(&buf[68], 16U);
+  Entry(buf, 64U, 1U, 40U, 4U);
+  CHECK(Walk(buf, 128U) == 2);
+
+  /* Entries after the terminator are ignored */
+  Simple(buf);
+  Put16(&buf[68], 24U);
+  Entry(buf, 64U, 2U, 40U, 4U);
+  CHECK(Walk(buf, 128U) == 1);
+}
+
+static void TestParseDatagram(void)
+{
+  NCM_NTB_ParserTypeDef p;
+  uint8_t *buf = (uint8_t *)test_mem;
+  const uint8_t *d;
+  uint16_t len;
+
+  /* Index inside the NTH16 */
+  Simple(buf);
+  Entry(buf, 64U, 0U, 8U, 20U);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* Datagram ending at, then past, the block end */
+  Simple(buf);
+  Entry(buf, 64U, 0U, 12U, 116U);
+  CHECK(Walk(buf, 128U) == 1);
+  Entry(buf, 64U, 0U, 12U, 117U);
+  CHECK(Walk(buf, 128U) == -1);
+  Entry(buf, 64U, 0U, 0xFFF0U, 0x20U);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* A bad entry after a good one: the good one is handed out first */
+  Simple(buf);
+  Put16(&buf[68], 20U);
+  Entry(buf, 64U, 1U, 100U, 100U);
+  Entry(buf, 64U, 2U, 0U, 0U);
+  CHECK(NCM_NTB_Parse(&p, buf, 128U) == 0);
+  CHECK(NCM_NTB_Next(&p, &d, &len) == 1);
+  CHECK((d == &buf[12]) && (len == 20U) && CheckDatagram(d, 0U, len));
+  CHECK(NCM_NTB_Next(&p, &d, &len) == -1);
+  CHECK(NCM_NTB_Next(&p, &d, &len) == 0);
+
+  /* Datagrams need no alignment on the OUT side (wNdpOutDivisor is for
+     the host to follow, not something to reject on) */
+  Simple(buf);
+  memmove(&buf[13], &buf[12], 20U);
+  Entry(buf, 64U, 0U, 13U, 20U);
+  CHECK(NCM_NTB_Parse(&p, buf, 128U) == 0);
+  CHECK(NCM_NTB_Next(&p, &d, &len) == 1);
+  CHECK((d == &buf[13]) && CheckDatagram(d, 0U, len));
+
+  /* More datagrams than the IN limit: wNtbOutMaxDatagrams is 0 */
+  memset(buf, 0, NCM_NTB_OUT_SIZE);
+  Nth(buf, NCM_NTB_OUT_SIZE, 1024U);
+  Ndp(buf, 1024U, NCM_NDP16_HEADER_SIZE + (4U * 101U), 0U);
+  for (len = 0U; len < 100U; len++)
+  {
+    Entry(buf, 1024U, len, 12U + (4U * len), 4U);
+  }
+  CHECK(Walk(buf, NCM_NTB_OUT_SIZE) == 100);
+}
+
+static void TestNdpChain(void)
+{
+  uint8_t *buf = (uint8_t *)test_mem;
+  uint32_t n;
+
+  /* NCM_NTB_MAX_NDPS NDPs of one datagram each, chained */
+  memset(buf, 0, NCM_NTB_OUT_SIZE);
+  Nth(buf, NCM_NTB_OUT_SIZE, 256U);
+  for (n = 0U; n < NCM_NTB_MAX_NDPS; n++)
+  {
+    uint32_t ndp = 256U + (16U * n);
+
+    Ndp(buf, ndp, 16U, (n + 1U < NCM_NTB_MAX_NDPS) ? (ndp + 16U) : 0U);
+    Entry(buf, ndp, 0U, 12U + (4U * n), 4U);
+  }
+  CHECK(Walk(buf, NCM_NTB_OUT_SIZE) == (int)NCM_NTB_MAX_NDPS);
+
+  /* One more is refused */
+  n = NCM_NTB_MAX_NDPS;
+  Put16(&buf[256U + (16U * (n - 1U)) + 6U], 256U + (16U * n));
+  Ndp(buf, 256U + (16U * n), 16U, 0U);
+  Entry(buf, 256U + (16U * n), 0U, 12U, 4U);
+  CHECK(Walk(buf, NCM_NTB_OUT_SIZE) == -1);
+
+  /* A chain looping on itself ends at the limit */
+  Simple(buf);
+  Put16(&buf[70], 64U);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* A bad NDP down the chain */
+  Simple(buf);
+  Put16(&buf[70], 98U);
+  CHECK(Walk(buf, 128U) == -1);
+
+  /* An empty NDP in the chain, then one more datagram */
+  Simple(buf);
+  Put16(&buf[70], 96U);
+  Ndp(buf, 96U, 16U, 112U);
+  Ndp(buf, 112U, 16U, 0U);
+  Entry(buf, 112U, 0U, 40U, 8U);
+  CHECK(Walk(buf, 128U) == 2);
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+int main(void)
+{
+  TestBuildSizes();
+  TestBuildLimits();
+  TestUnaligned();
+  TestParseNth();
+  TestParseNdp();
+  TestParseDatagram();
+  TestNdpChain();
+
+  printf("ncm_ntb_test: %u checks, %u failures\n", checks, failures);
+  return (failures == 0U) ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+/**
+  ******************************************************************************
+  * @file    ncm_ntb.c
+  * @brief   CDC-NCM 16-bit Network Transfer Blocks (NTB16), building and
+  *          parsing.
+  *
+  *          The builder appends datagrams after the NTH16 and only writes
+  *          the headers in NCM_NTB_Finish(), with the NDP16 at the end of
+  *          the block, so a datagram can be copied straight to its final
+  *          place. The parser checks every offset against the block before
+  *          handing out a datagram. All fields are little endian, the
+  *          buffers need no particular alignment.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "ncm_ntb.h"
+#include <string.h>
+
+/* Private macro -------------------------------------------------------------*/
+#define NCM_ALIGN(x)        (((x) + (NCM_NTB_ALIGN - 1U)) & ~(NCM_NTB_ALIGN - 1U))
+#define NCM_NDP16_SIZE(n)   (NCM_NDP16_HEADER_SIZE + (4U * ((uint32_t)(n) + 1U)))
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint16_t NCM_Get16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | ((uint16_t)p[1] << 8));
+}
+
+static uint32_t NCM_Get32(const uint8_t *p)
+{
+  return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void NCM_Put16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void NCM_Put32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+  * @brief  Load the NDP16 at ndp
+  * @param  p: Parser
+  * @param  ndp: NDP16 offset in the block
+  * @retval 0, or -1 if the NDP is malformed
+  */
+static int NCM_LoadNdp(NCM_NTB_ParserTypeDef *p, uint32_t ndp)
+{
+  uint32_t len;
+
+  if ((ndp < NCM_NTH16_SIZE) || ((ndp % NCM_NTB_ALIGN) != 0U) ||
+      ((ndp + NCM_NDP16_HEADER_SIZE) > p->BlockLen) ||
+      (++p->NdpCount > NCM_NTB_MAX_NDPS))
+  {
+    return -1;
+  }
+
+  len = NCM_Get16(&p->Buf[ndp + 4U]);
+  if ((NCM_Get32(&p->Buf[ndp]) != NCM_NDP16_SIGNATURE) ||
+      (len < NCM_NDP16_SIZE(1U)) || ((len % 4U) != 0U) || ((ndp + len) > p->BlockLen))
+  {
+    return -1;
+  }
+
+  p->Ndp = ndp;
+  p->Entry = ndp + NCM_NDP16_HEADER_SIZE;
+  p->NdpEnd = ndp + len;
+  return 0;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Start a new NTB
+  * @param  b: Builder
+  * @param  buf: NTB buffer
+  * @param  size: Largest NTB, at most 65535 bytes
+  * @retval None
+  */
+void NCM_NTB_Init(NCM_NTB_BuilderTypeDef *b, uint8_t *buf, uint32_t size)
+{
+  b->Buf = buf;
+  b->Size = (size > 0xFFFFU) ? 0xFFFFU : size;
+  b->Len = NCM_NTH16_SIZE;
+  b->Count = 0U;
+}
+
+/**
+  * @brief  Find room for a datagram, keeping room for the NDP
+  * @param  b: Builder
+  * @param  len: Datagram length
+  * @retval Where to copy the datagram, NULL if it does not fit this NTB
+  */
+uint8_t *NCM_NTB_Alloc(NCM_NTB_BuilderTypeDef *b, uint16_t len)
+{
+  uint32_t off = NCM_ALIGN(b->Len);
+
+  if ((len == 0U) || (b->Count >= NCM_NTB_MAX_DATAGRAMS) ||
+      ((NCM_ALIGN(off + len) + NCM_NDP16_SIZE(b->Count + 1U)) > b->Size))
+  {
+    return NULL;
+  }
+
+  /* No stale data in the padding */
+  memset(&b->Buf[b->Len], 0, off - b->Len);
+  return &b->Buf[off];
+}
+
+/**
+  * @brief  Add the datagram copied to the room given by NCM_NTB_Alloc()
+  * @param  b: Builder
+  * @param  len: Datagram length, the one passed to NCM_NTB_Alloc()
+  * @retval None
+  */
+void NCM_NTB_Commit(NCM_NTB_BuilderTypeDef *b, uint16_t len)
+{
+  uint32_t off = NCM_ALIGN(b->Len);
+
+  b->Index[b->Count] = (uint16_t)off;
+  b->Length[b->Count] = len;
+  b->Count++;
+  b->Len = off + len;
+}
+
+/**
+  * @brief  Write the NTH16 and the NDP16
+  * @param  b: Builder, to be initialized again for the next NTB
+  * @param  seq: NTB sequence number
+  * @retval Block length, 0 if the NTB holds no datagram
+  */
+uint32_t NCM_NTB_Finish(NCM_NTB_BuilderTypeDef *b, uint16_t seq)
+{
+  uint32_t ndp = NCM_ALIGN(b->Len);
+  uint32_t ndp_len = NCM_NDP16_SIZE(b->Count);
+  uint8_t *p;
+  uint16_t i;
+
+  if (b->Count == 0U)
+  {
+    return 0U;
+  }
+
+  memset(&b->Buf[b->Len], 0, ndp - b->Len);
+
+  p = &b->Buf[ndp];
+  NCM_Put32(&p[0], NCM_NDP16_SIGNATURE);
+  NCM_Put16(&p[4], (uint16_t)ndp_len);
+  NCM_Put16(&p[6], 0U);
+  p += NCM_NDP16_HEADER_SIZE;
+  for (i = 0U; i < b->Count; i++)
+  {
+    NCM_Put16(&p[0], b->Index[i]);
+    NCM_Put16(&p[2], b->Length[i]);
+    p += 4;
+  }
+  NCM_Put32(p, 0U);
+
+  p = b->Buf;
+  NCM_Put32(&p[0], NCM_NTH16_SIGNATURE);
+  NCM_Put16(&p[4], NCM_NTH16_SIZE);
+  NCM_Put16(&p[6], seq);
+  NCM_Put16(&p[8], (uint16_t)(ndp + ndp_len));
+  NCM_Put16(&p[10], (uint16_t)ndp);
+
+  return ndp + ndp_len;
+}
+
+/**
+  * @brief  Check an NTB and prepare to walk its datagrams
+  * @param  p: Parser
+  * @param  buf: Received NTB
+  * @param  len: Received length
+  * @retval 0, or -1 if the NTB is malformed
+  */
+int NCM_NTB_Parse(NCM_NTB_ParserTypeDef *p, const uint8_t *buf, uint32_t len)
+{
+  uint32_t block;
+
+  p->Buf = buf;
+  p->Ndp = 0U;
+  p->NdpCount = 0U;
+
+  if ((len < NCM_NTH16_SIZE) || (NCM_Get32(&buf[0]) != NCM_NTH16_SIGNATURE) ||
+      (NCM_Get16(&buf[4]) != NCM_NTH16_SIZE))
+  {
+    return -1;
+  }
+
+  /* A zero block length means the NTB ends with the transfer */
+  block = NCM_Get16(&buf[8]);
+  if (block == 0U)
+  {
+    block = len;
+  }
+  if (block > len)
+  {
+    return -1;
+  }
+  p->BlockLen = block;
+
+  return NCM_LoadNdp(p, NCM_Get16(&buf[10]));
+}
+
+/**
+  * @brief  Get the next datagram of the NTB
+  * @param  p: Parser
+  * @param  datagram: Set to the datagram, inside the NTB buffer
+  * @param  len: Set to the datagram length
+  * @retval 1 for a datagram, 0 at the end, -1 if the NTB is malformed
+  */
+int NCM_NTB_Next(NCM_NTB_ParserTypeDef *p, const uint8_t **datagram, uint16_t *len)
+{
+  uint32_t index;
+  uint32_t length;
+  uint32_t next;
+
+  while (p->Ndp != 0U)
+  {
+    if ((p->Entry + 4U) <= p->NdpEnd)
+    {
+      index = NCM_Get16(&p->Buf[p->Entry]);
+      length = NCM_Get16(&p->Buf[p->Entry + 2U]);
+      p->Entry += 4U;
+
+      if ((index != 0U) && (length != 0U))
+      {
+        if ((index < NCM_NTH16_SIZE) || ((index + length) > p->BlockLen))
+        {
+          p->Ndp = 0U;
+          return -1;
+        }
+        *datagram = &p->Buf[index];
+        *len = (uint16_t)length;
+        return 1;
+      }
+    }
+
+    /* Terminator or end of the table: follow the chain */
+    next = NCM_Get16(&p->Buf[p->Ndp + 6U]);
+    p->Ndp = 0U;
+    if ((next != 0U) && (NCM_LoadNdp(p, next) != 0))
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+/**
+  ******************************************************************************
+  * @file    ncm_ntb.h
+  * @brief   CDC-NCM 16-bit Network Transfer Blocks (NTB16), building and
+  *          parsing. Plain C on byte buffers, no USB or HAL dependency.
+  *
+  *          Built NTBs are laid out as:
+  *
+  *            NTH16 | datagram | pad | datagram | pad ... | NDP16
+  *
+  *          every datagram and the NDP starting on a NCM_NTB_ALIGN boundary.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __NCM_NTB_H__
+#define __NCM_NTB_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+#define NCM_NTH16_SIGNATURE         0x484D434EU   /* "NCMH" */
+#define NCM_NDP16_SIGNATURE         0x304D434EU   /* "NCM0", no CRC */
+#define NCM_NTH16_SIZE              12U
+#define NCM_NDP16_HEADER_SIZE       8U
+#define NCM_NTB_ALIGN               4U            /* Datagram and NDP alignment */
+#define NCM_NTB_MAX_DATAGRAMS       16U           /* Per built NTB */
+#define NCM_NTB_MAX_NDPS            8U            /* Per parsed NTB */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t  *Buf;
+  uint32_t Size;                                /* Room in Buf */
+  uint32_t Len;                                 /* End of the last datagram */
+  uint16_t Count;                               /* Datagrams so far */
+  uint16_t Index[NCM_NTB_MAX_DATAGRAMS];
+  uint16_t Length[NCM_NTB_MAX_DATAGRAMS];
+} NCM_NTB_BuilderTypeDef;
+
+typedef struct
+{
+  const uint8_t *Buf;
+  uint32_t BlockLen;                            /* From the NTH16 */
+  uint32_t Ndp;                                 /* Current NDP16, 0 at the end */
+  uint32_t Entry;                               /* Next entry in it */
+  uint32_t NdpEnd;
+  uint32_t NdpCount;                            /* NDPs visited, bounds the chain */
+} NCM_NTB_ParserTypeDef;
+
+/* Exported functions prototypes ---------------------------------------------*/
+void     NCM_NTB_Init(NCM_NTB_BuilderTypeDef *b, uint8_t *buf, uint32_t size);
+uint8_t *NCM_NTB_Alloc(NCM_NTB_BuilderTypeDef *b, uint16_t len);
+void     NCM_NTB_Commit(NCM_NTB_BuilderTypeDef *b, uint16_t len);
+uint32_t NCM_NTB_Finish(NCM_NTB_BuilderTypeDef *b, uint16_t seq);
+
+int      NCM_NTB_Parse(NCM_NTB_ParserTypeDef *p, const uint8_t *buf, uint32_t len);
+int      NCM_NTB_Next(NCM_NTB_ParserTypeDef *p, const uint8_t **datagram, uint16_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NCM_NTB_H__ */
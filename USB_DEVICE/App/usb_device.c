@@ -28,6 +28,9 @@
 
 /* USER CODE BEGIN Includes */
 
+#include "usbd_cdc_msc.h"
+#include "usbd_storage_if.h"
+
 /* USER CODE END Includes */
 
 /* USER CODE BEGIN PV */
@@ -72,7 +75,7 @@ void MX_USB_DEVICE_Init(void)
   {
     Error_Handler();
   }
-  if (USBD_RegisterClass(&hUsbDeviceFS, &USBD_CDC) != USBD_OK)
+  if (USBD_RegisterClass(&hUsbDeviceFS, &USBD_CDC_MSC) != USBD_OK)
   {
     Error_Handler();
   }
@@ -80,6 +83,10 @@ void MX_USB_DEVICE_Init(void)
   {
     Error_Handler();
   }
+  if (USBD_MSC_RegisterStorage(&hUsbDeviceFS, &USBD_Storage_Interface_fops_FS) != USBD_OK)
+  {
+    Error_Handler();
+  }
   if (USBD_Start(&hUsbDeviceFS) != USBD_OK)
   {
     Error_Handler();
@@ -90,6 +97,28 @@ void MX_USB_DEVICE_Init(void)
   /* USER CODE END USB_DEVICE_Init_PostTreatment */
 }
 
+/* USER CODE BEGIN 2 */
+
+/**
+  * USB device background work: Mass Storage commands and SD card ownership,
+  * or the vendor stream batches, and the NCM transfer blocks
+  * @retval None
+  */
+void MX_USB_DEVICE_Process(void)
+{
+#ifdef USBD_CDC_NCM
+  USBD_NCM_Process(&hUsbDeviceFS);
+#endif /* USBD_CDC_NCM */
+#ifdef USBD_VENDOR_STREAM
+  USBD_VENDOR_Process(&hUsbDeviceFS);
+#else
+  USBD_MSC_Process(&hUsbDeviceFS);
+  STORAGE_Process_FS();
+#endif /* USBD_VENDOR_STREAM */
+}
+
+/* USER CODE END 2 */
+
 /**
   * @}
   */
@@ -22,6 +22,7 @@
 #include "usbd_cdc_if.h"
 
 /* USER CODE BEGIN INCLUDE */
+#include <string.h>
 
 /* USER CODE END INCLUDE */
 
@@ -62,6 +63,9 @@
   */
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+#if ((APP_RX_DATA_SIZE & (APP_RX_DATA_SIZE - 1)) != 0) || ((APP_TX_DATA_SIZE & (APP_TX_DATA_SIZE - 1)) != 0)
+#error "APP_RX_DATA_SIZE and APP_TX_DATA_SIZE must be powers of 2"
+#endif
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -95,6 +99,17 @@ uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
 
+/* OUT packets land here and are copied into the UserRxBufferFS ring */
+static uint8_t RxPacketFS[CDC_DATA_FS_OUT_PACKET_SIZE];
+
+/* Free running ring indices, head is written by the producer only */
+static volatile uint32_t rx_head;
+static volatile uint32_t rx_tail;
+static volatile uint8_t rx_stalled;
+static volatile uint32_t tx_head;
+static volatile uint32_t tx_tail;
+static volatile uint32_t tx_inflight;
+
 /* USER CODE END PRIVATE_VARIABLES */
 
 /**
@@ -128,6 +143,7 @@ static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
 static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static void CDC_TxKick_FS(void);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -157,7 +173,15 @@ static int8_t CDC_Init_FS(void)
   /* USER CODE BEGIN 3 */
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, RxPacketFS);
+
+  /* Start from empty rings on every (re)configuration */
+  rx_head = 0;
+  rx_tail = 0;
+  rx_stalled = 0;
+  tx_head = 0;
+  tx_tail = 0;
+  tx_inflight = 0;
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -274,8 +298,27 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  uint32_t head = rx_head;
+  uint32_t offset = head & (APP_RX_DATA_SIZE - 1);
+  uint32_t first = APP_RX_DATA_SIZE - offset;
+
+  if (first > *Len)
+  {
+    first = *Len;
+  }
+  memcpy(&UserRxBufferFS[offset], Buf, first);
+  memcpy(&UserRxBufferFS[0], &Buf[first], *Len - first);
+  rx_head = head + *Len;
+
+  /* Flow control: leave the OUT endpoint NAKing until a full packet fits */
+  if ((APP_RX_DATA_SIZE - (rx_head - rx_tail)) >= CDC_DATA_FS_OUT_PACKET_SIZE)
+  {
+    USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+  }
+  else
+  {
+    rx_stalled = 1;
+  }
   return (USBD_OK);
   /* USER CODE END 6 */
 }
@@ -324,6 +367,11 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
   UNUSED(Buf);
   UNUSED(Len);
   UNUSED(epnum);
+
+  /* Release what was sent from the ring and start on everything queued since */
+  tx_tail += tx_inflight;
+  tx_inflight = 0;
+  CDC_TxKick_FS();
   /* USER CODE END 13 */
   return result;
 }
@@ -335,6 +383,126 @@ bool CDC_Is_Connected(void)
   return is_connected;
 }
 
+/**
+  * @brief  Start a transfer of the queued data if the IN endpoint is idle
+  * @note   Called with interrupts masked or from the USB interrupt. The whole
+  *         contiguous run is sent as one transfer: only its last packet can
+  *         be short, and the class adds a ZLP when it ends on a full packet.
+  * @retval None
+  */
+static void CDC_TxKick_FS(void)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  uint32_t tail = tx_tail;
+  uint32_t offset = tail & (APP_TX_DATA_SIZE - 1);
+  uint32_t len = tx_head - tail;
+
+  if ((hcdc == NULL) || (hcdc->TxState != 0) || (tx_inflight != 0) || (len == 0))
+  {
+    return;
+  }
+
+  if (len > (APP_TX_DATA_SIZE - offset))
+  {
+    len = APP_TX_DATA_SIZE - offset;
+  }
+
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &UserTxBufferFS[offset], len);
+  if (USBD_CDC_TransmitPacket(&hUsbDeviceFS) == USBD_OK)
+  {
+    tx_inflight = len;
+  }
+}
+
+/**
+  * @brief  Queue data for transmission over the CDC IN endpoint
+  * @note   Does not block. Data queued while a transfer is in progress is
+  *         sent in one batch from the transmit complete callback.
+  * @param  Buf: Data to send
+  * @param  Len: Number of bytes
+  * @retval Number of bytes queued, less than Len when the ring is full
+  */
+uint32_t CDC_Write_FS(const uint8_t* Buf, uint32_t Len)
+{
+  uint32_t head = tx_head;
+  uint32_t offset = head & (APP_TX_DATA_SIZE - 1);
+  uint32_t free = APP_TX_DATA_SIZE - (head - tx_tail);
+  uint32_t first = APP_TX_DATA_SIZE - offset;
+
+  if (Len > free)
+  {
+    Len = free;
+  }
+  if (first > Len)
+  {
+    first = Len;
+  }
+  memcpy(&UserTxBufferFS[offset], Buf, first);
+  memcpy(&UserTxBufferFS[0], &Buf[first], Len - first);
+  tx_head = head + Len;
+
+  __disable_irq();
+  CDC_TxKick_FS();
+  __enable_irq();
+
+  return Len;
+}
+
+/**
+  * @brief  Read received data from the CDC OUT ring
+  * @note   Re-enables reception if the host was being held off.
+  * @param  Buf: Destination buffer
+  * @param  Len: Size of the destination buffer
+  * @retval Number of bytes read
+  */
+uint32_t CDC_Read_FS(uint8_t* Buf, uint32_t Len)
+{
+  uint32_t tail = rx_tail;
+  uint32_t offset = tail & (APP_RX_DATA_SIZE - 1);
+  uint32_t avail = rx_head - tail;
+  uint32_t first = APP_RX_DATA_SIZE - offset;
+
+  if (Len > avail)
+  {
+    Len = avail;
+  }
+  if (first > Len)
+  {
+    first = Len;
+  }
+  memcpy(Buf, &UserRxBufferFS[offset], first);
+  memcpy(&Buf[first], &UserRxBufferFS[0], Len - first);
+  rx_tail = tail + Len;
+
+  if (rx_stalled && ((APP_RX_DATA_SIZE - (rx_head - rx_tail)) >= CDC_DATA_FS_OUT_PACKET_SIZE))
+  {
+    __disable_irq();
+    rx_stalled = 0;
+    USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+    __enable_irq();
+  }
+
+  return Len;
+}
+
+/**
+  * @brief  Space left in the transmission ring
+  * @retval Number of bytes CDC_Write_FS() can queue
+  */
+uint32_t CDC_TxFree_FS(void)
+{
+  return APP_TX_DATA_SIZE - (tx_head - tx_tail);
+}
+
+/**
+  * @brief  Received data waiting in the reception ring
+  * @retval Number of bytes CDC_Read_FS() can return
+  */
+uint32_t CDC_RxAvailable_FS(void)
+{
+  return rx_head - rx_tail;
+}
+
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
@@ -343,4 +511,4 @@ bool CDC_Is_Connected(void)
 
 /**
   * @}
-  */
\ No newline at end of file
+  */
\ No newline at end of file
@@ -50,10 +50,12 @@
   * @{
   */
 /* Define size for the receive and transmit buffer over CDC */
-#define APP_RX_DATA_SIZE  64
-#define APP_TX_DATA_SIZE  64
+#define APP_RX_DATA_SIZE  2048
+#define APP_TX_DATA_SIZE  4096
 /* USER CODE BEGIN EXPORTED_DEFINES */
 
+/* UserRxBufferFS / UserTxBufferFS are used as rings, sizes must be powers of 2 */
+
 /* USER CODE END EXPORTED_DEFINES */
 
 /**
@@ -112,6 +114,10 @@ uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
 
 bool CDC_Is_Connected(void);
+uint32_t CDC_Write_FS(const uint8_t* Buf, uint32_t Len);
+uint32_t CDC_Read_FS(uint8_t* Buf, uint32_t Len);
+uint32_t CDC_TxFree_FS(void);
+uint32_t CDC_RxAvailable_FS(void);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
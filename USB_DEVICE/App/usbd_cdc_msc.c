@@ -0,0 +1,479 @@
+/**
+  ******************************************************************************
+  * @file    usbd_cdc_msc.c
+  * @brief   Composite CDC ACM + Mass Storage class.
+  *
+  *          The device library runs a single class, so this one owns the
+  *          configuration descriptor and forwards every callback to the CDC
+  *          or MSC function: setup requests by interface or endpoint number,
+  *          bulk transfers by endpoint number. Both functions keep their own
+  *          state, the CDC handle stays in pClassData as before.
+  *          USBD_CDC_MSC_COMM_FUNCTION is the CDC ACM function, or CDC-NCM
+  *          when USBD_CDC_NCM is defined. USBD_CDC_MSC_FUNCTION is the Mass
+  *          Storage function, or the vendor bulk stream when
+  *          USBD_VENDOR_STREAM is defined.
+  *
+  *            EP0         control
+  *            EP1 IN/OUT  CDC data          (64 bytes)
+  *            EP2 IN      CDC notification  (8 bytes, 16 for NCM)
+  *            EP3 IN/OUT  MSC Bulk-Only or vendor stream (64 bytes)
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_cdc_msc.h"
+#include "usbd_ctlreq.h"
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t USBD_CDC_MSC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_CDC_MSC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_CDC_MSC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static uint8_t USBD_CDC_MSC_EP0_RxReady(USBD_HandleTypeDef *pdev);
+static uint8_t USBD_CDC_MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t USBD_CDC_MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t *USBD_CDC_MSC_GetCfgDesc(uint16_t *length);
+static uint8_t *USBD_CDC_MSC_GetDeviceQualifierDesc(uint16_t *length);
+#if (USBD_SUPPORT_USER_STRING_DESC == 1U)
+static uint8_t *USBD_CDC_MSC_GetUsrStrDesc(USBD_HandleTypeDef *pdev, uint8_t index, uint16_t *length);
+#endif /* USBD_SUPPORT_USER_STRING_DESC */
+
+/* Private variables ---------------------------------------------------------*/
+USBD_ClassTypeDef USBD_CDC_MSC =
+{
+  USBD_CDC_MSC_Init,
+  USBD_CDC_MSC_DeInit,
+  USBD_CDC_MSC_Setup,
+  NULL,                 /* EP0_TxSent */
+  USBD_CDC_MSC_EP0_RxReady,
+  USBD_CDC_MSC_DataIn,
+  USBD_CDC_MSC_DataOut,
+  NULL,
+  NULL,
+  NULL,
+  USBD_CDC_MSC_GetCfgDesc,
+  USBD_CDC_MSC_GetCfgDesc,
+  USBD_CDC_MSC_GetCfgDesc,
+  USBD_CDC_MSC_GetDeviceQualifierDesc,
+#if (USBD_SUPPORT_USER_STRING_DESC == 1U)
+  USBD_CDC_MSC_GetUsrStrDesc,
+#endif /* USBD_SUPPORT_USER_STRING_DESC */
+};
+
+/* USB CDC + MSC device Configuration Descriptor */
+__ALIGN_BEGIN static uint8_t USBD_CDC_MSC_CfgDesc[USB_CDC_MSC_CONFIG_DESC_SIZ] __ALIGN_END =
+{
+  /* Configuration Descriptor */
+  0x09,                                       /* bLength: Configuration Descriptor size */
+  USB_DESC_TYPE_CONFIGURATION,                /* bDescriptorType: Configuration */
+  USB_CDC_MSC_CONFIG_DESC_SIZ,                /* wTotalLength */
+  0x00,
+  0x03,                                       /* bNumInterfaces: 3 interfaces */
+  0x01,                                       /* bConfigurationValue: Configuration value */
+  0x00,                                       /* iConfiguration */
+#if (USBD_SELF_POWERED == 1U)
+  0xC0,                                       /* bmAttributes: Self Powered */
+#else
+  0x80,                                       /* bmAttributes: Bus Powered */
+#endif /* USBD_SELF_POWERED */
+  USBD_MAX_POWER,                             /* MaxPower (mA) */
+
+  /*---------------------------------------------------------------------------*/
+
+#ifndef USBD_CDC_NCM
+  /* Interface Association Descriptor: CDC ACM */
+  0x08,                                       /* bLength */
+  USB_DESC_TYPE_IAD,                          /* bDescriptorType: IAD */
+  CDC_MSC_CDC_CMD_ITF_NBR,                    /* bFirstInterface */
+  0x02,                                       /* bInterfaceCount */
+  0x02,                                       /* bFunctionClass: Communication Interface Class */
+  0x02,                                       /* bFunctionSubClass: Abstract Control Model */
+  0x01,                                       /* bFunctionProtocol: Common AT commands */
+  0x00,                                       /* iFunction */
+
+  /* Interface Descriptor */
+  0x09,                                       /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,                    /* bDescriptorType: Interface */
+  CDC_MSC_CDC_CMD_ITF_NBR,                    /* bInterfaceNumber: Number of Interface */
+  0x00,                                       /* bAlternateSetting: Alternate setting */
+  0x01,                                       /* bNumEndpoints: One endpoint used */
+  0x02,                                       /* bInterfaceClass: Communication Interface Class */
+  0x02,                                       /* bInterfaceSubClass: Abstract Control Model */
+  0x01,                                       /* bInterfaceProtocol: Common AT commands */
+  0x00,                                       /* iInterface */
+
+  /* Header Functional Descriptor */
+  0x05,                                       /* bLength: Endpoint Descriptor size */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x00,                                       /* bDescriptorSubtype: Header Func Desc */
+  0x10,                                       /* bcdCDC: spec release number */
+  0x01,
+
+  /* Call Management Functional Descriptor */
+  0x05,                                       /* bFunctionLength */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x01,                                       /* bDescriptorSubtype: Call Management Func Desc */
+  0x00,                                       /* bmCapabilities: D0+D1 */
+  CDC_MSC_CDC_DATA_ITF_NBR,                   /* bDataInterface */
+
+  /* ACM Functional Descriptor */
+  0x04,                                       /* bFunctionLength */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x02,                                       /* bDescriptorSubtype: Abstract Control Management desc */
+  0x02,                                       /* bmCapabilities */
+
+  /* Union Functional Descriptor */
+  0x05,                                       /* bFunctionLength */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x06,                                       /* bDescriptorSubtype: Union func desc */
+  CDC_MSC_CDC_CMD_ITF_NBR,                    /* bMasterInterface: Communication class interface */
+  CDC_MSC_CDC_DATA_ITF_NBR,                   /* bSlaveInterface0: Data Class Interface */
+
+  /* Endpoint 2 Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  CDC_CMD_EP,                                 /* bEndpointAddress */
+  0x03,                                       /* bmAttributes: Interrupt */
+  LOBYTE(CDC_CMD_PACKET_SIZE),                /* wMaxPacketSize */
+  HIBYTE(CDC_CMD_PACKET_SIZE),
+  CDC_FS_BINTERVAL,                           /* bInterval */
+
+  /* Data class interface descriptor */
+  0x09,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_INTERFACE,                    /* bDescriptorType: */
+  CDC_MSC_CDC_DATA_ITF_NBR,                   /* bInterfaceNumber: Number of Interface */
+  0x00,                                       /* bAlternateSetting: Alternate setting */
+  0x02,                                       /* bNumEndpoints: Two endpoints used */
+  0x0A,                                       /* bInterfaceClass: CDC */
+  0x00,                                       /* bInterfaceSubClass */
+  0x00,                                       /* bInterfaceProtocol */
+  0x00,                                       /* iInterface */
+
+  /* Endpoint OUT Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  CDC_OUT_EP,                                 /* bEndpointAddress */
+  0x02,                                       /* bmAttributes: Bulk */
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),        /* wMaxPacketSize */
+  HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
+  0x00,                                       /* bInterval */
+
+  /* Endpoint IN Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  CDC_IN_EP,                                  /* bEndpointAddress */
+  0x02,                                       /* bmAttributes: Bulk */
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),        /* wMaxPacketSize */
+  HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
+  0x00,                                       /* bInterval */
+#else
+  /* Interface Association Descriptor: CDC NCM */
+  0x08,                                       /* bLength */
+  USB_DESC_TYPE_IAD,                          /* bDescriptorType: IAD */
+  CDC_MSC_CDC_CMD_ITF_NBR,                    /* bFirstInterface */
+  0x02,                                       /* bInterfaceCount */
+  0x02,                                       /* bFunctionClass: Communication Interface Class */
+  0x0D,                                       /* bFunctionSubClass: Network Control Model */
+  0x00,                                       /* bFunctionProtocol: No encapsulated commands */
+  0x00,                                       /* iFunction */
+
+  /* Interface Descriptor */
+  0x09,                                       /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,                    /* bDescriptorType: Interface */
+  CDC_MSC_CDC_CMD_ITF_NBR,                    /* bInterfaceNumber: Number of Interface */
+  0x00,                                       /* bAlternateSetting: Alternate setting */
+  0x01,                                       /* bNumEndpoints: One endpoint used */
+  0x02,                                       /* bInterfaceClass: Communication Interface Class */
+  0x0D,                                       /* bInterfaceSubClass: Network Control Model */
+  0x00,                                       /* bInterfaceProtocol: No encapsulated commands */
+  0x00,                                       /* iInterface */
+
+  /* Header Functional Descriptor */
+  0x05,                                       /* bLength: Endpoint Descriptor size */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x00,                                       /* bDescriptorSubtype: Header Func Desc */
+  0x10,                                       /* bcdCDC: spec release number */
+  0x01,
+
+  /* Union Functional Descriptor */
+  0x05,                                       /* bFunctionLength */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x06,                                       /* bDescriptorSubtype: Union func desc */
+  CDC_MSC_CDC_CMD_ITF_NBR,                    /* bMasterInterface: Communication class interface */
+  CDC_MSC_CDC_DATA_ITF_NBR,                   /* bSlaveInterface0: Data Class Interface */
+
+  /* Ethernet Networking Functional Descriptor */
+  0x0D,                                       /* bFunctionLength */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x0F,                                       /* bDescriptorSubtype: Ethernet Networking */
+  NCM_MAC_STRING_INDEX,                       /* iMACAddress */
+  0x00,                                       /* bmEthernetStatistics: none */
+  0x00,
+  0x00,
+  0x00,
+  LOBYTE(NCM_MAX_SEGMENT_SIZE),               /* wMaxSegmentSize */
+  HIBYTE(NCM_MAX_SEGMENT_SIZE),
+  0x00,                                       /* wNumberMCFilters: none */
+  0x00,
+  0x00,                                       /* bNumberPowerFilters */
+
+  /* NCM Functional Descriptor */
+  0x06,                                       /* bFunctionLength */
+  0x24,                                       /* bDescriptorType: CS_INTERFACE */
+  0x1A,                                       /* bDescriptorSubtype: NCM */
+  0x00,                                       /* bcdNcmVersion: 1.00 */
+  0x01,
+  0x00,                                       /* bmNetworkCapabilities: none */
+
+  /* Endpoint 2 Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  NCM_NOTIFY_EP,                              /* bEndpointAddress */
+  0x03,                                       /* bmAttributes: Interrupt */
+  LOBYTE(NCM_NOTIFY_PACKET_SIZE),             /* wMaxPacketSize */
+  HIBYTE(NCM_NOTIFY_PACKET_SIZE),
+  NCM_FS_BINTERVAL,                           /* bInterval */
+
+  /* Data class interface descriptor, no endpoints: data path disabled */
+  0x09,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_INTERFACE,                    /* bDescriptorType: */
+  CDC_MSC_CDC_DATA_ITF_NBR,                   /* bInterfaceNumber: Number of Interface */
+  0x00,                                       /* bAlternateSetting: Alternate setting */
+  0x00,                                       /* bNumEndpoints */
+  0x0A,                                       /* bInterfaceClass: CDC */
+  0x00,                                       /* bInterfaceSubClass */
+  0x01,                                       /* bInterfaceProtocol: Network Transfer Block */
+  0x00,                                       /* iInterface */
+
+  /* Data class interface descriptor, data path enabled */
+  0x09,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_INTERFACE,                    /* bDescriptorType: */
+  CDC_MSC_CDC_DATA_ITF_NBR,                   /* bInterfaceNumber: Number of Interface */
+  0x01,                                       /* bAlternateSetting: Alternate setting */
+  0x02,                                       /* bNumEndpoints: Two endpoints used */
+  0x0A,                                       /* bInterfaceClass: CDC */
+  0x00,                                       /* bInterfaceSubClass */
+  0x01,                                       /* bInterfaceProtocol: Network Transfer Block */
+  0x00,                                       /* iInterface */
+
+  /* Endpoint OUT Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  NCM_OUT_EP,                                 /* bEndpointAddress */
+  0x02,                                       /* bmAttributes: Bulk */
+  LOBYTE(NCM_DATA_FS_MAX_PACKET),             /* wMaxPacketSize */
+  HIBYTE(NCM_DATA_FS_MAX_PACKET),
+  0x00,                                       /* bInterval */
+
+  /* Endpoint IN Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  NCM_IN_EP,                                  /* bEndpointAddress */
+  0x02,                                       /* bmAttributes: Bulk */
+  LOBYTE(NCM_DATA_FS_MAX_PACKET),             /* wMaxPacketSize */
+  HIBYTE(NCM_DATA_FS_MAX_PACKET),
+  0x00,                                       /* bInterval */
+#endif /* USBD_CDC_NCM */
+
+  /*---------------------------------------------------------------------------*/
+
+  /* Mass Storage / vendor interface descriptor */
+  0x09,                                       /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE,                    /* bDescriptorType: Interface */
+  CDC_MSC_MSC_ITF_NBR,                        /* bInterfaceNumber: Number of Interface */
+  0x00,                                       /* bAlternateSetting: Alternate setting */
+  0x02,                                       /* bNumEndpoints: Two endpoints used */
+#ifdef USBD_VENDOR_STREAM
+  0xFF,                                       /* bInterfaceClass: Vendor specific */
+  0x00,                                       /* bInterfaceSubClass */
+  0x00,                                       /* bInterfaceProtocol */
+#else
+  0x08,                                       /* bInterfaceClass: Mass Storage */
+  0x06,                                       /* bInterfaceSubClass: SCSI transparent */
+  0x50,                                       /* bInterfaceProtocol: Bulk-Only Transport */
+#endif /* USBD_VENDOR_STREAM */
+  0x00,                                       /* iInterface */
+
+  /* Endpoint IN Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  MSC_EPIN_ADDR,                              /* bEndpointAddress */
+  0x02,                                       /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_FS_PACKET),                  /* wMaxPacketSize */
+  HIBYTE(MSC_MAX_FS_PACKET),
+  0x00,                                       /* bInterval */
+
+  /* Endpoint OUT Descriptor */
+  0x07,                                       /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,                     /* bDescriptorType: Endpoint */
+  MSC_EPOUT_ADDR,                             /* bEndpointAddress */
+  0x02,                                       /* bmAttributes: Bulk */
+  LOBYTE(MSC_MAX_FS_PACKET),                  /* wMaxPacketSize */
+  HIBYTE(MSC_MAX_FS_PACKET),
+  0x00                                        /* bInterval */
+};
+
+/* USB Standard Device Descriptor */
+__ALIGN_BEGIN static uint8_t USBD_CDC_MSC_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END =
+{
+  USB_LEN_DEV_QUALIFIER_DESC,
+  USB_DESC_TYPE_DEVICE_QUALIFIER,
+  0x00,
+  0x02,
+  0xEF,
+  0x02,
+  0x01,
+  0x40,
+  0x01,
+  0x00,
+};
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Check whether a setup request is for the interface 2 function
+  * @param  req: usb request
+  * @retval 1 for MSC (or vendor), 0 for CDC (or NCM)
+  */
+static uint8_t USBD_CDC_MSC_IsMSC(USBD_SetupReqTypedef *req)
+{
+  switch (req->bmRequest & USB_REQ_RECIPIENT_MASK)
+  {
+    case USB_REQ_RECIPIENT_INTERFACE:
+      return (LOBYTE(req->wIndex) == CDC_MSC_MSC_ITF_NBR) ? 1U : 0U;
+
+    case USB_REQ_RECIPIENT_ENDPOINT:
+      return ((LOBYTE(req->wIndex) & 0x7FU) == (MSC_EPIN_ADDR & 0x7FU)) ? 1U : 0U;
+
+    default:
+      return 0U;
+  }
+}
+
+/**
+  * @brief  Initialize both functions
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_CDC_MSC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  if (USBD_CDC_MSC_COMM_FUNCTION.Init(pdev, cfgidx) != (uint8_t)USBD_OK)
+  {
+    return (uint8_t)USBD_FAIL;
+  }
+  return USBD_CDC_MSC_FUNCTION.Init(pdev, cfgidx);
+}
+
+/**
+  * @brief  DeInitialize both functions
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_CDC_MSC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  (void)USBD_CDC_MSC_FUNCTION.DeInit(pdev, cfgidx);
+  return USBD_CDC_MSC_COMM_FUNCTION.DeInit(pdev, cfgidx);
+}
+
+/**
+  * @brief  Route a setup request to its function
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t USBD_CDC_MSC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+  if (USBD_CDC_MSC_IsMSC(req) != 0U)
+  {
+    return USBD_CDC_MSC_FUNCTION.Setup(pdev, req);
+  }
+  return USBD_CDC_MSC_COMM_FUNCTION.Setup(pdev, req);
+}
+
+/**
+  * @brief  Control data received, only the CDC / NCM function uses it
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t USBD_CDC_MSC_EP0_RxReady(USBD_HandleTypeDef *pdev)
+{
+  return USBD_CDC_MSC_COMM_FUNCTION.EP0_RxReady(pdev);
+}
+
+/**
+  * @brief  Data sent on a non-control IN endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint number
+  * @retval status
+  */
+static uint8_t USBD_CDC_MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  if (epnum == (MSC_EPIN_ADDR & 0x7FU))
+  {
+    return USBD_CDC_MSC_FUNCTION.DataIn(pdev, epnum);
+  }
+  return USBD_CDC_MSC_COMM_FUNCTION.DataIn(pdev, epnum);
+}
+
+/**
+  * @brief  Data received on a non-control OUT endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint number
+  * @retval status
+  */
+static uint8_t USBD_CDC_MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  if (epnum == MSC_EPOUT_ADDR)
+  {
+    return USBD_CDC_MSC_FUNCTION.DataOut(pdev, epnum);
+  }
+  return USBD_CDC_MSC_COMM_FUNCTION.DataOut(pdev, epnum);
+}
+
+/**
+  * @brief  Return the configuration descriptor, full speed only
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t *USBD_CDC_MSC_GetCfgDesc(uint16_t *length)
+{
+  *length = (uint16_t)sizeof(USBD_CDC_MSC_CfgDesc);
+  return USBD_CDC_MSC_CfgDesc;
+}
+
+/**
+  * @brief  Return the Device Qualifier descriptor
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer
+  */
+static uint8_t *USBD_CDC_MSC_GetDeviceQualifierDesc(uint16_t *length)
+{
+  *length = (uint16_t)sizeof(USBD_CDC_MSC_DeviceQualifierDesc);
+  return USBD_CDC_MSC_DeviceQualifierDesc;
+}
+
+#if (USBD_SUPPORT_USER_STRING_DESC == 1U)
+/**
+  * @brief  Return the class string descriptors: the NCM MAC address
+  * @param  pdev: device instance
+  * @param  index: string index
+  * @param  length : pointer data length
+  * @retval pointer to descriptor buffer, NULL for an unknown index
+  */
+static uint8_t *USBD_CDC_MSC_GetUsrStrDesc(USBD_HandleTypeDef *pdev, uint8_t index, uint16_t *length)
+{
+  UNUSED(pdev);
+
+#ifdef USBD_CDC_NCM
+  if (index == NCM_MAC_STRING_INDEX)
+  {
+    return USBD_NCM_GetMacString(length);
+  }
+#else
+  UNUSED(index);
+#endif /* USBD_CDC_NCM */
+  *length = 0U;
+  return NULL;
+}
+#endif /* USBD_SUPPORT_USER_STRING_DESC */
@@ -0,0 +1,72 @@
+/**
+  ******************************************************************************
+  * @file    usbd_cdc_msc.h
+  * @brief   Composite CDC ACM + Mass Storage class.
+  *
+  *          Interfaces 0 and 1 are the CDC ACM function (grouped by an IAD),
+  *          handled by the stock USBD_CDC class on its usual endpoints, or
+  *          with USBD_CDC_NCM the CDC-NCM Ethernet function of usbd_ncm.c.
+  *          Interface 2 is the Mass Storage function of usbd_msc.c, or with
+  *          USBD_VENDOR_STREAM the vendor bulk stream of usbd_vendor.c.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __USBD_CDC_MSC_H__
+#define __USBD_CDC_MSC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_cdc.h"
+#include "usbd_msc.h"
+#include "usbd_vendor.h"
+#include "usbd_ncm.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define CDC_MSC_CDC_CMD_ITF_NBR     0x00U
+#define CDC_MSC_CDC_DATA_ITF_NBR    0x01U
+#define CDC_MSC_MSC_ITF_NBR         0x02U
+
+
+/* Put a CDC-NCM Ethernet adapter on interfaces 0 and 1 instead of the CDC
+   ACM serial port, on the same endpoints. */
+/* #define USBD_CDC_NCM */
+
+#ifdef USBD_CDC_NCM
+#define USBD_CDC_MSC_COMM_FUNCTION  USBD_NCM
+#define USB_CDC_MSC_CONFIG_DESC_SIZ 117U
+#else
+#define USBD_CDC_MSC_COMM_FUNCTION  USBD_CDC
+#define USB_CDC_MSC_CONFIG_DESC_SIZ 98U
+#endif
+
+#if (NCM_NOTIFY_EP != CDC_CMD_EP) || (NCM_IN_EP != CDC_IN_EP) || (NCM_OUT_EP != CDC_OUT_EP)
+#error "The interface 0/1 functions must share EP1 and EP2"
+#endif
+
+/* Put the vendor bulk stream on interface 2 instead of the Mass Storage
+   function. The OTG FS core has 4 endpoints per direction, EP3 is the only
+   bulk pair left after CDC, so the two cannot be offered together. */
+/* #define USBD_VENDOR_STREAM */
+
+#ifdef USBD_VENDOR_STREAM
+#define USBD_CDC_MSC_FUNCTION       USBD_VENDOR
+#else
+#define USBD_CDC_MSC_FUNCTION       USBD_MSC
+#endif
+
+#if (VENDOR_EPIN_ADDR != MSC_EPIN_ADDR) || (VENDOR_EPOUT_ADDR != MSC_EPOUT_ADDR)
+#error "The interface 2 functions must share EP3"
+#endif
+
+/* Exported variables --------------------------------------------------------*/
+extern USBD_ClassTypeDef USBD_CDC_MSC;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_CDC_MSC_H__ */
@@ -0,0 +1,1098 @@
+/**
+  ******************************************************************************
+  * @file    usbd_msc.c
+  * @brief   USB Mass Storage function, Bulk-Only Transport with the SCSI
+  *          transparent command set.
+  *
+  *          The OTG interrupt only records what happened on the bulk
+  *          endpoints (transfer complete, Bulk-Only reset, halt cleared).
+  *          USBD_MSC_Process() decodes the CBWs, runs the commands and starts
+  *          every bulk transfer, with the interrupts masked around the low
+  *          level calls.
+  *
+  *          READ(10) / WRITE(10) move up to MSC_MEDIA_PACKET bytes per storage
+  *          request through two buffers, so the storage DMA and the bus
+  *          overlap:
+  *
+  *            read  : storage -> buf[n]   while   buf[n^1] -> bulk IN
+  *            write : bulk OUT -> buf[n]  while   buf[n^1] -> storage
+  *
+  *          Errors follow the Bulk-Only Transport rules: the data endpoint
+  *          is halted and the CSW is sent once the host has cleared it; an
+  *          invalid CBW halts both endpoints until a Bulk-Only reset.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_msc.h"
+#include "usbd_ctlreq.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define MSC_CBW_SIGNATURE               0x43425355U
+#define MSC_CSW_SIGNATURE               0x53425355U
+#define MSC_CBW_LENGTH                  31U
+#define MSC_CSW_LENGTH                  13U
+
+#define MSC_CSW_PASSED                  0x00U
+#define MSC_CSW_FAILED                  0x01U
+#define MSC_CSW_PHASE_ERROR             0x02U
+
+#define MSC_RESPONSE_SIZE               64U
+#define MSC_STANDARD_INQUIRY_LEN        36U
+#define MSC_SENSE_LEN                   18U
+
+/* SCSI operation codes */
+#define SCSI_TEST_UNIT_READY            0x00U
+#define SCSI_REQUEST_SENSE              0x03U
+#define SCSI_INQUIRY                    0x12U
+#define SCSI_MODE_SENSE6                0x1AU
+#define SCSI_START_STOP_UNIT            0x1BU
+#define SCSI_ALLOW_MEDIUM_REMOVAL       0x1EU
+#define SCSI_READ_FORMAT_CAPACITIES     0x23U
+#define SCSI_READ_CAPACITY10            0x25U
+#define SCSI_READ10                     0x28U
+#define SCSI_WRITE10                    0x2AU
+#define SCSI_VERIFY10                   0x2FU
+#define SCSI_SYNCHRONIZE_CACHE10        0x35U
+#define SCSI_MODE_SENSE10               0x5AU
+
+/* Sense keys */
+#define SCSI_SK_NO_SENSE                0x00U
+#define SCSI_SK_NOT_READY               0x02U
+#define SCSI_SK_MEDIUM_ERROR            0x03U
+#define SCSI_SK_ILLEGAL_REQUEST         0x05U
+#define SCSI_SK_UNIT_ATTENTION          0x06U
+#define SCSI_SK_DATA_PROTECT            0x07U
+
+/* Additional sense codes */
+#define SCSI_ASC_WRITE_FAULT            0x03U
+#define SCSI_ASC_UNRECOVERED_READ_ERROR 0x11U
+#define SCSI_ASC_INVALID_COMMAND        0x20U
+#define SCSI_ASC_LBA_OUT_OF_RANGE       0x21U
+#define SCSI_ASC_INVALID_FIELD_IN_CDB   0x24U
+#define SCSI_ASC_WRITE_PROTECTED        0x27U
+#define SCSI_ASC_MEDIUM_CHANGED         0x28U
+#define SCSI_ASC_MEDIUM_NOT_PRESENT     0x3AU
+
+#if ((MSC_MEDIA_PACKET % MSC_MEDIA_BLOCK_SIZE) != 0U)
+#error "MSC_MEDIA_PACKET must be a multiple of the block size"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum
+{
+  MSC_BOT_IDLE = 0,     /* Nothing armed, after a reset or configuration */
+  MSC_BOT_CBW,          /* CBW reception armed */
+  MSC_BOT_DATA_IN,      /* Command response in flight, CSW follows */
+  MSC_BOT_READ,         /* READ(10) pipeline */
+  MSC_BOT_WRITE,        /* WRITE(10) pipeline */
+  MSC_BOT_CSW,          /* CSW in flight */
+  MSC_BOT_STALL,        /* Data endpoint halted, CSW sent once cleared */
+  MSC_BOT_RESET_WAIT    /* Invalid CBW, both endpoints halted until reset */
+} MSC_BOT_StateTypeDef;
+
+typedef enum
+{
+  MSC_BUF_FREE = 0,
+  MSC_BUF_MEDIA,        /* Owned by the storage */
+  MSC_BUF_BUS,          /* Owned by the bulk endpoint */
+  MSC_BUF_FULL          /* Holds data for the other side */
+} MSC_BufStateTypeDef;
+
+typedef struct
+{
+  uint32_t dSignature;
+  uint32_t dTag;
+  uint32_t dDataLength;
+  uint8_t  bmFlags;
+  uint8_t  bLUN;
+  uint8_t  bCBLength;
+  uint8_t  CB[16];
+  uint8_t  ReservedForAlign;
+} MSC_CBWTypeDef;
+
+typedef struct
+{
+  uint32_t dSignature;
+  uint32_t dTag;
+  uint32_t dDataResidue;
+  uint8_t  bStatus;
+  uint8_t  ReservedForAlign[3];
+} MSC_CSWTypeDef;
+
+typedef struct
+{
+  /* Set by the OTG interrupt */
+  volatile uint8_t  Active;         /* Configured, endpoints open */
+  volatile uint8_t  Start;          /* New configuration, not yet handled */
+  volatile uint8_t  Reset;          /* Bulk-Only Mass Storage Reset */
+  volatile uint8_t  HaltCleared;    /* ClearFeature(ENDPOINT_HALT) received */
+  volatile uint8_t  InDone;         /* Bulk IN transfer complete */
+  volatile uint8_t  OutDone;        /* Bulk OUT transfer complete */
+  volatile uint32_t OutLen;         /* Bytes of the last bulk OUT transfer */
+
+  /* Main loop only */
+  volatile uint8_t  State;          /* MSC_BOT_StateTypeDef */
+  MSC_CBWTypeDef    cbw;
+  MSC_CSWTypeDef    csw;
+  uint8_t           SenseKey;
+  uint8_t           Asc;
+  uint8_t           UnitAttention;
+  uint8_t           WasReady;
+  uint32_t          InLen;          /* Length of the command response */
+
+  uint32_t          BlkAddr;        /* Next block for the storage */
+  uint32_t          BlkLeft;        /* Blocks the storage still has to move */
+  uint32_t          BusLeft;        /* Bytes the bus still has to move */
+  uint32_t          Done;           /* Bytes fully processed, for the residue */
+  uint8_t           MediaIdx;       /* Buffer the storage uses next */
+  uint8_t           BusIdx;         /* Buffer the bus uses next */
+  uint8_t           MediaBusy;      /* Storage request in flight */
+  uint8_t           MediaCur;       /* Its buffer */
+  uint8_t           MediaError;     /* A storage request failed */
+  uint8_t           BusBusy;        /* Bulk transfer in flight */
+  uint8_t           BusCur;         /* Its buffer */
+  uint8_t           BufState[2];    /* MSC_BufStateTypeDef */
+  uint32_t          BufLen[2];
+} MSC_HandleTypeDef;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t USBD_MSC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_MSC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_MSC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static uint8_t USBD_MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t USBD_MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+/* Private variables ---------------------------------------------------------*/
+USBD_ClassTypeDef USBD_MSC =
+{
+  USBD_MSC_Init,
+  USBD_MSC_DeInit,
+  USBD_MSC_Setup,
+  NULL, /* EP0_TxSent */
+  NULL, /* EP0_RxReady */
+  USBD_MSC_DataIn,
+  USBD_MSC_DataOut,
+  NULL, /* SOF */
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+};
+
+static MSC_HandleTypeDef hmsc;
+static USBD_StorageTypeDef *pStorage;
+
+/* Word aligned for the storage DMA, not in CCMRAM */
+static uint32_t CbwBuf[MSC_MAX_FS_PACKET / 4U];
+static uint32_t CswBuf[(MSC_CSW_LENGTH + 3U) / 4U];
+static uint32_t RespBuf[MSC_RESPONSE_SIZE / 4U];
+static uint32_t MediaBuf[2][MSC_MEDIA_PACKET / 4U];
+
+/* Private functions ---------------------------------------------------------*/
+
+static uint32_t MSC_GetBE32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t MSC_GetBE16(const uint8_t *p)
+{
+  return (uint16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+static void MSC_PutBE32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+/**
+  * @brief  Start a bulk IN transfer
+  * @note   Masks the interrupts so that the OTG interrupt cannot close the
+  *         endpoints or use the FIFO registers in the middle of the call.
+  * @param  pdev: device instance
+  * @param  buf: Data to send
+  * @param  len: Length in bytes
+  * @retval None
+  */
+static void MSC_Transmit(USBD_HandleTypeDef *pdev, uint8_t *buf, uint32_t len)
+{
+  __disable_irq();
+  if (hmsc.Active != 0U)
+  {
+    hmsc.InDone = 0U;
+    (void)USBD_LL_Transmit(pdev, MSC_EPIN_ADDR, buf, len);
+  }
+  __enable_irq();
+}
+
+/**
+  * @brief  Arm a bulk OUT transfer
+  * @param  pdev: device instance
+  * @param  buf: Destination, room for len rounded up to a full packet
+  * @param  len: Length in bytes
+  * @retval None
+  */
+static void MSC_Receive(USBD_HandleTypeDef *pdev, uint8_t *buf, uint32_t len)
+{
+  __disable_irq();
+  if (hmsc.Active != 0U)
+  {
+    hmsc.OutDone = 0U;
+    (void)USBD_LL_PrepareReceive(pdev, MSC_EPOUT_ADDR, buf, len);
+  }
+  __enable_irq();
+}
+
+/**
+  * @brief  Halt a bulk endpoint
+  * @param  pdev: device instance
+  * @param  ep_addr: Endpoint address
+  * @retval None
+  */
+static void MSC_Stall(USBD_HandleTypeDef *pdev, uint8_t ep_addr)
+{
+  __disable_irq();
+  if (hmsc.Active != 0U)
+  {
+    (void)USBD_LL_StallEP(pdev, ep_addr);
+  }
+  __enable_irq();
+}
+
+/**
+  * @brief  Wait for the next CBW
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void MSC_ArmCBW(USBD_HandleTypeDef *pdev)
+{
+  hmsc.State = MSC_BOT_CBW;
+  MSC_Receive(pdev, (uint8_t *)CbwBuf, MSC_CBW_LENGTH);
+}
+
+/**
+  * @brief  Send the CSW of the current command
+  * @param  pdev: device instance
+  * @param  status: MSC_CSW_PASSED, MSC_CSW_FAILED or MSC_CSW_PHASE_ERROR
+  * @retval None
+  */
+static void MSC_SendCSW(USBD_HandleTypeDef *pdev, uint8_t status)
+{
+  hmsc.csw.dSignature = MSC_CSW_SIGNATURE;
+  hmsc.csw.dTag = hmsc.cbw.dTag;
+  hmsc.csw.bStatus = status;
+  memcpy(CswBuf, &hmsc.csw, MSC_CSW_LENGTH);
+
+  hmsc.State = MSC_BOT_CSW;
+  MSC_Transmit(pdev, (uint8_t *)CswBuf, MSC_CSW_LENGTH);
+}
+
+/**
+  * @brief  End the command without (more) data
+  * @note   If the host expects a data stage, the endpoint in that direction
+  *         is halted and the CSW goes out after the host has cleared it.
+  * @param  pdev: device instance
+  * @param  status: CSW status
+  * @retval None
+  */
+static void MSC_Abort(USBD_HandleTypeDef *pdev, uint8_t status)
+{
+  hmsc.csw.dDataResidue = hmsc.cbw.dDataLength - hmsc.Done;
+  hmsc.csw.bStatus = status;
+
+  if (hmsc.csw.dDataResidue == 0U)
+  {
+    MSC_SendCSW(pdev, status);
+    return;
+  }
+
+  hmsc.HaltCleared = 0U;
+  hmsc.State = MSC_BOT_STALL;
+  MSC_Stall(pdev, ((hmsc.cbw.bmFlags & 0x80U) != 0U) ? MSC_EPIN_ADDR : MSC_EPOUT_ADDR);
+}
+
+/**
+  * @brief  Fail the command with the given sense data
+  * @param  pdev: device instance
+  * @param  sk: Sense key
+  * @param  asc: Additional sense code
+  * @retval None
+  */
+static void MSC_Fail(USBD_HandleTypeDef *pdev, uint8_t sk, uint8_t asc)
+{
+  hmsc.SenseKey = sk;
+  hmsc.Asc = asc;
+  MSC_Abort(pdev, MSC_CSW_FAILED);
+}
+
+/**
+  * @brief  Send a command response from RespBuf, cut to the host length
+  * @param  pdev: device instance
+  * @param  len: Length of the response
+  * @retval None
+  */
+static void MSC_SendResponse(USBD_HandleTypeDef *pdev, uint32_t len)
+{
+  if ((hmsc.cbw.bmFlags & 0x80U) == 0U)
+  {
+    /* Host sends (or expects nothing) while the device has data */
+    if (hmsc.cbw.dDataLength != 0U)
+    {
+      MSC_Abort(pdev, MSC_CSW_PHASE_ERROR);
+    }
+    else
+    {
+      MSC_SendCSW(pdev, MSC_CSW_PASSED);
+    }
+    return;
+  }
+
+  if (len > hmsc.cbw.dDataLength)
+  {
+    len = hmsc.cbw.dDataLength;
+  }
+  hmsc.InLen = len;
+
+  if (len == 0U)
+  {
+    MSC_Abort(pdev, MSC_CSW_PASSED);
+    return;
+  }
+
+  hmsc.State = MSC_BOT_DATA_IN;
+  MSC_Transmit(pdev, (uint8_t *)RespBuf, len);
+}
+
+/**
+  * @brief  Check that the medium can be accessed, report changes once
+  * @param  pdev: device instance
+  * @retval 0 if ready, otherwise the command was failed
+  */
+static int8_t MSC_CheckMedium(USBD_HandleTypeDef *pdev)
+{
+  uint8_t ready = (pStorage->IsReady(hmsc.cbw.bLUN) == 0) ? 1U : 0U;
+
+  if ((ready != 0U) && (hmsc.WasReady == 0U))
+  {
+    hmsc.UnitAttention = 1U;
+  }
+  hmsc.WasReady = ready;
+
+  if (ready == 0U)
+  {
+    MSC_Fail(pdev, SCSI_SK_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+    return -1;
+  }
+  if (hmsc.UnitAttention != 0U)
+  {
+    hmsc.UnitAttention = 0U;
+    MSC_Fail(pdev, SCSI_SK_UNIT_ATTENTION, SCSI_ASC_MEDIUM_CHANGED);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+  * @brief  Set up a READ(10) or WRITE(10) pipeline
+  * @param  pdev: device instance
+  * @param  write: 0 for READ(10), 1 for WRITE(10)
+  * @retval None
+  */
+static void MSC_StartTransfer(USBD_HandleTypeDef *pdev, uint8_t write)
+{
+  uint32_t block_num;
+  uint16_t block_size;
+  uint32_t lba = MSC_GetBE32(&hmsc.cbw.CB[2]);
+  uint32_t len = MSC_GetBE16(&hmsc.cbw.CB[7]);
+  uint8_t dir_in = ((hmsc.cbw.bmFlags & 0x80U) != 0U) ? 1U : 0U;
+
+  if (MSC_CheckMedium(pdev) != 0)
+  {
+    return;
+  }
+  if ((pStorage->GetCapacity(hmsc.cbw.bLUN, &block_num, &block_size) != 0) ||
+      (block_size != MSC_MEDIA_BLOCK_SIZE))
+  {
+    MSC_Fail(pdev, SCSI_SK_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+    return;
+  }
+  if ((lba > block_num) || (len > (block_num - lba)))
+  {
+    MSC_Fail(pdev, SCSI_SK_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+    return;
+  }
+  if ((write != 0U) && (pStorage->IsWriteProtected(hmsc.cbw.bLUN) != 0))
+  {
+    MSC_Fail(pdev, SCSI_SK_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED);
+    return;
+  }
+  /* The host must move exactly the blocks asked for, in the right direction */
+  if ((hmsc.cbw.dDataLength != (len * MSC_MEDIA_BLOCK_SIZE)) ||
+      ((len != 0U) && (dir_in == write)))
+  {
+    MSC_Abort(pdev, MSC_CSW_PHASE_ERROR);
+    return;
+  }
+  if (len == 0U)
+  {
+    MSC_SendCSW(pdev, MSC_CSW_PASSED);
+    return;
+  }
+
+  hmsc.BlkAddr = lba;
+  hmsc.BlkLeft = len;
+  hmsc.BusLeft = hmsc.cbw.dDataLength;
+  hmsc.MediaIdx = 0U;
+  hmsc.BusIdx = 0U;
+  hmsc.MediaBusy = 0U;
+  hmsc.MediaError = 0U;
+  hmsc.BusBusy = 0U;
+  hmsc.BufState[0] = MSC_BUF_FREE;
+  hmsc.BufState[1] = MSC_BUF_FREE;
+  hmsc.State = (write != 0U) ? MSC_BOT_WRITE : MSC_BOT_READ;
+}
+
+/**
+  * @brief  Advance the READ(10) pipeline
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void MSC_ProcessRead(USBD_HandleTypeDef *pdev)
+{
+  uint32_t n;
+  int8_t st;
+
+  if (hmsc.MediaBusy != 0U)
+  {
+    st = pStorage->Poll(hmsc.cbw.bLUN);
+    if (st == MSC_STORAGE_BUSY)
+    {
+      /* Keep the bus going below */
+    }
+    else
+    {
+      hmsc.MediaBusy = 0U;
+      if (st != MSC_STORAGE_OK)
+      {
+        /* Fail once the transfer on the bus, if any, has completed */
+        hmsc.MediaError = 1U;
+        hmsc.BlkLeft = 0U;
+      }
+      else
+      {
+        hmsc.BufState[hmsc.MediaCur] = MSC_BUF_FULL;
+      }
+    }
+  }
+
+  if ((hmsc.BusBusy != 0U) && (hmsc.InDone != 0U))
+  {
+    hmsc.BusBusy = 0U;
+    hmsc.BusLeft -= hmsc.BufLen[hmsc.BusCur];
+    hmsc.Done += hmsc.BufLen[hmsc.BusCur];
+    hmsc.BufState[hmsc.BusCur] = MSC_BUF_FREE;
+    if (hmsc.BusLeft == 0U)
+    {
+      hmsc.csw.dDataResidue = 0U;
+      MSC_SendCSW(pdev, MSC_CSW_PASSED);
+      return;
+    }
+  }
+
+  if ((hmsc.MediaError != 0U) && (hmsc.BusBusy == 0U))
+  {
+    MSC_Fail(pdev, SCSI_SK_MEDIUM_ERROR, SCSI_ASC_UNRECOVERED_READ_ERROR);
+    return;
+  }
+
+  if ((hmsc.MediaBusy == 0U) && (hmsc.BlkLeft != 0U) &&
+      (hmsc.BufState[hmsc.MediaIdx] == MSC_BUF_FREE))
+  {
+    n = MIN(hmsc.BlkLeft, MSC_MEDIA_PACKET / MSC_MEDIA_BLOCK_SIZE);
+    if (pStorage->Read(hmsc.cbw.bLUN, (uint8_t *)MediaBuf[hmsc.MediaIdx],
+                       hmsc.BlkAddr, (uint16_t)n) != 0)
+    {
+      MSC_Fail(pdev, SCSI_SK_MEDIUM_ERROR, SCSI_ASC_UNRECOVERED_READ_ERROR);
+      return;
+    }
+    hmsc.BufLen[hmsc.MediaIdx] = n * MSC_MEDIA_BLOCK_SIZE;
+    hmsc.BufState[hmsc.MediaIdx] = MSC_BUF_MEDIA;
+    hmsc.MediaCur = hmsc.MediaIdx;
+    hmsc.MediaIdx ^= 1U;
+    hmsc.MediaBusy = 1U;
+    hmsc.BlkAddr += n;
+    hmsc.BlkLeft -= n;
+  }
+
+  if ((hmsc.BusBusy == 0U) && (hmsc.BufState[hmsc.BusIdx] == MSC_BUF_FULL))
+  {
+    hmsc.BufState[hmsc.BusIdx] = MSC_BUF_BUS;
+    hmsc.BusCur = hmsc.BusIdx;
+    hmsc.BusIdx ^= 1U;
+    hmsc.BusBusy = 1U;
+    MSC_Transmit(pdev, (uint8_t *)MediaBuf[hmsc.BusCur], hmsc.BufLen[hmsc.BusCur]);
+  }
+}
+
+/**
+  * @brief  Advance the WRITE(10) pipeline
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void MSC_ProcessWrite(USBD_HandleTypeDef *pdev)
+{
+  uint32_t n;
+  int8_t st;
+
+  if ((hmsc.BusBusy != 0U) && (hmsc.OutDone != 0U))
+  {
+    hmsc.BusBusy = 0U;
+    if (hmsc.OutLen != hmsc.BufLen[hmsc.BusCur])
+    {
+      /* Short packet: the host sent less than announced in the CBW */
+      MSC_Abort(pdev, MSC_CSW_PHASE_ERROR);
+      return;
+    }
+    hmsc.BusLeft -= hmsc.BufLen[hmsc.BusCur];
+    hmsc.BufState[hmsc.BusCur] = MSC_BUF_FULL;
+  }
+
+  if (hmsc.MediaBusy != 0U)
+  {
+    st = pStorage->Poll(hmsc.cbw.bLUN);
+    if (st != MSC_STORAGE_BUSY)
+    {
+      hmsc.MediaBusy = 0U;
+      if (st != MSC_STORAGE_OK)
+      {
+        MSC_Fail(pdev, SCSI_SK_MEDIUM_ERROR, SCSI_ASC_WRITE_FAULT);
+        return;
+      }
+      hmsc.Done += hmsc.BufLen[hmsc.MediaCur];
+      hmsc.BufState[hmsc.MediaCur] = MSC_BUF_FREE;
+      if (hmsc.Done == hmsc.cbw.dDataLength)
+      {
+        hmsc.csw.dDataResidue = 0U;
+        MSC_SendCSW(pdev, MSC_CSW_PASSED);
+        return;
+      }
+    }
+  }
+
+  if ((hmsc.BusBusy == 0U) && (hmsc.BusLeft != 0U) &&
+      (hmsc.BufState[hmsc.BusIdx] == MSC_BUF_FREE))
+  {
+    n = MIN(hmsc.BusLeft, MSC_MEDIA_PACKET);
+    hmsc.BufLen[hmsc.BusIdx] = n;
+    hmsc.BufState[hmsc.BusIdx] = MSC_BUF_BUS;
+    hmsc.BusCur = hmsc.BusIdx;
+    hmsc.BusIdx ^= 1U;
+    hmsc.BusBusy = 1U;
+    MSC_Receive(pdev, (uint8_t *)MediaBuf[hmsc.BusCur], n);
+  }
+
+  if ((hmsc.MediaBusy == 0U) && (hmsc.BufState[hmsc.MediaIdx] == MSC_BUF_FULL))
+  {
+    n = hmsc.BufLen[hmsc.MediaIdx] / MSC_MEDIA_BLOCK_SIZE;
+    if (pStorage->Write(hmsc.cbw.bLUN, (uint8_t *)MediaBuf[hmsc.MediaIdx],
+                        hmsc.BlkAddr, (uint16_t)n) != 0)
+    {
+      MSC_Fail(pdev, SCSI_SK_MEDIUM_ERROR, SCSI_ASC_WRITE_FAULT);
+      return;
+    }
+    hmsc.BufState[hmsc.MediaIdx] = MSC_BUF_MEDIA;
+    hmsc.MediaCur = hmsc.MediaIdx;
+    hmsc.MediaIdx ^= 1U;
+    hmsc.MediaBusy = 1U;
+    hmsc.BlkAddr += n;
+    hmsc.BlkLeft -= n;
+  }
+}
+
+/**
+  * @brief  Decode and run a SCSI command
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void MSC_ProcessCommand(USBD_HandleTypeDef *pdev)
+{
+  uint8_t *resp = (uint8_t *)RespBuf;
+  uint32_t block_num;
+  uint16_t block_size;
+  uint8_t wp;
+
+  memset(resp, 0, MSC_RESPONSE_SIZE);
+
+  switch (hmsc.cbw.CB[0])
+  {
+    case SCSI_TEST_UNIT_READY:
+      if (MSC_CheckMedium(pdev) == 0)
+      {
+        MSC_SendResponse(pdev, 0U);
+      }
+      break;
+
+    case SCSI_REQUEST_SENSE:
+      resp[0] = 0x70U;              /* Current error, fixed format */
+      resp[2] = hmsc.SenseKey;
+      resp[7] = MSC_SENSE_LEN - 8U;
+      resp[12] = hmsc.Asc;
+      hmsc.SenseKey = SCSI_SK_NO_SENSE;
+      hmsc.Asc = 0U;
+      MSC_SendResponse(pdev, MIN(hmsc.cbw.CB[4], MSC_SENSE_LEN));
+      break;
+
+    case SCSI_INQUIRY:
+      if ((hmsc.cbw.CB[1] & 0x01U) != 0U)
+      {
+        /* No vital product data pages */
+        MSC_Fail(pdev, SCSI_SK_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB);
+        break;
+      }
+      memcpy(resp, pStorage->pInquiry, MSC_STANDARD_INQUIRY_LEN);
+      MSC_SendResponse(pdev, MIN(MSC_GetBE16(&hmsc.cbw.CB[3]), MSC_STANDARD_INQUIRY_LEN));
+      break;
+
+    case SCSI_READ_FORMAT_CAPACITIES:
+      if (MSC_CheckMedium(pdev) != 0)
+      {
+        break;
+      }
+      if (pStorage->GetCapacity(hmsc.cbw.bLUN, &block_num, &block_size) != 0)
+      {
+        MSC_Fail(pdev, SCSI_SK_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+        break;
+      }
+      resp[3] = 0x08U;              /* Capacity list length */
+      MSC_PutBE32(&resp[4], block_num);
+      MSC_PutBE32(&resp[8], block_size);
+      resp[8] = 0x02U;              /* Formatted media, 24 bit block length follows */
+      MSC_SendResponse(pdev, MIN(MSC_GetBE16(&hmsc.cbw.CB[7]), 12U));
+      break;
+
+    case SCSI_READ_CAPACITY10:
+      if (MSC_CheckMedium(pdev) != 0)
+      {
+        break;
+      }
+      if (pStorage->GetCapacity(hmsc.cbw.bLUN, &block_num, &block_size) != 0)
+      {
+        MSC_Fail(pdev, SCSI_SK_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+        break;
+      }
+      MSC_PutBE32(&resp[0], block_num - 1U);
+      MSC_PutBE32(&resp[4], block_size);
+      MSC_SendResponse(pdev, 8U);
+      break;
+
+    case SCSI_MODE_SENSE6:
+      wp = (pStorage->IsWriteProtected(hmsc.cbw.bLUN) != 0) ? 0x80U : 0x00U;
+      resp[0] = 3U;                 /* Mode data length, no pages */
+      resp[2] = wp;
+      MSC_SendResponse(pdev, MIN(hmsc.cbw.CB[4], 4U));
+      break;
+
+    case SCSI_MODE_SENSE10:
+      wp = (pStorage->IsWriteProtected(hmsc.cbw.bLUN) != 0) ? 0x80U : 0x00U;
+      resp[1] = 6U;                 /* Mode data length, no pages */
+      resp[3] = wp;
+      MSC_SendResponse(pdev, MIN(MSC_GetBE16(&hmsc.cbw.CB[7]), 8U));
+      break;
+
+    case SCSI_START_STOP_UNIT:
+      /* LoEj set and Start clear: the host ejects the medium */
+      if ((hmsc.cbw.CB[4] & 0x03U) == 0x02U)
+      {
+        (void)pStorage->Eject(hmsc.cbw.bLUN);
+      }
+      MSC_SendResponse(pdev, 0U);
+      break;
+
+    case SCSI_ALLOW_MEDIUM_REMOVAL:
+    case SCSI_SYNCHRONIZE_CACHE10:
+      /* Writes are on the medium before their CSW, nothing is cached */
+      MSC_SendResponse(pdev, 0U);
+      break;
+
+    case SCSI_VERIFY10:
+      if (MSC_CheckMedium(pdev) == 0)
+      {
+        MSC_SendResponse(pdev, 0U);
+      }
+      break;
+
+    case SCSI_READ10:
+      MSC_StartTransfer(pdev, 0U);
+      break;
+
+    case SCSI_WRITE10:
+      MSC_StartTransfer(pdev, 1U);
+      break;
+
+    default:
+      MSC_Fail(pdev, SCSI_SK_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND);
+      break;
+  }
+}
+
+/**
+  * @brief  Check the received CBW and run its command
+  * @param  pdev: device instance
+  * @retval None
+  */
+static void MSC_ProcessCBW(USBD_HandleTypeDef *pdev)
+{
+  memcpy(&hmsc.cbw, CbwBuf, MSC_CBW_LENGTH);
+  hmsc.Done = 0U;
+  hmsc.csw.dDataResidue = 0U;
+
+  if ((hmsc.OutLen != MSC_CBW_LENGTH) ||
+      (hmsc.cbw.dSignature != MSC_CBW_SIGNATURE) ||
+      (hmsc.cbw.bLUN > (uint8_t)pStorage->GetMaxLun()) ||
+      (hmsc.cbw.bCBLength < 1U) || (hmsc.cbw.bCBLength > 16U))
+  {
+    /* Not meaningful: halt both endpoints until a Bulk-Only reset */
+    hmsc.State = MSC_BOT_RESET_WAIT;
+    MSC_Stall(pdev, MSC_EPIN_ADDR);
+    MSC_Stall(pdev, MSC_EPOUT_ADDR);
+    return;
+  }
+
+  MSC_ProcessCommand(pdev);
+}
+
+/**
+  * @brief  Initialize the MSC interface
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_MSC_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  UNUSED(cfgidx);
+
+  (void)USBD_LL_OpenEP(pdev, MSC_EPOUT_ADDR, USBD_EP_TYPE_BULK, MSC_MAX_FS_PACKET);
+  pdev->ep_out[MSC_EPOUT_ADDR & 0xFU].is_used = 1U;
+  (void)USBD_LL_OpenEP(pdev, MSC_EPIN_ADDR, USBD_EP_TYPE_BULK, MSC_MAX_FS_PACKET);
+  pdev->ep_in[MSC_EPIN_ADDR & 0xFU].is_used = 1U;
+
+  hmsc.InDone = 0U;
+  hmsc.OutDone = 0U;
+  hmsc.Reset = 0U;
+  hmsc.Start = 1U;
+  hmsc.Active = 1U;
+
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  DeInitialize the MSC interface
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_MSC_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  UNUSED(cfgidx);
+
+  hmsc.Active = 0U;
+
+  (void)USBD_LL_CloseEP(pdev, MSC_EPOUT_ADDR);
+  pdev->ep_out[MSC_EPOUT_ADDR & 0xFU].is_used = 0U;
+  (void)USBD_LL_CloseEP(pdev, MSC_EPIN_ADDR);
+  pdev->ep_in[MSC_EPIN_ADDR & 0xFU].is_used = 0U;
+
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  Handle the MSC specific requests
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t USBD_MSC_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+  static uint8_t max_lun;
+  static uint16_t status_info;
+  static uint8_t ifalt;
+  USBD_StatusTypeDef ret = USBD_OK;
+
+  switch (req->bmRequest & USB_REQ_TYPE_MASK)
+  {
+    case USB_REQ_TYPE_CLASS:
+      switch (req->bRequest)
+      {
+        case MSC_BOT_GET_MAX_LUN:
+          if ((req->wValue == 0U) && (req->wLength == 1U) &&
+              ((req->bmRequest & 0x80U) == 0x80U) && (pStorage != NULL))
+          {
+            max_lun = (uint8_t)pStorage->GetMaxLun();
+            (void)USBD_CtlSendData(pdev, &max_lun, 1U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case MSC_BOT_RESET:
+          if ((req->wValue == 0U) && (req->wLength == 0U) &&
+              ((req->bmRequest & 0x80U) != 0x80U))
+          {
+            hmsc.Reset = 1U;
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        default:
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+          break;
+      }
+      break;
+
+    case USB_REQ_TYPE_STANDARD:
+      switch (req->bRequest)
+      {
+        case USB_REQ_GET_STATUS:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            status_info = 0U;
+            (void)USBD_CtlSendData(pdev, (uint8_t *)&status_info, 2U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_GET_INTERFACE:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            ifalt = 0U;
+            (void)USBD_CtlSendData(pdev, &ifalt, 1U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_SET_INTERFACE:
+          if (pdev->dev_state != USBD_STATE_CONFIGURED)
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_CLEAR_FEATURE:
+          if (req->wValue == USB_FEATURE_EP_HALT)
+          {
+            if ((hmsc.State == MSC_BOT_RESET_WAIT) && (hmsc.Reset == 0U))
+            {
+              /* Only a Bulk-Only reset ends the recovery */
+              (void)USBD_LL_StallEP(pdev, LOBYTE(req->wIndex));
+            }
+            else
+            {
+              hmsc.HaltCleared = 1U;
+            }
+          }
+          break;
+
+        default:
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+          break;
+      }
+      break;
+
+    default:
+      USBD_CtlError(pdev, req);
+      ret = USBD_FAIL;
+      break;
+  }
+
+  return (uint8_t)ret;
+}
+
+/**
+  * @brief  Data sent on the bulk IN endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t USBD_MSC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  UNUSED(pdev);
+  UNUSED(epnum);
+
+  hmsc.InDone = 1U;
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  Data received on the bulk OUT endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t USBD_MSC_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  hmsc.OutLen = USBD_LL_GetRxDataSize(pdev, epnum);
+  hmsc.OutDone = 1U;
+  return (uint8_t)USBD_OK;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Register the storage backend
+  * @param  pdev: device instance
+  * @param  fops: Storage callbacks
+  * @retval status
+  */
+uint8_t USBD_MSC_RegisterStorage(USBD_HandleTypeDef *pdev, USBD_StorageTypeDef *fops)
+{
+  UNUSED(pdev);
+
+  if (fops == NULL)
+  {
+    return (uint8_t)USBD_FAIL;
+  }
+  pStorage = fops;
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  Run the Bulk-Only Transport, call from the main loop
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_MSC_Process(USBD_HandleTypeDef *pdev)
+{
+  uint8_t lun;
+
+  if (pStorage == NULL)
+  {
+    return;
+  }
+
+  /* A storage request can only be left behind, never cancelled */
+  if ((hmsc.MediaBusy != 0U) &&
+      ((hmsc.Active == 0U) || (hmsc.Reset != 0U) || (hmsc.Start != 0U) ||
+       ((hmsc.State != MSC_BOT_READ) && (hmsc.State != MSC_BOT_WRITE))))
+  {
+    if (pStorage->Poll(hmsc.cbw.bLUN) == MSC_STORAGE_BUSY)
+    {
+      return;
+    }
+    hmsc.MediaBusy = 0U;
+  }
+
+  if (hmsc.Active == 0U)
+  {
+    hmsc.State = MSC_BOT_IDLE;
+    return;
+  }
+
+  if (hmsc.Start != 0U)
+  {
+    hmsc.Start = 0U;
+    hmsc.Reset = 0U;
+    for (lun = 0U; lun <= (uint8_t)pStorage->GetMaxLun(); lun++)
+    {
+      (void)pStorage->Init(lun);
+    }
+    hmsc.WasReady = 0U;
+    hmsc.SenseKey = SCSI_SK_NO_SENSE;
+    hmsc.Asc = 0U;
+    MSC_ArmCBW(pdev);
+    return;
+  }
+
+  if (hmsc.Reset != 0U)
+  {
+    /* Bulk-Only Mass Storage Reset: drop the command, wait for a new CBW */
+    __disable_irq();
+    hmsc.Reset = 0U;
+    (void)USBD_LL_FlushEP(pdev, MSC_EPIN_ADDR);
+    (void)USBD_LL_FlushEP(pdev, MSC_EPOUT_ADDR);
+    __enable_irq();
+    MSC_ArmCBW(pdev);
+    return;
+  }
+
+  switch (hmsc.State)
+  {
+    case MSC_BOT_CBW:
+      if (hmsc.OutDone != 0U)
+      {
+        hmsc.OutDone = 0U;
+        MSC_ProcessCBW(pdev);
+      }
+      break;
+
+    case MSC_BOT_DATA_IN:
+      if (hmsc.InDone != 0U)
+      {
+        hmsc.Done = hmsc.InLen;
+        if ((hmsc.InLen < hmsc.cbw.dDataLength) && ((hmsc.InLen % MSC_MAX_FS_PACKET) == 0U))
+        {
+          /* No short packet to end the data stage, halt the endpoint */
+          MSC_Abort(pdev, MSC_CSW_PASSED);
+        }
+        else
+        {
+          hmsc.csw.dDataResidue = hmsc.cbw.dDataLength - hmsc.InLen;
+          MSC_SendCSW(pdev, MSC_CSW_PASSED);
+        }
+      }
+      break;
+
+    case MSC_BOT_READ:
+      MSC_ProcessRead(pdev);
+      break;
+
+    case MSC_BOT_WRITE:
+      MSC_ProcessWrite(pdev);
+      break;
+
+    case MSC_BOT_CSW:
+      if (hmsc.InDone != 0U)
+      {
+        MSC_ArmCBW(pdev);
+      }
+      break;
+
+    case MSC_BOT_STALL:
+      if (hmsc.HaltCleared != 0U)
+      {
+        hmsc.HaltCleared = 0U;
+        __disable_irq();
+        (void)USBD_LL_FlushEP(pdev, MSC_EPIN_ADDR);
+        __enable_irq();
+        MSC_SendCSW(pdev, hmsc.csw.bStatus);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file    usbd_msc.h
+  * @brief   USB Mass Storage function, Bulk-Only Transport with the SCSI
+  *          transparent command set.
+  *
+  *          Only the USB side runs in the OTG interrupt. Commands, media
+  *          accesses and all endpoint traffic are handled by
+  *          USBD_MSC_Process() from the main loop, so that the storage can use
+  *          interrupt driven DMA and wait for it without blocking the bus.
+  *
+  *          READ(10) and WRITE(10) are pipelined through two media buffers:
+  *          one is filled by the storage while the other is on the bus.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __USBD_MSC_H__
+#define __USBD_MSC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_ioreq.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define MSC_EPIN_ADDR               0x83U
+#define MSC_EPOUT_ADDR              0x03U
+#define MSC_MAX_FS_PACKET           64U
+#define MSC_MEDIA_PACKET            8192U   /* Per media buffer, two are used */
+#define MSC_MEDIA_BLOCK_SIZE        512U
+
+#define MSC_BOT_GET_MAX_LUN         0xFEU
+#define MSC_BOT_RESET               0xFFU
+
+/* Storage status, returned by USBD_StorageTypeDef::Poll() */
+#define MSC_STORAGE_OK              0
+#define MSC_STORAGE_BUSY            1
+#define MSC_STORAGE_ERROR           (-1)
+
+/* Exported types ------------------------------------------------------------*/
+
+/**
+  * @brief Storage backend of the MSC function
+  * @note  Read() and Write() only start the transfer and return at once,
+  *        completion is then polled through Poll(). All calls come from the
+  *        main loop. Return values are 0 for success, negative for errors.
+  */
+typedef struct
+{
+  int8_t (*Init)(uint8_t lun);
+  int8_t (*GetCapacity)(uint8_t lun, uint32_t *block_num, uint16_t *block_size);
+  int8_t (*IsReady)(uint8_t lun);
+  int8_t (*IsWriteProtected)(uint8_t lun);
+  int8_t (*Read)(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+  int8_t (*Write)(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+  int8_t (*Poll)(uint8_t lun);
+  int8_t (*Eject)(uint8_t lun);
+  int8_t (*GetMaxLun)(void);
+  int8_t *pInquiry;
+} USBD_StorageTypeDef;
+
+/* Exported variables --------------------------------------------------------*/
+/* Class callbacks, used by the composite class, no descriptors of its own */
+extern USBD_ClassTypeDef USBD_MSC;
+
+/* Exported functions prototypes ---------------------------------------------*/
+uint8_t USBD_MSC_RegisterStorage(USBD_HandleTypeDef *pdev, USBD_StorageTypeDef *fops);
+void    USBD_MSC_Process(USBD_HandleTypeDef *pdev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_MSC_H__ */
@@ -0,0 +1,714 @@
+/**
+  ******************************************************************************
+  * @file    usbd_ncm.c
+  * @brief   USB CDC-NCM (Network Control Model) function.
+  *
+  *          Transmit: frames are copied by the network interface straight
+  *          into the NTB being filled (USBD_NCM_TxAlloc() / TxCommit()).
+  *          When the bulk IN endpoint is idle the NTB is closed and sent at
+  *          once, otherwise the frames keep piling up in it while the other
+  *          NTB is on the bus. A lone frame therefore goes out without delay
+  *          and under load several frames share each transfer.
+  *
+  *          Receive: two NTB buffers take turns on the bulk OUT endpoint;
+  *          the interrupt arms the free one as soon as the other is full.
+  *          USBD_NCM_GetFrame() walks the datagrams of a full NTB in place
+  *          and gives the buffer back once they are all consumed.
+  *
+  *          The data interface has two alternate settings, the endpoints are
+  *          only open in the second one. Selecting it sends the connection
+  *          speed and the network connection notifications.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_ncm.h"
+#include "usbd_cdc_msc.h"
+#include "usbd_ctlreq.h"
+#include "ncm_ntb.h"
+
+/* Private define ------------------------------------------------------------*/
+#define NCM_RX_FREE                 0U
+#define NCM_RX_BUS                  1U      /* Armed on the OUT endpoint */
+#define NCM_RX_FULL                 2U      /* Holds an NTB to parse */
+#define NCM_RX_NONE                 0xFFU
+
+#define NCM_NOTIFY_NETWORK_CONNECTION   0x00U
+#define NCM_NOTIFY_SPEED_CHANGE         0x2AU
+
+#define NCM_NTB_PARAMETERS_SIZE     28U
+
+#if ((NCM_NTB_OUT_SIZE % NCM_DATA_FS_MAX_PACKET) != 0U) || (NCM_NTB_IN_SIZE < NCM_NTB_MIN_IN_SIZE)
+#error "Invalid NTB sizes"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  USBD_HandleTypeDef *pdev;
+
+  /* Set by the OTG interrupt */
+  volatile uint8_t  Configured;     /* Notification endpoint open */
+  volatile uint8_t  Alt;            /* Data interface alternate setting */
+  volatile uint8_t  Start;          /* Alternate setting 1 selected, not yet handled */
+  volatile uint8_t  NotifyBusy;     /* Notification in flight */
+  volatile uint8_t  TxBusy;         /* NTB or ZLP in flight */
+  volatile uint8_t  RxBus;          /* Buffer armed on the OUT endpoint */
+  volatile uint8_t  RxState[2];
+  volatile uint32_t RxLen[2];
+  volatile uint32_t InMaxSize;      /* dwNtbInMaxSize, may be lowered by the host */
+  uint32_t          TxLen;          /* Length of the NTB in flight */
+  uint8_t           Zlp;            /* Its ZLP is in flight */
+  uint8_t           CtrlReq;        /* Class request waiting for its data */
+
+  /* Main loop only */
+  uint8_t           Up;             /* Data path running */
+  uint8_t           Notify;         /* Notifications left to send */
+  uint8_t           TxFill;         /* Buffer being filled */
+  uint16_t          TxSeq;
+  uint8_t           RxNext;         /* Next buffer to parse */
+  uint8_t           RxParsing;      /* Rx walks RxBuf[RxNext] */
+  uint32_t          RxErrors;       /* Malformed NTBs */
+  NCM_NTB_BuilderTypeDef Tx;
+  NCM_NTB_ParserTypeDef  Rx;
+} NCM_HandleTypeDef;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t USBD_NCM_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_NCM_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_NCM_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static uint8_t USBD_NCM_EP0_RxReady(USBD_HandleTypeDef *pdev);
+static uint8_t USBD_NCM_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t USBD_NCM_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+/* Private variables ---------------------------------------------------------*/
+USBD_ClassTypeDef USBD_NCM =
+{
+  USBD_NCM_Init,
+  USBD_NCM_DeInit,
+  USBD_NCM_Setup,
+  NULL, /* EP0_TxSent */
+  USBD_NCM_EP0_RxReady,
+  USBD_NCM_DataIn,
+  USBD_NCM_DataOut,
+  NULL, /* SOF */
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+};
+
+static NCM_HandleTypeDef hncm;
+
+/* Word aligned, not in CCMRAM */
+static uint32_t TxBuf[2][NCM_NTB_IN_SIZE / 4U];
+static uint32_t RxBuf[2][NCM_NTB_OUT_SIZE / 4U];
+static uint32_t NotifyBuf[NCM_NOTIFY_PACKET_SIZE / 4U];
+static uint32_t CtrlBuf[NCM_NTB_PARAMETERS_SIZE / 4U];
+
+/* iMACAddress string: 12 hex digits in UTF-16 */
+__ALIGN_BEGIN static uint8_t NCM_MacString[2U + (12U * 2U)] __ALIGN_END;
+
+/* Private functions ---------------------------------------------------------*/
+
+static void NCM_Put16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void NCM_Put32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+/**
+  * @brief  Arm the OUT endpoint with a receive buffer
+  * @note   Runs in the OTG interrupt or with the interrupts masked.
+  * @param  idx: Buffer index
+  * @retval None
+  */
+static void NCM_RxArm(uint8_t idx)
+{
+  hncm.RxState[idx] = NCM_RX_BUS;
+  hncm.RxBus = idx;
+  (void)USBD_LL_PrepareReceive(hncm.pdev, NCM_OUT_EP, (uint8_t *)RxBuf[idx], NCM_NTB_OUT_SIZE);
+}
+
+/**
+  * @brief  Give the parsed receive buffer back
+  * @retval None
+  */
+static void NCM_RxRelease(void)
+{
+  hncm.RxParsing = 0U;
+
+  __disable_irq();
+  hncm.RxState[hncm.RxNext] = NCM_RX_FREE;
+  if ((hncm.Alt == 1U) && (hncm.Start == 0U) && (hncm.RxBus == NCM_RX_NONE))
+  {
+    NCM_RxArm(hncm.RxNext);
+  }
+  __enable_irq();
+
+  hncm.RxNext ^= 1U;
+}
+
+/**
+  * @brief  Close the NTB being filled and send it if the endpoint is idle
+  * @retval None
+  */
+static void NCM_TxFlush(void)
+{
+  uint32_t len;
+
+  if ((hncm.TxBusy != 0U) || (hncm.Tx.Count == 0U))
+  {
+    return;
+  }
+
+  len = NCM_NTB_Finish(&hncm.Tx, hncm.TxSeq++);
+
+  __disable_irq();
+  if ((hncm.Alt == 1U) && (hncm.Start == 0U))
+  {
+    hncm.TxBusy = 1U;
+    hncm.TxLen = len;
+    (void)USBD_LL_Transmit(hncm.pdev, NCM_IN_EP, (uint8_t *)TxBuf[hncm.TxFill], len);
+  }
+  __enable_irq();
+
+  hncm.TxFill ^= 1U;
+  NCM_NTB_Init(&hncm.Tx, (uint8_t *)TxBuf[hncm.TxFill], hncm.InMaxSize);
+}
+
+/**
+  * @brief  Send the next pending notification
+  * @retval None
+  */
+static void NCM_SendNotify(void)
+{
+  uint8_t *p = (uint8_t *)NotifyBuf;
+  uint16_t len;
+
+  p[0] = 0xA1U;                                   /* Class, interface, IN */
+  NCM_Put16(&p[2], 0U);
+  NCM_Put16(&p[4], CDC_MSC_CDC_CMD_ITF_NBR);
+  if (hncm.Notify == 2U)
+  {
+    p[1] = NCM_NOTIFY_SPEED_CHANGE;
+    NCM_Put16(&p[6], 8U);
+    NCM_Put32(&p[8], NCM_LINK_SPEED);             /* DLBitRRate */
+    NCM_Put32(&p[12], NCM_LINK_SPEED);            /* ULBitRate */
+    len = 16U;
+  }
+  else
+  {
+    p[1] = NCM_NOTIFY_NETWORK_CONNECTION;
+    NCM_Put16(&p[2], 1U);                         /* Connected */
+    NCM_Put16(&p[6], 0U);
+    len = 8U;
+  }
+
+  __disable_irq();
+  if (hncm.Configured != 0U)
+  {
+    hncm.NotifyBusy = 1U;
+    (void)USBD_LL_Transmit(hncm.pdev, NCM_NOTIFY_EP, p, len);
+  }
+  __enable_irq();
+  hncm.Notify--;
+}
+
+/**
+  * @brief  Select an alternate setting of the data interface
+  * @note   Runs in the OTG interrupt. The endpoints are opened again on
+  *         every selection so that their data toggles start over.
+  * @param  pdev: device instance
+  * @param  alt: 0 (no endpoints) or 1
+  * @retval None
+  */
+static void NCM_SetAlt(USBD_HandleTypeDef *pdev, uint8_t alt)
+{
+  if (hncm.Alt != 0U)
+  {
+    (void)USBD_LL_CloseEP(pdev, NCM_OUT_EP);
+    pdev->ep_out[NCM_OUT_EP & 0xFU].is_used = 0U;
+    (void)USBD_LL_CloseEP(pdev, NCM_IN_EP);
+    pdev->ep_in[NCM_IN_EP & 0xFU].is_used = 0U;
+  }
+
+  hncm.Alt = 0U;
+  hncm.TxBusy = 0U;
+  hncm.Zlp = 0U;
+  hncm.RxBus = NCM_RX_NONE;
+
+  if (alt != 0U)
+  {
+    (void)USBD_LL_OpenEP(pdev, NCM_OUT_EP, USBD_EP_TYPE_BULK, NCM_DATA_FS_MAX_PACKET);
+    pdev->ep_out[NCM_OUT_EP & 0xFU].is_used = 1U;
+    (void)USBD_LL_OpenEP(pdev, NCM_IN_EP, USBD_EP_TYPE_BULK, NCM_DATA_FS_MAX_PACKET);
+    pdev->ep_in[NCM_IN_EP & 0xFU].is_used = 1U;
+    hncm.Start = 1U;
+    hncm.Alt = 1U;
+  }
+}
+
+/**
+  * @brief  Initialize the NCM function
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_NCM_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  UNUSED(cfgidx);
+
+  (void)USBD_LL_OpenEP(pdev, NCM_NOTIFY_EP, USBD_EP_TYPE_INTR, NCM_NOTIFY_PACKET_SIZE);
+  pdev->ep_in[NCM_NOTIFY_EP & 0xFU].is_used = 1U;
+  pdev->ep_in[NCM_NOTIFY_EP & 0xFU].bInterval = NCM_FS_BINTERVAL;
+
+  hncm.pdev = pdev;
+  hncm.Alt = 0U;
+  hncm.Start = 0U;
+  hncm.NotifyBusy = 0U;
+  hncm.InMaxSize = NCM_NTB_IN_SIZE;
+  hncm.CtrlReq = 0xFFU;
+  hncm.Configured = 1U;
+
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  DeInitialize the NCM function
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_NCM_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  UNUSED(cfgidx);
+
+  hncm.Configured = 0U;
+  NCM_SetAlt(pdev, 0U);
+
+  (void)USBD_LL_CloseEP(pdev, NCM_NOTIFY_EP);
+  pdev->ep_in[NCM_NOTIFY_EP & 0xFU].is_used = 0U;
+  pdev->ep_in[NCM_NOTIFY_EP & 0xFU].bInterval = 0U;
+
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  Handle the NCM class and standard interface requests
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t USBD_NCM_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+  static uint16_t status_info;
+  static uint8_t ifalt;
+  uint8_t *buf = (uint8_t *)CtrlBuf;
+  uint8_t itf = LOBYTE(req->wIndex);
+  USBD_StatusTypeDef ret = USBD_OK;
+
+  switch (req->bmRequest & USB_REQ_TYPE_MASK)
+  {
+    case USB_REQ_TYPE_CLASS:
+      switch (req->bRequest)
+      {
+        case NCM_GET_NTB_PARAMETERS:
+          NCM_Put16(&buf[0], NCM_NTB_PARAMETERS_SIZE);      /* wLength */
+          NCM_Put16(&buf[2], 0x0001U);                      /* bmNtbFormatsSupported: NTB16 */
+          NCM_Put32(&buf[4], NCM_NTB_IN_SIZE);              /* dwNtbInMaxSize */
+          NCM_Put16(&buf[8], NCM_NTB_ALIGN);                /* wNdpInDivisor */
+          NCM_Put16(&buf[10], 0U);                          /* wNdpInPayloadRemainder */
+          NCM_Put16(&buf[12], NCM_NTB_ALIGN);               /* wNdpInAlignment */
+          NCM_Put16(&buf[14], 0U);
+          NCM_Put32(&buf[16], NCM_NTB_OUT_SIZE);            /* dwNtbOutMaxSize */
+          NCM_Put16(&buf[20], NCM_NTB_ALIGN);               /* wNdpOutDivisor */
+          NCM_Put16(&buf[22], 0U);                          /* wNdpOutPayloadRemainder */
+          NCM_Put16(&buf[24], NCM_NTB_ALIGN);               /* wNdpOutAlignment */
+          NCM_Put16(&buf[26], 0U);                          /* wNtbOutMaxDatagrams: no limit */
+          (void)USBD_CtlSendData(pdev, buf, MIN(req->wLength, NCM_NTB_PARAMETERS_SIZE));
+          break;
+
+        case NCM_GET_NTB_INPUT_SIZE:
+          NCM_Put32(buf, hncm.InMaxSize);
+          (void)USBD_CtlSendData(pdev, buf, MIN(req->wLength, 4U));
+          break;
+
+        case NCM_SET_NTB_INPUT_SIZE:
+          if ((req->wLength >= 4U) && (req->wLength <= 8U))
+          {
+            hncm.CtrlReq = req->bRequest;
+            (void)USBD_CtlPrepareRx(pdev, buf, req->wLength);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case NCM_GET_NTB_FORMAT:
+          NCM_Put16(buf, 0U);
+          (void)USBD_CtlSendData(pdev, buf, MIN(req->wLength, 2U));
+          break;
+
+        case NCM_SET_NTB_FORMAT:
+          if (req->wValue != 0U)
+          {
+            /* Only NTB16 */
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case NCM_SET_ETHERNET_PACKET_FILTER:
+          /* Every frame is passed up, LwIP filters by address */
+          break;
+
+        default:
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+          break;
+      }
+      break;
+
+    case USB_REQ_TYPE_STANDARD:
+      switch (req->bRequest)
+      {
+        case USB_REQ_GET_STATUS:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            status_info = 0U;
+            (void)USBD_CtlSendData(pdev, (uint8_t *)&status_info, 2U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_GET_INTERFACE:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            ifalt = (itf == CDC_MSC_CDC_DATA_ITF_NBR) ? hncm.Alt : 0U;
+            (void)USBD_CtlSendData(pdev, &ifalt, 1U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_SET_INTERFACE:
+          if ((pdev->dev_state == USBD_STATE_CONFIGURED) &&
+              (itf == CDC_MSC_CDC_DATA_ITF_NBR) && (req->wValue <= 1U))
+          {
+            NCM_SetAlt(pdev, (uint8_t)req->wValue);
+          }
+          else if ((pdev->dev_state != USBD_STATE_CONFIGURED) || (req->wValue != 0U))
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_CLEAR_FEATURE:
+          break;
+
+        default:
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+          break;
+      }
+      break;
+
+    default:
+      USBD_CtlError(pdev, req);
+      ret = USBD_FAIL;
+      break;
+  }
+
+  return (uint8_t)ret;
+}
+
+/**
+  * @brief  Data stage of a class request received
+  * @param  pdev: device instance
+  * @retval status
+  */
+static uint8_t USBD_NCM_EP0_RxReady(USBD_HandleTypeDef *pdev)
+{
+  const uint8_t *buf = (const uint8_t *)CtrlBuf;
+  uint32_t size;
+
+  UNUSED(pdev);
+
+  if (hncm.CtrlReq == NCM_SET_NTB_INPUT_SIZE)
+  {
+    size = buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+    if ((size >= NCM_NTB_MIN_IN_SIZE) && (size <= NCM_NTB_IN_SIZE))
+    {
+      /* Used from the next NTB on */
+      hncm.InMaxSize = size;
+    }
+  }
+  hncm.CtrlReq = 0xFFU;
+
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  Data sent on the bulk IN or the notification endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t USBD_NCM_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  if (epnum == (NCM_NOTIFY_EP & 0x7FU))
+  {
+    hncm.NotifyBusy = 0U;
+    return (uint8_t)USBD_OK;
+  }
+
+  if ((hncm.Zlp == 0U) && ((hncm.TxLen % NCM_DATA_FS_MAX_PACKET) == 0U) &&
+      (hncm.TxLen < hncm.InMaxSize))
+  {
+    /* End the transfer at the NTB boundary, unless it filled the host buffer */
+    hncm.Zlp = 1U;
+    (void)USBD_LL_Transmit(pdev, NCM_IN_EP, NULL, 0U);
+    return (uint8_t)USBD_OK;
+  }
+
+  hncm.Zlp = 0U;
+  hncm.TxBusy = 0U;
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  NTB received on the bulk OUT endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t USBD_NCM_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  uint8_t idx = hncm.RxBus;
+
+  if (idx == NCM_RX_NONE)
+  {
+    return (uint8_t)USBD_OK;
+  }
+
+  hncm.RxLen[idx] = USBD_LL_GetRxDataSize(pdev, epnum);
+  hncm.RxState[idx] = NCM_RX_FULL;
+  hncm.RxBus = NCM_RX_NONE;
+
+  if (hncm.RxState[idx ^ 1U] == NCM_RX_FREE)
+  {
+    NCM_RxArm(idx ^ 1U);
+  }
+  return (uint8_t)USBD_OK;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Check whether the host has enabled the data interface
+  * @retval 1 when frames can be exchanged
+  */
+uint8_t USBD_NCM_IsUp(void)
+{
+  return ((hncm.Up != 0U) && (hncm.Alt == 1U) && (hncm.Start == 0U)) ? 1U : 0U;
+}
+
+/**
+  * @brief  Get the next frame received from the host
+  * @note   Main loop only. The frame stays valid until the next call.
+  * @param  frame: Set to the Ethernet frame
+  * @retval Frame length, 0 if there is none
+  */
+uint16_t USBD_NCM_GetFrame(const uint8_t **frame)
+{
+  uint16_t len;
+  int ret;
+
+  if (USBD_NCM_IsUp() == 0U)
+  {
+    return 0U;
+  }
+
+  for (;;)
+  {
+    if (hncm.RxParsing == 0U)
+    {
+      if (hncm.RxState[hncm.RxNext] != NCM_RX_FULL)
+      {
+        return 0U;
+      }
+      if (NCM_NTB_Parse(&hncm.Rx, (const uint8_t *)RxBuf[hncm.RxNext], hncm.RxLen[hncm.RxNext]) != 0)
+      {
+        hncm.RxErrors++;
+        NCM_RxRelease();
+        continue;
+      }
+      hncm.RxParsing = 1U;
+    }
+
+    ret = NCM_NTB_Next(&hncm.Rx, frame, &len);
+    if (ret > 0)
+    {
+      return len;
+    }
+    if (ret < 0)
+    {
+      hncm.RxErrors++;
+    }
+    NCM_RxRelease();
+  }
+}
+
+/**
+  * @brief  Get room for a frame to send in the NTB being filled
+  * @note   Main loop only. Waits up to NCM_TX_TIMEOUT for the NTB on the
+  *         bus to complete when the current one is full.
+  * @param  len: Frame length
+  * @retval Where to copy the frame, NULL if it cannot be sent
+  */
+uint8_t *USBD_NCM_TxAlloc(uint16_t len)
+{
+  uint32_t tick = HAL_GetTick();
+  uint8_t *p;
+
+  if (len > NCM_MAX_SEGMENT_SIZE)
+  {
+    return NULL;
+  }
+
+  while (USBD_NCM_IsUp() != 0U)
+  {
+    p = NCM_NTB_Alloc(&hncm.Tx, len);
+    if (p != NULL)
+    {
+      return p;
+    }
+    NCM_TxFlush();
+    if ((HAL_GetTick() - tick) >= NCM_TX_TIMEOUT)
+    {
+      break;
+    }
+  }
+  return NULL;
+}
+
+/**
+  * @brief  Add the frame copied to the room given by USBD_NCM_TxAlloc()
+  * @param  len: Frame length
+  * @retval None
+  */
+void USBD_NCM_TxCommit(uint16_t len)
+{
+  NCM_NTB_Commit(&hncm.Tx, len);
+  NCM_TxFlush();
+}
+
+/**
+  * @brief  Locally administered MAC addresses derived from the unique ID
+  * @param  mac: 6 bytes
+  * @param  host: 1 for the host end of the link, 0 for the board
+  * @retval None
+  */
+void USBD_NCM_GetMacAddress(uint8_t *mac, uint8_t host)
+{
+  uint32_t uid = HAL_GetUIDw0() ^ HAL_GetUIDw1() ^ HAL_GetUIDw2();
+
+  mac[0] = 0x02U;
+  mac[1] = (uint8_t)(uid >> 24);
+  mac[2] = (uint8_t)(uid >> 16);
+  mac[3] = (uint8_t)(uid >> 8);
+  mac[4] = (uint8_t)uid;
+  mac[5] = (host != 0U) ? 0x01U : 0x02U;
+}
+
+/**
+  * @brief  Return the iMACAddress string descriptor, the host end address
+  * @param  length: pointer data length
+  * @retval pointer to descriptor buffer
+  */
+uint8_t *USBD_NCM_GetMacString(uint16_t *length)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  uint8_t mac[6];
+  uint8_t i;
+
+  USBD_NCM_GetMacAddress(mac, 1U);
+
+  NCM_MacString[0] = (uint8_t)sizeof(NCM_MacString);
+  NCM_MacString[1] = USB_DESC_TYPE_STRING;
+  for (i = 0U; i < 12U; i++)
+  {
+    NCM_MacString[2U + (2U * i)] = (uint8_t)hex[(mac[i / 2U] >> ((i & 1U) ? 0U : 4U)) & 0xFU];
+    NCM_MacString[3U + (2U * i)] = 0U;
+  }
+
+  *length = (uint16_t)sizeof(NCM_MacString);
+  return NCM_MacString;
+}
+
+/**
+  * @brief  Start the data path, send the notifications and the NTB being
+  *         filled, call from the main loop
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_NCM_Process(USBD_HandleTypeDef *pdev)
+{
+  UNUSED(pdev);
+
+  if ((hncm.Configured == 0U) || (hncm.Alt == 0U))
+  {
+    hncm.Up = 0U;
+    return;
+  }
+
+  if (hncm.Start != 0U)
+  {
+    hncm.TxFill = 0U;
+    hncm.TxSeq = 0U;
+    NCM_NTB_Init(&hncm.Tx, (uint8_t *)TxBuf[0], hncm.InMaxSize);
+    hncm.RxNext = 0U;
+    hncm.RxParsing = 0U;
+    hncm.Notify = 2U;
+
+    __disable_irq();
+    hncm.RxState[0] = NCM_RX_FREE;
+    hncm.RxState[1] = NCM_RX_FREE;
+    if (hncm.Alt == 1U)
+    {
+      hncm.Start = 0U;
+      NCM_RxArm(0U);
+    }
+    __enable_irq();
+
+    hncm.Up = 1U;
+  }
+
+  if ((hncm.Notify != 0U) && (hncm.NotifyBusy == 0U))
+  {
+    NCM_SendNotify();
+  }
+
+  NCM_TxFlush();
+}
@@ -0,0 +1,67 @@
+/**
+  ******************************************************************************
+  * @file    usbd_ncm.h
+  * @brief   USB CDC-NCM (Network Control Model) function: an Ethernet
+  *          adapter for the host, with several frames per bulk transfer.
+  *
+  *          The function only moves Ethernet frames, the network interface
+  *          on top of it is usbncmif.c. Like the other bulk functions, the
+  *          OTG interrupt only records what happened and the NTBs are built
+  *          and parsed from the main loop.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __USBD_NCM_H__
+#define __USBD_NCM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_ioreq.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define NCM_NOTIFY_EP               0x82U
+#define NCM_IN_EP                   0x81U
+#define NCM_OUT_EP                  0x01U
+#define NCM_NOTIFY_PACKET_SIZE      16U
+#define NCM_DATA_FS_MAX_PACKET      64U
+#define NCM_FS_BINTERVAL            0x10U
+
+#define NCM_NTB_IN_SIZE             4096U   /* Largest NTB sent, two buffers */
+#define NCM_NTB_OUT_SIZE            4096U   /* Largest NTB received, two buffers */
+#define NCM_NTB_MIN_IN_SIZE         2048U   /* Smallest the host may ask for */
+#define NCM_MAX_SEGMENT_SIZE        1514U   /* Ethernet frame, without FCS */
+#define NCM_LINK_SPEED              12000000U
+#define NCM_TX_TIMEOUT              10U     /* ms to wait for a free NTB */
+
+#define NCM_MAC_STRING_INDEX        0x06U   /* iMACAddress, after usbd_desc.c */
+
+/* NCM class requests */
+#define NCM_SET_ETHERNET_PACKET_FILTER  0x43U
+#define NCM_GET_NTB_PARAMETERS          0x80U
+#define NCM_GET_NTB_FORMAT              0x83U
+#define NCM_SET_NTB_FORMAT              0x84U
+#define NCM_GET_NTB_INPUT_SIZE          0x85U
+#define NCM_SET_NTB_INPUT_SIZE          0x86U
+
+/* Exported variables --------------------------------------------------------*/
+/* Class callbacks, used by the composite class, no descriptors of its own */
+extern USBD_ClassTypeDef USBD_NCM;
+
+/* Exported functions prototypes ---------------------------------------------*/
+uint8_t  USBD_NCM_IsUp(void);
+uint16_t USBD_NCM_GetFrame(const uint8_t **frame);
+uint8_t *USBD_NCM_TxAlloc(uint16_t len);
+void     USBD_NCM_TxCommit(uint16_t len);
+void     USBD_NCM_GetMacAddress(uint8_t *mac, uint8_t host);
+uint8_t *USBD_NCM_GetMacString(uint16_t *length);
+void     USBD_NCM_Process(USBD_HandleTypeDef *pdev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_NCM_H__ */
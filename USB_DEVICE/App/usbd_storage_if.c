@@ -0,0 +1,345 @@
+/**
+  ******************************************************************************
+  * @file    usbd_storage_if.c
+  * @brief   Mass Storage backend on the SDIO card.
+  *
+  *          Reads and writes are multi-block DMA transfers started with
+  *          BSP_SD_ReadBlocks_DMA() / BSP_SD_WriteBlocks_DMA(). Completion is
+  *          polled from the main loop through the HAL state, then the card
+  *          must be back in the transfer state (programming done) before the
+  *          next request, as in sd_diskio.c.
+  *
+  *          Exporting unregisters the FatFs volume and makes sd_diskio report
+  *          the drive as not initialized, so FatFs cannot touch the card
+  *          while the host owns it. Files left open are lost. Reclaiming
+  *          registers SDFatFS again, its content is read back on first use.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_storage_if.h"
+#include "fatfs.h"
+#include "sdio.h"
+
+/* Private function prototypes -----------------------------------------------*/
+static int8_t STORAGE_Init_FS(uint8_t lun);
+static int8_t STORAGE_GetCapacity_FS(uint8_t lun, uint32_t *block_num, uint16_t *block_size);
+static int8_t STORAGE_IsReady_FS(uint8_t lun);
+static int8_t STORAGE_IsWriteProtected_FS(uint8_t lun);
+static int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+static int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len);
+static int8_t STORAGE_Poll_FS(uint8_t lun);
+static int8_t STORAGE_Eject_FS(uint8_t lun);
+static int8_t STORAGE_GetMaxLun_FS(void);
+
+/* Private variables ---------------------------------------------------------*/
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+/* USB Mass storage Standard Inquiry Data */
+static int8_t STORAGE_Inquirydata_FS[] =
+{
+  /* LUN 0 */
+  0x00,           /* Direct access block device */
+  0x80,           /* Removable medium */
+  0x02,
+  0x02,
+  (36 - 5),       /* Additional length */
+  0x00,
+  0x00,
+  0x00,
+  'S', 'T', 'M', ' ', ' ', ' ', ' ', ' ', /* Manufacturer : 8 bytes */
+  'S', 'D', ' ', 'C', 'a', 'r', 'd', ' ', /* Product      : 16 Bytes */
+  ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+  '0', '.', '0', '1'                      /* Version      : 4 Bytes */
+};
+
+USBD_StorageTypeDef USBD_Storage_Interface_fops_FS =
+{
+  STORAGE_Init_FS,
+  STORAGE_GetCapacity_FS,
+  STORAGE_IsReady_FS,
+  STORAGE_IsWriteProtected_FS,
+  STORAGE_Read_FS,
+  STORAGE_Write_FS,
+  STORAGE_Poll_FS,
+  STORAGE_Eject_FS,
+  STORAGE_GetMaxLun_FS,
+  STORAGE_Inquirydata_FS
+};
+
+static uint8_t export_requested;  /* Application wants the card on USB */
+static uint8_t exported;          /* Card owned by the USB host */
+static uint8_t ejected;           /* Host ejected the medium, until reconfigured */
+static uint8_t card_ok;           /* Card initialized while exported */
+static uint32_t card_tick;        /* Last initialization attempt */
+static uint8_t req_active;        /* DMA request in flight */
+static uint32_t req_tick;         /* Its start */
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Make sure the card is initialized and in the transfer state
+  * @retval 0 if the card can be used
+  */
+static int8_t STORAGE_CardInit(void)
+{
+  card_tick = HAL_GetTick();
+
+  if ((HAL_SD_GetState(&hsd) != HAL_SD_STATE_RESET) &&
+      (BSP_SD_GetCardState() == SD_TRANSFER_OK))
+  {
+    return 0;
+  }
+  return (BSP_SD_Init() == MSD_OK) ? 0 : -1;
+}
+
+/**
+  * @brief  Initializes the storage unit (medium), on configuration
+  * @param  lun: Logical unit number
+  * @retval USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t STORAGE_Init_FS(uint8_t lun)
+{
+  UNUSED(lun);
+
+  ejected = 0U;
+  return (USBD_OK);
+}
+
+/**
+  * @brief  Returns the medium capacity.
+  * @param  lun: Logical unit number
+  * @param  block_num: Number of total block number
+  * @param  block_size: Block size
+  * @retval USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t STORAGE_GetCapacity_FS(uint8_t lun, uint32_t *block_num, uint16_t *block_size)
+{
+  BSP_SD_CardInfo info;
+
+  UNUSED(lun);
+
+  if ((exported == 0U) || (card_ok == 0U))
+  {
+    return (USBD_FAIL);
+  }
+
+  BSP_SD_GetCardInfo(&info);
+  *block_num = info.LogBlockNbr;
+  *block_size = (uint16_t)info.LogBlockSize;
+  return (USBD_OK);
+}
+
+/**
+  * @brief  Checks whether the medium is ready.
+  * @note   A card missing at export time is looked for again every
+  *         STORAGE_RETRY_MS, when the host polls the unit.
+  * @param  lun: Logical unit number
+  * @retval USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t STORAGE_IsReady_FS(uint8_t lun)
+{
+  UNUSED(lun);
+
+  if (exported == 0U)
+  {
+    return (USBD_FAIL);
+  }
+  if ((card_ok == 0U) && ((HAL_GetTick() - card_tick) >= STORAGE_RETRY_MS))
+  {
+    card_ok = (STORAGE_CardInit() == 0) ? 1U : 0U;
+  }
+  return (card_ok != 0U) ? (USBD_OK) : (USBD_FAIL);
+}
+
+/**
+  * @brief  Checks whether the medium is write protected.
+  * @param  lun: Logical unit number
+  * @retval USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t STORAGE_IsWriteProtected_FS(uint8_t lun)
+{
+  UNUSED(lun);
+
+  /* No write protect switch on the micro SD socket */
+  return (USBD_OK);
+}
+
+/**
+  * @brief  Starts reading from the medium.
+  * @param  lun: Logical unit number
+  * @param  buf: Word aligned data buffer
+  * @param  blk_addr: Logical block address
+  * @param  blk_len: Blocks number
+  * @retval USBD_OK if the transfer was started else USBD_FAIL
+  */
+static int8_t STORAGE_Read_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
+{
+  UNUSED(lun);
+
+  if ((exported == 0U) || (card_ok == 0U) || (req_active != 0U))
+  {
+    return (USBD_FAIL);
+  }
+  if (BSP_SD_ReadBlocks_DMA((uint32_t *)buf, blk_addr, blk_len) != MSD_OK)
+  {
+    return (USBD_FAIL);
+  }
+  req_active = 1U;
+  req_tick = HAL_GetTick();
+  return (USBD_OK);
+}
+
+/**
+  * @brief  Starts writing to the medium.
+  * @param  lun: Logical unit number
+  * @param  buf: Word aligned data buffer
+  * @param  blk_addr: Logical block address
+  * @param  blk_len: Blocks number
+  * @retval USBD_OK if the transfer was started else USBD_FAIL
+  */
+static int8_t STORAGE_Write_FS(uint8_t lun, uint8_t *buf, uint32_t blk_addr, uint16_t blk_len)
+{
+  UNUSED(lun);
+
+  if ((exported == 0U) || (card_ok == 0U) || (req_active != 0U))
+  {
+    return (USBD_FAIL);
+  }
+  if (BSP_SD_WriteBlocks_DMA((uint32_t *)buf, blk_addr, blk_len) != MSD_OK)
+  {
+    return (USBD_FAIL);
+  }
+  req_active = 1U;
+  req_tick = HAL_GetTick();
+  return (USBD_OK);
+}
+
+/**
+  * @brief  Checks the request started by STORAGE_Read_FS() / STORAGE_Write_FS()
+  * @param  lun: Logical unit number
+  * @retval MSC_STORAGE_OK, MSC_STORAGE_BUSY or MSC_STORAGE_ERROR
+  */
+static int8_t STORAGE_Poll_FS(uint8_t lun)
+{
+  UNUSED(lun);
+
+  if (req_active == 0U)
+  {
+    return MSC_STORAGE_OK;
+  }
+
+  if (HAL_SD_GetState(&hsd) == HAL_SD_STATE_BUSY)
+  {
+    if ((HAL_GetTick() - req_tick) < STORAGE_TIMEOUT)
+    {
+      return MSC_STORAGE_BUSY;
+    }
+    (void)HAL_SD_Abort(&hsd);
+    req_active = 0U;
+    return MSC_STORAGE_ERROR;
+  }
+
+  if (HAL_SD_GetError(&hsd) != HAL_SD_ERROR_NONE)
+  {
+    req_active = 0U;
+    return MSC_STORAGE_ERROR;
+  }
+
+  /* Data moved, wait for the card to finish programming */
+  if (BSP_SD_GetCardState() != SD_TRANSFER_OK)
+  {
+    if ((HAL_GetTick() - req_tick) < STORAGE_TIMEOUT)
+    {
+      return MSC_STORAGE_BUSY;
+    }
+    req_active = 0U;
+    return MSC_STORAGE_ERROR;
+  }
+
+  req_active = 0U;
+  return MSC_STORAGE_OK;
+}
+
+/**
+  * @brief  The host ejected the medium, give the card back to FatFs
+  * @param  lun: Logical unit number
+  * @retval USBD_OK
+  */
+static int8_t STORAGE_Eject_FS(uint8_t lun)
+{
+  UNUSED(lun);
+
+  ejected = 1U;
+  return (USBD_OK);
+}
+
+/**
+  * @brief  Returns the Max Supported LUNs.
+  * @retval Lun(s) number.
+  */
+static int8_t STORAGE_GetMaxLun_FS(void)
+{
+  return (STORAGE_LUN_NBR - 1);
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Hand the card to the USB host whenever one is attached
+  * @retval None
+  */
+void STORAGE_Export_FS(void)
+{
+  export_requested = 1U;
+}
+
+/**
+  * @brief  Keep the card for FatFs, takes it back from the host if needed
+  * @retval None
+  */
+void STORAGE_Reclaim_FS(void)
+{
+  export_requested = 0U;
+  STORAGE_Process_FS();
+}
+
+/**
+  * @brief  Check who owns the card
+  * @retval 1 while the USB host owns the card
+  */
+uint8_t STORAGE_IsExported_FS(void)
+{
+  return exported;
+}
+
+/**
+  * @brief  Switch the card between FatFs and the USB host, call from the main loop
+  * @retval None
+  */
+void STORAGE_Process_FS(void)
+{
+  uint8_t want = ((export_requested != 0U) && (ejected == 0U) &&
+                  (hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED)) ? 1U : 0U;
+
+  if ((want != 0U) && (exported == 0U))
+  {
+    (void)MX_SDIO_SD_Unmount();
+    SD_SetExported(1U);
+    card_ok = (STORAGE_CardInit() == 0) ? 1U : 0U;
+    exported = 1U;
+  }
+  else if ((want == 0U) && (exported != 0U))
+  {
+    /* Let a DMA request started for the host complete first, its
+       status is collected by the MSC function */
+    if (req_active != 0U)
+    {
+      return;
+    }
+    exported = 0U;
+    card_ok = 0U;
+    SD_SetExported(0U);
+    (void)MX_SDIO_SD_Mount();
+  }
+}
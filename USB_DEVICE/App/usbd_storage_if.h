@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    usbd_storage_if.h
+  * @brief   Mass Storage backend on the SDIO card.
+  *
+  *          The card is used by FatFs or by the USB host, never by both.
+  *          STORAGE_Export_FS() asks for the card to be handed to the host;
+  *          the switch is made by STORAGE_Process_FS() whenever a host has
+  *          configured the device, and undone when it ejects the medium or
+  *          goes away, or when STORAGE_Reclaim_FS() is called.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __USBD_STORAGE_IF_H__
+#define __USBD_STORAGE_IF_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_msc.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define STORAGE_LUN_NBR         1U
+#define STORAGE_TIMEOUT         (30U * 1000U)  /* ms, as SD_TIMEOUT in sd_diskio.c */
+#define STORAGE_RETRY_MS        1000U          /* Card initialization retry period */
+
+/* Exported variables --------------------------------------------------------*/
+extern USBD_StorageTypeDef USBD_Storage_Interface_fops_FS;
+
+/* Exported functions prototypes ---------------------------------------------*/
+void    STORAGE_Export_FS(void);
+void    STORAGE_Reclaim_FS(void);
+uint8_t STORAGE_IsExported_FS(void);
+void    STORAGE_Process_FS(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_STORAGE_IF_H__ */
@@ -0,0 +1,686 @@
+/**
+  ******************************************************************************
+  * @file    usbd_vendor.c
+  * @brief   Vendor specific bulk streaming function for data acquisition.
+  *
+  *          Transmit side: packets are laid out in TxRing exactly as they go
+  *          on the wire. A producer reserves room for one packet, fills the
+  *          payload in place (by CPU or DMA) and commits it. The IN endpoint
+  *          is then given the longest run of whole packets up to
+  *          VENDOR_MAX_BATCH, straight from the ring: the OTG FS core has no
+  *          DMA, so the FIFO is loaded from the ring by the interrupt
+  *          handler and no copy is made on the way. A packet never wraps,
+  *          when it does not fit at the end of the ring it goes to the start
+  *          and the data end is remembered in Wrap.
+  *
+  *            Tail          first byte not yet acknowledged by the host
+  *            Head          end of the committed packets
+  *            Wrap          end of the data before Head wrapped
+  *
+  *          A batch whose length is a multiple of the packet size is followed
+  *          by a ZLP, so that each bulk transfer ends at a batch boundary.
+  *
+  *          Receive side: the OUT endpoint is armed for VENDOR_RX_SIZE bytes;
+  *          the batch is parsed in place by USBD_VENDOR_Process() from the
+  *          main loop and the endpoint is armed again. The host ends every
+  *          batch with a short packet or a ZLP.
+  *
+  *          A reservation is exclusive: while one is open, Reserve() fails
+  *          for everybody else. Producers in different contexts (an
+  *          acquisition interrupt, the control replies and the test pattern
+  *          from the main loop) therefore lose packets rather than corrupt
+  *          the ring, and Commit() must only follow a successful Reserve().
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_vendor.h"
+#include "usbd_ctlreq.h"
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+#define VENDOR_PADDED(len)              (((uint32_t)(len) + 3U) & ~3U)
+#define VENDOR_PACKET_SIZE(len)         (VENDOR_HEADER_SIZE + VENDOR_PADDED(len))
+
+#if ((VENDOR_TX_RING % 4U) != 0U) || (VENDOR_MAX_BATCH > VENDOR_TX_RING)
+#error "VENDOR_TX_RING must be word sized and hold the largest batch"
+#endif
+
+#if ((VENDOR_RX_SIZE % VENDOR_MAX_FS_PACKET) != 0U)
+#error "VENDOR_RX_SIZE must be a multiple of the packet size"
+#endif
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  USBD_HandleTypeDef *pdev;
+
+  /* Set by the OTG interrupt */
+  volatile uint8_t  Active;         /* Configured, endpoints open */
+  volatile uint8_t  Start;          /* New configuration, not yet handled */
+  volatile uint8_t  OutDone;        /* Bulk OUT transfer complete */
+  volatile uint32_t OutLen;         /* Bytes of the last bulk OUT transfer */
+
+  /* Transmit ring, interrupts masked outside of the OTG interrupt */
+  volatile uint32_t Head;
+  volatile uint32_t Tail;
+  volatile uint32_t Wrap;
+  uint8_t           Busy;           /* Batch or ZLP in flight */
+  uint8_t           Zlp;            /* The ZLP closing a batch is in flight */
+  uint32_t          InLen;          /* Length of the batch in flight */
+  uint32_t          ResOff;         /* Reservation: packet offset */
+  uint32_t          ResLen;         /* Reservation: packet size, 0 if none */
+  uint8_t           ResWrap;        /* Reservation: Head wraps on commit */
+  uint8_t           Overflow;       /* Flag the next packet */
+  uint32_t          TxSeq;
+
+  /* Main loop only */
+  uint16_t          TestSize;       /* Test pattern payload, 0 when stopped */
+  uint32_t          TestWord;
+
+  USBD_VENDOR_StatsTypeDef Stats;
+} VENDOR_HandleTypeDef;
+
+/* Private function prototypes -----------------------------------------------*/
+static uint8_t USBD_VENDOR_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_VENDOR_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx);
+static uint8_t USBD_VENDOR_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
+static uint8_t USBD_VENDOR_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum);
+static uint8_t USBD_VENDOR_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum);
+
+/* Private variables ---------------------------------------------------------*/
+USBD_ClassTypeDef USBD_VENDOR =
+{
+  USBD_VENDOR_Init,
+  USBD_VENDOR_DeInit,
+  USBD_VENDOR_Setup,
+  NULL, /* EP0_TxSent */
+  NULL, /* EP0_RxReady */
+  USBD_VENDOR_DataIn,
+  USBD_VENDOR_DataOut,
+  NULL, /* SOF */
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+};
+
+static VENDOR_HandleTypeDef hven;
+
+/* Word aligned, so that every packet header is */
+static uint32_t TxRing[VENDOR_TX_RING / 4U];
+static uint32_t RxBuf[VENDOR_RX_SIZE / 4U];
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Start the next batch if the endpoint is idle
+  * @note   Runs in the OTG interrupt or with the interrupts masked.
+  * @retval None
+  */
+static void VENDOR_Kick(void)
+{
+  const uint8_t *ring = (const uint8_t *)TxRing;
+  const USBD_VENDOR_HeaderTypeDef *hdr;
+  uint32_t tail;
+  uint32_t end;
+  uint32_t len;
+  uint32_t pkt;
+
+  if ((hven.Active == 0U) || (hven.Busy != 0U))
+  {
+    return;
+  }
+
+  tail = hven.Tail;
+  if (hven.Head >= tail)
+  {
+    end = hven.Head;
+  }
+  else
+  {
+    end = hven.Wrap;
+    if (tail == end)
+    {
+      /* Everything before the wrap is sent, continue at the start */
+      tail = 0U;
+      hven.Tail = 0U;
+      end = hven.Head;
+    }
+  }
+
+  /* Whole packets only, so that the host can parse each batch alone */
+  len = 0U;
+  while ((tail + len) < end)
+  {
+    hdr = (const USBD_VENDOR_HeaderTypeDef *)&ring[tail + len];
+    pkt = VENDOR_PACKET_SIZE(hdr->Length);
+    if ((len + pkt) > VENDOR_MAX_BATCH)
+    {
+      break;
+    }
+    len += pkt;
+  }
+  if (len == 0U)
+  {
+    return;
+  }
+
+  hven.Busy = 1U;
+  hven.InLen = len;
+  hven.Stats.TxBatches++;
+  hven.Stats.TxBytes += len;
+  (void)USBD_LL_Transmit(hven.pdev, VENDOR_EPIN_ADDR, (uint8_t *)&ring[tail], len);
+}
+
+/**
+  * @brief  Reserve room for one packet in the transmit ring
+  * @param  len: Payload length
+  * @param  count_drop: Account a failure as a dropped packet
+  * @retval Payload area, NULL if the ring is full
+  */
+static uint8_t *VENDOR_Reserve(uint16_t len, uint8_t count_drop)
+{
+  uint32_t need = VENDOR_PACKET_SIZE(len);
+  uint32_t head;
+  uint32_t tail;
+  uint8_t *p = NULL;
+
+  if (len > VENDOR_MAX_PAYLOAD)
+  {
+    return NULL;
+  }
+
+  __disable_irq();
+  if ((hven.Active != 0U) && (hven.ResLen != 0U))
+  {
+    /* Another producer holds the ring */
+    if (count_drop != 0U)
+    {
+      hven.Overflow = 1U;
+      hven.Stats.Dropped++;
+    }
+  }
+  else if (hven.Active != 0U)
+  {
+    head = hven.Head;
+    tail = hven.Tail;
+    hven.ResWrap = 0U;
+    if (head >= tail)
+    {
+      if ((VENDOR_TX_RING - head) >= need)
+      {
+        hven.ResOff = head;
+        hven.ResLen = need;
+      }
+      else if (tail > need)
+      {
+        hven.ResOff = 0U;
+        hven.ResLen = need;
+        hven.ResWrap = 1U;
+      }
+    }
+    else if ((tail - head) > need)
+    {
+      hven.ResOff = head;
+      hven.ResLen = need;
+    }
+
+    if (hven.ResLen != 0U)
+    {
+      p = (uint8_t *)TxRing + hven.ResOff + VENDOR_HEADER_SIZE;
+    }
+    else if (count_drop != 0U)
+    {
+      hven.Overflow = 1U;
+      hven.Stats.Dropped++;
+    }
+  }
+  __enable_irq();
+
+  return p;
+}
+
+/**
+  * @brief  Forget the transmit ring content, on a new configuration
+  * @note   A reservation in progress stays valid.
+  * @retval None
+  */
+static void VENDOR_ResetTx(void)
+{
+  __disable_irq();
+  hven.Busy = 0U;
+  hven.Zlp = 0U;
+  hven.Head = (hven.ResLen != 0U) ? hven.ResOff : 0U;
+  hven.Tail = hven.Head;
+  hven.ResWrap = 0U;
+  hven.Overflow = 0U;
+  hven.TxSeq = 0U;
+  memset(&hven.Stats, 0, sizeof(hven.Stats));
+  __enable_irq();
+}
+
+/**
+  * @brief  Arm the bulk OUT endpoint for the next batch
+  * @retval None
+  */
+static void VENDOR_Receive(void)
+{
+  __disable_irq();
+  if (hven.Active != 0U)
+  {
+    hven.OutDone = 0U;
+    (void)USBD_LL_PrepareReceive(hven.pdev, VENDOR_EPOUT_ADDR, (uint8_t *)RxBuf, VENDOR_RX_SIZE);
+  }
+  __enable_irq();
+}
+
+/**
+  * @brief  Handle a command on the control channel
+  * @param  data: Payload
+  * @param  len: Payload length
+  * @retval None
+  */
+static void VENDOR_Control(const uint8_t *data, uint16_t len)
+{
+  USBD_VENDOR_StatsTypeDef stats;
+  uint16_t size;
+  uint8_t *p;
+
+  if (len == 0U)
+  {
+    return;
+  }
+
+  switch (data[0])
+  {
+    case VENDOR_CMD_ECHO:
+      /* Round trip latency probe, the host times the reply */
+      (void)USBD_VENDOR_Write(VENDOR_CHANNEL_CONTROL, data, len);
+      break;
+
+    case VENDOR_CMD_TEST_START:
+      size = (len >= 3U) ? (uint16_t)(data[1] | ((uint16_t)data[2] << 8)) : 0U;
+      if ((size < 4U) || (size > VENDOR_MAX_PAYLOAD))
+      {
+        size = VENDOR_MAX_PAYLOAD;
+      }
+      hven.TestSize = size & (uint16_t)~3U;
+      hven.TestWord = 0U;
+      break;
+
+    case VENDOR_CMD_TEST_STOP:
+      hven.TestSize = 0U;
+      break;
+
+    case VENDOR_CMD_GET_STATS:
+      USBD_VENDOR_GetStats(&stats);
+      p = VENDOR_Reserve(4U + (uint16_t)sizeof(stats), 1U);
+      if (p != NULL)
+      {
+        p[0] = VENDOR_CMD_GET_STATS;
+        p[1] = 0U;
+        p[2] = 0U;
+        p[3] = 0U;
+        memcpy(&p[4], &stats, sizeof(stats));
+        USBD_VENDOR_Commit(VENDOR_CHANNEL_CONTROL, 4U + (uint16_t)sizeof(stats));
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/**
+  * @brief  Parse a received batch and dispatch its packets
+  * @param  len: Batch length
+  * @retval None
+  */
+static void VENDOR_ParseBatch(uint32_t len)
+{
+  const uint8_t *buf = (const uint8_t *)RxBuf;
+  const USBD_VENDOR_HeaderTypeDef *hdr;
+  uint32_t off = 0U;
+
+  hven.Stats.RxBytes += len;
+
+  while ((off + VENDOR_HEADER_SIZE) <= len)
+  {
+    hdr = (const USBD_VENDOR_HeaderTypeDef *)&buf[off];
+    if ((off + VENDOR_HEADER_SIZE + hdr->Length) > len)
+    {
+      break;
+    }
+
+    hven.Stats.RxPackets++;
+    if (hdr->Channel == VENDOR_CHANNEL_CONTROL)
+    {
+      VENDOR_Control(&buf[off + VENDOR_HEADER_SIZE], hdr->Length);
+    }
+    else
+    {
+      USBD_VENDOR_RxCallback(hdr->Channel, &buf[off + VENDOR_HEADER_SIZE], hdr->Length);
+    }
+    off += VENDOR_PACKET_SIZE(hdr->Length);
+  }
+
+  if (off < len)
+  {
+    hven.Stats.RxErrors++;
+  }
+}
+
+/**
+  * @brief  Queue test pattern packets while there is room in the ring
+  * @retval None
+  */
+static void VENDOR_ProcessTest(void)
+{
+  uint32_t *p;
+  uint32_t i;
+
+  while (hven.TestSize != 0U)
+  {
+    p = (uint32_t *)VENDOR_Reserve(hven.TestSize, 0U);
+    if (p == NULL)
+    {
+      break;
+    }
+    for (i = 0U; i < (hven.TestSize / 4U); i++)
+    {
+      p[i] = hven.TestWord++;
+    }
+    USBD_VENDOR_Commit(VENDOR_CHANNEL_TEST, hven.TestSize);
+  }
+}
+
+/**
+  * @brief  Initialize the vendor interface
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_VENDOR_Init(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  UNUSED(cfgidx);
+
+  (void)USBD_LL_OpenEP(pdev, VENDOR_EPOUT_ADDR, USBD_EP_TYPE_BULK, VENDOR_MAX_FS_PACKET);
+  pdev->ep_out[VENDOR_EPOUT_ADDR & 0xFU].is_used = 1U;
+  (void)USBD_LL_OpenEP(pdev, VENDOR_EPIN_ADDR, USBD_EP_TYPE_BULK, VENDOR_MAX_FS_PACKET);
+  pdev->ep_in[VENDOR_EPIN_ADDR & 0xFU].is_used = 1U;
+
+  hven.pdev = pdev;
+  hven.OutDone = 0U;
+  hven.Start = 1U;
+  hven.Active = 1U;
+
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  DeInitialize the vendor interface
+  * @param  pdev: device instance
+  * @param  cfgidx: Configuration index
+  * @retval status
+  */
+static uint8_t USBD_VENDOR_DeInit(USBD_HandleTypeDef *pdev, uint8_t cfgidx)
+{
+  UNUSED(cfgidx);
+
+  hven.Active = 0U;
+
+  (void)USBD_LL_CloseEP(pdev, VENDOR_EPOUT_ADDR);
+  pdev->ep_out[VENDOR_EPOUT_ADDR & 0xFU].is_used = 0U;
+  (void)USBD_LL_CloseEP(pdev, VENDOR_EPIN_ADDR);
+  pdev->ep_in[VENDOR_EPIN_ADDR & 0xFU].is_used = 0U;
+
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  Handle the requests to the vendor interface, standard ones only
+  * @param  pdev: instance
+  * @param  req: usb requests
+  * @retval status
+  */
+static uint8_t USBD_VENDOR_Setup(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req)
+{
+  static uint16_t status_info;
+  static uint8_t ifalt;
+  USBD_StatusTypeDef ret = USBD_OK;
+
+  switch (req->bmRequest & USB_REQ_TYPE_MASK)
+  {
+    case USB_REQ_TYPE_STANDARD:
+      switch (req->bRequest)
+      {
+        case USB_REQ_GET_STATUS:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            status_info = 0U;
+            (void)USBD_CtlSendData(pdev, (uint8_t *)&status_info, 2U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_GET_INTERFACE:
+          if (pdev->dev_state == USBD_STATE_CONFIGURED)
+          {
+            ifalt = 0U;
+            (void)USBD_CtlSendData(pdev, &ifalt, 1U);
+          }
+          else
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_SET_INTERFACE:
+          if (pdev->dev_state != USBD_STATE_CONFIGURED)
+          {
+            USBD_CtlError(pdev, req);
+            ret = USBD_FAIL;
+          }
+          break;
+
+        case USB_REQ_CLEAR_FEATURE:
+          /* Endpoints are never halted by the device */
+          break;
+
+        default:
+          USBD_CtlError(pdev, req);
+          ret = USBD_FAIL;
+          break;
+      }
+      break;
+
+    default:
+      USBD_CtlError(pdev, req);
+      ret = USBD_FAIL;
+      break;
+  }
+
+  return (uint8_t)ret;
+}
+
+/**
+  * @brief  Data sent on the bulk IN endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t USBD_VENDOR_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  UNUSED(epnum);
+
+  if (hven.Zlp != 0U)
+  {
+    hven.Zlp = 0U;
+  }
+  else
+  {
+    hven.Tail += hven.InLen;
+    if ((hven.InLen % VENDOR_MAX_FS_PACKET) == 0U)
+    {
+      /* End the transfer at the batch boundary */
+      hven.Zlp = 1U;
+      (void)USBD_LL_Transmit(pdev, VENDOR_EPIN_ADDR, NULL, 0U);
+      return (uint8_t)USBD_OK;
+    }
+  }
+
+  hven.Busy = 0U;
+  VENDOR_Kick();
+  return (uint8_t)USBD_OK;
+}
+
+/**
+  * @brief  Data received on the bulk OUT endpoint
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  */
+static uint8_t USBD_VENDOR_DataOut(USBD_HandleTypeDef *pdev, uint8_t epnum)
+{
+  hven.OutLen = USBD_LL_GetRxDataSize(pdev, epnum);
+  hven.OutDone = 1U;
+  return (uint8_t)USBD_OK;
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Reserve room for one packet, to be filled in place
+  * @note   Only one reservation at a time. A failure is counted as a
+  *         dropped packet and flagged on the next one sent.
+  * @param  len: Payload length, at most VENDOR_MAX_PAYLOAD
+  * @retval Word aligned payload area, NULL if the ring is full or the
+  *         interface is not configured
+  */
+uint8_t *USBD_VENDOR_Reserve(uint16_t len)
+{
+  return VENDOR_Reserve(len, 1U);
+}
+
+/**
+  * @brief  Queue the packet reserved by USBD_VENDOR_Reserve()
+  * @param  channel: Channel of the packet
+  * @param  len: Payload length, at most the reserved one
+  * @retval None
+  */
+void USBD_VENDOR_Commit(uint8_t channel, uint16_t len)
+{
+  USBD_VENDOR_HeaderTypeDef *hdr;
+
+  __disable_irq();
+  if ((hven.ResLen != 0U) && (VENDOR_PACKET_SIZE(len) <= hven.ResLen))
+  {
+    hdr = (USBD_VENDOR_HeaderTypeDef *)((uint8_t *)TxRing + hven.ResOff);
+    hdr->Length = len;
+    hdr->Channel = channel;
+    hdr->Flags = (hven.Overflow != 0U) ? VENDOR_FLAG_OVERFLOW : 0U;
+    hdr->Sequence = hven.TxSeq++;
+    hven.Overflow = 0U;
+
+    if (hven.ResWrap != 0U)
+    {
+      hven.Wrap = hven.Head;
+    }
+    hven.Head = hven.ResOff + VENDOR_PACKET_SIZE(len);
+    hven.Stats.TxPackets++;
+    VENDOR_Kick();
+  }
+  hven.ResLen = 0U;
+  __enable_irq();
+}
+
+/**
+  * @brief  Queue a packet, copying the payload
+  * @param  channel: Channel of the packet
+  * @param  data: Payload
+  * @param  len: Payload length, at most VENDOR_MAX_PAYLOAD
+  * @retval len, 0 if the packet was dropped
+  */
+uint16_t USBD_VENDOR_Write(uint8_t channel, const uint8_t *data, uint16_t len)
+{
+  uint8_t *p = USBD_VENDOR_Reserve(len);
+
+  if (p == NULL)
+  {
+    return 0U;
+  }
+  memcpy(p, data, len);
+  USBD_VENDOR_Commit(channel, len);
+  return len;
+}
+
+/**
+  * @brief  Read the counters, reset on every configuration
+  * @param  stats: Destination
+  * @retval None
+  */
+void USBD_VENDOR_GetStats(USBD_VENDOR_StatsTypeDef *stats)
+{
+  __disable_irq();
+  *stats = hven.Stats;
+  __enable_irq();
+}
+
+/**
+  * @brief  Handle the received batches and the test pattern, call from the
+  *         main loop
+  * @param  pdev: device instance
+  * @retval None
+  */
+void USBD_VENDOR_Process(USBD_HandleTypeDef *pdev)
+{
+  UNUSED(pdev);
+
+  if (hven.Active == 0U)
+  {
+    hven.TestSize = 0U;
+    return;
+  }
+
+  if (hven.Start != 0U)
+  {
+    hven.Start = 0U;
+    hven.TestSize = 0U;
+    VENDOR_ResetTx();
+    VENDOR_Receive();
+    return;
+  }
+
+  if (hven.OutDone != 0U)
+  {
+    hven.OutDone = 0U;
+    VENDOR_ParseBatch(hven.OutLen);
+    VENDOR_Receive();
+  }
+
+  VENDOR_ProcessTest();
+}
+
+/**
+  * @brief  Packet received on an application channel
+  * @note   Runs from USBD_VENDOR_Process(). The payload is only valid during
+  *         the call.
+  * @param  channel: Channel of the packet, never VENDOR_CHANNEL_CONTROL
+  * @param  data: Payload
+  * @param  len: Payload length
+  * @retval None
+  */
+__weak void USBD_VENDOR_RxCallback(uint8_t channel, const uint8_t *data, uint16_t len)
+{
+  UNUSED(channel);
+  UNUSED(data);
+  UNUSED(len);
+}
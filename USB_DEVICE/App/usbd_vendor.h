@@ -0,0 +1,95 @@
+/**
+  ******************************************************************************
+  * @file    usbd_vendor.h
+  * @brief   Vendor specific bulk streaming function for data acquisition.
+  *
+  *          Both directions carry batches of packets, one batch per bulk
+  *          transfer (ended by a short packet or a ZLP). All fields little
+  *          endian, payloads padded to 4 bytes:
+  *
+  *            packet : length (2) | channel (1) | flags (1) | sequence (4)
+  *                     | length bytes of payload | 0..3 bytes of padding
+  *
+  *          Each direction numbers its packets. Channel 0 carries the
+  *          control commands below, channel VENDOR_CHANNEL_TEST the test
+  *          pattern; the other channels belong to the application.
+  *
+  *          Producers build their packets straight in the transmit ring
+  *          (USBD_VENDOR_Reserve() / USBD_VENDOR_Commit()) and the IN
+  *          endpoint is fed from the ring without any intermediate buffer.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __USBD_VENDOR_H__
+#define __USBD_VENDOR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_ioreq.h"
+
+/* Exported constants --------------------------------------------------------*/
+#define VENDOR_EPIN_ADDR            0x83U
+#define VENDOR_EPOUT_ADDR           0x03U
+#define VENDOR_MAX_FS_PACKET        64U
+
+#define VENDOR_TX_RING              8192U   /* Transmit ring, power of 2 not needed */
+#define VENDOR_MAX_BATCH            4096U   /* Largest bulk IN transfer */
+#define VENDOR_RX_SIZE              512U    /* Largest bulk OUT batch */
+
+#define VENDOR_HEADER_SIZE          8U
+#define VENDOR_MAX_PAYLOAD          (VENDOR_MAX_BATCH - VENDOR_HEADER_SIZE)
+
+/* Channels */
+#define VENDOR_CHANNEL_CONTROL      0x00U
+#define VENDOR_CHANNEL_TEST         0x7FU
+
+/* Packet flags */
+#define VENDOR_FLAG_OVERFLOW        0x01U   /* Packets were dropped before this one */
+
+/* Control commands, first payload byte on channel 0 */
+#define VENDOR_CMD_ECHO             0x01U   /* Reply with the same payload */
+#define VENDOR_CMD_TEST_START       0x02U   /* + payload size (2): stream the test pattern */
+#define VENDOR_CMD_TEST_STOP        0x03U
+#define VENDOR_CMD_GET_STATS        0x04U   /* Reply with USBD_VENDOR_StatsTypeDef */
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint16_t Length;      /* Payload bytes, without the padding */
+  uint8_t  Channel;
+  uint8_t  Flags;
+  uint32_t Sequence;
+} USBD_VENDOR_HeaderTypeDef;
+
+typedef struct
+{
+  uint32_t TxPackets;
+  uint32_t TxBytes;     /* Including headers and padding */
+  uint32_t TxBatches;
+  uint32_t Dropped;     /* Packets that did not fit the ring */
+  uint32_t RxPackets;
+  uint32_t RxBytes;
+  uint32_t RxErrors;    /* Malformed batches */
+} USBD_VENDOR_StatsTypeDef;
+
+/* Exported variables --------------------------------------------------------*/
+/* Class callbacks, used by the composite class, no descriptors of its own */
+extern USBD_ClassTypeDef USBD_VENDOR;
+
+/* Exported functions prototypes ---------------------------------------------*/
+uint8_t *USBD_VENDOR_Reserve(uint16_t len);
+void     USBD_VENDOR_Commit(uint8_t channel, uint16_t len);
+uint16_t USBD_VENDOR_Write(uint8_t channel, const uint8_t *data, uint16_t len);
+void     USBD_VENDOR_GetStats(USBD_VENDOR_StatsTypeDef *stats);
+void     USBD_VENDOR_Process(USBD_HandleTypeDef *pdev);
+void     USBD_VENDOR_RxCallback(uint8_t channel, const uint8_t *data, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBD_VENDOR_H__ */
@@ -27,6 +27,7 @@
 /* USER CODE BEGIN Includes */
 
 #include "fatfs.h"
+#include "usbh_msc_async.h"
 
 /* USER CODE END Includes */
 
@@ -98,6 +99,12 @@ void MX_USB_HOST_Process(void)
 {
   /* USB Host Background task */
   USBH_Process(&hUsbHostHS);
+  USBH_MSC_Async_Process(&hUsbHostHS);
+
+  if (Appli_state == APPLICATION_READY)
+  {
+    USBH_DiskCache_Process();
+  }
 }
 /*
  * user callback definition
@@ -112,6 +119,7 @@ static void USBH_UserProcess  (USBH_HandleTypeDef *phost, uint8_t id)
 
   case HOST_USER_DISCONNECTION:
   Appli_state = APPLICATION_DISCONNECT;
+  MX_FATFS_USB_Drive_Disconnected();
   break;
 
   case HOST_USER_CLASS_ACTIVE:
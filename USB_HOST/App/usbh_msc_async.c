@@ -0,0 +1,259 @@
+/**
+  ******************************************************************************
+  * @file    usbh_msc_async.c
+  * @brief   Non-blocking sector reads and writes on the USB host MSC class.
+  *
+  *          The class only runs one transfer at a time, so requests wait in
+  *          a FIFO. The transfer itself follows USBH_MSC_RdWrProcess() of
+  *          the ST library: the SCSI READ(10)/WRITE(10) state machine, then
+  *          REQUEST SENSE on failure so USBH_MSC_GetLUNInfo() reports why.
+  *          The blocking USBH_MSC_Read()/Write() must not be used alongside.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_msc_async.h"
+
+/* Private define ------------------------------------------------------------*/
+#define MSC_ASYNC_TIMEOUT_PER_SECTOR    10000U  /* ms, as USBH_MSC_Read() */
+
+/* Private variables ---------------------------------------------------------*/
+static USBH_MSC_AsyncReqTypeDef *head;
+static USBH_MSC_AsyncReqTypeDef *tail;
+static USBH_MSC_AsyncReqTypeDef *active;      /* On the bus */
+static uint32_t active_timer;
+
+/* Private functions ---------------------------------------------------------*/
+
+/**
+  * @brief  Finish the active request and call its callback
+  * @param  phost: Host handle
+  * @param  status: USBH_OK or USBH_FAIL
+  * @retval None
+  */
+static void MSC_Async_Complete(USBH_HandleTypeDef *phost, USBH_StatusTypeDef status)
+{
+  USBH_MSC_AsyncReqTypeDef *req = active;
+  MSC_HandleTypeDef *MSC_Handle;
+
+  if ((phost->pActiveClass != NULL) && (phost->pActiveClass->pData != NULL))
+  {
+    MSC_Handle = (MSC_HandleTypeDef *)phost->pActiveClass->pData;
+    MSC_Handle->state = MSC_IDLE;
+  }
+
+  /* Cleared first, the callback may submit and process again */
+  active = NULL;
+  req->Status = status;
+  if (req->Callback != NULL)
+  {
+    req->Callback(req);
+  }
+}
+
+/**
+  * @brief  Start the request at the head of the queue
+  * @param  phost: Host handle
+  * @retval None
+  */
+static void MSC_Async_Start(USBH_HandleTypeDef *phost)
+{
+  MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *)phost->pActiveClass->pData;
+  USBH_MSC_AsyncReqTypeDef *req = head;
+
+  head = req->Next;
+  if (head == NULL)
+  {
+    tail = NULL;
+  }
+  active = req;
+
+  if ((MSC_Handle->state != MSC_IDLE) || (req->Lun >= MSC_Handle->max_lun) ||
+      (MSC_Handle->unit[req->Lun].state != MSC_IDLE))
+  {
+    MSC_Async_Complete(phost, USBH_FAIL);
+    return;
+  }
+
+  MSC_Handle->state = req->Write ? MSC_WRITE : MSC_READ;
+  MSC_Handle->unit[req->Lun].state = MSC_Handle->state;
+  MSC_Handle->rw_lun = req->Lun;
+  active_timer = phost->Timer;
+
+  if (req->Write)
+  {
+    (void)USBH_MSC_SCSI_Write(phost, req->Lun, req->Sector, req->Buf, req->Count);
+  }
+  else
+  {
+    (void)USBH_MSC_SCSI_Read(phost, req->Lun, req->Sector, req->Buf, req->Count);
+  }
+}
+
+/**
+  * @brief  Move the active request one step on
+  * @param  phost: Host handle
+  * @retval None
+  */
+static void MSC_Async_Step(USBH_HandleTypeDef *phost)
+{
+  MSC_HandleTypeDef *MSC_Handle = (MSC_HandleTypeDef *)phost->pActiveClass->pData;
+  uint8_t lun = active->Lun;
+  USBH_StatusTypeDef scsi_status;
+
+  if ((phost->Timer - active_timer) > (MSC_ASYNC_TIMEOUT_PER_SECTOR * active->Count))
+  {
+    MSC_Async_Complete(phost, USBH_FAIL);
+    return;
+  }
+
+  switch (MSC_Handle->unit[lun].state)
+  {
+    case MSC_READ:
+    case MSC_WRITE:
+      if (MSC_Handle->unit[lun].state == MSC_WRITE)
+      {
+        scsi_status = USBH_MSC_SCSI_Write(phost, lun, 0U, NULL, 0U);
+      }
+      else
+      {
+        scsi_status = USBH_MSC_SCSI_Read(phost, lun, 0U, NULL, 0U);
+      }
+
+      if (scsi_status == USBH_OK)
+      {
+        MSC_Handle->unit[lun].state = MSC_IDLE;
+        MSC_Async_Complete(phost, USBH_OK);
+      }
+      else if (scsi_status == USBH_FAIL)
+      {
+        MSC_Handle->unit[lun].state = MSC_REQUEST_SENSE;
+      }
+      else if (scsi_status == USBH_UNRECOVERED_ERROR)
+      {
+        MSC_Handle->unit[lun].state = MSC_UNRECOVERED_ERROR;
+        MSC_Async_Complete(phost, USBH_FAIL);
+      }
+      else
+      {
+        /* Busy */
+      }
+      break;
+
+    case MSC_REQUEST_SENSE:
+      scsi_status = USBH_MSC_SCSI_RequestSense(phost, lun, &MSC_Handle->unit[lun].sense);
+
+      if (scsi_status == USBH_OK)
+      {
+        MSC_Handle->unit[lun].state = MSC_IDLE;
+        MSC_Handle->unit[lun].error = MSC_ERROR;
+        MSC_Async_Complete(phost, USBH_FAIL);
+      }
+      else if (scsi_status == USBH_UNRECOVERED_ERROR)
+      {
+        MSC_Handle->unit[lun].state = MSC_UNRECOVERED_ERROR;
+        MSC_Async_Complete(phost, USBH_FAIL);
+      }
+      else
+      {
+        /* Busy, or retried after a failed sense */
+      }
+      break;
+
+    default:
+      MSC_Async_Complete(phost, USBH_FAIL);
+      break;
+  }
+}
+
+/* Exported functions --------------------------------------------------------*/
+
+/**
+  * @brief  Queue a sector read or write
+  * @param  phost: Host handle
+  * @param  req: Request, owned by the caller until it completes
+  * @retval USBH_OK if queued, USBH_FAIL if no drive is ready or the buffer
+  *         cannot be used
+  */
+USBH_StatusTypeDef USBH_MSC_Async_Submit(USBH_HandleTypeDef *phost, USBH_MSC_AsyncReqTypeDef *req)
+{
+  if ((phost->device.is_connected == 0U) || (phost->gState != HOST_CLASS) ||
+      (req->Count == 0U) ||
+      (((uint32_t)req->Buf & 3U) && ((HCD_HandleTypeDef *)phost->pData)->Init.dma_enable))
+  {
+    return USBH_FAIL;
+  }
+
+  req->Status = USBH_BUSY;
+  req->Next = NULL;
+  if (tail != NULL)
+  {
+    tail->Next = req;
+  }
+  else
+  {
+    head = req;
+  }
+  tail = req;
+
+  return USBH_OK;
+}
+
+/**
+  * @brief  Advance the queued requests, without waiting for the bus.
+  *         Call from the main loop, after USBH_Process().
+  * @param  phost: Host handle
+  * @retval None
+  */
+void USBH_MSC_Async_Process(USBH_HandleTypeDef *phost)
+{
+  if ((active == NULL) && (head == NULL))
+  {
+    return;
+  }
+
+  /* The drive is gone: fail everything that was asked of it */
+  if ((phost->device.is_connected == 0U) || (phost->gState != HOST_CLASS))
+  {
+    while ((active != NULL) || (head != NULL))
+    {
+      if (active == NULL)
+      {
+        active = head;
+        head = head->Next;
+        if (head == NULL)
+        {
+          tail = NULL;
+        }
+      }
+      MSC_Async_Complete(phost, USBH_FAIL);
+    }
+    return;
+  }
+
+  if (active != NULL)
+  {
+    MSC_Async_Step(phost);
+  }
+
+  /* The CBW of the next request follows the CSW of the last one without
+     waiting for another call. BOT allows no more overlap than that. */
+  if ((active == NULL) && (head != NULL))
+  {
+    MSC_Async_Start(phost);
+    if (active != NULL)
+    {
+      MSC_Async_Step(phost);
+    }
+  }
+}
+
+/**
+  * @brief  Tell whether all the requests are done
+  * @param  None
+  * @retval 1 if nothing is queued or on the bus
+  */
+uint8_t USBH_MSC_Async_IsIdle(void)
+{
+  return (active == NULL) && (head == NULL);
+}
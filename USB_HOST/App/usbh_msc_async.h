@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    usbh_msc_async.h
+  * @brief   Non-blocking sector reads and writes on the USB host MSC class.
+  *
+  *          USBH_MSC_Read()/USBH_MSC_Write() spin until the BOT transfer is
+  *          over. Here a request is queued and USBH_MSC_Async_Process(),
+  *          called from MX_USB_HOST_Process(), moves it one BOT step at a
+  *          time, calling its callback at the end. The request objects
+  *          belong to the caller and must stay valid until completed.
+  ******************************************************************************
+  */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __USBH_MSC_ASYNC_H__
+#define __USBH_MSC_ASYNC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbh_msc.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct USBH_MSC_AsyncReq USBH_MSC_AsyncReqTypeDef;
+
+/* Called from USBH_MSC_Async_Process() once req->Status is final. It may
+   submit further requests. */
+typedef void (*USBH_MSC_AsyncCallbackTypeDef)(USBH_MSC_AsyncReqTypeDef *req);
+
+struct USBH_MSC_AsyncReq
+{
+  uint8_t  Lun;
+  uint8_t  Write;                       /* 0: read, 1: write */
+  uint32_t Sector;
+  uint8_t  *Buf;                        /* Word aligned when the OTG DMA is on */
+  uint32_t Count;                       /* Sectors */
+  USBH_MSC_AsyncCallbackTypeDef Callback; /* May be NULL, poll Status */
+  void     *Context;                    /* For the caller */
+
+  /* Set by the driver */
+  volatile USBH_StatusTypeDef Status;   /* USBH_BUSY until done, then USBH_OK or USBH_FAIL */
+  USBH_MSC_AsyncReqTypeDef *Next;
+};
+
+/* Exported functions prototypes ---------------------------------------------*/
+USBH_StatusTypeDef USBH_MSC_Async_Submit(USBH_HandleTypeDef *phost, USBH_MSC_AsyncReqTypeDef *req);
+void               USBH_MSC_Async_Process(USBH_HandleTypeDef *phost);
+uint8_t            USBH_MSC_Async_IsIdle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USBH_MSC_ASYNC_H__ */